@@ -0,0 +1,244 @@
+/*-
+ * Copyright (c) 2026 The libarchive developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Zipseek measures how long it takes to fetch one file from a Zip
+ * archive with archive_read_seek_entry() compared to scanning the
+ * archive with archive_read_next_header() until the name turns up.
+ *
+ * Usage: zipseek [-c count] [-r rounds] archive.zip [pathname]
+ *
+ * With -c, a Zip archive holding count small deflated files named
+ * "dir/fileN" is written first.  Without a pathname the last file
+ * in the archive is fetched, which is the worst case for the scan.
+ *
+ * Build: cc -O2 -o zipseek zipseek.c -larchive
+ */
+
+#include <archive.h>
+#include <archive_entry.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+static void
+fail(struct archive *a, const char *what)
+{
+	fprintf(stderr, "zipseek: %s: %s\n", what,
+	    a != NULL ? archive_error_string(a) : "failed");
+	exit(1);
+}
+
+static void
+create(const char *path, long count, char *last, size_t lastsize)
+{
+	struct archive *a;
+	struct archive_entry *ae;
+	char data[1024];
+	long i;
+
+	memset(data, 'x', sizeof(data));
+	a = archive_write_new();
+	if (archive_write_set_format_zip(a) != ARCHIVE_OK ||
+	    archive_write_open_filename(a, path) != ARCHIVE_OK)
+		fail(a, path);
+	ae = archive_entry_new();
+	for (i = 0; i < count; i++) {
+		snprintf(last, lastsize, "dir/file%ld", i);
+		snprintf(data, 32, "%ld", i);
+		archive_entry_clear(ae);
+		archive_entry_copy_pathname(ae, last);
+		archive_entry_set_mode(ae, AE_IFREG | 0644);
+		archive_entry_set_size(ae, sizeof(data));
+		if (archive_write_header(a, ae) != ARCHIVE_OK ||
+		    archive_write_data(a, data, sizeof(data)) < 0)
+			fail(a, "write");
+	}
+	archive_entry_free(ae);
+	if (archive_write_free(a) != ARCHIVE_OK)
+		fail(NULL, "close");
+}
+
+static struct archive *
+open_zip(const char *path)
+{
+	struct archive *a;
+
+	a = archive_read_new();
+	if (archive_read_support_format_zip(a) != ARCHIVE_OK ||
+	    archive_read_open_filename(a, path, 65536) != ARCHIVE_OK)
+		fail(a, path);
+	return (a);
+}
+
+static int64_t
+read_body(struct archive *a)
+{
+	char buff[8192];
+	la_ssize_t n;
+	int64_t total = 0;
+
+	while ((n = archive_read_data(a, buff, sizeof(buff))) > 0)
+		total += n;
+	if (n < 0)
+		fail(a, "read");
+	return (total);
+}
+
+static int64_t
+fetch_scan(const char *path, const char *name)
+{
+	struct archive *a = open_zip(path);
+	struct archive_entry *ae;
+	int64_t size = -1;
+	int r;
+
+	while ((r = archive_read_next_header(a, &ae)) == ARCHIVE_OK) {
+		if (strcmp(archive_entry_pathname(ae), name) == 0) {
+			size = read_body(a);
+			break;
+		}
+	}
+	if (r != ARCHIVE_OK && r != ARCHIVE_EOF)
+		fail(a, "scan");
+	archive_read_free(a);
+	return (size);
+}
+
+static int64_t
+fetch_seek(const char *path, const char *name)
+{
+	struct archive *a = open_zip(path);
+	struct archive_entry *ae;
+	int64_t size;
+
+	if (archive_read_seek_entry(a, name, &ae) != ARCHIVE_OK)
+		fail(a, name);
+	size = read_body(a);
+	archive_read_free(a);
+	return (size);
+}
+
+/*
+ * Time repeated lookups on one open archive, after a first lookup
+ * has read the central directory.
+ */
+static double
+time_seek_warm(const char *path, const char *name, int rounds)
+{
+	struct archive *a = open_zip(path);
+	struct archive_entry *ae;
+	double t;
+	int i;
+
+	if (archive_read_seek_entry(a, name, &ae) != ARCHIVE_OK)
+		fail(a, name);
+	t = now();
+	for (i = 0; i < rounds; i++) {
+		if (archive_read_seek_entry(a, name, &ae) != ARCHIVE_OK)
+			fail(a, name);
+		read_body(a);
+	}
+	t = (now() - t) / rounds;
+	archive_read_free(a);
+	return (t);
+}
+
+int
+main(int argc, char **argv)
+{
+	char last[64] = "";
+	const char *path, *name;
+	long count = 0;
+	int64_t size;
+	double t;
+	int opt, rounds = 10, i;
+
+	while ((opt = getopt(argc, argv, "c:r:")) != -1) {
+		switch (opt) {
+		case 'c': count = atol(optarg); break;
+		case 'r': rounds = atoi(optarg); break;
+		default:
+			fprintf(stderr, "usage: zipseek [-c count] "
+			    "[-r rounds] archive.zip [pathname]\n");
+			return (1);
+		}
+	}
+	if (optind >= argc || rounds < 1) {
+		fprintf(stderr, "usage: zipseek [-c count] "
+		    "[-r rounds] archive.zip [pathname]\n");
+		return (1);
+	}
+	path = argv[optind];
+	if (count > 0)
+		create(path, count, last, sizeof(last));
+	if (optind + 1 < argc)
+		name = argv[optind + 1];
+	else {
+		if (last[0] == '\0') {
+			struct archive *a = open_zip(path);
+			struct archive_entry *ae;
+
+			while (archive_read_next_header(a, &ae) == ARCHIVE_OK)
+				snprintf(last, sizeof(last), "%s",
+				    archive_entry_pathname(ae));
+			archive_read_free(a);
+		}
+		name = last;
+	}
+
+	t = now();
+	for (i = 0; i < rounds; i++)
+		size = fetch_scan(path, name);
+	t = (now() - t) / rounds;
+	if (size < 0) {
+		fprintf(stderr, "zipseek: %s: entry not found\n", name);
+		return (1);
+	}
+	printf("sequential scan:        %10.3f ms\n", t * 1e3);
+
+	t = now();
+	for (i = 0; i < rounds; i++)
+		size = fetch_seek(path, name);
+	t = (now() - t) / rounds;
+	printf("open + seek_entry:      %10.3f ms\n", t * 1e3);
+
+	t = time_seek_warm(path, name, rounds);
+	printf("seek_entry, index warm: %10.3f ms\n", t * 1e3);
+	printf("(%s, %lld bytes, %d rounds)\n", name, (long long)size,
+	    rounds);
+	return (0);
+}
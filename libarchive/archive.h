@@ -535,6 +535,12 @@ __LA_DECL int archive_read_open_filenames(struct archive *,
 		     const char **_filenames, size_t _block_size);
 __LA_DECL int archive_read_open_filename_w(struct archive *,
 		     const wchar_t *_filename, size_t _block_size);
+/* Like archive_read_open_filename(), but maps regular files into
+ * memory instead of reading them into a buffer. */
+__LA_DECL int archive_read_open_filename_mmap(struct archive *,
+		     const char *_filename, size_t _block_size);
+__LA_DECL int archive_read_open_filename_mmap_w(struct archive *,
+		     const wchar_t *_filename, size_t _block_size);
 /* archive_read_open_file() is a deprecated synonym for ..._open_filename(). */
 __LA_DECL int archive_read_open_file(struct archive *,
 		     const char *_filename, size_t _block_size) __LA_DEPRECATED;
@@ -559,6 +565,17 @@ __LA_DECL int archive_read_next_header(struct archive *,
 __LA_DECL int archive_read_next_header2(struct archive *,
 		     struct archive_entry *);
 
+/*
+ * Positions the reader at the entry with the given pathname and
+ * parses its header, without reading the entries before it.
+ * Only formats with an index (seekable Zip, or tar given the
+ * "tar:index" option) support this; others return ARCHIVE_FAILED.
+ * A missing entry also returns ARCHIVE_FAILED and leaves the reader
+ * where it was.
+ */
+__LA_DECL int archive_read_seek_entry(struct archive *,
+		     const char *_pathname, struct archive_entry **);
+
 /*
  * Retrieve the byte offset in UNCOMPRESSED data where last-read
  * header started.
@@ -701,6 +718,9 @@ __LA_DECL int archive_read_set_passphrase_callback(struct archive *,
 #define	ARCHIVE_EXTRACT_CLEAR_NOCHANGE_FFLAGS	(0x20000)
 /* Default: Do not extract atomically (using rename) */
 #define	ARCHIVE_EXTRACT_SAFE_WRITES		(0x40000)
+/* Default: Let the file grow as its data is written. */
+/* Reserves the space of regular files up front and writes at offsets. */
+#define	ARCHIVE_EXTRACT_PREALLOCATE		(0x80000)
 
 __LA_DECL int archive_read_extract(struct archive *, struct archive_entry *,
 		     int flags);
@@ -714,6 +734,15 @@ __LA_DECL void	 archive_read_extract_set_progress_callback(struct archive *,
 __LA_DECL void		archive_read_extract_set_skip_file(struct archive *,
 		     la_int64_t, la_int64_t);
 
+/* Restore regular files on the given number of worker threads while the
+ * calling thread keeps decoding the archive; 0 uses one thread per
+ * processor.  Files are still created by the calling thread, so that
+ * failing to create one is returned for its entry; a failure writing
+ * its data or metadata is reported by a later archive_read_extract2()
+ * call or by archive_read_close(). */
+__LA_DECL int		archive_read_extract_set_threads(struct archive *,
+		     int);
+
 /* Close the file and release most resources. */
 __LA_DECL int		 archive_read_close(struct archive *);
 /* Release all resources and destroy the object. */
@@ -826,6 +855,8 @@ __LA_DECL int archive_write_set_format_filter_by_ext(struct archive *a, const ch
 __LA_DECL int archive_write_set_format_filter_by_ext_def(struct archive *a, const char *filename, const char * def_ext);
 __LA_DECL int archive_write_zip_set_compression_deflate(struct archive *);
 __LA_DECL int archive_write_zip_set_compression_store(struct archive *);
+__LA_DECL int archive_write_zip_set_compression_xz(struct archive *);
+__LA_DECL int archive_write_zip_set_compression_zstd(struct archive *);
 /* Deprecated; use archive_write_open2 instead */
 __LA_DECL int archive_write_open(struct archive *, void *,
 		     archive_open_callback *, archive_write_callback *,
@@ -854,6 +885,11 @@ __LA_DECL int archive_write_header(struct archive *,
 		     struct archive_entry *);
 __LA_DECL la_ssize_t	archive_write_data(struct archive *,
 			    const void *, size_t);
+/* Like archive_write_data(), with the data read from the file
+ * descriptor at the given offset.  Where nothing transforms the data,
+ * the kernel copies it straight to the output file or pipe. */
+__LA_DECL la_ssize_t	archive_write_data_from_fd(struct archive *,
+			    int, la_int64_t, size_t);
 
 /* This interface is currently only available for archive_write_disk handles.  */
 __LA_DECL la_ssize_t	 archive_write_data_block(struct archive *,
@@ -1028,9 +1064,19 @@ __LA_DECL int  archive_read_disk_set_atime_restored(struct archive *);
 #define	ARCHIVE_READDISK_NO_FFLAGS		(0x0040)
 /* Default: Sparse file information is read from disk. */
 #define	ARCHIVE_READDISK_NO_SPARSE		(0x0080)
+/* Default: Only holes the filesystem reports are skipped; with this
+ * flag, files it reports as dense are read to look for zero blocks. */
+#define	ARCHIVE_READDISK_SCAN_SPARSE		(0x0100)
+/* Default: File data is read through the page cache; with this flag it
+ * is read with O_DIRECT where the filesystem allows it. */
+#define	ARCHIVE_READDISK_DIRECT_IO		(0x0200)
 
 __LA_DECL int  archive_read_disk_set_behavior(struct archive *,
 		    int flags);
+/* Stat the entries of each directory on the given number of worker
+ * threads ahead of the traversal; 0 uses one thread per processor.
+ * Entries are still returned in the same order. */
+__LA_DECL int  archive_read_disk_set_threads(struct archive *, int);
 
 /*
  * Set archive_match object that will be used in archive_read_disk to
@@ -1063,6 +1109,13 @@ __LA_DECL int		 archive_filter_count(struct archive *);
 __LA_DECL la_int64_t	 archive_filter_bytes(struct archive *, int);
 __LA_DECL int		 archive_filter_code(struct archive *, int);
 __LA_DECL const char *	 archive_filter_name(struct archive *, int);
+/* For a read archive: how many bytes the read-ahead of a filter had
+ * to copy to join data from separate blocks, and how many bytes it
+ * handed out straight from the blocks it was given. */
+__LA_DECL la_int64_t	 archive_read_filter_bytes_copied(struct archive *,
+			     int);
+__LA_DECL la_int64_t	 archive_read_filter_bytes_passed(struct archive *,
+			     int);
 
 #if ARCHIVE_VERSION_NUMBER < 4000000
 /* These don't properly handle multiple filters, so are deprecated and
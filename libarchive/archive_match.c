@@ -49,8 +49,40 @@ struct match {
 	struct match		*next;
 	int			 matches;
 	struct archive_mstring	 pattern;
+	/* Chain within an index bucket; see match_list_index(). */
+	struct match		*index_next;
+	unsigned		 seen;
 };
 
+/*
+ * Pathname patterns are also indexed, so that a pathname does not
+ * have to be tried against every pattern in the list:
+ *   * Patterns without wildcards go into a trie of path elements,
+ *     kept as a hash table of every element-aligned prefix.
+ *   * Other patterns are grouped by their longest run of literal
+ *     characters, which every pathname they match must contain.
+ *   * The few patterns that have neither are always tried.
+ * Candidates found this way are still confirmed with
+ * archive_pathmatch(), so the index only has to never miss a match.
+ * Only multibyte pathnames are looked up through the index.
+ */
+struct match_key {
+	struct match_key	*next;		/* Hash chain. */
+	unsigned		 hash;
+	struct match		*matches;	/* Patterns filed here. */
+	size_t			 len;
+	char			 key[1];
+};
+
+struct match_table {
+	struct match_key	**buckets;
+	size_t			 size;
+	size_t			 count;
+};
+
+/* Longer literal runs are cut to this many characters. */
+#define MATCH_RUN_MAX	16
+
 struct match_list {
 	struct match		*first;
 	struct match		**last;
@@ -58,6 +90,18 @@ struct match_list {
 	int			 unmatched_count;
 	struct match		*unmatched_next;
 	int			 unmatched_eof;
+
+	/* Pattern index. */
+	struct match_table	 literals;
+	struct match_table	 runs;
+	unsigned		 run_lengths;	/* Bit n-1 set: a run of n. */
+	struct match		*unindexed;
+	unsigned		 generation;
+	/* Result of the last lookup. */
+	struct match		**candidates;
+	size_t			 candidates_count;
+	size_t			 candidates_size;
+	struct archive_string	 path;
 };
 
 struct match_file {
@@ -158,6 +202,12 @@ static int	error_nomem(struct archive_match *);
 static void	match_list_add(struct match_list *, struct match *);
 static void	match_list_free(struct match_list *);
 static void	match_list_init(struct match_list *);
+static int	match_list_index(struct match_list *, struct match *,
+		    const char *);
+static int	match_list_index_pattern(struct archive_match *,
+		    struct match_list *, struct match *);
+static void	match_table_free(struct match_table *);
+static int	match_list_lookup(struct match_list *, const char *, int);
 static int	match_list_unmatched_inclusions_next(struct archive_match *,
 		    struct match_list *, int, const void **);
 static int	match_owner_id(struct id_array *, int64_t);
@@ -175,6 +225,7 @@ static int	match_path_inclusion(struct archive_match *,
 static int	owner_excluded(struct archive_match *,
 		    struct archive_entry *);
 static int	path_excluded(struct archive_match *, int, const void *);
+static int	path_excluded_mbs(struct archive_match *, const char *);
 static int	set_timefilter(struct archive_match *, int, time_t, long,
 		    time_t, long);
 static int	set_timefilter_pathname_mbs(struct archive_match *,
@@ -565,7 +616,7 @@ add_pattern_mbs(struct archive_match *a, struct match_list *list,
 	archive_mstring_copy_mbs_len(&(match->pattern), pattern, len);
 	match_list_add(list, match);
 	a->setflag |= PATTERN_IS_SET;
-	return (ARCHIVE_OK);
+	return (match_list_index_pattern(a, list, match));
 }
 
 static int
@@ -585,7 +636,7 @@ add_pattern_wcs(struct archive_match *a, struct match_list *list,
 	archive_mstring_copy_wcs_len(&(match->pattern), pattern, len);
 	match_list_add(list, match);
 	a->setflag |= PATTERN_IS_SET;
-	return (ARCHIVE_OK);
+	return (match_list_index_pattern(a, list, match));
 }
 
 static int
@@ -716,6 +767,8 @@ path_excluded(struct archive_match *a, int mbs, const void *pathname)
 
 	if (a == NULL)
 		return (0);
+	if (mbs && pathname != NULL)
+		return (path_excluded_mbs(a, (const char *)pathname));
 
 	/* Mark off any unmatched inclusions. */
 	/* In particular, if a filename does appear in the archive and
@@ -770,6 +823,63 @@ path_excluded(struct archive_match *a, int mbs, const void *pathname)
 	return (0);
 }
 
+/*
+ * Same as path_excluded(), but only the patterns the index offers
+ * are tried.
+ */
+static int
+path_excluded_mbs(struct archive_match *a, const char *pathname)
+{
+	struct match *match;
+	struct match *matched, *included;
+	size_t i;
+	int r;
+
+	/* Mark off any unmatched inclusions, as above, and note one
+	 * that had been matched before. */
+	matched = included = NULL;
+	if (match_list_lookup(&(a->inclusions), pathname, 1) != 0)
+		return (error_nomem(a));
+	for (i = 0; i < a->inclusions.candidates_count; i++) {
+		match = a->inclusions.candidates[i];
+		r = match_path_inclusion(a, match, 1, pathname);
+		if (r == 0)
+			continue;
+		if (r < 0)
+			return (r);
+		if (match->matches == 0) {
+			a->inclusions.unmatched_count--;
+			match->matches++;
+			matched = match;
+		} else if (included == NULL)
+			included = match;
+	}
+
+	/* Exclusions take priority */
+	if (match_list_lookup(&(a->exclusions), pathname, 0) != 0)
+		return (error_nomem(a));
+	for (i = 0; i < a->exclusions.candidates_count; i++) {
+		r = match_path_exclusion(a, a->exclusions.candidates[i],
+		    1, pathname);
+		if (r)
+			return (r);
+	}
+
+	if (matched != NULL)
+		return (0);
+	if (included != NULL) {
+		included->matches++;
+		return (0);
+	}
+
+	/* If there were inclusions, default is to exclude. */
+	if (a->inclusions.first != NULL)
+	    return (1);
+
+	/* No explicit inclusions, default is to match. */
+	return (0);
+}
+
 /*
  * This is a little odd, but it matches the default behavior of
  * gtar.  In particular, 'a*b' will match 'foo/a1111/222b/bar'
@@ -836,6 +946,7 @@ match_list_init(struct match_list *list)
 	list->first = NULL;
 	list->last = &(list->first);
 	list->count = 0;
+	archive_string_init(&(list->path));
 }
 
 static void
@@ -849,6 +960,10 @@ match_list_free(struct match_list *list)
 		archive_mstring_clean(&(q->pattern));
 		free(q);
 	}
+	match_table_free(&(list->literals));
+	match_table_free(&(list->runs));
+	free(list->candidates);
+	archive_string_free(&(list->path));
 }
 
 static void
@@ -860,6 +975,328 @@ match_list_add(struct match_list *list, struct match *m)
 	list->unmatched_count++;
 }
 
+/*
+ * FNV-1a, continued from a previous value so that a key can be
+ * extended a piece at a time.
+ */
+static unsigned
+match_hash(unsigned h, const char *p, size_t len)
+{
+	while (len--) {
+		h ^= (unsigned char)*p++;
+		h *= 16777619U;
+	}
+	return (h);
+}
+
+#define MATCH_HASH_INIT	2166136261U
+
+static struct match_key *
+match_table_find(struct match_table *t, unsigned hash, const char *key,
+    size_t len)
+{
+	struct match_key *k;
+
+	if (t->size == 0)
+		return (NULL);
+	for (k = t->buckets[hash & (t->size - 1)]; k != NULL; k = k->next) {
+		if (k->hash == hash && k->len == len &&
+		    memcmp(k->key, key, len) == 0)
+			return (k);
+	}
+	return (NULL);
+}
+
+static struct match_key *
+match_table_add(struct match_table *t, const char *key, size_t len)
+{
+	struct match_key *k, *next;
+	unsigned hash;
+	size_t i;
+
+	hash = match_hash(MATCH_HASH_INIT, key, len);
+	k = match_table_find(t, hash, key, len);
+	if (k != NULL)
+		return (k);
+	if (t->count >= t->size) {
+		struct match_key **b;
+		size_t size;
+
+		/* Keep the load factor at most one. */
+		size = t->size ? t->size * 2 : 64;
+		b = calloc(size, sizeof(*b));
+		if (b == NULL)
+			return (NULL);
+		for (i = 0; i < t->size; i++) {
+			for (k = t->buckets[i]; k != NULL; k = next) {
+				next = k->next;
+				k->next = b[k->hash & (size - 1)];
+				b[k->hash & (size - 1)] = k;
+			}
+		}
+		free(t->buckets);
+		t->buckets = b;
+		t->size = size;
+	}
+	k = calloc(1, sizeof(*k) + len);
+	if (k == NULL)
+		return (NULL);
+	k->hash = hash;
+	k->len = len;
+	memcpy(k->key, key, len);
+	k->next = t->buckets[hash & (t->size - 1)];
+	t->buckets[hash & (t->size - 1)] = k;
+	t->count++;
+	return (k);
+}
+
+static void
+match_table_free(struct match_table *t)
+{
+	struct match_key *k, *next;
+	size_t i;
+
+	for (i = 0; i < t->size; i++) {
+		for (k = t->buckets[i]; k != NULL; k = next) {
+			next = k->next;
+			free(k);
+		}
+	}
+	free(t->buckets);
+}
+
+/*
+ * Characters that make a pattern more than a literal pathname, and
+ * that end a run of characters a match must contain verbatim.
+ */
+static int
+match_is_special(char c)
+{
+	return (c == '*' || c == '?' || c == '[' || c == ']' || c == '\\' ||
+	    c == '$' || c == '^' || c == '/');
+}
+
+/*
+ * Add a pattern to the index of the list.
+ */
+static int
+match_list_index(struct match_list *list, struct match *m, const char *p)
+{
+	struct match_key *k;
+	const char *e, *run, *best;
+	size_t best_len;
+	int literal;
+
+	/* A literal is a pattern with no wildcards whose elements are
+	 * neither empty nor ".", since archive_pathmatch() skips those
+	 * in pathnames.  It matches exactly when its elements equal
+	 * consecutive elements of the pathname. */
+	literal = (*p != '\0');
+	for (e = p; *e != '\0' && literal; e++) {
+		if (*e == '/') {
+			if (e == p || e[-1] == '/' ||
+			    (e[-1] == '.' && (e - 1 == p || e[-2] == '/')))
+				literal = 0;
+		} else if (match_is_special(*e))
+			literal = 0;
+	}
+	if (literal && (e[-1] == '/' ||
+	    (e[-1] == '.' && (e - 1 == p || e[-2] == '/'))))
+		literal = 0;
+	if (literal) {
+		/* Register every element-aligned prefix so that lookups
+		 * can stop as soon as the pathname leaves the trie. */
+		for (e = p; ; e++) {
+			if (*e != '/' && *e != '\0')
+				continue;
+			k = match_table_add(&(list->literals), p, e - p);
+			if (k == NULL)
+				return (-1);
+			if (*e == '\0') {
+				m->index_next = k->matches;
+				k->matches = m;
+				return (0);
+			}
+		}
+	}
+
+	/* Find the longest run of characters that stand for
+	 * themselves; nothing in a character class does. */
+	best = NULL;
+	best_len = 0;
+	for (e = p; *e != '\0'; ) {
+		if (*e == '[') {
+			/* Skip the class the way archive_pathmatch() finds
+			 * its end, "\]" included; without one, the '['
+			 * only stands for itself. */
+			for (run = e + 1; *run != '\0' && *run != ']'; run++)
+				if (*run == '\\' && run[1] != '\0')
+					run++;
+			e = *run == ']' ? run + 1 : e + 1;
+			continue;
+		}
+		if (match_is_special(*e)) {
+			e++;
+			continue;
+		}
+		for (run = e; *e != '\0' && !match_is_special(*e); e++)
+			continue;
+		/* A "." element matches nothing in the pathname. */
+		if (e - run == 1 && *run == '.' &&
+		    (run == p || run[-1] == '/') && (*e == '\0' || *e == '/'))
+			continue;
+		if ((size_t)(e - run) > best_len) {
+			best = run;
+			best_len = e - run;
+		}
+	}
+	if (best != NULL) {
+		if (best_len > MATCH_RUN_MAX)
+			best_len = MATCH_RUN_MAX;
+		k = match_table_add(&(list->runs), best, best_len);
+		if (k == NULL)
+			return (-1);
+		m->index_next = k->matches;
+		k->matches = m;
+		list->run_lengths |= 1U << (best_len - 1);
+		return (0);
+	}
+
+	m->index_next = list->unindexed;
+	list->unindexed = m;
+	return (0);
+}
+
+static int
+match_list_index_pattern(struct archive_match *a, struct match_list *list,
+    struct match *m)
+{
+	const char *p;
+
+	if (archive_mstring_get_mbs(&(a->archive), &(m->pattern), &p) != 0 ||
+	    p == NULL) {
+		if (errno == ENOMEM)
+			return (error_nomem(a));
+		/* Let archive_pathmatch() sort it out each time. */
+		m->index_next = list->unindexed;
+		list->unindexed = m;
+		return (ARCHIVE_OK);
+	}
+	if (match_list_index(list, m, p) != 0)
+		return (error_nomem(a));
+	return (ARCHIVE_OK);
+}
+
+static int
+match_add_candidates(struct match_list *list, struct match *m)
+{
+	for (; m != NULL; m = m->index_next) {
+		if (m->seen == list->generation)
+			continue;
+		m->seen = list->generation;
+		if (list->candidates_count >= list->candidates_size) {
+			struct match **p;
+			size_t size;
+
+			size = list->candidates_size ?
+			    list->candidates_size * 2 : 16;
+			p = realloc(list->candidates, size * sizeof(*p));
+			if (p == NULL)
+				return (-1);
+			list->candidates = p;
+			list->candidates_size = size;
+		}
+		list->candidates[list->candidates_count++] = m;
+	}
+	return (0);
+}
+
+/*
+ * Collect the patterns of the list that might match pathname.
+ * Anchored lookups only consider literals that start at the first
+ * path element.
+ */
+static int
+match_list_lookup(struct match_list *list, const char *pn, int anchored)
+{
+	struct match_key *k;
+	const char *p, *q, *start, *end;
+	unsigned hash;
+	size_t len;
+
+	list->candidates_count = 0;
+	/* Zero means "not seen", so skip it when wrapping around. */
+	if (++list->generation == 0)
+		++list->generation;
+
+	if (match_add_candidates(list, list->unindexed) != 0)
+		return (-1);
+
+	/* Try every substring that is as long as some run. */
+	if (list->run_lengths != 0) {
+		for (p = pn; *p != '\0'; p++) {
+			hash = MATCH_HASH_INIT;
+			for (len = 1; len <= MATCH_RUN_MAX && p[len - 1] != '\0';
+			    len++) {
+				hash = match_hash(hash, p + len - 1, 1);
+				if ((list->run_lengths & (1U << (len - 1))) == 0)
+					continue;
+				k = match_table_find(&(list->runs), hash, p, len);
+				if (k != NULL &&
+				    match_add_candidates(list, k->matches) != 0)
+					return (-1);
+			}
+		}
+	}
+
+	if (list->literals.count == 0 || *pn == '\0')
+		return (0);
+
+	/* Put the pathname in the literal patterns' form: elements
+	 * separated by single slashes, without "." elements. */
+	archive_string_empty(&(list->path));
+	for (p = pn; *p != '\0'; p = q) {
+		while (*p == '/')
+			p++;
+		for (q = p; *q != '\0' && *q != '/'; q++)
+			continue;
+		if (q == p || (q - p == 1 && *p == '.'))
+			continue;
+		if (archive_strlen(&(list->path)) > 0)
+			archive_strappend_char(&(list->path), '/');
+		archive_strncat(&(list->path), p, q - p);
+	}
+	if (archive_strlen(&(list->path)) == 0)
+		return (0);
+
+	/* Walk the trie from each element in turn. */
+	end = list->path.s + archive_strlen(&(list->path));
+	for (start = list->path.s; start < end; ) {
+		hash = MATCH_HASH_INIT;
+		for (p = q = start; ; q++) {
+			if (q < end && *q != '/')
+				continue;
+			hash = match_hash(hash, p, q - p);
+			k = match_table_find(&(list->literals), hash, start,
+			    q - start);
+			if (k == NULL)
+				break;
+			if (match_add_candidates(list, k->matches) != 0)
+				return (-1);
+			if (q == end)
+				break;
+			p = q;
+		}
+		if (anchored)
+			break;
+		start = memchr(start, '/', end - start);
+		if (start == NULL)
+			break;
+		start++;
+	}
+	return (0);
+}
+
 static int
 match_list_unmatched_inclusions_next(struct archive_match *a,
     struct match_list *list, int mbs, const void **vp)
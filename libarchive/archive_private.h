@@ -165,6 +165,9 @@ int	__archive_mkstemp(char *template);
 
 int	__archive_clean(struct archive *);
 
+/* Length of the run of zero bytes at the start of a buffer. */
+size_t	__archive_zero_run(const void *, size_t);
+
 void __archive_reset_read_data(struct archive *);
 
 #define	err_combine(a,b)	((a) < (b) ? (a) : (b))
@@ -52,6 +52,7 @@ __FBSDID("$FreeBSD: head/lib/libarchive/archive_read.c 201157 2009-12-29 05:30:2
 #include "archive_entry.h"
 #include "archive_private.h"
 #include "archive_read_private.h"
+#include "archive_read_index_private.h"
 
 #define minimum(a, b) (a < b ? a : b)
 
@@ -687,6 +688,57 @@ _archive_read_next_header(struct archive *_a, struct archive_entry **entryp)
 	return ret;
 }
 
+/*
+ * Jump to a named entry using the format's index.
+ */
+int
+archive_read_seek_entry(struct archive *_a, const char *pathname,
+    struct archive_entry **entryp)
+{
+	struct archive_read *a = (struct archive_read *)_a;
+	int r;
+
+	archive_check_magic(_a, ARCHIVE_READ_MAGIC,
+	    ARCHIVE_STATE_HEADER | ARCHIVE_STATE_DATA | ARCHIVE_STATE_EOF,
+	    "archive_read_seek_entry");
+
+	*entryp = NULL;
+	archive_clear_error(&a->archive);
+	if (a->format == NULL || a->format->seek_entry == NULL) {
+		archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+		    "Format does not support seeking to an entry");
+		return (ARCHIVE_FAILED);
+	}
+	if (pathname == NULL) {
+		archive_set_error(&a->archive, EINVAL, "Invalid pathname");
+		return (ARCHIVE_FAILED);
+	}
+
+	/* The format clears the entry only once the name is found. */
+	r = (a->format->seek_entry)(a, pathname, a->entry);
+
+	switch (r) {
+	case ARCHIVE_OK:
+	case ARCHIVE_WARN:
+		++_a->file_count;
+		a->archive.state = ARCHIVE_STATE_DATA;
+		break;
+	case ARCHIVE_FAILED:
+		/* Entry not found; the current position is unchanged. */
+		return (r);
+	default:
+		a->archive.state = ARCHIVE_STATE_FATAL;
+		r = ARCHIVE_FATAL;
+		break;
+	}
+
+	__archive_reset_read_data(&a->archive);
+
+	a->data_start_node = a->client.cursor;
+	*entryp = a->entry;
+	return (r);
+}
+
 /*
  * Allow each registered format to bid on whether it wants to handle
  * the next entry.  Return index of winning bidder.
@@ -1053,6 +1105,10 @@ _archive_read_close(struct archive *_a)
 	archive_clear_error(&a->archive);
 	a->archive.state = ARCHIVE_STATE_CLOSED;
 
+	/* Finish files still being restored by archive_read_extract2(). */
+	if (a->flush_archive_extract != NULL)
+		r = (a->flush_archive_extract)(a);
+
 	/* TODO: Clean up the formatters. */
 
 	/* Release the filter objects. */
@@ -1107,6 +1163,8 @@ _archive_read_free(struct archive *_a)
 		(a->bidders[i].vtable->free)(&a->bidders[i]);
 	}
 
+	__archive_read_index_free(a->index);
+
 	/* Release passphrase list. */
 	p = a->passphrases.first;
 	while (p != NULL) {
@@ -1174,6 +1232,28 @@ _archive_filter_bytes(struct archive *_a, int n)
 	return f == NULL ? -1 : f->position;
 }
 
+la_int64_t
+archive_read_filter_bytes_copied(struct archive *_a, int n)
+{
+	struct archive_read_filter *f;
+
+	archive_check_magic(_a, ARCHIVE_READ_MAGIC, ARCHIVE_STATE_ANY,
+	    "archive_read_filter_bytes_copied");
+	f = get_filter(_a, n);
+	return f == NULL ? -1 : f->bytes_copied;
+}
+
+la_int64_t
+archive_read_filter_bytes_passed(struct archive *_a, int n)
+{
+	struct archive_read_filter *f;
+
+	archive_check_magic(_a, ARCHIVE_READ_MAGIC, ARCHIVE_STATE_ANY,
+	    "archive_read_filter_bytes_passed");
+	f = get_filter(_a, n);
+	return f == NULL ? -1 : f->bytes_passed;
+}
+
 /*
  * Used internally by read format handlers to register their bid and
  * initialization functions.
@@ -1224,6 +1304,29 @@ __archive_read_register_format(struct archive_read *a,
 	return (ARCHIVE_FATAL);
 }
 
+/*
+ * Used by formats that can locate an entry by name to attach that
+ * capability to the format registered with the given bidder.
+ */
+int
+__archive_read_register_format_seek_entry(struct archive_read *a,
+    int (*bid)(struct archive_read *, int),
+    int (*seek_entry)(struct archive_read *, const char *,
+	struct archive_entry *))
+{
+	int i, number_slots;
+
+	number_slots = sizeof(a->formats) / sizeof(a->formats[0]);
+
+	for (i = 0; i < number_slots; i++) {
+		if (a->formats[i].bid == bid) {
+			a->formats[i].seek_entry = seek_entry;
+			return (ARCHIVE_OK);
+		}
+	}
+	return (ARCHIVE_FATAL);
+}
+
 /*
  * Used internally by decompression routines to register their bid and
  * initialization functions.
@@ -1484,6 +1587,7 @@ __archive_read_filter_ahead(struct archive_read_filter *filter,
 
 			memcpy(filter->next + filter->avail,
 			    filter->client_next, tocopy);
+			filter->bytes_copied += tocopy;
 			/* Remove this data from client buffer. */
 			filter->client_next += tocopy;
 			filter->client_avail -= tocopy;
@@ -1493,6 +1597,60 @@ __archive_read_filter_ahead(struct archive_read_filter *filter,
 	}
 }
 
+/*
+ * Scatter/gather version of the above for readers that can work on
+ * data in pieces, such as bulk copies into their own buffers.
+ *
+ * When a request straddles the end of the current client block, the
+ * plain read-ahead copies the whole request into the copy buffer.
+ * Here only the tail of the current block is copied (it becomes
+ * invalid once the next block is read), and the next block is
+ * returned as a second segment as it is.  Only when the next block
+ * is still too short does this fall back to a single copied segment.
+ *
+ * Returns the number of segments (1 or 2) that together hold at
+ * least 'min' bytes, 0 at end of file or ARCHIVE_FATAL on error.  As
+ * with __archive_read_filter_ahead(), nothing is consumed.
+ */
+int
+__archive_read_ahead_iov(struct archive_read *a, size_t min,
+    struct archive_read_iov iov[2])
+{
+	return (__archive_read_filter_ahead_iov(a->filter, min, iov));
+}
+
+int
+__archive_read_filter_ahead_iov(struct archive_read_filter *filter,
+    size_t min, struct archive_read_iov iov[2])
+{
+	const void *p;
+	ssize_t avail;
+	size_t have;
+
+	have = filter->avail + filter->client_avail;
+	if (have < min && !filter->end_of_file && !filter->fatal) {
+		/* Asking for one byte past what we have copies the
+		 * rest of the current block and reads the next one. */
+		p = __archive_read_filter_ahead(filter, have + 1, &avail);
+		if (p == NULL)
+			return (avail < 0 ? ARCHIVE_FATAL : 0);
+		if (filter->avail + filter->client_avail >= min) {
+			iov[0].buff = filter->next;
+			iov[0].len = filter->avail;
+			iov[1].buff = filter->client_next;
+			iov[1].len = filter->client_avail;
+			return (2);
+		}
+	}
+
+	p = __archive_read_filter_ahead(filter, min, &avail);
+	if (p == NULL)
+		return (avail < 0 ? ARCHIVE_FATAL : 0);
+	iov[0].buff = p;
+	iov[0].len = avail;
+	return (1);
+}
+
 /*
  * Move the file pointer forward.
  */
@@ -1555,6 +1713,7 @@ advance_file_pointer(struct archive_read_filter *filter, int64_t request)
 	/* Then use up the client buffer. */
 	if (filter->client_avail > 0) {
 		min = (size_t)minimum(request, (int64_t)filter->client_avail);
+		filter->bytes_passed += min;
 		filter->client_next += min;
 		filter->client_avail -= min;
 		request -= min;
@@ -1638,6 +1797,28 @@ __archive_read_filter_seek(struct archive_read_filter *filter, int64_t offset,
 	if (filter->can_seek == 0)
 		return (ARCHIVE_FAILED);
 
+	if (filter->upstream != NULL) {
+		/* A decompressor can restart at a checkpoint and then
+		 * decode forward to the requested offset. */
+		if (whence == SEEK_CUR)
+			offset += filter->position;
+		else if (whence != SEEK_SET)
+			return (ARCHIVE_FAILED);
+		if (filter->vtable->seek == NULL || offset < 0)
+			return (ARCHIVE_FAILED);
+		r = (filter->vtable->seek)(filter, offset);
+		if (r < 0)
+			return (r);
+		filter->avail = filter->client_avail = 0;
+		filter->next = filter->buffer;
+		filter->position = r;
+		filter->end_of_file = 0;
+		if (r < offset &&
+		    __archive_read_filter_consume(filter, offset - r) < 0)
+			return (ARCHIVE_FATAL);
+		return (offset);
+	}
+
 	client = &(filter->archive->client);
 	switch (whence) {
 	case SEEK_CUR:
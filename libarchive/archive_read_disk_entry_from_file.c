@@ -115,6 +115,8 @@ static int setup_sparse(struct archive_read_disk *,
 static int setup_sparse_fiemap(struct archive_read_disk *,
     struct archive_entry *, int *fd);
 #endif
+static int setup_sparse_scan(struct archive_read_disk *,
+    struct archive_entry *, int *fd);
 
 #if !ARCHIVE_ACL_SUPPORT
 int
@@ -307,6 +309,13 @@ archive_read_disk_entry_from_file(struct archive *_a,
 		r1 = setup_sparse(a, entry, &fd);
 		if (r1 < r)
 			r = r1;
+		if (r1 == ARCHIVE_OK &&
+		    (a->flags & ARCHIVE_READDISK_SCAN_SPARSE) != 0 &&
+		    archive_entry_sparse_count(entry) == 0) {
+			r1 = setup_sparse_scan(a, entry, &fd);
+			if (r1 < r)
+				r = r1;
+		}
 	}
 
 	/* If we opened the file earlier in this function, close it. */
@@ -1082,5 +1091,87 @@ setup_sparse(struct archive_read_disk *a,
 
 #endif
 
+/*
+ * Find the holes of a file that the filesystem does not report as
+ * sparse, such as one that was copied without preserving its holes,
+ * by reading it.  Every aligned block of SPARSE_SCAN_BLOCK bytes that
+ * is all zeros is left out of the data.
+ */
+#define SPARSE_SCAN_BLOCK	4096
+#define SPARSE_SCAN_BUFF	(64 * 1024)
+
+static int
+setup_sparse_scan(struct archive_read_disk *a,
+    struct archive_entry *entry, int *fd)
+{
+	char *buff;
+	int64_t size, offset;
+	off_t initial_off;
+	ssize_t bytes, i, len;
+	int holes = 0;
+	const char *path;
+
+	if (archive_entry_filetype(entry) != AE_IFREG
+	    || archive_entry_size(entry) <= SPARSE_SCAN_BLOCK
+	    || archive_entry_hardlink(entry) != NULL)
+		return (ARCHIVE_OK);
+
+	if (*fd < 0) {
+		path = archive_read_disk_entry_setup_path(a, entry, fd);
+		if (path == NULL)
+			return (ARCHIVE_FAILED);
+		if (*fd < 0)
+			*fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+		if (*fd < 0) {
+			archive_set_error(&a->archive, errno,
+			    "Can't open `%s'", path);
+			return (ARCHIVE_FAILED);
+		}
+		__archive_ensure_cloexec_flag(*fd);
+		initial_off = 0;
+	} else
+		initial_off = lseek(*fd, 0, SEEK_CUR);
+	if (lseek(*fd, 0, SEEK_SET) < 0)
+		return (ARCHIVE_OK);
+
+	buff = malloc(SPARSE_SCAN_BUFF);
+	if (buff == NULL) {
+		archive_set_error(&a->archive, ENOMEM,
+		    "Couldn't allocate memory");
+		return (ARCHIVE_FATAL);
+	}
+	size = archive_entry_size(entry);
+	for (offset = 0; offset < size; offset += bytes) {
+		bytes = SPARSE_SCAN_BUFF;
+		if (bytes > size - offset)
+			bytes = (ssize_t)(size - offset);
+		bytes = read(*fd, buff, bytes);
+		if (bytes <= 0)
+			break;
+		for (i = 0; i < bytes; i += len) {
+			len = SPARSE_SCAN_BLOCK - (offset + i) % SPARSE_SCAN_BLOCK;
+			if (len > bytes - i)
+				len = bytes - i;
+			/* Adjacent data blocks are merged into one entry. */
+			if (__archive_zero_run(buff + i, len) == (size_t)len)
+				holes = 1;
+			else
+				archive_entry_sparse_add_entry(entry,
+				    offset + i, len);
+		}
+	}
+	free(buff);
+	lseek(*fd, initial_off, SEEK_SET);
+
+	if (bytes < 0 || offset < size || !holes) {
+		/* Unreadable, shrunk, or there is nothing to skip. */
+		archive_entry_sparse_clear(entry);
+	} else if (archive_entry_sparse_count(entry) == 0) {
+		/* Fully sparse file; insert a zero-length "data" entry */
+		archive_entry_sparse_add_entry(entry, 0, 0);
+	}
+	return (ARCHIVE_OK);
+}
+
 #endif /* !defined(_WIN32) || defined(__CYGWIN__) */
 
@@ -97,6 +97,7 @@ __FBSDID("$FreeBSD$");
 #include "archive_entry.h"
 #include "archive_private.h"
 #include "archive_read_disk_private.h"
+#include "archive_thread_pool_private.h"
 
 #ifndef HAVE_FCHDIR
 #error fchdir function required.
@@ -107,6 +108,9 @@ __FBSDID("$FreeBSD$");
 #ifndef O_CLOEXEC
 #define O_CLOEXEC	0
 #endif
+#ifndef O_NOFOLLOW
+#define O_NOFOLLOW	0
+#endif
 
 #if defined(__hpux) && !defined(HAVE_DIRFD)
 #define dirfd(x) ((x)->__dd_fd)
@@ -185,6 +189,69 @@ struct filesystem {
 	/* Pointer adjusted to the filesystem alignment . */
 	unsigned char	*buff;
 	size_t		 buff_size;
+	/* Number of buff_size buffers at buff; two with read-ahead. */
+	int		 buff_count;
+};
+
+/*
+ * Parallel traversal: the entries of the open directory are read in
+ * chunks, and worker threads lstat() a few chunks ahead of the one
+ * being handed out.  Entries are still returned in readdir() order.
+ */
+#if defined(HAVE_FSTATAT) && defined(HAVE_DIRFD)
+#define	USE_TREE_PREFETCH
+#endif
+#define	PREFETCH_CHUNK	32
+
+struct tree_prefetch_entry {
+	struct archive_string	 name;
+	struct stat		 lst;
+	struct stat		 st;
+	int			 flags;	/* hasLstat, hasStat */
+};
+
+struct tree_prefetch_chunk {
+	struct archive_thread_job job;
+	int			 dir_fd;
+	int			 count;
+	int			 waited;
+	int			 read_ahead;	/* Start reading small files. */
+	struct tree_prefetch_entry entries[PREFETCH_CHUNK];
+};
+
+struct tree_prefetch {
+	struct archive_thread_pool *pool;
+	struct tree_prefetch_chunk *chunks;
+	int			 nchunks;
+	int			 head;	/* Chunk being handed out. */
+	int			 filled;	/* Chunks read and queued. */
+	int			 pos;	/* Next entry of the head chunk. */
+	int			 eof;
+	int			 error;	/* readdir() failure at eof. */
+	int			 read_ahead;
+};
+
+/*
+ * Read-ahead of file data: with more than one thread, the next buffer
+ * of the current file is read on a worker thread while the caller
+ * consumes the one returned last.
+ */
+#if defined(HAVE_PREAD)
+#define	USE_READ_AHEAD
+#endif
+/* Prefetched regular files up to this size are read ahead whole. */
+#define	READ_AHEAD_SMALL_FILE	(256 * 1024)
+
+struct tree_read_ahead {
+	struct archive_thread_job job;
+	struct archive_thread_pool *pool;
+	int			 queued;
+	int			 fd;
+	unsigned char		*buff;
+	size_t			 want;	/* Bytes the caller will get. */
+	size_t			 size;	/* Bytes asked of pread(). */
+	int64_t			 offset;
+	ssize_t			 bytes;	/* Result of pread(). */
 };
 
 /* Definitions for tree_entry.flags bitmap. */
@@ -251,11 +318,17 @@ struct tree {
 	int			 allocated_filesystem;
 
 	int			 entry_fd;
+	int			 entry_direct_io; /* entry_fd has O_DIRECT. */
 	int			 entry_eof;
 	int64_t			 entry_remaining_bytes;
 	int64_t			 entry_total;
 	unsigned char		*entry_buff;
 	size_t			 entry_buff_size;
+
+	/* Non-NULL when siblings are stat()ed on worker threads. */
+	struct tree_prefetch	*prefetch;
+	/* Non-NULL when file data is read ahead on a worker thread. */
+	struct tree_read_ahead	*read_ahead;
 };
 
 /* Definitions for tree.flags bitmap. */
@@ -268,6 +341,19 @@ struct tree {
 
 static int
 tree_dir_next_posix(struct tree *t);
+static int	tree_readdir(struct tree *t);
+#ifdef USE_TREE_PREFETCH
+static int	tree_prefetch_setup(struct tree *, int);
+static void	tree_prefetch_reset(struct tree *);
+static void	tree_prefetch_free(struct tree *);
+static int	tree_dir_next_prefetch(struct tree *);
+#endif
+#ifdef USE_READ_AHEAD
+static int	tree_read_ahead_setup(struct tree *);
+static void	tree_read_ahead_wait(struct tree *);
+static void	tree_read_ahead_free(struct tree *);
+static void	tree_read_ahead_submit(struct tree *);
+#endif
 
 #ifdef HAVE_DIRENT_D_NAMLEN
 /* BSD extension; avoids need for a strlen() call. */
@@ -595,6 +681,25 @@ archive_read_disk_set_behavior(struct archive *_a, int flags)
 	return (r);
 }
 
+int
+archive_read_disk_set_threads(struct archive *_a, int threads)
+{
+	struct archive_read_disk *a = (struct archive_read_disk *)_a;
+
+	archive_check_magic(_a, ARCHIVE_READ_DISK_MAGIC,
+	    ARCHIVE_STATE_NEW | ARCHIVE_STATE_CLOSED,
+	    "archive_read_disk_set_threads");
+	if (threads < 0) {
+		archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+		    "Invalid number of threads: %d", threads);
+		return (ARCHIVE_FAILED);
+	}
+	if (threads == 0)
+		threads = __archive_thread_pool_cpus();
+	a->threads = threads;
+	return (ARCHIVE_OK);
+}
+
 /*
  * Trivial implementations of gname/uname lookup functions.
  * These are normally overridden by the client, but these stub
@@ -656,6 +761,15 @@ setup_suitable_read_buffer(struct archive_read_disk *a)
 			 * alignment. */
 			asize += xfer_align;
 		}
+		/* O_DIRECT reads have to be a multiple of the alignment. */
+		cf->buff_size = asize - xfer_align;
+		cf->buff_size -= cf->buff_size % xfer_align;
+		if (cf->buff_size == 0)
+			cf->buff_size = xfer_align;
+		/* Read-ahead fills a second buffer while the caller
+		 * uses the first. */
+		cf->buff_count = (t->read_ahead != NULL)? 2: 1;
+		asize = cf->buff_size * cf->buff_count + xfer_align;
 		cf->allocation_ptr = malloc(asize);
 		if (cf->allocation_ptr == NULL) {
 			archive_set_error(&a->archive, ENOMEM,
@@ -677,11 +791,72 @@ setup_suitable_read_buffer(struct archive_read_disk *a)
 		 * the current filesystem.
 		 */
 		cf->buff = cf->allocation_ptr + s;
-		cf->buff_size = asize - xfer_align;
 	}
 	return (ARCHIVE_OK);
 }
 
+/*
+ * O_DIRECT reads have to start at an aligned offset and ask for a
+ * multiple of the alignment; the last read of a file may ask for more
+ * than is left.  Returns the size to ask for, or drops O_DIRECT for
+ * the rest of the file when the read cannot be made to fit.
+ */
+static size_t
+direct_io_size(struct tree *t, size_t size)
+{
+#if defined(O_DIRECT)
+	size_t align, rounded;
+
+	if (!t->entry_direct_io)
+		return (size);
+	align = (size_t)t->current_filesystem->xfer_align;
+	if (t->entry_total % align == 0) {
+		rounded = (size + align - 1) / align * align;
+		if (rounded == size)
+			return (size);
+		if ((int64_t)size >= t->entry_remaining_bytes &&
+		    rounded <= t->entry_buff_size)
+			return (rounded);
+	}
+	(void)fcntl(t->entry_fd, F_SETFL,
+	    fcntl(t->entry_fd, F_GETFL) & ~O_DIRECT);
+	t->entry_direct_io = 0;
+#endif
+	return (size);
+}
+
+/*
+ * Read up to size bytes of the current file at t->entry_total.
+ */
+static ssize_t
+read_file_data(struct tree *t, unsigned char *buff, size_t size)
+{
+	ssize_t bytes;
+
+#if defined(HAVE_PREAD)
+	bytes = pread(t->entry_fd, buff, direct_io_size(t, size),
+	    (off_t)t->entry_total);
+#else
+	bytes = read(t->entry_fd, buff, direct_io_size(t, size));
+#endif
+#if defined(O_DIRECT)
+	/* Some filesystems accept O_DIRECT at open() but not at read(). */
+	if (bytes < 0 && errno == EINVAL && t->entry_direct_io) {
+		(void)fcntl(t->entry_fd, F_SETFL,
+		    fcntl(t->entry_fd, F_GETFL) & ~O_DIRECT);
+		t->entry_direct_io = 0;
+#if defined(HAVE_PREAD)
+		bytes = pread(t->entry_fd, buff, size, (off_t)t->entry_total);
+#else
+		bytes = read(t->entry_fd, buff, size);
+#endif
+	}
+#endif
+	if (bytes > (ssize_t)size)
+		bytes = (ssize_t)size;
+	return (bytes);
+}
+
 static int
 _archive_read_data_block(struct archive *_a, const void **buff,
     size_t *size, int64_t *offset)
@@ -709,13 +884,11 @@ _archive_read_data_block(struct archive *_a, const void **buff,
 		int flags = O_RDONLY | O_BINARY | O_CLOEXEC;
 
 		/*
-		 * Eliminate or reduce cache effects if we can.
-		 *
-		 * Carefully consider this to be enabled.
+		 * Eliminate or reduce cache effects if we were asked to.
 		 */
-#if defined(O_DIRECT) && 0/* Disabled for now */
-		if (t->current_filesystem->xfer_align != -1 &&
-		    t->nlink == 1)
+#if defined(O_DIRECT)
+		if ((a->flags & ARCHIVE_READDISK_DIRECT_IO) != 0 &&
+		    t->current_filesystem->xfer_align != -1)
 			flags |= O_DIRECT;
 #endif
 #if defined(O_NOATIME)
@@ -729,6 +902,17 @@ _archive_read_data_block(struct archive *_a, const void **buff,
 		t->entry_fd = open_on_current_dir(t,
 		    tree_current_access_path(t), flags);
 		__archive_ensure_cloexec_flag(t->entry_fd);
+#if defined(O_DIRECT)
+		/* Not every filesystem supports direct I/O. */
+		if (t->entry_fd < 0 && (flags & O_DIRECT) != 0 &&
+		    errno == EINVAL) {
+			flags &= ~O_DIRECT;
+			t->entry_fd = open_on_current_dir(t,
+			    tree_current_access_path(t), flags);
+			__archive_ensure_cloexec_flag(t->entry_fd);
+		}
+		t->entry_direct_io = t->entry_fd >= 0 && (flags & O_DIRECT);
+#endif
 #if defined(O_NOATIME)
 		/*
 		 * When we did open the file with O_NOATIME flag,
@@ -751,6 +935,11 @@ _archive_read_data_block(struct archive *_a, const void **buff,
 			goto abort_read_data;
 		}
 		tree_enter_initial_dir(t);
+#if defined(HAVE_POSIX_FADVISE) && defined(POSIX_FADV_SEQUENTIAL)
+		if (!t->entry_direct_io)
+			(void)posix_fadvise(t->entry_fd, 0, 0,
+			    POSIX_FADV_SEQUENTIAL);
+#endif
 	}
 
 	/*
@@ -775,9 +964,9 @@ _archive_read_data_block(struct archive *_a, const void **buff,
 
 	/*
 	 * Skip hole.
-	 * TODO: Should we consider t->current_filesystem->xfer_align?
 	 */
 	if (t->current_sparse->offset > t->entry_total) {
+#if !defined(HAVE_PREAD)
 		if (lseek(t->entry_fd,
 		    (off_t)t->current_sparse->offset, SEEK_SET) < 0) {
 			archive_set_error(&a->archive, errno, "Seek error");
@@ -785,6 +974,7 @@ _archive_read_data_block(struct archive *_a, const void **buff,
 			a->archive.state = ARCHIVE_STATE_FATAL;
 			goto abort_read_data;
 		}
+#endif
 		sparse_bytes = t->current_sparse->offset - t->entry_total;
 		t->entry_remaining_bytes -= sparse_bytes;
 		t->entry_total += sparse_bytes;
@@ -793,8 +983,25 @@ _archive_read_data_block(struct archive *_a, const void **buff,
 	/*
 	 * Read file contents.
 	 */
-	if (buffbytes > 0) {
-		bytes = read(t->entry_fd, t->entry_buff, buffbytes);
+	bytes = -1;
+#ifdef USE_READ_AHEAD
+	if (t->read_ahead != NULL && t->read_ahead->queued) {
+		struct tree_read_ahead *ra = t->read_ahead;
+
+		tree_read_ahead_wait(t);
+		/* Use what the worker read unless it failed; the read
+		 * below reports the error. */
+		if (ra->offset == t->entry_total && ra->want == buffbytes &&
+		    ra->bytes >= 0) {
+			t->entry_buff = ra->buff;
+			bytes = ra->bytes;
+		}
+	}
+#endif
+	if (bytes >= 0)
+		;
+	else if (buffbytes > 0) {
+		bytes = read_file_data(t, t->entry_buff, buffbytes);
 		if (bytes < 0) {
 			archive_set_error(&a->archive, errno, "Read error");
 			r = ARCHIVE_FATAL;
@@ -828,6 +1035,10 @@ _archive_read_data_block(struct archive *_a, const void **buff,
 	t->current_sparse->length -= bytes;
 	if (t->current_sparse->length == 0 && !t->entry_eof)
 		t->current_sparse++;
+#ifdef USE_READ_AHEAD
+	else if (t->read_ahead != NULL && !t->entry_eof && bytes > 0)
+		tree_read_ahead_submit(t);
+#endif
 	return (ARCHIVE_OK);
 
 abort_read_data:
@@ -1376,6 +1587,28 @@ _archive_read_disk_open(struct archive *_a, const char *pathname)
 		a->archive.state = ARCHIVE_STATE_FATAL;
 		return (ARCHIVE_FATAL);
 	}
+#ifdef USE_TREE_PREFETCH
+	if (a->threads > 1 && a->tree->prefetch == NULL &&
+	    tree_prefetch_setup(a->tree, a->threads) != 0) {
+		archive_set_error(&a->archive, ENOMEM,
+		    "Can't allocate tar data");
+		a->archive.state = ARCHIVE_STATE_FATAL;
+		return (ARCHIVE_FATAL);
+	}
+	/* Warming the page cache would defeat direct I/O. */
+	if (a->tree->prefetch != NULL)
+		a->tree->prefetch->read_ahead =
+		    (a->flags & ARCHIVE_READDISK_DIRECT_IO) == 0;
+#endif
+#ifdef USE_READ_AHEAD
+	if (a->threads > 1 && a->tree->read_ahead == NULL &&
+	    tree_read_ahead_setup(a->tree) != 0) {
+		archive_set_error(&a->archive, ENOMEM,
+		    "Can't allocate tar data");
+		a->archive.state = ARCHIVE_STATE_FATAL;
+		return (ARCHIVE_FATAL);
+	}
+#endif
 	a->archive.state = ARCHIVE_STATE_HEADER;
 
 	return (ARCHIVE_OK);
@@ -2006,7 +2239,12 @@ static int
 close_and_restore_time(int fd, struct tree *t, struct restore_time *rt)
 {
 #ifndef HAVE_UTIMES
+#ifdef USE_READ_AHEAD
+	/* A worker may still be reading from fd. */
+	tree_read_ahead_wait(t);
+#else
 	(void)t; /* UNUSED */
+#endif
 	(void)rt; /* UNUSED */
 	return (close(fd));
 #else
@@ -2015,6 +2253,10 @@ close_and_restore_time(int fd, struct tree *t, struct restore_time *rt)
 #endif
 	struct timeval times[2];
 
+#ifdef USE_READ_AHEAD
+	/* A worker may still be reading from fd. */
+	tree_read_ahead_wait(t);
+#endif
 	if ((t->flags & needsRestoreTimes) == 0 || rt->noatime) {
 		if (fd >= 0)
 			return (close(fd));
@@ -2463,26 +2705,13 @@ tree_dir_next_posix(struct tree *t)
 		}
 #endif /* USE_READDIR_R */
 	}
+#ifdef USE_TREE_PREFETCH
+	if (t->prefetch != NULL)
+		return (tree_dir_next_prefetch(t));
+#endif
 	for (;;) {
-		errno = 0;
-#if defined(USE_READDIR_R)
-		r = readdir_r(t->d, t->dirent, &t->de);
-#ifdef _AIX
-		/* Note: According to the man page, return value 9 indicates
-		 * that the readdir_r was not successful and the error code
-		 * is set to the global errno variable. And then if the end
-		 * of directory entries was reached, the return value is 9
-		 * and the third parameter is set to NULL and errno is
-		 * unchanged. */
-		if (r == 9)
-			r = errno;
-#endif /* _AIX */
+		r = tree_readdir(t);
 		if (r != 0 || t->de == NULL) {
-#else
-		t->de = readdir(t->d);
-		if (t->de == NULL) {
-			r = errno;
-#endif
 			closedir(t->d);
 			t->d = INVALID_DIR_HANDLE;
 			if (r != 0) {
@@ -2505,6 +2734,340 @@ tree_dir_next_posix(struct tree *t)
 	}
 }
 
+/*
+ * Read the next entry of the open directory into t->de, which is left
+ * NULL at the end of the directory.  Returns an errno value on failure.
+ */
+static int
+tree_readdir(struct tree *t)
+{
+	int r = 0;
+
+	errno = 0;
+#if defined(USE_READDIR_R)
+	r = readdir_r(t->d, t->dirent, &t->de);
+#ifdef _AIX
+	/* Note: According to the man page, return value 9 indicates
+	 * that the readdir_r was not successful and the error code
+	 * is set to the global errno variable. And then if the end
+	 * of directory entries was reached, the return value is 9
+	 * and the third parameter is set to NULL and errno is
+	 * unchanged. */
+	if (r == 9)
+		r = errno;
+#endif /* _AIX */
+#else
+	t->de = readdir(t->d);
+	if (t->de == NULL)
+		r = errno;
+#endif
+	return (r);
+}
+
+#ifdef USE_TREE_PREFETCH
+
+static void
+tree_prefetch_run(void *arg)
+{
+	struct tree_prefetch_chunk *c = arg;
+	struct tree_prefetch_entry *e;
+	int i;
+
+	for (i = 0; i < c->count; i++) {
+		e = &c->entries[i];
+		e->flags = 0;
+		if (fstatat(c->dir_fd, e->name.s, &e->lst,
+		    AT_SYMLINK_NOFOLLOW) != 0)
+			continue;
+		e->flags |= hasLstat;
+		if (!S_ISLNK(e->lst.st_mode)) {
+			/* stat() would return the same thing. */
+			e->st = e->lst;
+			e->flags |= hasStat;
+		} else if (fstatat(c->dir_fd, e->name.s, &e->st, 0) == 0)
+			e->flags |= hasStat;
+#if defined(HAVE_OPENAT) && defined(HAVE_POSIX_FADVISE) && \
+    defined(POSIX_FADV_WILLNEED)
+		/* Start reading small files the caller is about to read.
+		 * The file may have been replaced since the fstatat() by
+		 * a FIFO, which would block the open, or by a symlink. */
+		if (c->read_ahead && S_ISREG(e->lst.st_mode) &&
+		    e->lst.st_size > 0 &&
+		    e->lst.st_size <= READ_AHEAD_SMALL_FILE) {
+			int fd = openat(c->dir_fd, e->name.s,
+			    O_RDONLY | O_NONBLOCK | O_NOFOLLOW | O_CLOEXEC);
+			if (fd >= 0) {
+				(void)posix_fadvise(fd, 0, 0,
+				    POSIX_FADV_WILLNEED);
+				close(fd);
+			}
+		}
+#endif
+	}
+}
+
+static int
+tree_prefetch_setup(struct tree *t, int threads)
+{
+	struct tree_prefetch *pf;
+	int i, j;
+
+	pf = calloc(1, sizeof(*pf));
+	if (pf == NULL)
+		return (-1);
+	pf->pool = __archive_thread_pool_new(threads);
+	if (pf->pool == NULL) {
+		free(pf);
+		return (-1);
+	}
+	if (__archive_thread_pool_threads(pf->pool) == 0) {
+		/* No threads to be had; traverse as usual. */
+		__archive_thread_pool_free(pf->pool);
+		free(pf);
+		return (0);
+	}
+	/* Keep a few chunks queued for every worker. */
+	pf->nchunks = __archive_thread_pool_threads(pf->pool) * 4;
+	pf->chunks = calloc(pf->nchunks, sizeof(pf->chunks[0]));
+	if (pf->chunks == NULL) {
+		__archive_thread_pool_free(pf->pool);
+		free(pf);
+		return (-1);
+	}
+	for (i = 0; i < pf->nchunks; i++) {
+		pf->chunks[i].job.run = tree_prefetch_run;
+		pf->chunks[i].job.arg = &pf->chunks[i];
+		for (j = 0; j < PREFETCH_CHUNK; j++)
+			archive_string_init(&pf->chunks[i].entries[j].name);
+	}
+	t->prefetch = pf;
+	return (0);
+}
+
+/*
+ * Wait for the chunks still queued and forget the open directory.
+ */
+static void
+tree_prefetch_reset(struct tree *t)
+{
+	struct tree_prefetch *pf = t->prefetch;
+	struct tree_prefetch_chunk *c;
+
+	if (pf == NULL)
+		return;
+	while (pf->filled > 0) {
+		c = &pf->chunks[pf->head];
+		if (!c->waited)
+			__archive_thread_pool_wait(pf->pool, &c->job);
+		pf->head = (pf->head + 1) % pf->nchunks;
+		pf->filled--;
+	}
+	pf->pos = 0;
+	pf->eof = 0;
+	pf->error = 0;
+}
+
+static void
+tree_prefetch_free(struct tree *t)
+{
+	struct tree_prefetch *pf = t->prefetch;
+	int i, j;
+
+	if (pf == NULL)
+		return;
+	tree_prefetch_reset(t);
+	__archive_thread_pool_free(pf->pool);
+	for (i = 0; i < pf->nchunks; i++)
+		for (j = 0; j < PREFETCH_CHUNK; j++)
+			archive_string_free(&pf->chunks[i].entries[j].name);
+	free(pf->chunks);
+	free(pf);
+	t->prefetch = NULL;
+}
+
+/*
+ * Read directory entries into free chunks and queue them.
+ */
+static void
+tree_prefetch_fill(struct tree *t)
+{
+	struct tree_prefetch *pf = t->prefetch;
+	struct tree_prefetch_chunk *c;
+	const char *name;
+	int r;
+
+	while (!pf->eof && pf->filled < pf->nchunks) {
+		c = &pf->chunks[(pf->head + pf->filled) % pf->nchunks];
+		c->dir_fd = dirfd(t->d);
+		c->count = 0;
+		c->waited = 0;
+		c->read_ahead = pf->read_ahead;
+		while (c->count < PREFETCH_CHUNK) {
+			r = tree_readdir(t);
+			if (r != 0 || t->de == NULL) {
+				pf->eof = 1;
+				pf->error = r;
+				break;
+			}
+			name = t->de->d_name;
+			if (name[0] == '.' && name[1] == '\0')
+				continue;
+			if (name[0] == '.' && name[1] == '.' && name[2] == '\0')
+				continue;
+			archive_strncpy(&c->entries[c->count].name, name,
+			    D_NAMELEN(t->de));
+			c->count++;
+		}
+		if (c->count == 0)
+			break;
+		__archive_thread_pool_submit(pf->pool, &c->job);
+		pf->filled++;
+	}
+}
+
+static int
+tree_dir_next_prefetch(struct tree *t)
+{
+	struct tree_prefetch *pf = t->prefetch;
+	struct tree_prefetch_chunk *c;
+	struct tree_prefetch_entry *e;
+	int r;
+
+	for (;;) {
+		tree_prefetch_fill(t);
+		if (pf->filled == 0) {
+			/* Every entry has been handed out. */
+			r = pf->error;
+			tree_prefetch_reset(t);
+			closedir(t->d);
+			t->d = INVALID_DIR_HANDLE;
+			if (r != 0) {
+				t->tree_errno = r;
+				t->visit_type = TREE_ERROR_DIR;
+				return (t->visit_type);
+			}
+			return (0);
+		}
+		c = &pf->chunks[pf->head];
+		if (!c->waited) {
+			__archive_thread_pool_wait(pf->pool, &c->job);
+			c->waited = 1;
+		}
+		if (pf->pos < c->count)
+			break;
+		pf->head = (pf->head + 1) % pf->nchunks;
+		pf->filled--;
+		pf->pos = 0;
+	}
+	e = &c->entries[pf->pos++];
+	tree_append(t, e->name.s, archive_strlen(&e->name));
+	t->flags &= ~hasLstat;
+	t->flags &= ~hasStat;
+	if (e->flags & hasLstat) {
+		t->lst = e->lst;
+		t->flags |= hasLstat;
+	}
+	if (e->flags & hasStat) {
+		t->st = e->st;
+		t->flags |= hasStat;
+	}
+	return (t->visit_type = TREE_REGULAR);
+}
+
+#endif /* USE_TREE_PREFETCH */
+
+#ifdef USE_READ_AHEAD
+
+static void
+tree_read_ahead_run(void *arg)
+{
+	struct tree_read_ahead *ra = arg;
+
+	ra->bytes = pread(ra->fd, ra->buff, ra->size, (off_t)ra->offset);
+	if (ra->bytes > (ssize_t)ra->want)
+		ra->bytes = (ssize_t)ra->want;
+}
+
+static int
+tree_read_ahead_setup(struct tree *t)
+{
+	struct tree_read_ahead *ra;
+
+	ra = calloc(1, sizeof(*ra));
+	if (ra == NULL)
+		return (-1);
+	/* Only one read is ever in flight, but a pool of one thread
+	 * would run it on the caller's. */
+	ra->pool = __archive_thread_pool_new(2);
+	if (ra->pool == NULL) {
+		free(ra);
+		return (-1);
+	}
+	if (__archive_thread_pool_threads(ra->pool) == 0) {
+		__archive_thread_pool_free(ra->pool);
+		free(ra);
+		return (0);
+	}
+	ra->job.run = tree_read_ahead_run;
+	ra->job.arg = ra;
+	t->read_ahead = ra;
+	return (0);
+}
+
+/*
+ * Wait for the read in flight, if any.
+ */
+static void
+tree_read_ahead_wait(struct tree *t)
+{
+	struct tree_read_ahead *ra = t->read_ahead;
+
+	if (ra == NULL || !ra->queued)
+		return;
+	__archive_thread_pool_wait(ra->pool, &ra->job);
+	ra->queued = 0;
+}
+
+static void
+tree_read_ahead_free(struct tree *t)
+{
+	struct tree_read_ahead *ra = t->read_ahead;
+
+	if (ra == NULL)
+		return;
+	tree_read_ahead_wait(t);
+	__archive_thread_pool_free(ra->pool);
+	free(ra);
+	t->read_ahead = NULL;
+}
+
+/*
+ * Queue a read of the next piece of the current file into the buffer
+ * the caller does not hold.
+ */
+static void
+tree_read_ahead_submit(struct tree *t)
+{
+	struct tree_read_ahead *ra = t->read_ahead;
+	struct filesystem *cf = t->current_filesystem;
+
+	if (cf->buff_count < 2 || t->current_sparse->length <= 0)
+		return;
+	ra->fd = t->entry_fd;
+	ra->buff = (t->entry_buff == cf->buff)?
+	    cf->buff + cf->buff_size: cf->buff;
+	ra->want = cf->buff_size;
+	if ((int64_t)ra->want > t->current_sparse->length)
+		ra->want = (size_t)t->current_sparse->length;
+	ra->size = direct_io_size(t, ra->want);
+	ra->offset = t->entry_total;
+	ra->bytes = -1;
+	ra->queued = 1;
+	__archive_thread_pool_submit(ra->pool, &ra->job);
+}
+
+#endif /* USE_READ_AHEAD */
+
 
 /*
  * Get the stat() data for the entry just returned from tree_next().
@@ -2687,6 +3250,9 @@ tree_close(struct tree *t)
 	}
 	/* Close the handle of readdir(). */
 	if (t->d != INVALID_DIR_HANDLE) {
+#ifdef USE_TREE_PREFETCH
+		tree_prefetch_reset(t);
+#endif
 		closedir(t->d);
 		t->d = INVALID_DIR_HANDLE;
 	}
@@ -2716,6 +3282,12 @@ tree_free(struct tree *t)
 
 	if (t == NULL)
 		return;
+#ifdef USE_TREE_PREFETCH
+	tree_prefetch_free(t);
+#endif
+#ifdef USE_READ_AHEAD
+	tree_read_ahead_free(t);
+#endif
 	archive_string_free(&t->path);
 #if defined(USE_READDIR_R)
 	free(t->dirent);
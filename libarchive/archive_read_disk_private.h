@@ -68,6 +68,9 @@ struct archive_read_disk {
 	/* Bitfield with ARCHIVE_READDISK_* tunables */
 	int	flags;
 
+	/* Worker threads used to stat() directory entries ahead. */
+	int	threads;
+
 	const char * (*lookup_gname)(void *private, int64_t gid);
 	void	(*cleanup_gname)(void *private);
 	void	 *lookup_gname_data;
@@ -659,6 +659,17 @@ archive_read_disk_set_behavior(struct archive *_a, int flags)
 	return (r);
 }
 
+int
+archive_read_disk_set_threads(struct archive *_a, int threads)
+{
+	archive_check_magic(_a, ARCHIVE_READ_DISK_MAGIC,
+	    ARCHIVE_STATE_NEW | ARCHIVE_STATE_CLOSED,
+	    "archive_read_disk_set_threads");
+	/* Directories are always traversed by the calling thread. */
+	(void)threads; /* UNUSED */
+	return (ARCHIVE_OK);
+}
+
 /*
  * Trivial implementations of gname/uname lookup functions.
  * These are normally overridden by the client, but these stub
@@ -32,6 +32,12 @@ __FBSDID("$FreeBSD: src/lib/libarchive/archive_read_extract.c,v 1.61 2008/05/26
 #ifdef HAVE_ERRNO_H
 #include <errno.h>
 #endif
+#ifdef HAVE_LIMITS_H
+#include <limits.h>
+#endif
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
 #ifdef HAVE_STRING_H
 #include <string.h>
 #endif
@@ -40,9 +46,62 @@ __FBSDID("$FreeBSD: src/lib/libarchive/archive_read_extract.c,v 1.61 2008/05/26
 #include "archive_entry.h"
 #include "archive_private.h"
 #include "archive_read_private.h"
+#include "archive_thread_pool_private.h"
+#include "archive_write_disk_private.h"
+
+/*
+ * Regular files no larger than this are read into memory and handed
+ * to a worker thread; anything bigger is restored by the caller.
+ */
+#define EXTRACT_JOB_MAX_SIZE	(1024 * 1024)
+
+/* One file being restored by a worker thread. */
+struct extract_job {
+	struct archive_thread_job job;
+	/* Each job slot owns its disk writer, so that no two workers
+	 * ever share one. */
+	struct archive		*ad;
+	struct archive_entry	*entry;
+	char			*buff;
+	size_t			 buff_size;
+	size_t			 used;
+	/* Data blocks in the order the reader returned them. */
+	struct extract_block {
+		int64_t		 offset;
+		size_t		 start;	/* Position in buff. */
+		size_t		 size;
+	}			*blocks;
+	int			 nblocks;
+	int			 blocks_alloc;
+	/* Result of the restore and the writer's message. */
+	int			 r;
+	int			 error_number;
+	struct archive_string	 error;
+};
+
+struct archive_read_extract_threads {
+	struct archive_thread_ring jobs;
+	/* The job writers have been closed. */
+	int			 flushed;
+	/* Message of the last failed job, for the archive's error. */
+	int			 error_number;
+	struct archive_string	 error;
+};
 
 static int	copy_data(struct archive *ar, struct archive *aw);
 static int	archive_read_extract_cleanup(struct archive_read *);
+static int	archive_read_extract_flush(struct archive_read *);
+static int	extract_threads_init(struct archive_read *, struct archive *);
+static int	extract_changes_cwd(struct archive_entry *, struct archive *);
+static void	extract_threads_free(struct archive_read_extract_threads *);
+static int	extract_queue(struct archive_read *, struct archive_entry *,
+		    struct archive *);
+static int	extract_drain(struct archive_read *);
+static int	extract_reap(struct archive_read *);
+static int	extract_wait_path(struct archive_read *, const char *);
+static void	extract_job_run(void *);
+static void	extract_job_release(void *);
+static void	extract_copy_job_error(struct archive_read *);
 
 
 /* Retrieve an extract object without initialising the associated
@@ -57,6 +116,7 @@ __archive_read_get_extract(struct archive_read *a)
 			archive_set_error(&a->archive, ENOMEM, "Can't extract");
 			return (NULL);
 		}
+		a->extract->threads = 1;
 		a->cleanup_archive_extract = archive_read_extract_cleanup;
 	}
 	return (a->extract);
@@ -70,8 +130,14 @@ archive_read_extract_cleanup(struct archive_read *a)
 {
 	int ret = ARCHIVE_OK;
 
+	if (a->extract->workers != NULL) {
+		ret = archive_read_extract_flush(a);
+		extract_threads_free(a->extract->workers);
+	}
 	if (a->extract->ad != NULL) {
-		ret = archive_write_free(a->extract->ad);
+		int r = archive_write_free(a->extract->ad);
+		if (r < ret)
+			ret = r;
 	}
 	free(a->extract);
 	a->extract = NULL;
@@ -83,7 +149,37 @@ archive_read_extract2(struct archive *_a, struct archive_entry *entry,
     struct archive *ad)
 {
 	struct archive_read *a = (struct archive_read *)_a;
-	int r, r2;
+	struct archive_read_extract *extract = a->extract;
+	int cwd, r, r2, r3 = ARCHIVE_OK;
+
+	if (extract != NULL && extract->threads != 1) {
+		if (extract->workers == NULL &&
+		    extract_threads_init(a, ad) != ARCHIVE_OK)
+			return (ARCHIVE_FATAL);
+	}
+	if (extract != NULL && extract->workers != NULL) {
+		cwd = extract_changes_cwd(entry, ad);
+		if (!cwd && archive_entry_filetype(entry) == AE_IFREG &&
+		    archive_entry_hardlink(entry) == NULL &&
+		    archive_entry_size_is_set(entry) &&
+		    archive_entry_size(entry) <= EXTRACT_JOB_MAX_SIZE)
+			return (extract_queue(a, entry, ad));
+		/*
+		 * Everything else is restored here.  Directories and
+		 * large files only have to wait for queued files at,
+		 * above or below the same path; links and special files
+		 * may refer to any file restored so far, so let all of
+		 * them land.  So must an entry that moves the working
+		 * directory the workers resolve their paths from.
+		 */
+		if (!cwd && (archive_entry_filetype(entry) == AE_IFDIR ||
+		    (archive_entry_filetype(entry) == AE_IFREG &&
+		     archive_entry_hardlink(entry) == NULL)))
+			r3 = extract_wait_path(a,
+			    archive_entry_pathname(entry));
+		else
+			r3 = extract_drain(a);
+	}
 
 	/* Set up for this particular entry. */
 	if (a->skip_file_set)
@@ -107,6 +203,12 @@ archive_read_extract2(struct archive *_a, struct archive_entry *entry,
 	/* Use the worst error return. */
 	if (r2 < r)
 		r = r2;
+	/* Report a failed background restore if this entry went fine. */
+	if (r3 < r) {
+		if (r == ARCHIVE_OK)
+			extract_copy_job_error(a);
+		r = r3;
+	}
 	return (r);
 }
 
@@ -122,6 +224,432 @@ archive_read_extract_set_progress_callback(struct archive *_a,
 	}
 }
 
+int
+archive_read_extract_set_threads(struct archive *_a, int threads)
+{
+	struct archive_read *a = (struct archive_read *)_a;
+	struct archive_read_extract *extract;
+
+	archive_check_magic(_a, ARCHIVE_READ_MAGIC,
+	    ARCHIVE_STATE_ANY, "archive_read_extract_set_threads");
+	if (threads < 0) {
+		archive_set_error(_a, ARCHIVE_ERRNO_MISC,
+		    "Invalid number of extract threads: %d", threads);
+		return (ARCHIVE_FAILED);
+	}
+	extract = __archive_read_get_extract(a);
+	if (extract == NULL)
+		return (ARCHIVE_FATAL);
+	if (extract->workers != NULL) {
+		archive_set_error(_a, ARCHIVE_ERRNO_MISC,
+		    "Extract threads are already running");
+		return (ARCHIVE_FAILED);
+	}
+	if (threads == 0)
+		threads = __archive_thread_pool_cpus();
+	extract->threads = threads;
+	return (ARCHIVE_OK);
+}
+
+/*
+ * Whether restoring the entry may chdir(), which moves every thread
+ * of the process: paths longer than PATH_MAX are restored from an
+ * intermediate directory, and without openat() the symlink checks
+ * walk the path with chdir().  Such entries stay on the calling
+ * thread.
+ */
+static int
+extract_changes_cwd(struct archive_entry *entry, struct archive *ad)
+{
+#ifdef PATH_MAX
+	const char *p = archive_entry_pathname(entry);
+
+	if (p != NULL && strlen(p) >= PATH_MAX)
+		return (1);
+#else
+	(void)entry; /* UNUSED */
+#endif
+#if !defined(_WIN32) || defined(__CYGWIN__)
+#if !defined(HAVE_OPENAT) || !defined(HAVE_FSTATAT) || !defined(HAVE_UNLINKAT)
+	if (__archive_write_disk_get_options(ad) &
+	    ARCHIVE_EXTRACT_SECURE_SYMLINKS)
+		return (1);
+#endif
+#endif
+	(void)ad; /* UNUSED */
+	return (0);
+}
+
+static int
+extract_threads_init(struct archive_read *a, struct archive *ad)
+{
+	struct archive_read_extract *extract = a->extract;
+	struct archive_read_extract_threads *w;
+	struct extract_job *job;
+	int i;
+
+	w = calloc(1, sizeof(*w));
+	if (w == NULL)
+		goto nomem;
+	if (__archive_thread_ring_init(&w->jobs, extract->threads,
+	    sizeof(struct extract_job), extract_job_run) != ARCHIVE_OK)
+		goto nomem;
+	if (__archive_thread_pool_threads(w->jobs.pool) == 0) {
+		/* No threads to be had; extract as usual. */
+		extract_threads_free(w);
+		extract->threads = 1;
+		return (ARCHIVE_OK);
+	}
+	for (i = 0; i < w->jobs.nslots; i++) {
+		job = __archive_thread_ring_pending(&w->jobs, i);
+		job->ad = archive_write_disk_new();
+		if (job->ad == NULL)
+			goto nomem;
+		/* Use the umask the client's writer read. */
+		__archive_write_disk_set_umask(job->ad,
+		    __archive_write_disk_get_umask(ad));
+	}
+	extract->workers = w;
+	a->flush_archive_extract = archive_read_extract_flush;
+	return (ARCHIVE_OK);
+nomem:
+	extract_threads_free(w);
+	archive_set_error(&a->archive, ENOMEM, "Can't extract");
+	return (ARCHIVE_FATAL);
+}
+
+static void
+extract_threads_free(struct archive_read_extract_threads *w)
+{
+	if (w == NULL)
+		return;
+	__archive_thread_ring_free(&w->jobs, extract_job_release);
+	archive_string_free(&w->error);
+	free(w);
+}
+
+static void
+extract_job_release(void *arg)
+{
+	struct extract_job *job = arg;
+
+	archive_write_free(job->ad);
+	archive_entry_free(job->entry);
+	free(job->buff);
+	free(job->blocks);
+	archive_string_free(&job->error);
+}
+
+/*
+ * Wait for every queued file.
+ */
+static int
+extract_drain(struct archive_read *a)
+{
+	struct archive_read_extract_threads *w = a->extract->workers;
+	int r, ret = ARCHIVE_OK;
+
+	while (w->jobs.pending > 0) {
+		r = extract_reap(a);
+		if (r < ret)
+			ret = r;
+	}
+	return (ret);
+}
+
+/*
+ * Wait for every queued file and apply the directory fixups of the
+ * workers' disk writers.
+ */
+static int
+archive_read_extract_flush(struct archive_read *a)
+{
+	struct archive_read_extract_threads *w;
+	struct extract_job *job;
+	int i, r, ret;
+
+	if (a->extract == NULL || a->extract->workers == NULL ||
+	    a->extract->workers->flushed)
+		return (ARCHIVE_OK);
+	w = a->extract->workers;
+	w->flushed = 1;
+	ret = extract_drain(a);
+	for (i = 0; i < w->jobs.nslots; i++) {
+		job = __archive_thread_ring_pending(&w->jobs, i);
+		r = archive_write_close(job->ad);
+		if (r != ARCHIVE_OK) {
+			if (r < ARCHIVE_WARN)
+				r = ARCHIVE_WARN;
+			w->error_number = archive_errno(job->ad);
+			archive_strcpy(&w->error,
+			    archive_error_string(job->ad));
+			if (r < ret)
+				ret = r;
+		}
+	}
+	if (ret != ARCHIVE_OK)
+		extract_copy_job_error(a);
+	return (ret);
+}
+
+/*
+ * Wait for the oldest queued file and return how its restore went.
+ */
+static int
+extract_reap(struct archive_read *a)
+{
+	struct archive_read_extract_threads *w = a->extract->workers;
+	struct extract_job *job = __archive_thread_ring_reap(&w->jobs);
+
+	if (job->r != ARCHIVE_OK) {
+		w->error_number = job->error_number;
+		archive_string_empty(&w->error);
+		archive_string_sprintf(&w->error, "%s: %s",
+		    archive_entry_pathname(job->entry),
+		    job->error.s != NULL ? job->error.s : "");
+	}
+	return (job->r);
+}
+
+/*
+ * Whether the paths are the same or one names a directory above the
+ * other, so that restoring one can create, replace or remove what the
+ * other restores.
+ */
+static int
+extract_paths_overlap(const char *p1, const char *p2)
+{
+	size_t n;
+
+	for (n = 0; p1[n] != '\0' && p1[n] == p2[n]; n++)
+		continue;
+	if (p1[n] == p2[n])
+		return (1);
+	if (p1[n] == '\0')
+		return (p2[n] == '/' || (n > 0 && p1[n - 1] == '/'));
+	if (p2[n] == '\0')
+		return (p1[n] == '/' || (n > 0 && p2[n - 1] == '/'));
+	return (0);
+}
+
+/*
+ * Wait until no queued file will write to the given path, to a
+ * directory above it or to anything below it.
+ */
+static int
+extract_wait_path(struct archive_read *a, const char *path)
+{
+	struct archive_read_extract_threads *w = a->extract->workers;
+	int i, last = -1, r, ret = ARCHIVE_OK;
+
+	if (path == NULL)
+		return (ARCHIVE_OK);
+	for (i = 0; i < w->jobs.pending; i++) {
+		struct extract_job *job =
+		    __archive_thread_ring_pending(&w->jobs, i);
+		const char *p = archive_entry_pathname(job->entry);
+		if (p != NULL && extract_paths_overlap(p, path))
+			last = i;
+	}
+	for (; last >= 0; last--) {
+		r = extract_reap(a);
+		if (r < ret)
+			ret = r;
+	}
+	return (ret);
+}
+
+static void
+extract_copy_job_error(struct archive_read *a)
+{
+	struct archive_read_extract_threads *w = a->extract->workers;
+
+	archive_set_error(&a->archive, w->error_number, "%s",
+	    w->error.s != NULL ? w->error.s : "");
+}
+
+/*
+ * Create a small regular file with the writer of a free job slot, read
+ * its data into the slot and hand it to a worker thread to write the
+ * data and set the metadata.  The file is created here so that a
+ * failure to do so is returned for this entry, as it would be without
+ * the workers.
+ */
+static int
+extract_queue(struct archive_read *a, struct archive_entry *entry,
+    struct archive *ad)
+{
+	struct archive_read_extract_threads *w = a->extract->workers;
+	struct extract_job *job;
+	struct extract_block *blk;
+	const void *buff;
+	size_t size;
+	int64_t offset;
+	int flags, r, r2, ret;
+
+	ret = extract_wait_path(a, archive_entry_pathname(entry));
+	if ((job = __archive_thread_ring_next(&w->jobs)) == NULL) {
+		r = extract_reap(a);
+		if (r < ret)
+			ret = r;
+		job = __archive_thread_ring_next(&w->jobs);
+	}
+
+	archive_entry_free(job->entry);
+	job->entry = archive_entry_clone(entry);
+	if (job->entry == NULL) {
+		archive_set_error(&a->archive, ENOMEM, "Can't extract");
+		return (ARCHIVE_FATAL);
+	}
+	/* Name lookups are not safe to run on a worker, so resolve the
+	 * owner here with the client's disk writer. */
+	flags = __archive_write_disk_get_options(ad);
+	if (flags & (ARCHIVE_EXTRACT_OWNER | ARCHIVE_EXTRACT_PERM)) {
+		archive_entry_set_uid(job->entry, archive_write_disk_uid(ad,
+		    archive_entry_uname(entry), archive_entry_uid(entry)));
+		archive_entry_set_gid(job->entry, archive_write_disk_gid(ad,
+		    archive_entry_gname(entry), archive_entry_gid(entry)));
+	}
+	archive_entry_set_uname(job->entry, NULL);
+	archive_entry_set_gname(job->entry, NULL);
+	archive_write_disk_set_options(job->ad, flags);
+	if (a->skip_file_set)
+		archive_write_disk_set_skip_file(job->ad,
+		    a->skip_file_dev, a->skip_file_ino);
+
+	r = archive_write_header(job->ad, job->entry);
+	if (r != ARCHIVE_OK) {
+		/* As the serial path does, skip the data and report
+		 * the first message. */
+		if (r < ARCHIVE_WARN)
+			r = ARCHIVE_WARN;
+		archive_copy_error(&a->archive, job->ad);
+		r2 = archive_write_finish_entry(job->ad);
+		if (r2 < ARCHIVE_WARN)
+			r2 = ARCHIVE_WARN;
+		if (r2 < r)
+			r = r2;
+		return (r < ret ? r : ret);
+	}
+	if (!__archive_write_disk_has_file(job->ad)) {
+		/* Nothing was opened, as for a file that is not to be
+		 * overwritten: pass over the data here, as the serial
+		 * path does, to return the same result. */
+		r = ARCHIVE_OK;
+		if (!archive_entry_size_is_set(entry) ||
+		    archive_entry_size(entry) > 0)
+			r = copy_data(&a->archive, job->ad);
+		r2 = archive_write_finish_entry(job->ad);
+		if (r2 < ARCHIVE_WARN)
+			r2 = ARCHIVE_WARN;
+		if (r2 != ARCHIVE_OK && r == ARCHIVE_OK)
+			archive_copy_error(&a->archive, job->ad);
+		if (r2 < r)
+			r = r2;
+		return (r < ret ? r : ret);
+	}
+
+	job->used = 0;
+	job->nblocks = 0;
+	for (;;) {
+		r = archive_read_data_block(&a->archive, &buff, &size,
+		    &offset);
+		if (r == ARCHIVE_EOF) {
+			r = ARCHIVE_OK;
+			break;
+		}
+		if (r != ARCHIVE_OK)
+			break;
+		if (job->used + size > job->buff_size) {
+			size_t s = job->buff_size ? job->buff_size : 8192;
+			char *p;
+
+			while (s < job->used + size)
+				s *= 2;
+			p = realloc(job->buff, s);
+			if (p == NULL) {
+				archive_set_error(&a->archive, ENOMEM,
+				    "Can't extract");
+				return (ARCHIVE_FATAL);
+			}
+			job->buff = p;
+			job->buff_size = s;
+		}
+		blk = job->nblocks > 0 ? &job->blocks[job->nblocks - 1] : NULL;
+		if (blk == NULL || blk->offset + (int64_t)blk->size != offset) {
+			if (job->nblocks == job->blocks_alloc) {
+				int n = job->blocks_alloc ?
+				    job->blocks_alloc * 2 : 8;
+				blk = realloc(job->blocks,
+				    n * sizeof(job->blocks[0]));
+				if (blk == NULL) {
+					archive_set_error(&a->archive,
+					    ENOMEM, "Can't extract");
+					return (ARCHIVE_FATAL);
+				}
+				job->blocks = blk;
+				job->blocks_alloc = n;
+			}
+			blk = &job->blocks[job->nblocks++];
+			blk->offset = offset;
+			blk->start = job->used;
+			blk->size = 0;
+		}
+		memcpy(job->buff + job->used, buff, size);
+		job->used += size;
+		blk->size += size;
+		if (a->extract->extract_progress)
+			(a->extract->extract_progress)
+			    (a->extract->extract_progress_user_data);
+	}
+	/* Like the serial path, restore whatever could be read even if
+	 * reading the rest of the entry failed. */
+	__archive_thread_ring_submit(&w->jobs);
+
+	if (r != ARCHIVE_OK) {
+		/* The reader's own message is already in place. */
+		return (r < ret ? r : ret);
+	}
+	if (ret != ARCHIVE_OK)
+		extract_copy_job_error(a);
+	return (ret);
+}
+
+static void
+extract_job_run(void *arg)
+{
+	struct extract_job *job = arg;
+	struct extract_block *blk;
+	int i, r = ARCHIVE_OK, r2;
+
+	/* The file was created by extract_queue(). */
+	for (i = 0; i < job->nblocks; i++) {
+		blk = &job->blocks[i];
+		r = (int)archive_write_data_block(job->ad,
+		    job->buff + blk->start, blk->size, blk->offset);
+		if (r < ARCHIVE_WARN)
+			r = ARCHIVE_WARN;
+		if (r < ARCHIVE_OK) {
+			archive_strcpy(&job->error,
+			    archive_error_string(job->ad));
+			break;
+		}
+		r = ARCHIVE_OK;
+	}
+	if (r != ARCHIVE_OK)
+		job->error_number = archive_errno(job->ad);
+	r2 = archive_write_finish_entry(job->ad);
+	if (r2 < ARCHIVE_WARN)
+		r2 = ARCHIVE_WARN;
+	if (r2 != ARCHIVE_OK && r == ARCHIVE_OK) {
+		job->error_number = archive_errno(job->ad);
+		archive_strcpy(&job->error, archive_error_string(job->ad));
+	}
+	if (r2 < r)
+		r = r2;
+	job->r = r;
+}
+
 static int
 copy_data(struct archive *ar, struct archive *aw)
 {
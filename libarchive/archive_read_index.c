@@ -0,0 +1,550 @@
+/*-
+ * Copyright (c) 2026 The libarchive developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "archive_platform.h"
+__FBSDID("$FreeBSD$");
+
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#include "archive.h"
+#include "archive_endian.h"
+#include "archive_private.h"
+#include "archive_read_private.h"
+#include "archive_read_index_private.h"
+
+/*
+ * Index file layout; all integers are little-endian.
+ *
+ *	magic		8 bytes "LAIDX\0\0\1", written last so that an
+ *			interrupted recording is never taken for an index
+ *	checkpoints	8 bytes, number of checkpoint records
+ *	entries		8 bytes, number of entry records
+ *
+ * followed by the checkpoint records, in increasing offset order:
+ *
+ *	8 bytes uncompressed offset, 8 bytes compressed offset,
+ *	1 byte bits, 1 byte flags, 2 bytes window size, window
+ *
+ * and then the entry records, in archive order:
+ *
+ *	8 bytes header offset, 2 bytes pathname length, pathname
+ */
+#define INDEX_MAGIC		"LAIDX\0\0\1"
+#define INDEX_HEADER_SIZE	24
+#define CHECKPOINT_HEADER_SIZE	20
+#define ENTRY_HEADER_SIZE	10
+#define MAX_WINDOW_SIZE		65535
+#define MAX_PATHNAME_SIZE	65535
+
+/* Decoding at most this much to reach any offset seems a fair cost
+ * for about 32KiB of index per checkpoint. */
+#define DEFAULT_SPAN		(4 * 1024 * 1024)
+
+struct index_entry {
+	int64_t		 offset;
+	size_t		 name;	/* Offset into names. */
+};
+
+struct sorted_entry {
+	const char	*name;
+	int64_t		 offset;
+	size_t		 seq;	/* Position in archive order. */
+};
+
+struct archive_read_index {
+	FILE		*file;
+	char		*path;
+	char		 recording;
+	char		 saved;
+	int64_t		 span;
+	int64_t		 file_pos;
+
+	struct archive_read_index_checkpoint *checkpoints;
+	size_t		 checkpoint_count;
+	size_t		 checkpoint_alloc;
+
+	struct index_entry *entries;
+	size_t		 entry_count;
+	size_t		 entry_alloc;
+	struct archive_string names;
+
+	/* Entries ordered by name, built on the first lookup. */
+	struct sorted_entry *sorted;
+};
+
+static struct archive_read_index *
+index_new(struct archive_read *a, const char *path)
+{
+	struct archive_read_index *idx;
+
+	if (a->index != NULL) {
+		archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+		    "An index is already in use");
+		return (NULL);
+	}
+	idx = (struct archive_read_index *)calloc(1, sizeof(*idx));
+	if (idx == NULL || (idx->path = strdup(path)) == NULL) {
+		free(idx);
+		archive_set_error(&a->archive, ENOMEM,
+		    "Can't allocate index");
+		return (NULL);
+	}
+	idx->span = DEFAULT_SPAN;
+	archive_string_init(&idx->names);
+	return (idx);
+}
+
+static int
+index_write(struct archive_read *a, struct archive_read_index *idx,
+    const void *p, size_t size)
+{
+	if (size > 0 && fwrite(p, 1, size, idx->file) != size) {
+		archive_set_error(&a->archive, errno,
+		    "Can't write index %s", idx->path);
+		return (ARCHIVE_FATAL);
+	}
+	idx->file_pos += size;
+	return (ARCHIVE_OK);
+}
+
+static int
+index_read(struct archive_read *a, struct archive_read_index *idx,
+    void *p, size_t size)
+{
+	if (size > 0 && fread(p, 1, size, idx->file) != size) {
+		archive_set_error(&a->archive, ARCHIVE_ERRNO_FILE_FORMAT,
+		    "Truncated index %s", idx->path);
+		return (ARCHIVE_FATAL);
+	}
+	idx->file_pos += size;
+	return (ARCHIVE_OK);
+}
+
+/*
+ * Seek in the index, which may well be larger than a long can
+ * address on LLP64 systems.
+ */
+static int
+index_seek(struct archive_read_index *idx, int64_t offset, int whence)
+{
+#if defined(_WIN32) && !defined(__CYGWIN__)
+	return (_fseeki64(idx->file, offset, whence));
+#elif HAVE_FSEEKO
+	return (fseeko(idx->file, (off_t)offset, whence));
+#elif HAVE__FSEEKI64
+	return (_fseeki64(idx->file, offset, whence));
+#else
+	return (fseek(idx->file, (long)offset, whence));
+#endif
+}
+
+static int
+append_entry(struct archive_read *a, struct archive_read_index *idx,
+    const char *pathname, size_t len, int64_t offset)
+{
+	struct index_entry *e;
+
+	if (idx->entry_count == idx->entry_alloc) {
+		size_t n = idx->entry_alloc ? idx->entry_alloc * 2 : 1024;
+
+		e = (struct index_entry *)realloc(idx->entries,
+		    n * sizeof(*e));
+		if (e == NULL) {
+			archive_set_error(&a->archive, ENOMEM,
+			    "Can't allocate index");
+			return (ARCHIVE_FATAL);
+		}
+		idx->entries = e;
+		idx->entry_alloc = n;
+	}
+	e = &idx->entries[idx->entry_count];
+	e->offset = offset;
+	e->name = archive_strlen(&idx->names);
+	if (archive_string_ensure(&idx->names, e->name + len + 1) == NULL) {
+		archive_set_error(&a->archive, ENOMEM,
+		    "Can't allocate index");
+		return (ARCHIVE_FATAL);
+	}
+	archive_strncat(&idx->names, pathname, len);
+	/* Keep the terminating NUL of each name in the buffer. */
+	idx->names.length++;
+	idx->entry_count++;
+	free(idx->sorted);
+	idx->sorted = NULL;
+	return (ARCHIVE_OK);
+}
+
+int
+__archive_read_index_record(struct archive_read *a, const char *path)
+{
+	struct archive_read_index *idx;
+	unsigned char header[INDEX_HEADER_SIZE];
+
+	if ((idx = index_new(a, path)) == NULL)
+		return (ARCHIVE_FATAL);
+	idx->recording = 1;
+	idx->file = fopen(path, "wb");
+	if (idx->file == NULL) {
+		archive_set_error(&a->archive, errno,
+		    "Can't create index %s", path);
+		__archive_read_index_free(idx);
+		return (ARCHIVE_FATAL);
+	}
+	/* The header is filled in by __archive_read_index_save(). */
+	memset(header, 0, sizeof(header));
+	if (index_write(a, idx, header, sizeof(header)) != ARCHIVE_OK) {
+		__archive_read_index_free(idx);
+		return (ARCHIVE_FATAL);
+	}
+	a->index = idx;
+	return (ARCHIVE_OK);
+}
+
+int
+__archive_read_index_load(struct archive_read *a, const char *path)
+{
+	struct archive_read_index *idx;
+	struct archive_read_index_checkpoint *cp;
+	unsigned char header[INDEX_HEADER_SIZE];
+	unsigned char rec[CHECKPOINT_HEADER_SIZE];
+	struct archive_string name;
+	uint64_t checkpoints, entries, i;
+	size_t len;
+
+	if ((idx = index_new(a, path)) == NULL)
+		return (ARCHIVE_FATAL);
+	archive_string_init(&name);
+	idx->file = fopen(path, "rb");
+	if (idx->file == NULL) {
+		archive_set_error(&a->archive, errno,
+		    "Can't open index %s", path);
+		goto fail;
+	}
+	if (index_read(a, idx, header, sizeof(header)) != ARCHIVE_OK)
+		goto fail;
+	if (memcmp(header, INDEX_MAGIC, 8) != 0) {
+		archive_set_error(&a->archive, ARCHIVE_ERRNO_FILE_FORMAT,
+		    "%s is not a complete archive index", path);
+		goto fail;
+	}
+	checkpoints = archive_le64dec(header + 8);
+	entries = archive_le64dec(header + 16);
+
+	for (i = 0; i < checkpoints; i++) {
+		if (index_read(a, idx, rec, CHECKPOINT_HEADER_SIZE)
+		    != ARCHIVE_OK)
+			goto fail;
+		if (idx->checkpoint_count == idx->checkpoint_alloc) {
+			size_t n = idx->checkpoint_alloc ?
+			    idx->checkpoint_alloc * 2 : 64;
+
+			cp = (struct archive_read_index_checkpoint *)realloc(
+			    idx->checkpoints, n * sizeof(*cp));
+			if (cp == NULL) {
+				archive_set_error(&a->archive, ENOMEM,
+				    "Can't allocate index");
+				goto fail;
+			}
+			idx->checkpoints = cp;
+			idx->checkpoint_alloc = n;
+		}
+		cp = &idx->checkpoints[idx->checkpoint_count];
+		cp->uncompressed = (int64_t)archive_le64dec(rec);
+		cp->compressed = (int64_t)archive_le64dec(rec + 8);
+		cp->bits = rec[16];
+		cp->flags = rec[17];
+		cp->window_size = archive_le16dec(rec + 18);
+		cp->window_offset = idx->file_pos;
+		if (cp->uncompressed < 0 || cp->compressed < 0 ||
+		    cp->bits > 7 || (cp->bits && cp->compressed == 0) ||
+		    (idx->checkpoint_count > 0 && cp->uncompressed <
+		     cp[-1].uncompressed)) {
+			archive_set_error(&a->archive,
+			    ARCHIVE_ERRNO_FILE_FORMAT,
+			    "Damaged index %s", path);
+			goto fail;
+		}
+		if (index_seek(idx, cp->window_size, SEEK_CUR) != 0) {
+			archive_set_error(&a->archive, errno,
+			    "Can't read index %s", path);
+			goto fail;
+		}
+		idx->file_pos += cp->window_size;
+		idx->checkpoint_count++;
+	}
+
+	for (i = 0; i < entries; i++) {
+		if (index_read(a, idx, rec, ENTRY_HEADER_SIZE) != ARCHIVE_OK)
+			goto fail;
+		len = archive_le16dec(rec + 8);
+		if (archive_string_ensure(&name, len + 1) == NULL) {
+			archive_set_error(&a->archive, ENOMEM,
+			    "Can't allocate index");
+			goto fail;
+		}
+		if (index_read(a, idx, name.s, len) != ARCHIVE_OK)
+			goto fail;
+		if (append_entry(a, idx, name.s, len,
+		    (int64_t)archive_le64dec(rec)) != ARCHIVE_OK)
+			goto fail;
+	}
+	archive_string_free(&name);
+	a->index = idx;
+	return (ARCHIVE_OK);
+fail:
+	archive_string_free(&name);
+	__archive_read_index_free(idx);
+	return (ARCHIVE_FATAL);
+}
+
+int
+__archive_read_index_set_span(struct archive_read *a, int64_t span)
+{
+	if (a->index == NULL || !a->index->recording) {
+		archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+		    "No index is being recorded");
+		return (ARCHIVE_FAILED);
+	}
+	if (span <= 0) {
+		archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+		    "Invalid index span");
+		return (ARCHIVE_FAILED);
+	}
+	a->index->span = span;
+	return (ARCHIVE_OK);
+}
+
+int64_t
+__archive_read_index_span(struct archive_read *a)
+{
+	if (a->index == NULL || !a->index->recording || a->index->saved)
+		return (0);
+	return (a->index->span);
+}
+
+int
+__archive_read_index_add_entry(struct archive_read *a,
+    const char *pathname, int64_t offset)
+{
+	struct archive_read_index *idx = a->index;
+	size_t len;
+
+	if (idx == NULL || !idx->recording || idx->saved || pathname == NULL)
+		return (ARCHIVE_OK);
+	len = strlen(pathname);
+	if (len > MAX_PATHNAME_SIZE)
+		return (ARCHIVE_OK);	/* Not reachable through the index. */
+	return (append_entry(a, idx, pathname, len, offset));
+}
+
+int
+__archive_read_index_add_checkpoint(struct archive_read *a,
+    const struct archive_read_index_checkpoint *cp, const void *window)
+{
+	struct archive_read_index *idx = a->index;
+	unsigned char rec[CHECKPOINT_HEADER_SIZE];
+
+	if (idx == NULL || !idx->recording || idx->saved)
+		return (ARCHIVE_OK);
+	if (cp->window_size > MAX_WINDOW_SIZE) {
+		archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+		    "Index window too large");
+		return (ARCHIVE_FATAL);
+	}
+	archive_le64enc(rec, (uint64_t)cp->uncompressed);
+	archive_le64enc(rec + 8, (uint64_t)cp->compressed);
+	rec[16] = cp->bits;
+	rec[17] = cp->flags;
+	archive_le16enc(rec + 18, (uint16_t)cp->window_size);
+	if (index_write(a, idx, rec, sizeof(rec)) != ARCHIVE_OK ||
+	    index_write(a, idx, window, cp->window_size) != ARCHIVE_OK)
+		return (ARCHIVE_FATAL);
+	idx->checkpoint_count++;
+	return (ARCHIVE_OK);
+}
+
+int
+__archive_read_index_save(struct archive_read *a)
+{
+	struct archive_read_index *idx = a->index;
+	unsigned char rec[INDEX_HEADER_SIZE];
+	size_t i, len;
+	int r;
+
+	if (idx == NULL || !idx->recording || idx->saved)
+		return (ARCHIVE_OK);
+	idx->saved = 1;
+	for (i = 0; i < idx->entry_count; i++) {
+		const char *name = idx->names.s + idx->entries[i].name;
+
+		len = strlen(name);
+		archive_le64enc(rec, (uint64_t)idx->entries[i].offset);
+		archive_le16enc(rec + 8, (uint16_t)len);
+		if (index_write(a, idx, rec, ENTRY_HEADER_SIZE) != ARCHIVE_OK ||
+		    index_write(a, idx, name, len) != ARCHIVE_OK)
+			return (ARCHIVE_FATAL);
+	}
+	memcpy(rec, INDEX_MAGIC, 8);
+	archive_le64enc(rec + 8, (uint64_t)idx->checkpoint_count);
+	archive_le64enc(rec + 16, (uint64_t)idx->entry_count);
+	if (fflush(idx->file) != 0 || index_seek(idx, 0, SEEK_SET) != 0) {
+		archive_set_error(&a->archive, errno,
+		    "Can't write index %s", idx->path);
+		return (ARCHIVE_FATAL);
+	}
+	if (index_write(a, idx, rec, INDEX_HEADER_SIZE) != ARCHIVE_OK)
+		return (ARCHIVE_FATAL);
+	r = fclose(idx->file);
+	idx->file = NULL;
+	if (r != 0) {
+		archive_set_error(&a->archive, errno,
+		    "Can't write index %s", idx->path);
+		return (ARCHIVE_FATAL);
+	}
+	return (ARCHIVE_OK);
+}
+
+static int
+cmp_sorted(const void *p1, const void *p2)
+{
+	const struct sorted_entry *e1 = (const struct sorted_entry *)p1;
+	const struct sorted_entry *e2 = (const struct sorted_entry *)p2;
+	int r;
+
+	r = strcmp(e1->name, e2->name);
+	if (r != 0)
+		return (r);
+	return (e1->seq < e2->seq ? -1 : e1->seq > e2->seq);
+}
+
+int64_t
+__archive_read_index_find_entry(struct archive_read *a,
+    const char *pathname)
+{
+	struct archive_read_index *idx = a->index;
+	size_t i, lo, hi, mid;
+
+	if (idx == NULL || idx->entry_count == 0)
+		return (-1);
+	if (idx->sorted == NULL) {
+		idx->sorted = (struct sorted_entry *)calloc(idx->entry_count,
+		    sizeof(*idx->sorted));
+		if (idx->sorted == NULL)
+			return (-1);
+		for (i = 0; i < idx->entry_count; i++) {
+			idx->sorted[i].name =
+			    idx->names.s + idx->entries[i].name;
+			idx->sorted[i].offset = idx->entries[i].offset;
+			idx->sorted[i].seq = i;
+		}
+		qsort(idx->sorted, idx->entry_count, sizeof(*idx->sorted),
+		    cmp_sorted);
+	}
+
+	/* Find the first element whose name sorts after pathname; the
+	 * one before it is the last copy of pathname, if any. */
+	lo = 0;
+	hi = idx->entry_count;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (strcmp(idx->sorted[mid].name, pathname) <= 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == 0 || strcmp(idx->sorted[lo - 1].name, pathname) != 0)
+		return (-1);
+	return (idx->sorted[lo - 1].offset);
+}
+
+int
+__archive_read_index_has_checkpoints(struct archive_read *a)
+{
+	return (a->index != NULL && !a->index->recording &&
+	    a->index->checkpoint_count > 0);
+}
+
+const struct archive_read_index_checkpoint *
+__archive_read_index_find_checkpoint(struct archive_read *a, int64_t offset)
+{
+	struct archive_read_index *idx = a->index;
+	size_t lo, hi, mid;
+
+	if (idx == NULL || idx->recording)
+		return (NULL);
+	lo = 0;
+	hi = idx->checkpoint_count;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (idx->checkpoints[mid].uncompressed <= offset)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return (lo == 0 ? NULL : &idx->checkpoints[lo - 1]);
+}
+
+int
+__archive_read_index_read_window(struct archive_read *a,
+    const struct archive_read_index_checkpoint *cp, void *buff)
+{
+	struct archive_read_index *idx = a->index;
+
+	if (index_seek(idx, cp->window_offset, SEEK_SET) != 0) {
+		archive_set_error(&a->archive, errno,
+		    "Can't read index %s", idx->path);
+		return (ARCHIVE_FATAL);
+	}
+	idx->file_pos = cp->window_offset;
+	return (index_read(a, idx, buff, cp->window_size));
+}
+
+void
+__archive_read_index_free(struct archive_read_index *idx)
+{
+	if (idx == NULL)
+		return;
+	if (idx->file != NULL) {
+		fclose(idx->file);
+		/* Don't leave a partial recording behind. */
+		if (idx->recording)
+			remove(idx->path);
+	}
+	free(idx->path);
+	free(idx->checkpoints);
+	free(idx->entries);
+	free(idx->sorted);
+	archive_string_free(&idx->names);
+	free(idx);
+}
@@ -0,0 +1,89 @@
+/*-
+ * Copyright (c) 2026 The libarchive developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef ARCHIVE_READ_INDEX_PRIVATE_H_INCLUDED
+#define ARCHIVE_READ_INDEX_PRIVATE_H_INCLUDED
+
+#ifndef __LIBARCHIVE_BUILD
+#error This header is only to be used internally to libarchive.
+#endif
+
+/*
+ * A sidecar index lets a reader jump into an archive that has no
+ * directory of its own.  It holds two kinds of records, both keyed
+ * on offsets in the uncompressed archive stream:
+ *
+ *   - entries, recorded by the format: the offset of the first
+ *     header block of each entry, by pathname;
+ *   - checkpoints, recorded by a decompression filter: places where
+ *     decoding can be restarted, with whatever decoder state is
+ *     needed to do so.
+ *
+ * An index is either being recorded during a sequential read and is
+ * written out when the format reaches the end of the archive, or was
+ * loaded from a file and is used to seek.
+ */
+struct archive_read;
+struct archive_read_index;
+
+struct archive_read_index_checkpoint {
+	int64_t		 uncompressed;	/* Offset in the decoded stream. */
+	int64_t		 compressed;	/* Offset in the encoded stream. */
+	int64_t		 window_offset;	/* Where the window is stored. */
+	unsigned	 window_size;
+	unsigned char	 bits;	/* Bits of the previous byte still unread. */
+	unsigned char	 flags;
+#define ARCHIVE_READ_INDEX_MEMBER_START	1 /* Decoding starts afresh. */
+};
+
+/* Start recording an index that will be written to path. */
+int	__archive_read_index_record(struct archive_read *, const char *path);
+/* Load an index from path for seeking. */
+int	__archive_read_index_load(struct archive_read *, const char *path);
+/* Set the distance between checkpoints while recording. */
+int	__archive_read_index_set_span(struct archive_read *, int64_t);
+/* Non-zero distance between checkpoints if a filter should record them. */
+int64_t	__archive_read_index_span(struct archive_read *);
+int	__archive_read_index_add_entry(struct archive_read *,
+	    const char *pathname, int64_t offset);
+int	__archive_read_index_add_checkpoint(struct archive_read *,
+	    const struct archive_read_index_checkpoint *, const void *window);
+/* Write out the index being recorded; later additions are ignored. */
+int	__archive_read_index_save(struct archive_read *);
+/* Header offset of the last entry with that pathname, or -1. */
+int64_t	__archive_read_index_find_entry(struct archive_read *,
+	    const char *pathname);
+/* Non-zero if a loaded index has checkpoints to seek with. */
+int	__archive_read_index_has_checkpoints(struct archive_read *);
+/* The last checkpoint at or before offset, or NULL. */
+const struct archive_read_index_checkpoint *
+	__archive_read_index_find_checkpoint(struct archive_read *,
+	    int64_t offset);
+/* Read a checkpoint's window into buff, which holds window_size bytes. */
+int	__archive_read_index_read_window(struct archive_read *,
+	    const struct archive_read_index_checkpoint *, void *buff);
+void	__archive_read_index_free(struct archive_read_index *);
+
+#endif /* ARCHIVE_READ_INDEX_PRIVATE_H_INCLUDED */
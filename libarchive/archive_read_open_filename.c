@@ -29,6 +29,9 @@ __FBSDID("$FreeBSD: head/lib/libarchive/archive_read_open_filename.c 201093 2009
 #ifdef HAVE_SYS_IOCTL_H
 #include <sys/ioctl.h>
 #endif
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
 #ifdef HAVE_SYS_STAT_H
 #include <sys/stat.h>
 #endif
@@ -70,12 +73,26 @@ __FBSDID("$FreeBSD: head/lib/libarchive/archive_read_open_filename.c 201093 2009
 #define O_CLOEXEC	0
 #endif
 
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+#define USE_MMAP
+/* How much of the file to map at a time. */
+#define MMAP_WINDOW_SIZE	(16 * 1024 * 1024)
+#endif
+
 struct read_file_data {
 	int	 fd;
 	size_t	 block_size;
 	void	*buffer;
 	mode_t	 st_mode;  /* Mode bits for opened file. */
 	char	 use_lseek;
+	char	 want_mmap; /* Client asked for mmap(). */
+	char	 use_mmap;
+	void	*map;	   /* Currently mapped window. */
+	size_t	 map_size;
+	int64_t	 offset;   /* Read position when using mmap(). */
+	int64_t	 size;	   /* File size when using mmap(). */
+	time_t	 mtime;	   /* To tell whether the file changed. */
+	time_t	 ctime;
 	enum fnt_e { FNT_STDIN, FNT_MBS, FNT_WCS } filename_type;
 	union {
 		char	 m[1];/* MBS filename. */
@@ -91,6 +108,8 @@ static ssize_t	file_read(struct archive *, void *, const void **buff);
 static int64_t	file_seek(struct archive *, void *, int64_t request, int);
 static int64_t	file_skip(struct archive *, void *, int64_t request);
 static int64_t	file_skip_lseek(struct archive *, void *, int64_t request);
+static int	open_filenames(struct archive *, const char **, size_t, int);
+static int	open_filename_w(struct archive *, const wchar_t *, size_t, int);
 
 int
 archive_read_open_file(struct archive *a, const char *filename,
@@ -109,9 +128,26 @@ archive_read_open_filename(struct archive *a, const char *filename,
 	return archive_read_open_filenames(a, filenames, block_size);
 }
 
+int
+archive_read_open_filename_mmap(struct archive *a, const char *filename,
+    size_t block_size)
+{
+	const char *filenames[2];
+	filenames[0] = filename;
+	filenames[1] = NULL;
+	return open_filenames(a, filenames, block_size, 1);
+}
+
 int
 archive_read_open_filenames(struct archive *a, const char **filenames,
     size_t block_size)
+{
+	return open_filenames(a, filenames, block_size, 0);
+}
+
+static int
+open_filenames(struct archive *a, const char **filenames,
+    size_t block_size, int want_mmap)
 {
 	struct read_file_data *mine;
 	const char *filename = NULL;
@@ -132,6 +168,7 @@ archive_read_open_filenames(struct archive *a, const char **filenames,
 		mine->fd = -1;
 		mine->buffer = NULL;
 		mine->st_mode = mine->use_lseek = 0;
+		mine->want_mmap = want_mmap;
 		if (filename == NULL || filename[0] == '\0') {
 			mine->filename_type = FNT_STDIN;
 		} else
@@ -158,6 +195,20 @@ no_memory:
 int
 archive_read_open_filename_w(struct archive *a, const wchar_t *wfilename,
     size_t block_size)
+{
+	return open_filename_w(a, wfilename, block_size, 0);
+}
+
+int
+archive_read_open_filename_mmap_w(struct archive *a,
+    const wchar_t *wfilename, size_t block_size)
+{
+	return open_filename_w(a, wfilename, block_size, 1);
+}
+
+static int
+open_filename_w(struct archive *a, const wchar_t *wfilename,
+    size_t block_size, int want_mmap)
 {
 	struct read_file_data *mine = (struct read_file_data *)calloc(1,
 		sizeof(*mine) + wcslen(wfilename) * sizeof(wchar_t));
@@ -168,6 +219,7 @@ archive_read_open_filename_w(struct archive *a, const wchar_t *wfilename,
 	}
 	mine->fd = -1;
 	mine->block_size = block_size;
+	mine->want_mmap = want_mmap;
 
 	if (wfilename == NULL || wfilename[0] == L'\0') {
 		mine->filename_type = FNT_STDIN;
@@ -373,6 +425,20 @@ file_open(struct archive *a, void *client_data)
 	if (is_disk_like)
 		mine->use_lseek = 1;
 
+#ifdef USE_MMAP
+	/* Only named regular files have a size we can map.  Remember
+	 * what the file looked like to notice it changing later. */
+	mine->use_mmap = 0;
+	if (mine->want_mmap && mine->filename_type == FNT_MBS &&
+	    S_ISREG(st.st_mode)) {
+		mine->use_mmap = 1;
+		mine->offset = 0;
+		mine->size = st.st_size;
+		mine->mtime = st.st_mtime;
+		mine->ctime = st.st_ctime;
+	}
+#endif
+
 	return (ARCHIVE_OK);
 fail:
 	/*
@@ -384,6 +450,69 @@ fail:
 	return (ARCHIVE_FATAL);
 }
 
+#ifdef USE_MMAP
+static void
+file_unmap(struct read_file_data *mine)
+{
+	if (mine->map != NULL) {
+		munmap(mine->map, mine->map_size);
+		mine->map = NULL;
+		mine->map_size = 0;
+	}
+}
+
+/*
+ * Hand the next window of the file to libarchive straight from the
+ * page cache.  The previous window is no longer referenced once we
+ * are called again, so it can be unmapped here.  Returns ARCHIVE_WARN
+ * if the file can't be mapped.
+ *
+ * Touching a mapped page past the end of a file that was truncated
+ * raises SIGBUS, so a window is only mapped while the file is still
+ * the size and age it had when it was opened; a file being rewritten
+ * is read() from then on, which just comes up short.
+ */
+static ssize_t
+file_read_mmap(struct archive *a, void *client_data, const void **buff)
+{
+	struct read_file_data *mine = (struct read_file_data *)client_data;
+	struct stat st;
+	int64_t start, len;
+	long page_size;
+	void *p;
+
+	(void)a; /* UNUSED */
+	file_unmap(mine);
+	if (mine->offset >= mine->size)
+		return (0);
+	if (fstat(mine->fd, &st) != 0 || st.st_size != mine->size ||
+	    st.st_mtime != mine->mtime || st.st_ctime != mine->ctime)
+		return (ARCHIVE_WARN);
+
+	page_size = sysconf(_SC_PAGESIZE);
+	if (page_size <= 0)
+		page_size = 4096;
+	start = mine->offset - mine->offset % page_size;
+	len = mine->size - start;
+	if (len > MMAP_WINDOW_SIZE)
+		len = MMAP_WINDOW_SIZE;
+	p = mmap(NULL, (size_t)len, PROT_READ, MAP_SHARED, mine->fd,
+	    (off_t)start);
+	if (p == MAP_FAILED)
+		return (ARCHIVE_WARN);
+#ifdef HAVE_MADVISE
+	madvise(p, (size_t)len, MADV_SEQUENTIAL);
+	madvise(p, (size_t)len, MADV_WILLNEED);
+#endif
+	mine->map = p;
+	mine->map_size = (size_t)len;
+	*buff = (const char *)p + (mine->offset - start);
+	len -= mine->offset - start;
+	mine->offset += len;
+	return ((ssize_t)len);
+}
+#endif
+
 static ssize_t
 file_read(struct archive *a, void *client_data, const void **buff)
 {
@@ -394,9 +523,22 @@ file_read(struct archive *a, void *client_data, const void **buff)
 	 * mis-aligned, read and return a short block to try to get
 	 * us back in alignment. */
 
-	/* TODO: Someday, try mmap() here; if that succeeds, give
-	 * the entire file to libarchive as a single block.  That
-	 * could be a lot faster than block-by-block manual I/O. */
+#ifdef USE_MMAP
+	if (mine->use_mmap) {
+		bytes_read = file_read_mmap(a, client_data, buff);
+		if (bytes_read != ARCHIVE_WARN)
+			return (bytes_read);
+		/* The file can't be mapped after all or has
+		 * changed; carry on with plain reads from the same
+		 * position. */
+		mine->use_mmap = 0;
+		if (lseek(mine->fd, mine->offset, SEEK_SET) < 0) {
+			archive_set_error(a, errno,
+			    "Error seeking in '%s'", mine->filename.m);
+			return (-1);
+		}
+	}
+#endif
 
 	/* TODO: We might be able to improve performance on pipes and
 	 * sockets by setting non-blocking I/O and just accepting
@@ -495,6 +637,14 @@ file_skip(struct archive *a, void *client_data, int64_t request)
 {
 	struct read_file_data *mine = (struct read_file_data *)client_data;
 
+#ifdef USE_MMAP
+	/* Skipping is just moving the window. */
+	if (mine->use_mmap) {
+		mine->offset += request;
+		return (request);
+	}
+#endif
+
 	/* Delegate skip requests. */
 	if (mine->use_lseek)
 		return (file_skip_lseek(a, client_data, request));
@@ -512,6 +662,27 @@ file_seek(struct archive *a, void *client_data, int64_t request, int whence)
 	struct read_file_data *mine = (struct read_file_data *)client_data;
 	int64_t r;
 
+#ifdef USE_MMAP
+	if (mine->use_mmap) {
+		switch (whence) {
+		case SEEK_CUR:
+			request += mine->offset;
+			break;
+		case SEEK_END:
+			request += mine->size;
+			break;
+		}
+		if (request >= 0) {
+			mine->offset = request;
+			return (request);
+		}
+		errno = EINVAL;
+		archive_set_error(a, errno, "Error seeking in '%s'",
+		    mine->filename.m);
+		return (ARCHIVE_FATAL);
+	}
+#endif
+
 	/* We use off_t here because lseek() is declared that way. */
 	/* See above for notes about when off_t is less than 64 bits. */
 	r = lseek(mine->fd, request, whence);
@@ -563,6 +734,10 @@ file_close2(struct archive *a, void *client_data)
 		if (mine->filename_type != FNT_STDIN)
 			close(mine->fd);
 	}
+#ifdef USE_MMAP
+	file_unmap(mine);
+	mine->use_mmap = 0;
+#endif
 	free(mine->buffer);
 	mine->buffer = NULL;
 	mine->fd = -1;
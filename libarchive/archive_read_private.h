@@ -48,6 +48,9 @@ struct archive_read_filter_bidder_vtable {
 	    struct archive_read_filter *);
 	/* Initialize a newly-created filter. */
 	int (*init)(struct archive_read_filter *);
+	/* Set an option for filters created by this bidder. */
+	int (*options)(struct archive_read_filter_bidder *,
+	    const char *key, const char *value);
 	/* Release the bidder's configuration data. */
 	void (*free)(struct archive_read_filter_bidder *);
 };
@@ -82,6 +85,9 @@ struct archive_read_filter_vtable {
 	int (*close)(struct archive_read_filter *self);
 	/* Read any header metadata if available. */
 	int (*read_header)(struct archive_read_filter *self, struct archive_entry *entry);
+	/* Restart decoding at or before the given offset of the output;
+	 * returns the offset reached.  Only called if can_seek is set. */
+	int64_t (*seek)(struct archive_read_filter *self, int64_t offset);
 };
 
 /*
@@ -117,6 +123,11 @@ struct archive_read_filter {
 	char		 end_of_file;
 	char		 closed;
 	char		 fatal;
+
+	/* Statistics: bytes the read-ahead had to copy out of client
+	 * blocks, and bytes consumed straight from client blocks. */
+	int64_t		 bytes_copied;
+	int64_t		 bytes_passed;
 };
 
 /*
@@ -155,6 +166,10 @@ struct archive_read_extract {
 	/* Progress function invoked during extract. */
 	void			(*extract_progress)(void *);
 	void			 *extract_progress_user_data;
+
+	/* Worker threads restoring regular files. */
+	int			  threads;
+	struct archive_read_extract_threads *workers;
 };
 
 struct archive_read {
@@ -207,6 +222,8 @@ struct archive_read {
 		int	(*cleanup)(struct archive_read *);
 		int	(*format_capabilties)(struct archive_read *);
 		int	(*has_encrypted_entries)(struct archive_read *);
+		int	(*seek_entry)(struct archive_read *, const char *,
+		    struct archive_entry *);
 	}	formats[16];
 	struct archive_format_descriptor	*format; /* Active format. */
 
@@ -215,6 +232,7 @@ struct archive_read {
 	 */
 	struct archive_read_extract		*extract;
 	int			(*cleanup_archive_extract)(struct archive_read *);
+	int			(*flush_archive_extract)(struct archive_read *);
 
 	/*
 	 * Decryption passphrase.
@@ -226,6 +244,9 @@ struct archive_read {
 		archive_passphrase_callback *callback;
 		void *client_data;
 	}		passphrases;
+
+	/* Sidecar index being recorded or used for seeking. */
+	struct archive_read_index *index;
 };
 
 int	__archive_read_register_format(struct archive_read *a,
@@ -240,6 +261,10 @@ int	__archive_read_register_format(struct archive_read *a,
 		int (*cleanup)(struct archive_read *),
 		int (*format_capabilities)(struct archive_read *),
 		int (*has_encrypted_entries)(struct archive_read *));
+int	__archive_read_register_format_seek_entry(struct archive_read *a,
+		int (*bid)(struct archive_read *, int),
+		int (*seek_entry)(struct archive_read *, const char *,
+		    struct archive_entry *));
 
 int __archive_read_register_bidder(struct archive_read *a,
 		void *bidder_data,
@@ -249,6 +274,16 @@ int __archive_read_register_bidder(struct archive_read *a,
 const void *__archive_read_ahead(struct archive_read *, size_t, ssize_t *);
 const void *__archive_read_filter_ahead(struct archive_read_filter *,
     size_t, ssize_t *);
+
+/* One piece of a scattered read-ahead. */
+struct archive_read_iov {
+	const void	*buff;
+	size_t		 len;
+};
+int	__archive_read_ahead_iov(struct archive_read *, size_t,
+	    struct archive_read_iov[2]);
+int	__archive_read_filter_ahead_iov(struct archive_read_filter *, size_t,
+	    struct archive_read_iov[2]);
 int64_t	__archive_read_seek(struct archive_read*, int64_t, int);
 int64_t	__archive_read_filter_seek(struct archive_read_filter *, int64_t, int);
 int64_t	__archive_read_consume(struct archive_read *, int64_t);
@@ -45,16 +45,72 @@ __FBSDID("$FreeBSD$");
 #endif
 
 #include "archive.h"
+#include "archive_endian.h"
 #include "archive_private.h"
 #include "archive_read_private.h"
+#include "archive_thread_pool_private.h"
+
+/* Options given to the bzip2 bidder. */
+struct bzip2_options {
+	int		 threads;
+};
 
 #if defined(HAVE_BZLIB_H) && defined(BZ_CONFIG_ERROR)
+/*
+ * With the "threads" option, the compressed data is split at the
+ * 48-bit block magic numbers, in the manner of lbzip2.  Blocks are
+ * not byte aligned, so each one is shifted into a buffer of its own
+ * and wrapped in a stream header and an end-of-stream marker that
+ * carries the block's CRC.  That makes every block a complete
+ * single-block bzip2 stream which a worker can decode with the
+ * regular library calls.  Decoded blocks are handed back strictly in
+ * input order, and the combined CRC stored at the end of each stream
+ * is verified against the CRCs of its blocks.
+ *
+ * A block may contain a bit pattern equal to a magic number, which
+ * then splits it in two pieces that fail to decode.  The compressed
+ * data is kept from the start of the oldest queued block, so such a
+ * block is decoded again by the calling thread, each time taking in
+ * the data up to the next magic number, until it decodes.
+ */
+struct bzip2_block {
+	struct archive_thread_job job;
+	size_t		 start;		/* Bit position in buf. */
+	size_t		 nbits;
+	uint32_t	 crc;
+	char		*in;
+	size_t		 in_size;
+	size_t		 in_alloc;
+	char		*out;
+	size_t		 out_size;
+	size_t		 out_alloc;
+	char		 error;
+};
+
+#define BZIP2_BLOCK_MAGIC	0x314159265359ULL
+#define BZIP2_EOS_MAGIC		0x177245385090ULL
+
 struct private_data {
 	bz_stream	 stream;
 	char		*out_block;
 	size_t		 out_block_size;
 	char		 valid; /* True = decompressor is initialized */
 	char		 eof; /* True = found end of compressed data. */
+
+	/* Parallel decoding of blocks. */
+	struct archive_thread_pool *pool;
+	struct bzip2_block *blocks;
+	int		 nblocks;
+	int		 block_head;	/* Oldest queued block. */
+	int		 block_count;	/* Blocks queued or in use. */
+	char		 block_delivered; /* Oldest block was returned. */
+	int		 level;		/* Block size of current stream. */
+	uint32_t	 combined_crc;
+	/* Compressed data from the start of the oldest queued block. */
+	unsigned char	*buf;
+	size_t		 buf_len;
+	size_t		 buf_alloc;
+	size_t		 pos;		/* Bit position of next block. */
 };
 
 /* Bzip2 filter */
@@ -70,6 +126,9 @@ static int	bzip2_filter_close(struct archive_read_filter *);
  */
 static int	bzip2_reader_bid(struct archive_read_filter_bidder *, struct archive_read_filter *);
 static int	bzip2_reader_init(struct archive_read_filter *);
+static int	bzip2_reader_options(struct archive_read_filter_bidder *,
+		    const char *, const char *);
+static void	bzip2_reader_free(struct archive_read_filter_bidder *);
 
 #if ARCHIVE_VERSION_NUMBER < 4000000
 /* Deprecated; remove in libarchive 4.0 */
@@ -84,16 +143,28 @@ static const struct archive_read_filter_bidder_vtable
 bzip2_bidder_vtable = {
 	.bid = bzip2_reader_bid,
 	.init = bzip2_reader_init,
+	.options = bzip2_reader_options,
+	.free = bzip2_reader_free,
 };
 
 int
 archive_read_support_filter_bzip2(struct archive *_a)
 {
 	struct archive_read *a = (struct archive_read *)_a;
+	struct bzip2_options *options;
 
-	if (__archive_read_register_bidder(a, NULL, "bzip2",
-				&bzip2_bidder_vtable) != ARCHIVE_OK)
+	options = (struct bzip2_options *)calloc(1, sizeof(*options));
+	if (options == NULL) {
+		archive_set_error(_a, ENOMEM,
+		    "Can't allocate data for bzip2 bidder");
+		return (ARCHIVE_FATAL);
+	}
+	options->threads = 1;
+	if (__archive_read_register_bidder(a, options, "bzip2",
+				&bzip2_bidder_vtable) != ARCHIVE_OK) {
+		free(options);
 		return (ARCHIVE_FATAL);
+	}
 
 #if defined(HAVE_BZLIB_H) && defined(BZ_CONFIG_ERROR)
 	return (ARCHIVE_OK);
@@ -104,6 +175,41 @@ archive_read_support_filter_bzip2(struct archive *_a)
 #endif
 }
 
+static int
+bzip2_reader_options(struct archive_read_filter_bidder *self,
+    const char *key, const char *value)
+{
+	struct bzip2_options *options = (struct bzip2_options *)self->data;
+
+	if (strcmp(key, "threads") == 0) {
+		char *endptr;
+
+		if (value == NULL)
+			return (ARCHIVE_WARN);
+		errno = 0;
+		options->threads = (int)strtoul(value, &endptr, 10);
+		if (errno != 0 || *endptr != '\0') {
+			options->threads = 1;
+			return (ARCHIVE_WARN);
+		}
+		if (options->threads == 0)
+			options->threads = __archive_thread_pool_cpus();
+		return (ARCHIVE_OK);
+	}
+
+	/* Note: The "warn" return is just to inform the options
+	 * supervisor that we didn't handle it.  It will generate
+	 * a suitable error if no one used this option. */
+	return (ARCHIVE_WARN);
+}
+
+static void
+bzip2_reader_free(struct archive_read_filter_bidder *self)
+{
+	free(self->data);
+	self->data = NULL;
+}
+
 /*
  * Test whether we can handle this data.
  *
@@ -188,6 +294,7 @@ bzip2_reader_init(struct archive_read_filter *self)
 	static const size_t out_block_size = 64 * 1024;
 	void *out_block;
 	struct private_data *state;
+	struct bzip2_options *options;
 
 	self->code = ARCHIVE_FILTER_BZIP2;
 	self->name = "bzip2";
@@ -207,6 +314,19 @@ bzip2_reader_init(struct archive_read_filter *self)
 	state->out_block = out_block;
 	self->vtable = &bzip2_reader_vtable;
 
+	options = (struct bzip2_options *)self->bidder->data;
+	if (options != NULL && options->threads > 1) {
+		state->nblocks = options->threads * 2;
+		state->blocks = (struct bzip2_block *)calloc(state->nblocks,
+		    sizeof(state->blocks[0]));
+		state->pool = __archive_thread_pool_new(options->threads);
+		if (state->blocks == NULL || state->pool == NULL) {
+			archive_set_error(&self->archive->archive, ENOMEM,
+			    "Can't allocate data for bzip2 decompression");
+			return (ARCHIVE_FATAL);
+		}
+	}
+
 	return (ARCHIVE_OK);
 }
 
@@ -214,7 +334,7 @@ bzip2_reader_init(struct archive_read_filter *self)
  * Return the next block of decompressed data.
  */
 static ssize_t
-bzip2_filter_read(struct archive_read_filter *self, const void **p)
+bzip2_filter_read_serial(struct archive_read_filter *self, const void **p)
 {
 	struct private_data *state;
 	size_t decompressed;
@@ -333,6 +453,472 @@ bzip2_filter_read(struct archive_read_filter *self, const void **p)
 	}
 }
 
+/*
+ * Read 'n' (at most 32) bits starting at bit 'pos' of 'p'.
+ */
+static uint32_t
+bzip2_get_bits(const unsigned char *p, size_t pos, int n)
+{
+	uint32_t v = 0;
+
+	while (n-- > 0) {
+		v = (v << 1) | ((p[pos >> 3] >> (7 - (pos & 7))) & 1);
+		pos++;
+	}
+	return (v);
+}
+
+/*
+ * Store the low 'n' bits of 'v' at bit 'pos' of 'p', which must be
+ * zeroed beforehand.
+ */
+static void
+bzip2_put_bits(unsigned char *p, size_t pos, uint64_t v, int n)
+{
+	while (n-- > 0) {
+		if ((v >> n) & 1)
+			p[pos >> 3] |= 0x80 >> (pos & 7);
+		pos++;
+	}
+}
+
+/*
+ * Find the first block or end-of-stream magic number that starts at
+ * or after bit 'from' of the 'avail' bytes at 'p'.  Returns its bit
+ * position, or (size_t)-1 if there is none.
+ */
+static size_t
+bzip2_find_magic(const unsigned char *p, size_t avail, size_t from)
+{
+	static const uint64_t magic[2] = {
+	    BZIP2_BLOCK_MAGIC, BZIP2_EOS_MAGIC };
+	uint16_t candidates[256];
+	uint64_t w;
+	size_t i;
+	int m, s;
+
+	/* For every bit alignment, the third byte of a match is fully
+	 * determined; use it to skip quickly over everything else. */
+	memset(candidates, 0, sizeof(candidates));
+	for (m = 0; m < 2; m++)
+		for (s = 0; s < 8; s++)
+			candidates[((magic[m] << (16 - s)) >> 40) & 0xff] |=
+			    1 << (s * 2 + m);
+
+	for (i = from >> 3; i + 8 <= avail; i++) {
+		if (candidates[p[i + 2]] == 0)
+			continue;
+		w = archive_be64dec(p + i);
+		for (s = 0; s < 8; s++) {
+			for (m = 0; m < 2; m++) {
+				if ((candidates[p[i + 2]] &
+				    (1 << (s * 2 + m))) == 0)
+					continue;
+				if (((w >> (16 - s)) & 0xffffffffffffULL)
+				    == magic[m] && i * 8 + s >= from)
+					return (i * 8 + s);
+			}
+		}
+	}
+	return ((size_t)-1);
+}
+
+/*
+ * Decode one block, wrapped as a complete stream, on a worker thread.
+ */
+static void
+bzip2_block_decode(void *arg)
+{
+	struct bzip2_block *b = (struct bzip2_block *)arg;
+	bz_stream stream;
+	char *out;
+	int ret;
+
+	memset(&stream, 0, sizeof(stream));
+	b->error = 1;
+	b->out_size = 0;
+	if (BZ2_bzDecompressInit(&stream, 0, 0) != BZ_OK)
+		return;
+	stream.next_in = b->in;
+	stream.avail_in = (unsigned int)b->in_size;
+	for (;;) {
+		if (b->out_size == b->out_alloc) {
+			out = (char *)realloc(b->out, b->out_alloc * 2);
+			if (out == NULL)
+				break;
+			b->out = out;
+			b->out_alloc *= 2;
+		}
+		stream.next_out = b->out + b->out_size;
+		stream.avail_out = (unsigned int)(b->out_alloc - b->out_size);
+		ret = BZ2_bzDecompress(&stream);
+		b->out_size = b->out_alloc - stream.avail_out;
+		if (ret == BZ_STREAM_END) {
+			if (stream.avail_in == 0)
+				b->error = 0;
+			break;
+		}
+		/* Stop if the library is stuck or failed. */
+		if (ret != BZ_OK || stream.avail_out != 0)
+			break;
+	}
+	BZ2_bzDecompressEnd(&stream);
+}
+
+/*
+ * Make 'bytes' bytes from the one holding bit 'pos' available in buf.
+ * Returns ARCHIVE_EOF if the input ends first.
+ */
+static int
+bzip2_fill(struct archive_read_filter *self, size_t bytes)
+{
+	struct private_data *state = (struct private_data *)self->data;
+	const void *p;
+	size_t keep, need, n;
+	ssize_t avail;
+	int i;
+
+	need = state->pos / 8 + bytes;
+	if (need > state->buf_alloc) {
+		/* Drop the data of the blocks already decoded. */
+		i = state->block_delivered;
+		if (i < state->block_count)
+			keep = state->blocks[(state->block_head + i)
+			    % state->nblocks].start / 8;
+		else
+			keep = state->pos / 8;
+		memmove(state->buf, state->buf + keep, state->buf_len - keep);
+		state->buf_len -= keep;
+		state->pos -= keep * 8;
+		for (; i < state->block_count; i++)
+			state->blocks[(state->block_head + i)
+			    % state->nblocks].start -= keep * 8;
+		need -= keep;
+		/* Keep room to read ahead as much as is kept. */
+		if (need * 2 > state->buf_alloc) {
+			unsigned char *buf;
+
+			n = state->buf_alloc ? state->buf_alloc : 256 * 1024;
+			while (n < need * 2)
+				n *= 2;
+			buf = (unsigned char *)realloc(state->buf, n);
+			if (buf == NULL) {
+				archive_set_error(&self->archive->archive,
+				    ENOMEM,
+				    "Can't allocate data for bzip2 decompression");
+				return (ARCHIVE_FATAL);
+			}
+			state->buf = buf;
+			state->buf_alloc = n;
+		}
+	}
+	while (state->buf_len < need) {
+		p = __archive_read_filter_ahead(self->upstream, 1, &avail);
+		if (p == NULL)
+			return (avail < 0 ? ARCHIVE_FATAL : ARCHIVE_EOF);
+		n = state->buf_alloc - state->buf_len;
+		if (n > (size_t)avail)
+			n = (size_t)avail;
+		memcpy(state->buf + state->buf_len, p, n);
+		state->buf_len += n;
+		__archive_read_filter_consume(self->upstream, n);
+	}
+	return (ARCHIVE_OK);
+}
+
+/*
+ * Find the first magic number at least 'skip' bits past 'pos', reading
+ * up to 'max' bytes past it.  Returns ARCHIVE_EOF if there is none.
+ */
+static int
+bzip2_next_magic(struct archive_read_filter *self, size_t skip, size_t max,
+    size_t *end)
+{
+	struct private_data *state = (struct private_data *)self->data;
+	size_t want;
+	int r;
+
+	for (want = 64 * 1024;; want *= 2) {
+		if (want > max)
+			want = max;
+		r = bzip2_fill(self, want);
+		if (r == ARCHIVE_FATAL)
+			return (r);
+		*end = bzip2_find_magic(state->buf, state->buf_len,
+		    state->pos + skip);
+		if (*end != (size_t)-1)
+			return (ARCHIVE_OK);
+		if (r == ARCHIVE_EOF || want == max)
+			return (ARCHIVE_EOF);
+		/* Only a magic number across the end is left to find. */
+		if (state->buf_len > 8 &&
+		    (state->buf_len - 8) * 8 > state->pos + skip)
+			skip = (state->buf_len - 8) * 8 - state->pos;
+	}
+}
+
+/*
+ * Wrap the bits from the start of the block up to 'end' as a stream:
+ * "BZh" + level, the block bits, the end-of-stream marker and the
+ * block CRC, which is also the stream CRC.
+ */
+static int
+bzip2_build_block(struct archive_read_filter *self, struct bzip2_block *b,
+    size_t end)
+{
+	struct private_data *state = (struct private_data *)self->data;
+	const unsigned char *p = state->buf + b->start / 8;
+	unsigned char *q;
+	size_t nbits, nbytes, i;
+	int shift = b->start & 7;
+
+	nbits = end - b->start;
+	nbytes = 4 + (nbits + 80 + 7) / 8;
+	if (b->in_alloc < nbytes) {
+		free(b->in);
+		b->in_alloc = nbytes;
+		b->in = (char *)malloc(b->in_alloc);
+	}
+	if (b->out_alloc < (size_t)state->level * 100000) {
+		free(b->out);
+		b->out_alloc = state->level * 100000;
+		b->out = (char *)malloc(b->out_alloc);
+	}
+	if (b->in == NULL || b->out == NULL) {
+		free(b->in);
+		free(b->out);
+		b->in = b->out = NULL;
+		b->in_alloc = b->out_alloc = 0;
+		archive_set_error(&self->archive->archive, ENOMEM,
+		    "Can't allocate data for bzip2 decompression");
+		return (ARCHIVE_FATAL);
+	}
+	q = (unsigned char *)b->in;
+	memcpy(q, "BZh", 3);
+	q[3] = '0' + state->level;
+	q += 4;
+	if (shift == 0)
+		memcpy(q, p, (nbits + 7) / 8);
+	else {
+		/* A magic number follows, so p[i + 1] exists. */
+		for (i = 0; i < (nbits + 7) / 8; i++)
+			q[i] = (p[i] << shift) | (p[i + 1] >> (8 - shift));
+	}
+	if (nbits & 7)
+		q[nbits / 8] &= 0xff << (8 - (nbits & 7));
+	memset(q + (nbits + 7) / 8, 0, nbytes - 4 - (nbits + 7) / 8);
+	bzip2_put_bits(q, nbits, BZIP2_EOS_MAGIC, 48);
+	bzip2_put_bits(q, nbits + 48, b->crc, 32);
+	b->nbits = nbits;
+	b->in_size = nbytes;
+	return (ARCHIVE_OK);
+}
+
+/*
+ * Copy the next block out of the input and queue it for decoding.
+ * Returns ARCHIVE_EOF at the end of the compressed data, and
+ * ARCHIVE_RETRY if the queued blocks must be decoded first to tell
+ * whether the next magic number is real.
+ */
+static int
+bzip2_queue_block(struct archive_read_filter *self)
+{
+	struct private_data *state = (struct private_data *)self->data;
+	struct bzip2_block *b;
+	const unsigned char *p;
+	size_t end, max;
+	int r;
+
+	for (;;) {
+		if (state->level == 0) {
+			/* Expect the header of a new stream. */
+			r = bzip2_fill(self, 14);
+			if (r == ARCHIVE_FATAL)
+				return (r);
+			p = state->buf + state->pos / 8;
+			if (r != ARCHIVE_OK || memcmp(p, "BZh", 3) != 0 ||
+			    p[3] < '1' || p[3] > '9' ||
+			    (memcmp(p + 4, "\x31\x41\x59\x26\x53\x59", 6) != 0 &&
+			     memcmp(p + 4, "\x17\x72\x45\x38\x50\x90", 6) != 0)) {
+				state->eof = 1;
+				return (ARCHIVE_EOF);
+			}
+			state->level = p[3] - '0';
+			state->combined_crc = 0;
+			state->pos += 32;
+		}
+
+		/* Enough for a magic number and a CRC at any alignment. */
+		r = bzip2_fill(self, 11);
+		if (r == ARCHIVE_FATAL)
+			return (r);
+		if (state->buf_len * 8 < state->pos + 80)
+			goto truncated;
+		if (bzip2_get_bits(state->buf, state->pos, 24) ==
+		    (BZIP2_EOS_MAGIC >> 24) &&
+		    bzip2_get_bits(state->buf, state->pos + 24, 24) ==
+		    (BZIP2_EOS_MAGIC & 0xffffff)) {
+			/* Inside a queued block that was split too early,
+			 * this may be a false one. */
+			if (state->block_count > 0)
+				return (ARCHIVE_RETRY);
+			/* End of stream; the padding up to the next byte
+			 * boundary is discarded. */
+			if (bzip2_get_bits(state->buf, state->pos + 48, 32) !=
+			    state->combined_crc) {
+				archive_set_error(&self->archive->archive,
+				    ARCHIVE_ERRNO_MISC,
+				    "bzip2 stream CRC mismatch");
+				return (ARCHIVE_FATAL);
+			}
+			state->pos = (state->pos + 80 + 7) & ~(size_t)7;
+			state->level = 0;
+			continue;
+		}
+		if (bzip2_get_bits(state->buf, state->pos, 24) !=
+		    (BZIP2_BLOCK_MAGIC >> 24) ||
+		    bzip2_get_bits(state->buf, state->pos + 24, 24) !=
+		    (BZIP2_BLOCK_MAGIC & 0xffffff)) {
+			archive_set_error(&self->archive->archive,
+			    ARCHIVE_ERRNO_MISC, "Invalid bzip2 data");
+			return (ARCHIVE_FATAL);
+		}
+		break;
+	}
+
+	/* The block ends where the next magic number begins.  No valid
+	 * block holds more than level * 100000 symbols of at most 20
+	 * bits, plus its tables. */
+	max = state->level * 250000 + 64 * 1024;
+	r = bzip2_next_magic(self, 80, max, &end);
+	if (r == ARCHIVE_FATAL)
+		return (r);
+	if (r != ARCHIVE_OK)
+		goto truncated;
+
+	b = &state->blocks[(state->block_head + state->block_count)
+	    % state->nblocks];
+	b->start = state->pos;
+	b->crc = bzip2_get_bits(state->buf, state->pos + 48, 32);
+	if (bzip2_build_block(self, b, end) != ARCHIVE_OK)
+		return (ARCHIVE_FATAL);
+	state->pos = end;
+
+	b->job.run = bzip2_block_decode;
+	b->job.arg = b;
+	__archive_thread_pool_submit(state->pool, &b->job);
+	state->block_count++;
+	return (ARCHIVE_OK);
+
+truncated:
+	/* A queued block may yet take in this data. */
+	if (state->block_count > 0)
+		return (ARCHIVE_RETRY);
+	archive_set_error(&self->archive->archive, ARCHIVE_ERRNO_MISC,
+	    "truncated bzip2 input");
+	return (ARCHIVE_FATAL);
+}
+
+/*
+ * The oldest queued block did not decode: it ended at a false magic
+ * number inside the block, or the data is damaged.  Drop the blocks
+ * queued after it and decode it on this thread, taking in the data
+ * up to each following magic number in turn.
+ */
+static int
+bzip2_regrow_block(struct archive_read_filter *self)
+{
+	struct private_data *state = (struct private_data *)self->data;
+	struct bzip2_block *b = &state->blocks[state->block_head];
+	size_t end, max;
+	int i, r;
+
+	for (i = 1; i < state->block_count; i++)
+		__archive_thread_pool_wait(state->pool,
+		    &state->blocks[(state->block_head + i)
+		    % state->nblocks].job);
+	state->block_count = 1;
+	state->pos = b->start + b->nbits;
+	max = state->level * 250000 + 64 * 1024;
+	while ((state->pos - b->start) / 8 < max) {
+		r = bzip2_next_magic(self, 1,
+		    max - (state->pos - b->start) / 8, &end);
+		if (r == ARCHIVE_FATAL)
+			return (r);
+		if (r != ARCHIVE_OK)
+			break;
+		if (bzip2_build_block(self, b, end) != ARCHIVE_OK)
+			return (ARCHIVE_FATAL);
+		state->pos = end;
+		bzip2_block_decode(b);
+		if (!b->error)
+			return (ARCHIVE_OK);
+	}
+	archive_set_error(&self->archive->archive,
+	    ARCHIVE_ERRNO_MISC, "bzip decompression failed");
+	return (ARCHIVE_FATAL);
+}
+
+static void
+bzip2_release_block(struct private_data *state)
+{
+	state->block_head = (state->block_head + 1) % state->nblocks;
+	state->block_count--;
+}
+
+static ssize_t
+bzip2_filter_read_parallel(struct archive_read_filter *self, const void **p)
+{
+	struct private_data *state = (struct private_data *)self->data;
+	struct bzip2_block *b;
+	int r;
+
+	/* The caller is done with the block we returned last time. */
+	if (state->block_delivered) {
+		bzip2_release_block(state);
+		state->block_delivered = 0;
+	}
+
+	for (;;) {
+		/* Keep the workers busy with the blocks that follow. */
+		while (!state->eof && state->block_count < state->nblocks) {
+			r = bzip2_queue_block(self);
+			if (r == ARCHIVE_FATAL)
+				return (ARCHIVE_FATAL);
+			if (r != ARCHIVE_OK)
+				break;
+		}
+
+		if (state->block_count == 0) {
+			*p = NULL;
+			return (0);
+		}
+		b = &state->blocks[state->block_head];
+		__archive_thread_pool_wait(state->pool, &b->job);
+		if (b->error && bzip2_regrow_block(self) != ARCHIVE_OK)
+			return (ARCHIVE_FATAL);
+		state->combined_crc = ((state->combined_crc << 1) |
+		    (state->combined_crc >> 31)) ^ b->crc;
+		if (b->out_size == 0) {
+			bzip2_release_block(state);
+			continue;
+		}
+		state->block_delivered = 1;
+		*p = b->out;
+		return ((ssize_t)b->out_size);
+	}
+}
+
+static ssize_t
+bzip2_filter_read(struct archive_read_filter *self, const void **p)
+{
+	struct private_data *state = (struct private_data *)self->data;
+
+	if (state->pool != NULL)
+		return (bzip2_filter_read_parallel(self, p));
+	return (bzip2_filter_read_serial(self, p));
+}
+
 /*
  * Clean up the decompressor.
  */
@@ -357,6 +943,20 @@ bzip2_filter_close(struct archive_read_filter *self)
 		state->valid = 0;
 	}
 
+	if (state->blocks != NULL) {
+		int i;
+
+		/* Let the workers finish anything still queued before
+		 * releasing the buffers they work on. */
+		__archive_thread_pool_free(state->pool);
+		for (i = 0; i < state->nblocks; i++) {
+			free(state->blocks[i].in);
+			free(state->blocks[i].out);
+		}
+		free(state->blocks);
+	} else
+		__archive_thread_pool_free(state->pool);
+	free(state->buf);
 	free(state->out_block);
 	free(state);
 	return (ret);
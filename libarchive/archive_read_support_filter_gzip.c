@@ -52,8 +52,41 @@ __FBSDID("$FreeBSD$");
 #include "archive_endian.h"
 #include "archive_private.h"
 #include "archive_read_private.h"
+#include "archive_read_index_private.h"
+#include "archive_thread_pool_private.h"
+
+/* Options given to the gzip bidder. */
+struct gzip_options {
+	int		 threads;
+};
 
 #ifdef HAVE_ZLIB_H
+/*
+ * With the "threads" option, members that record their own compressed
+ * size in a BGZF "BC" extra subfield (bgzip and similar block-oriented
+ * writers) are copied out of the input stream and inflated on the
+ * worker pool.  Decoded blocks are handed back strictly in input order.
+ * Members without that subfield are inflated on the calling thread as
+ * usual, because their end can only be found by decoding them.
+ */
+struct gzip_block {
+	struct archive_thread_job job;
+	unsigned char	*in;
+	size_t		 in_size;
+	size_t		 in_alloc;
+	unsigned char	*out;
+	size_t		 out_size;
+	size_t		 out_alloc;
+	uint32_t	 crc;
+	char		 error;
+};
+
+/* Don't hand a single member bigger than this to a worker. */
+#define GZIP_BLOCK_MAX_OUT	(4 * 1024 * 1024)
+
+/* Deflate never refers back further than this. */
+#define GZIP_WINDOW_SIZE	32768
+
 struct private_data {
 	z_stream	 stream;
 	char		 in_stream;
@@ -64,11 +97,30 @@ struct private_data {
 	uint32_t	 mtime;
 	char		*name;
 	char		 eof; /* True = found end of compressed data. */
+
+	/* Parallel decoding of BGZF members. */
+	struct archive_thread_pool *pool;
+	struct gzip_block *blocks;
+	int		 nblocks;
+	int		 block_head;	/* Oldest queued block. */
+	int		 block_count;	/* Blocks queued or in use. */
+	char		 block_delivered; /* Oldest block was returned. */
+
+	/*
+	 * Recording checkpoints for a sidecar index.  Decoding stops
+	 * at every deflate block boundary so that one can be taken
+	 * there; the last 32KiB of output are kept to go with it.
+	 */
+	int64_t		 index_span;
+	int64_t		 last_checkpoint;
+	unsigned char	*window;
+	size_t		 window_len;
 };
 
 /* Gzip Filter. */
 static ssize_t	gzip_filter_read(struct archive_read_filter *, const void **);
 static int	gzip_filter_close(struct archive_read_filter *);
+static int64_t	gzip_filter_seek(struct archive_read_filter *, int64_t);
 #endif
 
 /*
@@ -84,6 +136,9 @@ static int	gzip_filter_close(struct archive_read_filter *);
 static int	gzip_bidder_bid(struct archive_read_filter_bidder *,
 		    struct archive_read_filter *);
 static int	gzip_bidder_init(struct archive_read_filter *);
+static int	gzip_bidder_options(struct archive_read_filter_bidder *,
+		    const char *, const char *);
+static void	gzip_bidder_free(struct archive_read_filter_bidder *);
 
 #if ARCHIVE_VERSION_NUMBER < 4000000
 /* Deprecated; remove in libarchive 4.0 */
@@ -98,16 +153,28 @@ static const struct archive_read_filter_bidder_vtable
 gzip_bidder_vtable = {
 	.bid = gzip_bidder_bid,
 	.init = gzip_bidder_init,
+	.options = gzip_bidder_options,
+	.free = gzip_bidder_free,
 };
 
 int
 archive_read_support_filter_gzip(struct archive *_a)
 {
 	struct archive_read *a = (struct archive_read *)_a;
+	struct gzip_options *options;
 
-	if (__archive_read_register_bidder(a, NULL, "gzip",
-				&gzip_bidder_vtable) != ARCHIVE_OK)
+	options = (struct gzip_options *)calloc(1, sizeof(*options));
+	if (options == NULL) {
+		archive_set_error(_a, ENOMEM,
+		    "Can't allocate data for gzip bidder");
+		return (ARCHIVE_FATAL);
+	}
+	options->threads = 1;
+	if (__archive_read_register_bidder(a, options, "gzip",
+				&gzip_bidder_vtable) != ARCHIVE_OK) {
+		free(options);
 		return (ARCHIVE_FATAL);
+	}
 
 	/* Signal the extent of gzip support with the return value here. */
 #if HAVE_ZLIB_H
@@ -119,6 +186,41 @@ archive_read_support_filter_gzip(struct archive *_a)
 #endif
 }
 
+static int
+gzip_bidder_options(struct archive_read_filter_bidder *self,
+    const char *key, const char *value)
+{
+	struct gzip_options *options = (struct gzip_options *)self->data;
+
+	if (strcmp(key, "threads") == 0) {
+		char *endptr;
+
+		if (value == NULL)
+			return (ARCHIVE_WARN);
+		errno = 0;
+		options->threads = (int)strtoul(value, &endptr, 10);
+		if (errno != 0 || *endptr != '\0') {
+			options->threads = 1;
+			return (ARCHIVE_WARN);
+		}
+		if (options->threads == 0)
+			options->threads = __archive_thread_pool_cpus();
+		return (ARCHIVE_OK);
+	}
+
+	/* Note: The "warn" return is just to inform the options
+	 * supervisor that we didn't handle it.  It will generate
+	 * a suitable error if no one used this option. */
+	return (ARCHIVE_WARN);
+}
+
+static void
+gzip_bidder_free(struct archive_read_filter_bidder *self)
+{
+	free(self->data);
+	self->data = NULL;
+}
+
 /*
  * Read and verify the header.
  *
@@ -295,6 +397,7 @@ gzip_reader_vtable = {
 #ifdef HAVE_ZLIB_H
 	.read_header = gzip_read_header,
 #endif
+	.seek = gzip_filter_seek,
 };
 
 /*
@@ -304,6 +407,7 @@ static int
 gzip_bidder_init(struct archive_read_filter *self)
 {
 	struct private_data *state;
+	struct gzip_options *options;
 	static const size_t out_block_size = 64 * 1024;
 	void *out_block;
 
@@ -327,6 +431,36 @@ gzip_bidder_init(struct archive_read_filter *self)
 
 	state->in_stream = 0; /* We're not actually within a stream yet. */
 
+	/* Checkpoints are taken and used by the serial decoder only. */
+	state->index_span = __archive_read_index_span(self->archive);
+	if (state->index_span > 0) {
+		state->last_checkpoint = -state->index_span;
+		state->window = (unsigned char *)malloc(2 * GZIP_WINDOW_SIZE);
+		if (state->window == NULL) {
+			archive_set_error(&self->archive->archive, ENOMEM,
+			    "Can't allocate data for gzip decompression");
+			return (ARCHIVE_FATAL);
+		}
+		return (ARCHIVE_OK);
+	}
+	if (__archive_read_index_has_checkpoints(self->archive)) {
+		self->can_seek = 1;
+		return (ARCHIVE_OK);
+	}
+
+	options = (struct gzip_options *)self->bidder->data;
+	if (options != NULL && options->threads > 1) {
+		state->nblocks = options->threads * 2;
+		state->blocks = (struct gzip_block *)calloc(state->nblocks,
+		    sizeof(state->blocks[0]));
+		state->pool = __archive_thread_pool_new(options->threads);
+		if (state->blocks == NULL || state->pool == NULL) {
+			archive_set_error(&self->archive->archive, ENOMEM,
+			    "Can't allocate data for gzip decompression");
+			return (ARCHIVE_FATAL);
+		}
+	}
+
 	return (ARCHIVE_OK);
 }
 
@@ -421,13 +555,68 @@ consume_trailer(struct archive_read_filter *self)
 	return (ARCHIVE_OK);
 }
 
+/*
+ * Keep the last GZIP_WINDOW_SIZE bytes of output.
+ */
+static void
+gzip_window_append(struct private_data *state, const unsigned char *p,
+    size_t n)
+{
+	size_t keep;
+
+	if (n >= GZIP_WINDOW_SIZE) {
+		memcpy(state->window, p + n - GZIP_WINDOW_SIZE,
+		    GZIP_WINDOW_SIZE);
+		state->window_len = GZIP_WINDOW_SIZE;
+		return;
+	}
+	if (state->window_len + n > 2 * GZIP_WINDOW_SIZE) {
+		keep = GZIP_WINDOW_SIZE - n;
+		memmove(state->window,
+		    state->window + state->window_len - keep, keep);
+		state->window_len = keep;
+	}
+	memcpy(state->window + state->window_len, p, n);
+	state->window_len += n;
+}
+
+/*
+ * Record a place where decoding can restart.  The compressed offset
+ * is that of the next byte to be read from upstream.
+ */
+static int
+gzip_add_checkpoint(struct archive_read_filter *self, int64_t compressed,
+    int flags)
+{
+	struct private_data *state = (struct private_data *)self->data;
+	struct archive_read_index_checkpoint cp;
+	const unsigned char *window = NULL;
+
+	memset(&cp, 0, sizeof(cp));
+	cp.uncompressed = state->total_out +
+	    (state->stream.next_out - state->out_block);
+	cp.compressed = compressed;
+	cp.flags = flags;
+	if ((flags & ARCHIVE_READ_INDEX_MEMBER_START) == 0) {
+		cp.bits = state->stream.data_type & 7;
+		cp.window_size = state->window_len < GZIP_WINDOW_SIZE ?
+		    (unsigned)state->window_len : GZIP_WINDOW_SIZE;
+		window = state->window + state->window_len - cp.window_size;
+	}
+	state->last_checkpoint = cp.uncompressed;
+	return (__archive_read_index_add_checkpoint(self->archive, &cp,
+	    window));
+}
+
 static ssize_t
-gzip_filter_read(struct archive_read_filter *self, const void **p)
+gzip_filter_read_serial(struct archive_read_filter *self, const void **p)
 {
 	struct private_data *state;
 	size_t decompressed;
 	ssize_t avail_in, max_in;
-	int ret;
+	unsigned char *out;
+	int64_t member_start;
+	int ret, members = 0;
 
 	state = (struct private_data *)self->data;
 
@@ -440,6 +629,11 @@ gzip_filter_read(struct archive_read_filter *self, const void **p)
 		/* If we're not in a stream, read a header
 		 * and initialize the decompression library. */
 		if (!state->in_stream) {
+			/* In parallel mode, let the caller decide how
+			 * the next member gets decoded. */
+			if (state->pool != NULL && members > 0)
+				break;
+			member_start = self->upstream->position;
 			ret = consume_header(self);
 			if (ret == ARCHIVE_EOF) {
 				state->eof = 1;
@@ -447,6 +641,13 @@ gzip_filter_read(struct archive_read_filter *self, const void **p)
 			}
 			if (ret < ARCHIVE_OK)
 				return (ret);
+			if (state->index_span > 0 &&
+			    state->total_out + (state->stream.next_out -
+			    state->out_block) - state->last_checkpoint >=
+			    state->index_span &&
+			    gzip_add_checkpoint(self, member_start,
+			    ARCHIVE_READ_INDEX_MEMBER_START) != ARCHIVE_OK)
+				return (ARCHIVE_FATAL);
 		}
 
 		/* Peek at the next available data. */
@@ -469,11 +670,28 @@ gzip_filter_read(struct archive_read_filter *self, const void **p)
 		state->stream.avail_in = (uInt)avail_in;
 
 		/* Decompress and consume some of that data. */
-		ret = inflate(&(state->stream), 0);
+		out = state->stream.next_out;
+		ret = inflate(&(state->stream),
+		    state->index_span > 0 ? Z_BLOCK : Z_NO_FLUSH);
+		if (state->index_span > 0 && (ret == Z_OK ||
+		    ret == Z_STREAM_END))
+			gzip_window_append(state, out,
+			    state->stream.next_out - out);
 		switch (ret) {
 		case Z_OK: /* Decompressor made some progress. */
 			__archive_read_filter_consume(self->upstream,
 			    avail_in - state->stream.avail_in);
+			/* At the end of a deflate block that isn't the
+			 * last one, see if a checkpoint is due. */
+			if (state->index_span > 0 &&
+			    (state->stream.data_type & 128) != 0 &&
+			    (state->stream.data_type & 64) == 0 &&
+			    state->total_out + (state->stream.next_out -
+			    state->out_block) - state->last_checkpoint >=
+			    state->index_span &&
+			    gzip_add_checkpoint(self,
+			    self->upstream->position, 0) != ARCHIVE_OK)
+				return (ARCHIVE_FATAL);
 			break;
 		case Z_STREAM_END: /* Found end of stream. */
 			__archive_read_filter_consume(self->upstream,
@@ -483,6 +701,7 @@ gzip_filter_read(struct archive_read_filter *self, const void **p)
 			ret = consume_trailer(self);
 			if (ret < ARCHIVE_OK)
 				return (ret);
+			members++;
 			break;
 		default:
 			/* Return an error. */
@@ -503,6 +722,288 @@ gzip_filter_read(struct archive_read_filter *self, const void **p)
 	return (decompressed);
 }
 
+/*
+ * Return the compressed size of the member whose header is at the
+ * start of the upstream buffer if the header carries a BGZF "BC"
+ * extra subfield, otherwise zero.
+ */
+static size_t
+bgzf_block_size(struct archive_read_filter *upstream, size_t header_len)
+{
+	const unsigned char *p, *extra, *end;
+	size_t xlen, slen;
+
+	p = __archive_read_filter_ahead(upstream, header_len, NULL);
+	if (p == NULL || (p[3] & 4) == 0)
+		return (0);
+	xlen = archive_le16dec(p + 10);
+	extra = p + 12;
+	end = extra + xlen;
+	if (12 + xlen > header_len)
+		return (0);
+	while (extra + 4 <= end) {
+		slen = archive_le16dec(extra + 2);
+		if (extra + 4 + slen > end)
+			break;
+		if (extra[0] == 'B' && extra[1] == 'C' && slen == 2)
+			return ((size_t)archive_le16dec(extra + 4) + 1);
+		extra += 4 + slen;
+	}
+	return (0);
+}
+
+/*
+ * Inflate one complete member on a worker thread and verify its
+ * length and CRC.
+ */
+static void
+gzip_block_decode(void *arg)
+{
+	struct gzip_block *b = (struct gzip_block *)arg;
+	z_stream stream;
+	int ret;
+
+	memset(&stream, 0, sizeof(stream));
+	b->error = 1;
+	if (inflateInit2(&stream, -15) != Z_OK)
+		return;
+	stream.next_in = b->in;
+	stream.avail_in = (uInt)b->in_size;
+	stream.next_out = b->out;
+	stream.avail_out = (uInt)b->out_alloc;
+	ret = inflate(&stream, Z_FINISH);
+	if (ret == Z_STREAM_END && stream.avail_in == 0 &&
+	    stream.total_out == b->out_size &&
+	    crc32(crc32(0L, NULL, 0), b->out, (uInt)b->out_size) == b->crc)
+		b->error = 0;
+	inflateEnd(&stream);
+}
+
+/*
+ * Copy the next member out of the input and queue it for decoding.
+ * Returns ARCHIVE_WARN if the member has to be decoded serially.
+ */
+static int
+gzip_queue_block(struct archive_read_filter *self)
+{
+	struct private_data *state = (struct private_data *)self->data;
+	struct gzip_block *b;
+	const unsigned char *p;
+	size_t header_len, block_size, in_size, out_size;
+
+	header_len = peek_at_header(self->upstream, NULL, state);
+	if (header_len == 0) {
+		state->eof = 1;
+		return (ARCHIVE_EOF);
+	}
+	block_size = bgzf_block_size(self->upstream, header_len);
+	if (block_size < header_len + 8)
+		return (ARCHIVE_WARN);
+	p = __archive_read_filter_ahead(self->upstream, block_size, NULL);
+	if (p == NULL)
+		return (ARCHIVE_WARN);
+	out_size = archive_le32dec(p + block_size - 4);
+	if (out_size > GZIP_BLOCK_MAX_OUT)
+		return (ARCHIVE_WARN);
+	in_size = block_size - header_len - 8;
+
+	b = &state->blocks[(state->block_head + state->block_count)
+	    % state->nblocks];
+	if (b->in_alloc < in_size + 1) {
+		free(b->in);
+		b->in_alloc = in_size + 1;
+		b->in = (unsigned char *)malloc(b->in_alloc);
+	}
+	if (b->out_alloc < out_size + 1) {
+		free(b->out);
+		b->out_alloc = out_size + 1;
+		b->out = (unsigned char *)malloc(b->out_alloc);
+	}
+	if (b->in == NULL || b->out == NULL) {
+		free(b->in);
+		free(b->out);
+		b->in = b->out = NULL;
+		b->in_alloc = b->out_alloc = 0;
+		archive_set_error(&self->archive->archive, ENOMEM,
+		    "Can't allocate data for gzip decompression");
+		return (ARCHIVE_FATAL);
+	}
+	memcpy(b->in, p + header_len, in_size);
+	b->in_size = in_size;
+	b->out_size = out_size;
+	b->crc = archive_le32dec(p + block_size - 8);
+	__archive_read_filter_consume(self->upstream, block_size);
+
+	b->job.run = gzip_block_decode;
+	b->job.arg = b;
+	__archive_thread_pool_submit(state->pool, &b->job);
+	state->block_count++;
+	return (ARCHIVE_OK);
+}
+
+static void
+gzip_release_block(struct private_data *state)
+{
+	state->block_head = (state->block_head + 1) % state->nblocks;
+	state->block_count--;
+}
+
+static ssize_t
+gzip_filter_read_parallel(struct archive_read_filter *self, const void **p)
+{
+	struct private_data *state = (struct private_data *)self->data;
+	struct gzip_block *b;
+	ssize_t ret;
+	int r;
+
+	/* The caller is done with the block we returned last time. */
+	if (state->block_delivered) {
+		gzip_release_block(state);
+		state->block_delivered = 0;
+	}
+
+	for (;;) {
+		/* Keep the workers busy with the members that follow. */
+		while (!state->in_stream && !state->eof &&
+		    state->block_count < state->nblocks) {
+			r = gzip_queue_block(self);
+			if (r == ARCHIVE_FATAL)
+				return (ARCHIVE_FATAL);
+			if (r != ARCHIVE_OK)
+				break;
+		}
+
+		if (state->block_count > 0) {
+			b = &state->blocks[state->block_head];
+			__archive_thread_pool_wait(state->pool, &b->job);
+			if (b->error) {
+				archive_set_error(&self->archive->archive,
+				    ARCHIVE_ERRNO_MISC,
+				    "gzip decompression failed");
+				return (ARCHIVE_FATAL);
+			}
+			if (b->out_size == 0) {
+				/* Empty member, such as the BGZF EOF marker. */
+				gzip_release_block(state);
+				continue;
+			}
+			state->block_delivered = 1;
+			state->total_out += b->out_size;
+			*p = b->out;
+			return ((ssize_t)b->out_size);
+		}
+
+		if (state->eof) {
+			*p = NULL;
+			return (0);
+		}
+
+		/* The next member doesn't tell us where it ends. */
+		ret = gzip_filter_read_serial(self, p);
+		if (ret != 0 || state->eof)
+			return (ret);
+	}
+}
+
+/*
+ * Restart decoding from the last index checkpoint at or before
+ * offset, unless the decoder is already between the two.
+ */
+static int64_t
+gzip_filter_seek(struct archive_read_filter *self, int64_t offset)
+{
+	struct private_data *state = (struct private_data *)self->data;
+	const struct archive_read_index_checkpoint *cp;
+	const unsigned char *p;
+	unsigned char *window;
+	int64_t r;
+	int ret;
+
+	cp = __archive_read_index_find_checkpoint(self->archive, offset);
+	if (cp == NULL) {
+		archive_set_error(&self->archive->archive,
+		    ARCHIVE_ERRNO_MISC,
+		    "No index checkpoint before offset %jd",
+		    (intmax_t)offset);
+		return (ARCHIVE_FAILED);
+	}
+	if (state->total_out <= offset &&
+	    state->total_out >= cp->uncompressed)
+		return (state->total_out);
+
+	if (state->in_stream) {
+		inflateEnd(&state->stream);
+		state->in_stream = 0;
+	}
+	r = __archive_read_filter_seek(self->upstream,
+	    cp->compressed - (cp->bits ? 1 : 0), SEEK_SET);
+	if (r < 0)
+		return (r);
+	state->eof = 0;
+	state->total_out = cp->uncompressed;
+	if (cp->flags & ARCHIVE_READ_INDEX_MEMBER_START)
+		return (cp->uncompressed);
+
+	memset(&state->stream, 0, sizeof(state->stream));
+	if (inflateInit2(&state->stream, -15) != Z_OK) {
+		archive_set_error(&self->archive->archive,
+		    ARCHIVE_ERRNO_MISC,
+		    "Can't initialize gzip decompression");
+		return (ARCHIVE_FATAL);
+	}
+	state->in_stream = 1;
+	if (cp->bits) {
+		p = __archive_read_filter_ahead(self->upstream, 1, NULL);
+		if (p == NULL) {
+			archive_set_error(&self->archive->archive,
+			    ARCHIVE_ERRNO_MISC, "truncated gzip input");
+			return (ARCHIVE_FATAL);
+		}
+		ret = inflatePrime(&state->stream, cp->bits,
+		    p[0] >> (8 - cp->bits));
+		__archive_read_filter_consume(self->upstream, 1);
+		if (ret != Z_OK) {
+			archive_set_error(&self->archive->archive,
+			    ARCHIVE_ERRNO_MISC,
+			    "Can't restart gzip decompression");
+			return (ARCHIVE_FATAL);
+		}
+	}
+	if (cp->window_size > 0) {
+		window = (unsigned char *)malloc(cp->window_size);
+		if (window == NULL) {
+			archive_set_error(&self->archive->archive, ENOMEM,
+			    "Can't allocate data for gzip decompression");
+			return (ARCHIVE_FATAL);
+		}
+		if (__archive_read_index_read_window(self->archive, cp,
+		    window) != ARCHIVE_OK) {
+			free(window);
+			return (ARCHIVE_FATAL);
+		}
+		ret = inflateSetDictionary(&state->stream, window,
+		    cp->window_size);
+		free(window);
+		if (ret != Z_OK) {
+			archive_set_error(&self->archive->archive,
+			    ARCHIVE_ERRNO_MISC,
+			    "Can't restart gzip decompression");
+			return (ARCHIVE_FATAL);
+		}
+	}
+	return (cp->uncompressed);
+}
+
+static ssize_t
+gzip_filter_read(struct archive_read_filter *self, const void **p)
+{
+	struct private_data *state = (struct private_data *)self->data;
+
+	if (state->pool != NULL)
+		return (gzip_filter_read_parallel(self, p));
+	return (gzip_filter_read_serial(self, p));
+}
+
 /*
  * Clean up the decompressor.
  */
@@ -527,7 +1028,21 @@ gzip_filter_close(struct archive_read_filter *self)
 		}
 	}
 
+	if (state->blocks != NULL) {
+		int i;
+
+		/* Let the workers finish anything still queued before
+		 * releasing the buffers they work on. */
+		__archive_thread_pool_free(state->pool);
+		for (i = 0; i < state->nblocks; i++) {
+			free(state->blocks[i].in);
+			free(state->blocks[i].out);
+		}
+		free(state->blocks);
+	} else
+		__archive_thread_pool_free(state->pool);
 	free(state->name);
+	free(state->window);
 	free(state->out_block);
 	free(state);
 	return (ret);
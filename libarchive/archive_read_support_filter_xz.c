@@ -49,6 +49,13 @@ __FBSDID("$FreeBSD$");
 #include "archive_endian.h"
 #include "archive_private.h"
 #include "archive_read_private.h"
+#include "archive_thread_pool_private.h"
+
+/* Options given to the xz bidder. */
+struct xz_options {
+	int		 threads;
+	uint64_t	 memlimit;
+};
 
 #if HAVE_LZMA_H && HAVE_LIBLZMA
 
@@ -91,6 +98,9 @@ static int	xz_lzma_bidder_init(struct archive_read_filter *);
 static int	xz_bidder_bid(struct archive_read_filter_bidder *,
 		    struct archive_read_filter *);
 static int	xz_bidder_init(struct archive_read_filter *);
+static int	xz_bidder_options(struct archive_read_filter_bidder *,
+		    const char *, const char *);
+static void	xz_bidder_free(struct archive_read_filter_bidder *);
 static int	lzma_bidder_bid(struct archive_read_filter_bidder *,
 		    struct archive_read_filter *);
 static int	lzma_bidder_init(struct archive_read_filter *);
@@ -112,16 +122,28 @@ static const struct archive_read_filter_bidder_vtable
 xz_bidder_vtable = {
 	.bid = xz_bidder_bid,
 	.init = xz_bidder_init,
+	.options = xz_bidder_options,
+	.free = xz_bidder_free,
 };
 
 int
 archive_read_support_filter_xz(struct archive *_a)
 {
 	struct archive_read *a = (struct archive_read *)_a;
+	struct xz_options *options;
 
-	if (__archive_read_register_bidder(a, NULL, "xz",
-				&xz_bidder_vtable) != ARCHIVE_OK)
+	options = (struct xz_options *)calloc(1, sizeof(*options));
+	if (options == NULL) {
+		archive_set_error(_a, ENOMEM,
+		    "Can't allocate data for xz bidder");
+		return (ARCHIVE_FATAL);
+	}
+	options->threads = 1;
+	if (__archive_read_register_bidder(a, options, "xz",
+				&xz_bidder_vtable) != ARCHIVE_OK) {
+		free(options);
 		return (ARCHIVE_FATAL);
+	}
 
 #if HAVE_LZMA_H && HAVE_LIBLZMA
 	return (ARCHIVE_OK);
@@ -132,6 +154,73 @@ archive_read_support_filter_xz(struct archive *_a)
 #endif
 }
 
+static int
+xz_bidder_options(struct archive_read_filter_bidder *self,
+    const char *key, const char *value)
+{
+	struct xz_options *options = (struct xz_options *)self->data;
+	char *endptr;
+
+	if (strcmp(key, "threads") == 0) {
+		if (value == NULL)
+			return (ARCHIVE_WARN);
+		errno = 0;
+		options->threads = (int)strtoul(value, &endptr, 10);
+		if (errno != 0 || *endptr != '\0') {
+			options->threads = 1;
+			return (ARCHIVE_WARN);
+		}
+		if (options->threads == 0)
+			options->threads = __archive_thread_pool_cpus();
+		return (ARCHIVE_OK);
+	} else if (strcmp(key, "memlimit") == 0) {
+		/* A byte count, optionally followed by K, M or G. */
+		uint64_t limit = 0;
+
+		if (value == NULL || *value < '0' || *value > '9')
+			return (ARCHIVE_WARN);
+		for (; *value >= '0' && *value <= '9'; value++) {
+			if (limit > (UINT64_MAX - 9) / 10)
+				return (ARCHIVE_WARN);
+			limit = limit * 10 + (*value - '0');
+		}
+		switch (*value) {
+		case 'G': case 'g':
+			if (limit > UINT64_MAX >> 10)
+				return (ARCHIVE_WARN);
+			limit <<= 10;
+			/* FALLTHROUGH */
+		case 'M': case 'm':
+			if (limit > UINT64_MAX >> 10)
+				return (ARCHIVE_WARN);
+			limit <<= 10;
+			/* FALLTHROUGH */
+		case 'K': case 'k':
+			if (limit > UINT64_MAX >> 10)
+				return (ARCHIVE_WARN);
+			limit <<= 10;
+			value++;
+			break;
+		}
+		if (*value != '\0')
+			return (ARCHIVE_WARN);
+		options->memlimit = limit;
+		return (ARCHIVE_OK);
+	}
+
+	/* Note: The "warn" return is just to inform the options
+	 * supervisor that we didn't handle it.  It will generate
+	 * a suitable error if no one used this option. */
+	return (ARCHIVE_WARN);
+}
+
+static void
+xz_bidder_free(struct archive_read_filter_bidder *self)
+{
+	free(self->data);
+	self->data = NULL;
+}
+
 #if ARCHIVE_VERSION_NUMBER < 4000000
 int
 archive_read_support_compression_lzma(struct archive *a)
@@ -476,6 +565,10 @@ xz_lzma_bidder_init(struct archive_read_filter *self)
 	static const size_t out_block_size = 64 * 1024;
 	void *out_block;
 	struct private_data *state;
+#ifdef HAVE_LZMA_STREAM_DECODER_MT
+	struct xz_options *options;
+	lzma_mt mt_options;
+#endif
 	int ret;
 
 	state = (struct private_data *)calloc(sizeof(*state), 1);
@@ -511,11 +604,34 @@ xz_lzma_bidder_init(struct archive_read_filter *self)
 		state->in_stream = 1;
 
 	/* Initialize compression library. */
-	if (self->code == ARCHIVE_FILTER_XZ)
-		ret = lzma_stream_decoder(&(state->stream),
-		    LZMA_MEMLIMIT,/* memlimit */
-		    LZMA_CONCATENATED);
-	else
+	if (self->code == ARCHIVE_FILTER_XZ) {
+#ifdef HAVE_LZMA_STREAM_DECODER_MT
+		/*
+		 * The threaded decoder works on blocks whose sizes are
+		 * stored in the block headers, as written by the threaded
+		 * encoder.  Other streams are decoded by a single thread.
+		 * "memlimit" caps the memory used for threading; when a
+		 * block would exceed it, liblzma decodes in single-threaded
+		 * mode instead of failing.
+		 */
+		options = (struct xz_options *)self->bidder->data;
+		if (options != NULL && options->threads > 1) {
+			memset(&mt_options, 0, sizeof(mt_options));
+			mt_options.threads = options->threads;
+			mt_options.timeout = 300;
+			mt_options.flags = LZMA_CONCATENATED;
+			mt_options.memlimit_threading =
+			    options->memlimit != 0 ?
+			    options->memlimit : LZMA_MEMLIMIT;
+			mt_options.memlimit_stop = LZMA_MEMLIMIT;
+			ret = lzma_stream_decoder_mt(&(state->stream),
+			    &mt_options);
+		} else
+#endif
+			ret = lzma_stream_decoder(&(state->stream),
+			    LZMA_MEMLIMIT,/* memlimit */
+			    LZMA_CONCATENATED);
+	} else
 		ret = lzma_alone_decoder(&(state->stream),
 		    LZMA_MEMLIMIT);/* memlimit */
 
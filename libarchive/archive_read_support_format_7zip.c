@@ -49,10 +49,9 @@ __FBSDID("$FreeBSD$");
 #include "archive_private.h"
 #include "archive_read_private.h"
 #include "archive_endian.h"
+#include "archive_thread_pool_private.h"
 
-#ifndef HAVE_ZLIB_H
 #include "archive_crc32.h"
-#endif
 
 #define _7ZIP_SIGNATURE	"7z\xBC\xAF\x27\x1C"
 #define SFX_MIN_ADDR	0x27000
@@ -141,6 +140,29 @@ struct _7z_folder {
 	uint32_t		 packIndex;
 	/* Unoperated bytes. */
 	uint64_t		 skipped_bytes;
+	/* Places where decoding can restart; see add_checkpoint(). */
+	struct _7z_checkpoint	*checkpoints;
+	size_t			 numCheckpoints;
+	size_t			 allocCheckpoints;
+};
+
+/*
+ * With the "checkpoint-span" option, the reader remembers places in a
+ * folder where decoding can be restarted, so that reading an entry
+ * again, or one further on, does not have to decode the folder from
+ * its start.  LZMA2 restarts at any chunk that resets the dictionary,
+ * which needs no saved state.  Deflate restarts at a block boundary
+ * given the last 32KiB of output and the bits of the previous byte
+ * that were not consumed yet.
+ */
+#define CP_WINDOW_SIZE	(32 * 1024)
+
+struct _7z_checkpoint {
+	uint64_t		 unpack;	/* Offset in the folder. */
+	uint64_t		 pack;		/* Offset in the pack stream. */
+	unsigned char		*window;
+	size_t			 window_size;
+	int			 bits;
 };
 
 struct _7z_coders_info {
@@ -188,6 +210,8 @@ struct _7zip_entry {
 #endif
 	uint32_t		 folderIndex;
 	uint32_t		 ssIndex;
+	/* Offset of the contents in the folder. */
+	uint64_t		 folderOffset;
 	unsigned		 flg;
 #define MTIME_IS_SET	(1<<0)
 #define ATIME_IS_SET	(1<<1)
@@ -205,6 +229,38 @@ struct _7zip_entry {
 	uint32_t		 attr;
 };
 
+/*
+ * With the "threads" option, folders are decoded ahead of the reader
+ * on worker threads.  The calling thread reads the packed stream of
+ * each folder into memory and a worker decodes the whole folder into
+ * a buffer of its own, from which read_stream() then hands out the
+ * entries in archive order.  Only folders with a single pack stream
+ * and a single compressor are queued; stored, PPMd, BCJ2 and
+ * encrypted folders as well as folders larger than
+ * FOLDER_JOB_MAX_SIZE are still decoded by the calling thread.  There
+ * is a job for every worker and one for the folder being read, and no
+ * further folder is queued while the packed and decoded data held by
+ * the jobs would exceed FOLDER_JOB_QUEUE_MAX.
+ */
+#define FOLDER_JOB_MAX_SIZE	(64 * 1024 * 1024)
+#define FOLDER_JOB_QUEUE_MAX	(256 * 1024 * 1024)
+/* Room for the bytes the BCJ filter holds back. */
+#define FOLDER_JOB_SLACK	16
+
+struct _7z_folder_job {
+	struct archive_thread_job job;
+	/* Private to the worker; only used to collect its error. */
+	struct archive_read	 shadow;
+	struct _7zip		*dec;
+	const struct _7z_folder	*folder;
+	unsigned		 folder_index;
+	unsigned char		*in;
+	size_t			 in_size;
+	unsigned char		*out;
+	size_t			 out_size;
+	int			 ret;
+};
+
 struct _7zip {
 	/* Structural information about the archive. */
 	struct _7z_stream_info	 si;
@@ -331,6 +387,41 @@ struct _7zip {
 
 	/* Custom value that is non-zero if this archive contains encrypted entries. */
 	int			 has_encrypted_entries;
+
+	/* Parallel folder decoding; see struct _7z_folder_job. */
+	int			 threads;
+	struct archive_thread_pool *pool;
+	struct _7z_folder_job	*jobs;
+	int			 njobs;
+	int			 first_job;
+	int			 pending_jobs;
+	unsigned		 next_job_folder;
+	uint64_t		 queued_bytes;	/* Held by the jobs. */
+	struct _7z_folder_job	*folder_job;	/* Folder being read. */
+
+	/* Entries sorted by pathname for archive_read_seek_entry(). */
+	struct _7z_name {
+		char		*name;
+		size_t		 index;
+	}			*name_index;
+	size_t			 name_index_count;
+	/* The data of the current entry has not been positioned yet. */
+	int			 seek_pending;
+
+	/* Recording checkpoints; see struct _7z_checkpoint. */
+	uint64_t		 checkpoint_span;
+	struct _7z_folder	*cp_folder;	/* NULL if not recording. */
+	uint64_t		 cp_pack;
+	uint64_t		 cp_unpack;
+	/* Where the LZMA2 chunk header being read starts. */
+	uint64_t		 cp_chunk_pack;
+	uint64_t		 cp_chunk_unpack;
+	uint64_t		 cp_chunk_skip;
+	unsigned char		 cp_chunk_header[6];
+	int			 cp_chunk_header_len;
+	/* The latest Deflate output. */
+	unsigned char		*cp_window;
+	size_t			 cp_window_len;
 };
 
 /* Maximum entry size. This limitation prevents reading intentional
@@ -342,11 +433,21 @@ static int	archive_read_format_7zip_has_encrypted_entries(struct archive_read *)
 static int	archive_read_support_format_7zip_capabilities(struct archive_read *a);
 static int	archive_read_format_7zip_bid(struct archive_read *, int);
 static int	archive_read_format_7zip_cleanup(struct archive_read *);
+static int	archive_read_format_7zip_options(struct archive_read *,
+		    const char *, const char *);
 static int	archive_read_format_7zip_read_data(struct archive_read *,
 		    const void **, size_t *, int64_t *);
 static int	archive_read_format_7zip_read_data_skip(struct archive_read *);
 static int	archive_read_format_7zip_read_header(struct archive_read *,
 		    struct archive_entry *);
+static int	archive_read_format_7zip_seek_entry(struct archive_read *,
+		    const char *, struct archive_entry *);
+static int	add_checkpoint(struct archive_read *, uint64_t, uint64_t,
+		    int, const unsigned char *, size_t);
+static int	checkpoint_begin(struct archive_read *, struct _7z_folder *,
+		    const struct _7z_checkpoint *);
+static void	checkpoint_window_append(struct _7zip *,
+		    const unsigned char *, size_t);
 static int	check_7zip_header_in_sfx(const char *);
 static unsigned long decode_codec_id(const unsigned char *, size_t);
 static int	decode_encoded_header_info(struct archive_read *,
@@ -364,6 +465,7 @@ static void	free_PackInfo(struct _7z_pack_info *);
 static void	free_StreamsInfo(struct _7z_stream_info *);
 static void	free_SubStreamsInfo(struct _7z_substream_info *);
 static int	free_decompression(struct archive_read *, struct _7zip *);
+static void	free_folder_jobs(struct _7zip *);
 static ssize_t	get_uncompressed_data(struct archive_read *, const void **,
 		    size_t, size_t);
 static const unsigned char * header_bytes(struct archive_read *, size_t);
@@ -386,8 +488,13 @@ static int	read_SubStreamsInfo(struct archive_read *,
 static int	read_Times(struct archive_read *, struct _7z_header_info *,
 		    int);
 static void	read_consume(struct archive_read *);
+static int	read_entry_header(struct archive_read *,
+		    struct archive_entry *);
+static int	record_checkpoints(struct archive_read *, const void *,
+		    size_t, const void *, size_t);
 static ssize_t	read_stream(struct archive_read *, const void **, size_t,
 		    size_t);
+static int	seek_folder(struct archive_read *, unsigned, uint64_t);
 static int	seek_pack(struct archive_read *);
 static int64_t	skip_stream(struct archive_read *, size_t);
 static int	skip_sfx(struct archive_read *, ssize_t);
@@ -395,6 +502,7 @@ static int	slurp_central_directory(struct archive_read *, struct _7zip *,
 		    struct _7z_header_info *);
 static int	setup_decode_folder(struct archive_read *, struct _7z_folder *,
 		    int);
+static int	setup_folder_job(struct archive_read *);
 static void	x86_Init(struct _7zip *);
 static size_t	x86_Convert(struct _7zip *, uint8_t *, size_t);
 static ssize_t		Bcj2_Decode(struct _7zip *, uint8_t *, size_t);
@@ -422,13 +530,14 @@ archive_read_support_format_7zip(struct archive *_a)
 	 * any encrypted entries yet.
 	 */
 	zip->has_encrypted_entries = ARCHIVE_READ_FORMAT_ENCRYPTION_DONT_KNOW;
+	zip->threads = 1;
 
 
 	r = __archive_read_register_format(a,
 	    zip,
 	    "7zip",
 	    archive_read_format_7zip_bid,
-	    NULL,
+	    archive_read_format_7zip_options,
 	    archive_read_format_7zip_read_header,
 	    archive_read_format_7zip_read_data,
 	    archive_read_format_7zip_read_data_skip,
@@ -437,8 +546,13 @@ archive_read_support_format_7zip(struct archive *_a)
 	    archive_read_support_format_7zip_capabilities,
 	    archive_read_format_7zip_has_encrypted_entries);
 
-	if (r != ARCHIVE_OK)
+	if (r != ARCHIVE_OK) {
 		free(zip);
+		return (ARCHIVE_OK);
+	}
+	__archive_read_register_format_seek_entry(a,
+	    archive_read_format_7zip_bid,
+	    archive_read_format_7zip_seek_entry);
 	return (ARCHIVE_OK);
 }
 
@@ -463,6 +577,46 @@ archive_read_format_7zip_has_encrypted_entries(struct archive_read *_a)
 	return ARCHIVE_READ_FORMAT_ENCRYPTION_DONT_KNOW;
 }
 
+static int
+archive_read_format_7zip_options(struct archive_read *a,
+    const char *key, const char *val)
+{
+	struct _7zip *zip = (struct _7zip *)a->format->data;
+
+	if (strcmp(key, "threads") == 0) {
+		char *endptr;
+
+		if (val == NULL)
+			return (ARCHIVE_WARN);
+		errno = 0;
+		zip->threads = (int)strtoul(val, &endptr, 10);
+		if (errno != 0 || *endptr != '\0') {
+			zip->threads = 1;
+			return (ARCHIVE_WARN);
+		}
+		if (zip->threads == 0)
+			zip->threads = __archive_thread_pool_cpus();
+		return (ARCHIVE_OK);
+	} else if (strcmp(key, "checkpoint-span") == 0) {
+		char *endptr;
+
+		if (val == NULL)
+			return (ARCHIVE_WARN);
+		errno = 0;
+		zip->checkpoint_span = strtoul(val, &endptr, 10);
+		if (errno != 0 || *endptr != '\0') {
+			zip->checkpoint_span = 0;
+			return (ARCHIVE_WARN);
+		}
+		return (ARCHIVE_OK);
+	}
+
+	/* Note: The "warn" return is just to inform the options
+	 * supervisor that we didn't handle it.  It will generate
+	 * a suitable error if no one used this option. */
+	return (ARCHIVE_WARN);
+}
+
 static int
 archive_read_format_7zip_bid(struct archive_read *a, int best_bid)
 {
@@ -607,15 +761,13 @@ fatal:
 	return (ARCHIVE_FATAL);
 }
 
+/*
+ * Read the archive header and the list of entries, once.
+ */
 static int
-archive_read_format_7zip_read_header(struct archive_read *a,
-	struct archive_entry *entry)
+read_central_directory(struct archive_read *a, struct _7zip *zip)
 {
-	struct _7zip *zip = (struct _7zip *)a->format->data;
-	struct _7zip_entry *zip_entry;
-	int r, ret = ARCHIVE_OK;
-	struct _7z_folder *folder = 0;
-	uint64_t fidx = 0;
+	int r;
 
 	/*
 	 * It should be sufficient to call archive_read_next_header() for
@@ -641,19 +793,7 @@ archive_read_format_7zip_read_header(struct archive_read *a,
 		if (r != ARCHIVE_OK)
 			return (r);
 		zip->entries_remaining = (size_t)zip->numFiles;
-		zip->entry = zip->entries;
-	} else {
-		++zip->entry;
 	}
-	zip_entry = zip->entry;
-
-	if (zip->entries_remaining <= 0 || zip_entry == NULL)
-		return ARCHIVE_EOF;
-	--zip->entries_remaining;
-
-	zip->entry_offset = 0;
-	zip->end_of_entry = 0;
-	zip->entry_crc32 = crc32(0, NULL, 0);
 
 	/* Setup a string conversion for a filename. */
 	if (zip->sconv == NULL) {
@@ -662,6 +802,144 @@ archive_read_format_7zip_read_header(struct archive_read *a,
 		if (zip->sconv == NULL)
 			return (ARCHIVE_FATAL);
 	}
+	return (ARCHIVE_OK);
+}
+
+static int
+archive_read_format_7zip_read_header(struct archive_read *a,
+	struct archive_entry *entry)
+{
+	struct _7zip *zip = (struct _7zip *)a->format->data;
+	int r;
+
+	r = read_central_directory(a, zip);
+	if (r != ARCHIVE_OK)
+		return (r);
+	if (zip->entry == NULL)
+		zip->entry = zip->entries;
+	else
+		++zip->entry;
+
+	if (zip->entries_remaining <= 0 || zip->entry == NULL)
+		return ARCHIVE_EOF;
+	--zip->entries_remaining;
+	return (read_entry_header(a, entry));
+}
+
+static int
+cmp_name_index(const void *p1, const void *p2)
+{
+	const struct _7z_name *n1 = (const struct _7z_name *)p1;
+	const struct _7z_name *n2 = (const struct _7z_name *)p2;
+	int r;
+
+	r = strcmp(n1->name, n2->name);
+	if (r != 0)
+		return (r);
+	if (n1->index < n2->index)
+		return (-1);
+	return (n1->index > n2->index);
+}
+
+static int
+build_name_index(struct archive_read *a, struct _7zip *zip)
+{
+	struct archive_string name;
+	size_t i;
+
+	zip->name_index = calloc(zip->numFiles ? (size_t)zip->numFiles : 1,
+	    sizeof(*zip->name_index));
+	if (zip->name_index == NULL) {
+		archive_set_error(&a->archive, ENOMEM,
+		    "Can't allocate 7-Zip name index");
+		return (ARCHIVE_FATAL);
+	}
+	archive_string_init(&name);
+	for (i = 0; i < zip->numFiles; i++) {
+		/* A name that cannot be converted is indexed as it
+		 * would be reported by archive_read_next_header(). */
+		archive_string_empty(&name);
+		if (archive_strncpy_l(&name,
+		    (const char *)zip->entries[i].utf16name,
+		    zip->entries[i].name_len, zip->sconv) != 0 &&
+		    errno == ENOMEM)
+			break;
+		zip->name_index[i].name = strdup(name.s != NULL ? name.s : "");
+		if (zip->name_index[i].name == NULL)
+			break;
+		zip->name_index[i].index = i;
+		zip->name_index_count++;
+	}
+	archive_string_free(&name);
+	if (i < zip->numFiles) {
+		archive_set_error(&a->archive, ENOMEM,
+		    "Can't allocate 7-Zip name index");
+		return (ARCHIVE_FATAL);
+	}
+	qsort(zip->name_index, zip->name_index_count,
+	    sizeof(*zip->name_index), cmp_name_index);
+	return (ARCHIVE_OK);
+}
+
+/*
+ * Look up an entry by name and read its header.  The data is not
+ * positioned until it is read, so looking up several entries in a row
+ * costs nothing.  When a name occurs more than once, the last copy in
+ * the archive wins, as it would on extraction.
+ */
+static int
+archive_read_format_7zip_seek_entry(struct archive_read *a,
+	const char *pathname, struct archive_entry *entry)
+{
+	struct _7zip *zip = (struct _7zip *)a->format->data;
+	size_t lo, hi, mid;
+	int r;
+
+	r = read_central_directory(a, zip);
+	if (r != ARCHIVE_OK)
+		return (r);
+	if (zip->name_index == NULL) {
+		r = build_name_index(a, zip);
+		if (r != ARCHIVE_OK)
+			return (r);
+	}
+
+	/* Find the first element whose name sorts after pathname. */
+	lo = 0;
+	hi = zip->name_index_count;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (strcmp(zip->name_index[mid].name, pathname) <= 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == 0 || strcmp(zip->name_index[lo - 1].name, pathname)) {
+		archive_set_error(&a->archive, ENOENT,
+		    "%s: entry not found", pathname);
+		return (ARCHIVE_FAILED);
+	}
+
+	archive_entry_clear(entry);
+	zip->entry = &zip->entries[zip->name_index[lo - 1].index];
+	zip->entries_remaining = (size_t)(zip->numFiles -
+	    zip->name_index[lo - 1].index - 1);
+	zip->seek_pending = 1;
+	return (read_entry_header(a, entry));
+}
+
+static int
+read_entry_header(struct archive_read *a, struct archive_entry *entry)
+{
+	struct _7zip *zip = (struct _7zip *)a->format->data;
+	struct _7zip_entry *zip_entry = zip->entry;
+	int r, ret = ARCHIVE_OK;
+	struct _7z_folder *folder = 0;
+	uint64_t fidx = 0;
+
+	zip->entry_offset = 0;
+	zip->end_of_entry = 0;
+	zip->entry_crc32 = crc32(0, NULL, 0);
 
 	/* Figure out if the entry is encrypted by looking at the folder
 	   that is associated to the current 7zip entry. If the folder
@@ -809,6 +1087,14 @@ archive_read_format_7zip_read_data(struct archive_read *a,
 	if (zip->end_of_entry)
 		return (ARCHIVE_EOF);
 
+	/* After a seek, find the data of the entry now. */
+	if (zip->seek_pending) {
+		if (seek_folder(a, zip->entry->folderIndex,
+		    zip->entry->folderOffset) != ARCHIVE_OK)
+			return (ARCHIVE_FATAL);
+		zip->seek_pending = 0;
+	}
+
 	const uint64_t max_read_size = 16 * 1024 * 1024;  // Don't try to read more than 16 MB at a time
 	size_t bytes_to_read = max_read_size;
 	if ((uint64_t)bytes_to_read > zip->entry_bytes_remaining) {
@@ -829,7 +1115,7 @@ archive_read_format_7zip_read_data(struct archive_read *a,
 
 	/* Update checksum */
 	if ((zip->entry->flg & CRC32_IS_SET) && bytes)
-		zip->entry_crc32 = crc32(zip->entry_crc32, *buff,
+		zip->entry_crc32 = __archive_crc32(zip->entry_crc32, *buff,
 		    (unsigned)bytes);
 
 	/* If we hit the end, swallow any end-of-data marker. */
@@ -869,6 +1155,19 @@ archive_read_format_7zip_read_data_skip(struct archive_read *a)
 	if (zip->end_of_entry)
 		return (ARCHIVE_OK);
 
+	/*
+	 * Leave the data to whichever entry is read next if it has not
+	 * been positioned yet, or if a checkpoint might get there faster
+	 * than decoding the rest of this one.
+	 */
+	if (zip->seek_pending ||
+	    (zip->checkpoint_span > 0 && zip->folder_index != 0)) {
+		zip->seek_pending = 1;
+		zip->entry_bytes_remaining = 0;
+		zip->end_of_entry = 1;
+		return (ARCHIVE_OK);
+	}
+
 	/*
 	 * If the length is at the beginning, we can skip the
 	 * compressed data much more quickly.
@@ -887,11 +1186,18 @@ static int
 archive_read_format_7zip_cleanup(struct archive_read *a)
 {
 	struct _7zip *zip;
+	size_t i;
 
 	zip = (struct _7zip *)(a->format->data);
+	/* Stop the workers before the folders they use are freed. */
+	free_folder_jobs(zip);
 	free_StreamsInfo(&(zip->si));
 	free(zip->entries);
 	free(zip->entry_names);
+	for (i = 0; i < zip->name_index_count; i++)
+		free(zip->name_index[i].name);
+	free(zip->name_index);
+	free(zip->cp_window);
 	free_decompression(a, zip);
 	free(zip->uncompressed_buffer);
 	free(zip->sub_stream_buff[0]);
@@ -1472,7 +1778,9 @@ decompress(struct archive_read *a, struct _7zip *zip,
 		zip->stream.avail_in = (uInt)t_avail_in;
 		zip->stream.next_out = t_next_out;
 		zip->stream.avail_out = (uInt)t_avail_out;
-		r = inflate(&(zip->stream), 0);
+		/* Stop at block boundaries to record checkpoints. */
+		r = inflate(&(zip->stream),
+		    zip->cp_folder != NULL ? Z_BLOCK : 0);
 		switch (r) {
 		case Z_STREAM_END: /* Found end of stream. */
 			ret = ARCHIVE_EOF;
@@ -1845,6 +2153,9 @@ free_Folder(struct _7z_folder *f)
 	free(f->bindPairs);
 	free(f->packedStreams);
 	free(f->unPackSize);
+	for (i = 0; i < f->numCheckpoints; i++)
+		free(f->checkpoints[i].window);
+	free(f->checkpoints);
 }
 
 static int
@@ -2358,6 +2669,7 @@ read_Header(struct archive_read *a, struct _7z_header_info *h,
 	struct _7z_stream_info *si = &(zip->si);
 	struct _7zip_entry *entries;
 	uint32_t folderIndex, indexInFolder;
+	uint64_t folderOffset = 0;
 	unsigned i;
 	int eindex, empty_streams, sindex;
 
@@ -2665,6 +2977,10 @@ read_Header(struct archive_read *a, struct _7z_header_info *h,
 		entries[i].folderIndex = folderIndex;
 		if ((entries[i].flg & HAS_STREAM) == 0)
 			continue;
+		if (indexInFolder == 0)
+			folderOffset = 0;
+		entries[i].folderOffset = folderOffset;
+		folderOffset += si->ss.unpackSizes[entries[i].ssIndex];
 		indexInFolder++;
 		if (indexInFolder >= folders[folderIndex].numUnpackStreams) {
 			folderIndex++;
@@ -2821,7 +3137,7 @@ header_bytes(struct archive_read *a, size_t rbytes)
 	}
 
 	/* Update checksum */
-	zip->header_crc32 = crc32(zip->header_crc32, p, (unsigned)rbytes);
+	zip->header_crc32 = __archive_crc32(zip->header_crc32, p, rbytes);
 	return (p);
 }
 
@@ -3170,6 +3486,9 @@ extract_pack_stream(struct archive_read *a, size_t minimum)
 		if (bytes_out > zip->folder_outbytes_remaining)
 			bytes_out = (size_t)zip->folder_outbytes_remaining;
 		zip->folder_outbytes_remaining -= bytes_out;
+		if (zip->cp_folder != NULL && record_checkpoints(a, buff_in,
+		    bytes_in, buff_out, bytes_out) != ARCHIVE_OK)
+			return (ARCHIVE_FATAL);
 		zip->uncompressed_buffer_bytes_remaining += bytes_out;
 		zip->pack_stream_bytes_unconsumed = bytes_in;
 
@@ -3233,6 +3552,7 @@ read_stream(struct archive_read *a, const void **buff, size_t size,
 {
 	struct _7zip *zip = (struct _7zip *)a->format->data;
 	uint64_t skip_bytes = 0;
+	int folder_queued = 0;
 	ssize_t r;
 
 	if (zip->uncompressed_buffer_bytes_remaining == 0) {
@@ -3282,25 +3602,41 @@ read_stream(struct archive_read *a, const void **buff, size_t size,
 			*buff = NULL;
 			return (0);
 		}
-		r = setup_decode_folder(a,
-			&(zip->si.ci.folders[zip->folder_index]), 0);
-		if (r != ARCHIVE_OK)
-			return (ARCHIVE_FATAL);
+		if (zip->threads > 1) {
+			folder_queued = setup_folder_job(a);
+			if (folder_queued < 0)
+				return (ARCHIVE_FATAL);
+		}
+		if (!folder_queued) {
+			r = setup_decode_folder(a,
+			    &(zip->si.ci.folders[zip->folder_index]), 0);
+			if (r != ARCHIVE_OK)
+				return (ARCHIVE_FATAL);
+			r = checkpoint_begin(a,
+			    &(zip->si.ci.folders[zip->folder_index]), NULL);
+			if (r != ARCHIVE_OK)
+				return (ARCHIVE_FATAL);
+		}
 
 		zip->folder_index++;
 	}
 
 	/*
-	 * Switch to next pack stream.
+	 * A folder decoded by a worker is already in memory.
 	 */
-	r = seek_pack(a);
-	if (r < 0)
-		return (r);
+	if (!folder_queued) {
+		/*
+		 * Switch to next pack stream.
+		 */
+		r = seek_pack(a);
+		if (r < 0)
+			return (r);
 
-	/* Extract a new pack stream. */
-	r = extract_pack_stream(a, 0);
-	if (r < 0)
-		return (r);
+		/* Extract a new pack stream. */
+		r = extract_pack_stream(a, 0);
+		if (r < 0)
+			return (r);
+	}
 
 	/*
 	 * Skip the bytes we already has skipped in skip_stream().
@@ -3347,6 +3683,9 @@ setup_decode_folder(struct archive_read *a, struct _7z_folder *folder,
 	unsigned i;
 	int r, found_bcj2 = 0;
 
+	/* Nothing is recorded unless checkpoint_begin() says so. */
+	zip->cp_folder = NULL;
+
 	/*
 	 * Release the memory which the previous folder used for BCJ2.
 	 */
@@ -3629,6 +3968,681 @@ skip_stream(struct archive_read *a, size_t skip_bytes)
 	return (skip_bytes);
 }
 
+/*
+ * Return non-zero if checkpoints can be recorded for the folder.
+ */
+static int
+checkpoint_eligible(const struct _7z_folder *folder)
+{
+
+	if (folder->numCoders != 1 || folder->numPackedStreams != 1)
+		return (0);
+	switch (folder->coders[0].codec) {
+	case _7Z_LZMA2:
+#ifdef HAVE_ZLIB_H
+	case _7Z_DEFLATE:
+#endif
+		return (1);
+	default:
+		return (0);
+	}
+}
+
+/*
+ * Start recording checkpoints for a folder that is decoded from its
+ * start or, if cp is not NULL, from that checkpoint.
+ */
+static int
+checkpoint_begin(struct archive_read *a, struct _7z_folder *folder,
+    const struct _7z_checkpoint *cp)
+{
+	struct _7zip *zip = (struct _7zip *)a->format->data;
+
+	zip->cp_folder = NULL;
+	if (zip->checkpoint_span == 0 || !checkpoint_eligible(folder))
+		return (ARCHIVE_OK);
+	if (zip->cp_window == NULL && folder->coders[0].codec == _7Z_DEFLATE) {
+		zip->cp_window = malloc(2 * CP_WINDOW_SIZE);
+		if (zip->cp_window == NULL) {
+			archive_set_error(&a->archive, ENOMEM,
+			    "No memory for 7-Zip decompression");
+			return (ARCHIVE_FATAL);
+		}
+	}
+	zip->cp_folder = folder;
+	zip->cp_pack = (cp != NULL) ? cp->pack : 0;
+	zip->cp_unpack = (cp != NULL) ? cp->unpack : 0;
+	zip->cp_chunk_unpack = zip->cp_unpack;
+	zip->cp_chunk_skip = 0;
+	zip->cp_chunk_header_len = 0;
+	zip->cp_window_len = 0;
+	if (cp != NULL && cp->window_size > 0)
+		checkpoint_window_append(zip, cp->window, cp->window_size);
+	return (ARCHIVE_OK);
+}
+
+/*
+ * Keep the last CP_WINDOW_SIZE bytes of output.
+ */
+static void
+checkpoint_window_append(struct _7zip *zip, const unsigned char *p,
+    size_t n)
+{
+
+	if (n >= CP_WINDOW_SIZE) {
+		memcpy(zip->cp_window, p + n - CP_WINDOW_SIZE, CP_WINDOW_SIZE);
+		zip->cp_window_len = CP_WINDOW_SIZE;
+		return;
+	}
+	if (zip->cp_window_len + n > 2 * CP_WINDOW_SIZE) {
+		memmove(zip->cp_window, zip->cp_window + zip->cp_window_len -
+		    CP_WINDOW_SIZE, CP_WINDOW_SIZE);
+		zip->cp_window_len = CP_WINDOW_SIZE;
+	}
+	memcpy(zip->cp_window + zip->cp_window_len, p, n);
+	zip->cp_window_len += n;
+}
+
+/*
+ * Remember a place where decoding the folder being recorded can
+ * restart, unless it is too close to the last one.  Decoding a folder
+ * again finds the same places, which are known already.
+ */
+static int
+add_checkpoint(struct archive_read *a, uint64_t unpack, uint64_t pack,
+    int bits, const unsigned char *window, size_t window_size)
+{
+	struct _7zip *zip = (struct _7zip *)a->format->data;
+	struct _7z_folder *folder = zip->cp_folder;
+	struct _7z_checkpoint *cp;
+	uint64_t last = 0;
+
+	if (folder->numCheckpoints > 0)
+		last = folder->checkpoints[folder->numCheckpoints - 1].unpack;
+	if (unpack <= last || unpack - last < zip->checkpoint_span)
+		return (ARCHIVE_OK);
+
+	if (folder->numCheckpoints >= folder->allocCheckpoints) {
+		size_t n = folder->allocCheckpoints ?
+		    folder->allocCheckpoints * 2 : 16;
+
+		cp = realloc(folder->checkpoints, n * sizeof(*cp));
+		if (cp == NULL)
+			goto nomem;
+		folder->checkpoints = cp;
+		folder->allocCheckpoints = n;
+	}
+	cp = &(folder->checkpoints[folder->numCheckpoints]);
+	memset(cp, 0, sizeof(*cp));
+	cp->unpack = unpack;
+	cp->pack = pack;
+	cp->bits = bits;
+	if (window_size > 0) {
+		cp->window = malloc(window_size);
+		if (cp->window == NULL)
+			goto nomem;
+		memcpy(cp->window, window, window_size);
+		cp->window_size = window_size;
+	}
+	folder->numCheckpoints++;
+	return (ARCHIVE_OK);
+nomem:
+	archive_set_error(&a->archive, ENOMEM,
+	    "No memory for 7-Zip checkpoints");
+	return (ARCHIVE_FATAL);
+}
+
+/*
+ * Follow the LZMA2 chunk headers in the data the decoder has used.
+ * A chunk that resets the dictionary does not depend on anything
+ * before it.
+ */
+static int
+lzma2_checkpoints(struct archive_read *a, const unsigned char *p, size_t n)
+{
+	struct _7zip *zip = (struct _7zip *)a->format->data;
+	const unsigned char *h = zip->cp_chunk_header;
+	uint64_t pack = zip->cp_pack;
+	uint64_t size;
+	int need;
+
+	while (n > 0) {
+		if (zip->cp_chunk_skip > 0) {
+			size = n;
+			if (size > zip->cp_chunk_skip)
+				size = zip->cp_chunk_skip;
+			zip->cp_chunk_skip -= size;
+			p += size;
+			n -= (size_t)size;
+			pack += size;
+			continue;
+		}
+		if (zip->cp_chunk_header_len == 0)
+			zip->cp_chunk_pack = pack;
+		zip->cp_chunk_header[zip->cp_chunk_header_len++] = *p++;
+		n--;
+		pack++;
+		if (h[0] >= 0xC0)
+			need = 6;
+		else if (h[0] >= 0x80)
+			need = 5;
+		else if (h[0] == 0x01 || h[0] == 0x02)
+			need = 3;
+		else {
+			/* End of the stream, or something the decoder
+			 * is going to reject. */
+			zip->cp_folder = NULL;
+			return (ARCHIVE_OK);
+		}
+		if (zip->cp_chunk_header_len < need)
+			continue;
+		zip->cp_chunk_header_len = 0;
+
+		if (h[0] == 0x01 || h[0] >= 0xE0) {
+			if (add_checkpoint(a, zip->cp_chunk_unpack,
+			    zip->cp_chunk_pack, 0, NULL, 0) != ARCHIVE_OK)
+				return (ARCHIVE_FATAL);
+		}
+		if (h[0] >= 0x80) {
+			/* LZMA chunk. */
+			zip->cp_chunk_unpack += (((uint64_t)h[0] & 0x1F) << 16)
+			    + (h[1] << 8) + h[2] + 1;
+			zip->cp_chunk_skip = (h[3] << 8) + h[4] + 1;
+		} else {
+			/* Uncompressed chunk. */
+			size = (h[1] << 8) + h[2] + 1;
+			zip->cp_chunk_unpack += size;
+			zip->cp_chunk_skip = size;
+		}
+	}
+	return (ARCHIVE_OK);
+}
+
+/*
+ * Called with the data the decoder used and produced in the folder
+ * being recorded.
+ */
+static int
+record_checkpoints(struct archive_read *a, const void *in, size_t in_bytes,
+    const void *out, size_t out_bytes)
+{
+	struct _7zip *zip = (struct _7zip *)a->format->data;
+	int r = ARCHIVE_OK;
+
+	switch (zip->codec) {
+	case _7Z_LZMA2:
+		r = lzma2_checkpoints(a, in, in_bytes);
+		break;
+#ifdef HAVE_ZLIB_H
+	case _7Z_DEFLATE:
+		checkpoint_window_append(zip, out, out_bytes);
+		/* At the end of a block that isn't the last one. */
+		if ((zip->stream.data_type & 128) != 0 &&
+		    (zip->stream.data_type & 64) == 0) {
+			size_t size = zip->cp_window_len < CP_WINDOW_SIZE ?
+			    zip->cp_window_len : CP_WINDOW_SIZE;
+
+			r = add_checkpoint(a, zip->cp_unpack + out_bytes,
+			    zip->cp_pack + in_bytes, zip->stream.data_type & 7,
+			    zip->cp_window + zip->cp_window_len - size, size);
+		}
+		break;
+#endif
+	default:
+		break;
+	}
+	zip->cp_pack += in_bytes;
+	zip->cp_unpack += out_bytes;
+	return (r);
+}
+
+/*
+ * The last checkpoint of the folder at or before offset, or NULL.
+ */
+static const struct _7z_checkpoint *
+find_checkpoint(const struct _7z_folder *folder, uint64_t offset)
+{
+	size_t lo = 0, hi = folder->numCheckpoints, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (folder->checkpoints[mid].unpack <= offset)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return (lo > 0 ? &(folder->checkpoints[lo - 1]) : NULL);
+}
+
+/*
+ * Free the decoded data of a job that is done with.
+ */
+static void
+folder_job_release(struct _7zip *zip, struct _7z_folder_job *job)
+{
+	free(job->out);
+	job->out = NULL;
+	zip->queued_bytes -= job->in_size + job->out_size;
+	job->in_size = job->out_size = 0;
+}
+
+/*
+ * Throw away the folders that workers decoded ahead of findex.
+ * Returns non-zero if findex itself is queued.
+ */
+static int
+drop_folder_jobs(struct _7zip *zip, unsigned findex)
+{
+	struct _7z_folder_job *job;
+	int queued;
+
+	if (zip->folder_job != NULL) {
+		folder_job_release(zip, zip->folder_job);
+		zip->folder_job = NULL;
+	}
+	queued = zip->pending_jobs > 0 &&
+	    findex >= zip->jobs[zip->first_job].folder_index &&
+	    findex < zip->next_job_folder;
+	while (zip->pending_jobs > 0) {
+		job = &zip->jobs[zip->first_job];
+		if (queued && job->folder_index == findex)
+			break;
+		/* A job that has not started yet is run here; there is
+		 * no taking it back from the pool. */
+		__archive_thread_pool_wait(zip->pool, &job->job);
+		folder_job_release(zip, job);
+		zip->first_job = (zip->first_job + 1) % zip->njobs;
+		zip->pending_jobs--;
+	}
+	return (queued);
+}
+
+#ifdef HAVE_ZLIB_H
+static int
+restart_deflate(struct archive_read *a, const struct _7z_checkpoint *cp)
+{
+	struct _7zip *zip = (struct _7zip *)a->format->data;
+	const unsigned char *p;
+	int r = Z_OK;
+
+	if (cp->bits) {
+		/* Feed the bits of the previous byte not used yet. */
+		p = __archive_read_ahead(a, 1, NULL);
+		if (p == NULL) {
+			archive_set_error(&a->archive,
+			    ARCHIVE_ERRNO_FILE_FORMAT,
+			    "Truncated 7-Zip file body");
+			return (ARCHIVE_FATAL);
+		}
+		r = inflatePrime(&(zip->stream), cp->bits,
+		    p[0] >> (8 - cp->bits));
+		__archive_read_consume(a, 1);
+		zip->stream_offset++;
+	}
+	if (r == Z_OK && cp->window_size > 0)
+		r = inflateSetDictionary(&(zip->stream), cp->window,
+		    (uInt)cp->window_size);
+	if (r != Z_OK) {
+		archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+		    "Couldn't restart zlib stream.");
+		return (ARCHIVE_FATAL);
+	}
+	return (ARCHIVE_OK);
+}
+#endif
+
+/*
+ * Make read_stream() continue at offset in folder findex.  Depending
+ * on what is cheapest, that reads on from where the folder is being
+ * read now, rewinds a folder that a worker decoded, or restarts at
+ * the start of the folder or at a checkpoint.
+ */
+static int
+seek_folder(struct archive_read *a, unsigned findex, uint64_t offset)
+{
+	struct _7zip *zip = (struct _7zip *)a->format->data;
+	struct _7z_folder *folder = &(zip->si.ci.folders[findex]);
+	const struct _7z_checkpoint *cp;
+	struct _7z_checkpoint stored;
+	int64_t pack_offset;
+	uint64_t pos = 0;
+	int current = 0;
+
+	if (zip->pack_stream_bytes_unconsumed)
+		read_consume(a);
+
+	if (zip->folder_index == findex + 1) {
+		struct _7z_folder_job *job = zip->folder_job;
+
+		if (job != NULL && job->folder_index == findex) {
+			zip->uncompressed_buffer_pointer =
+			    job->out + (size_t)offset;
+			zip->uncompressed_buffer_bytes_remaining =
+			    job->out_size - (size_t)offset;
+			return (ARCHIVE_OK);
+		}
+		pos = folder_uncompressed_size(folder) -
+		    zip->folder_outbytes_remaining -
+		    zip->uncompressed_buffer_bytes_remaining;
+		current = (pos <= offset);
+	}
+
+	if (folder->numCoders == 1 && folder->numPackedStreams == 1 &&
+	    folder->coders[0].codec == _7Z_COPY) {
+		/* Stored data can be read from anywhere. */
+		memset(&stored, 0, sizeof(stored));
+		stored.unpack = stored.pack = offset;
+		cp = &stored;
+	} else
+		cp = find_checkpoint(folder, offset);
+
+	if (current && (cp == NULL || cp->unpack <= pos))
+		return (skip_stream(a, (size_t)(offset - pos)) < 0 ?
+		    ARCHIVE_FATAL : ARCHIVE_OK);
+
+	zip->uncompressed_buffer_pointer = NULL;
+	zip->uncompressed_buffer_bytes_remaining = 0;
+	zip->pack_stream_inbytes_remaining = 0;
+	zip->folder_outbytes_remaining = 0;
+	zip->pack_stream_remaining = 0;
+	zip->cp_folder = NULL;
+
+	if (cp == NULL) {
+		/* Start over, with the folder a worker might have
+		 * queued already. */
+		drop_folder_jobs(zip, findex);
+		folder->skipped_bytes = 0;
+		zip->folder_index = findex;
+		return (skip_stream(a, (size_t)offset) < 0 ?
+		    ARCHIVE_FATAL : ARCHIVE_OK);
+	}
+
+	drop_folder_jobs(zip, (unsigned)zip->si.ci.numFolders);
+	if (setup_decode_folder(a, folder, 0) != ARCHIVE_OK)
+		return (ARCHIVE_FATAL);
+	zip->folder_index = findex + 1;
+	zip->pack_stream_inbytes_remaining =
+	    zip->si.pi.sizes[zip->pack_stream_index] - cp->pack;
+	zip->folder_outbytes_remaining -= cp->unpack;
+	pack_offset = zip->si.pi.positions[zip->pack_stream_index] + cp->pack;
+	if (cp->bits)
+		pack_offset--;
+	zip->pack_stream_index++;
+	zip->pack_stream_remaining--;
+	if (zip->stream_offset != pack_offset) {
+		if (0 > __archive_read_seek(a, pack_offset + zip->seek_base,
+		    SEEK_SET))
+			return (ARCHIVE_FATAL);
+		zip->stream_offset = pack_offset;
+	}
+#ifdef HAVE_ZLIB_H
+	if (zip->codec == _7Z_DEFLATE && restart_deflate(a, cp) != ARCHIVE_OK)
+		return (ARCHIVE_FATAL);
+#endif
+	if (checkpoint_begin(a, folder, cp) != ARCHIVE_OK)
+		return (ARCHIVE_FATAL);
+	return (skip_stream(a, (size_t)(offset - cp->unpack)) < 0 ?
+	    ARCHIVE_FATAL : ARCHIVE_OK);
+}
+
+/*
+ * Return non-zero if the folder can be decoded by a worker thread.
+ */
+static int
+folder_job_eligible(struct _7zip *zip, struct _7z_folder *folder)
+{
+
+	if (folder->numCoders < 1 || folder->numCoders > 2 ||
+	    folder->numPackedStreams != 1)
+		return (0);
+	switch (folder->coders[0].codec) {
+	case _7Z_LZMA:
+	case _7Z_LZMA2:
+	case _7Z_DEFLATE:
+	case _7Z_BZ2:
+		break;
+	default:
+		return (0);
+	}
+	if (folder->numCoders == 2) {
+		switch (folder->coders[1].codec) {
+		case _7Z_X86_BCJ2:
+		case _7Z_CRYPTO_MAIN_ZIP:
+		case _7Z_CRYPTO_RAR_29:
+		case _7Z_CRYPTO_AES_256_SHA_256:
+			return (0);
+		}
+	}
+	return (folder_uncompressed_size(folder) <= FOLDER_JOB_MAX_SIZE &&
+	    zip->si.pi.sizes[folder->packIndex] <= FOLDER_JOB_MAX_SIZE);
+}
+
+/*
+ * Read the pack stream of a queued folder into memory.
+ */
+static int
+folder_job_read_pack(struct archive_read *a, struct _7z_folder_job *job)
+{
+	struct _7zip *zip = (struct _7zip *)a->format->data;
+	int64_t pack_offset;
+	size_t done = 0;
+
+	job->in_size = (size_t)zip->si.pi.sizes[job->folder->packIndex];
+	job->in = malloc(job->in_size + 1);
+	if (job->in == NULL) {
+		archive_set_error(&a->archive, ENOMEM,
+		    "No memory for 7-Zip decompression");
+		return (ARCHIVE_FATAL);
+	}
+	pack_offset = zip->si.pi.positions[job->folder->packIndex];
+	if (zip->stream_offset != pack_offset) {
+		if (0 > __archive_read_seek(a, pack_offset + zip->seek_base,
+		    SEEK_SET))
+			return (ARCHIVE_FATAL);
+		zip->stream_offset = pack_offset;
+	}
+	while (done < job->in_size) {
+		const void *p;
+		ssize_t bytes_avail;
+
+		p = __archive_read_ahead(a, 1, &bytes_avail);
+		if (p == NULL || bytes_avail <= 0) {
+			archive_set_error(&a->archive,
+			    ARCHIVE_ERRNO_FILE_FORMAT,
+			    "Truncated 7-Zip file body");
+			return (ARCHIVE_FATAL);
+		}
+		if ((size_t)bytes_avail > job->in_size - done)
+			bytes_avail = (ssize_t)(job->in_size - done);
+		memcpy(job->in + done, p, bytes_avail);
+		__archive_read_consume(a, bytes_avail);
+		zip->stream_offset += bytes_avail;
+		done += bytes_avail;
+	}
+	return (ARCHIVE_OK);
+}
+
+/*
+ * Decode a whole folder.  This runs on a worker thread, so it must
+ * only touch the job; errors are recorded in the job's own archive
+ * object and copied over by setup_folder_job().
+ */
+static void
+folder_job_run(void *arg)
+{
+	struct _7z_folder_job *job = (struct _7z_folder_job *)arg;
+	struct archive_read *a = &job->shadow;
+	const struct _7z_folder *folder = job->folder;
+	size_t out_avail = job->out_size + FOLDER_JOB_SLACK;
+	size_t in_pos = 0, out_len = 0;
+	int r;
+
+	memset(job->dec, 0, sizeof(*job->dec));
+	job->ret = ARCHIVE_FATAL;
+	r = init_decompression(a, job->dec, &(folder->coders[0]),
+	    (folder->numCoders == 2) ? &(folder->coders[1]) : NULL);
+	while (r == ARCHIVE_OK) {
+		size_t bytes_in = job->in_size - in_pos;
+		size_t bytes_out = out_avail - out_len;
+
+		r = decompress(a, job->dec, job->out + out_len, &bytes_out,
+		    job->in + in_pos, &bytes_in);
+		if (r != ARCHIVE_OK && r != ARCHIVE_EOF)
+			break;
+		in_pos += bytes_in;
+		if (bytes_out > job->out_size - out_len)
+			bytes_out = job->out_size - out_len;
+		out_len += bytes_out;
+		if (in_pos == job->in_size && out_len == job->out_size) {
+			job->ret = ARCHIVE_OK;
+			break;
+		}
+		if (r == ARCHIVE_EOF || (bytes_in == 0 && bytes_out == 0)) {
+			archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+			    "Damaged 7-Zip archive");
+			break;
+		}
+	}
+	free_decompression(a, job->dec);
+	free(job->in);
+	job->in = NULL;
+}
+
+/*
+ * Queue the folders following the current one and hand out the
+ * current folder once a worker has decoded it.  Returns 1 if the
+ * folder is now in memory, 0 if the caller has to decode it itself
+ * and -1 on error.
+ */
+static int
+setup_folder_job(struct archive_read *a)
+{
+	struct _7zip *zip = (struct _7zip *)a->format->data;
+	struct _7z_folder *folders = zip->si.ci.folders;
+	struct _7z_folder_job *job;
+	int i;
+
+	/* The folder handed out last time has been read through. */
+	if (zip->folder_job != NULL) {
+		folder_job_release(zip, zip->folder_job);
+		zip->folder_job = NULL;
+	}
+
+	if (zip->pending_jobs == 0) {
+		if (!folder_job_eligible(zip, &folders[zip->folder_index]))
+			return (0);
+		zip->next_job_folder = zip->folder_index;
+	}
+
+	if (zip->jobs == NULL) {
+		if (zip->pool == NULL)
+			zip->pool = __archive_thread_pool_new(zip->threads);
+		if (zip->pool == NULL) {
+			archive_set_error(&a->archive, ENOMEM,
+			    "No memory for 7-Zip decompression");
+			return (-1);
+		}
+		/* Size the queue from the workers that actually run. */
+		zip->njobs = __archive_thread_pool_threads(zip->pool) + 1;
+		zip->jobs = calloc(zip->njobs, sizeof(*zip->jobs));
+		for (i = 0; zip->jobs != NULL && i < zip->njobs; i++) {
+			zip->jobs[i].dec = calloc(1, sizeof(struct _7zip));
+			if (zip->jobs[i].dec == NULL)
+				break;
+		}
+		if (zip->pool == NULL || zip->jobs == NULL || i < zip->njobs) {
+			archive_set_error(&a->archive, ENOMEM,
+			    "No memory for 7-Zip decompression");
+			return (-1);
+		}
+	}
+
+	/*
+	 * Keep the workers busy with the folders that follow, up to
+	 * the first one that has to be decoded here.
+	 */
+	while (zip->pending_jobs < zip->njobs &&
+	    zip->next_job_folder < zip->si.ci.numFolders &&
+	    folder_job_eligible(zip, &folders[zip->next_job_folder])) {
+		struct _7z_folder *folder = &folders[zip->next_job_folder];
+		uint64_t bytes = folder_uncompressed_size(folder) +
+		    zip->si.pi.sizes[folder->packIndex];
+
+		/* The current folder is always queued. */
+		if (zip->pending_jobs > 0 &&
+		    zip->queued_bytes + bytes > FOLDER_JOB_QUEUE_MAX)
+			break;
+		job = &zip->jobs[(zip->first_job + zip->pending_jobs)
+		    % zip->njobs];
+		job->folder = folder;
+		job->folder_index = zip->next_job_folder;
+		job->out_size = (size_t)folder_uncompressed_size(folder);
+		job->out = malloc(job->out_size + FOLDER_JOB_SLACK);
+		if (job->out == NULL) {
+			archive_set_error(&a->archive, ENOMEM,
+			    "No memory for 7-Zip decompression");
+			return (-1);
+		}
+		if (folder_job_read_pack(a, job) != ARCHIVE_OK)
+			return (-1);
+		job->job.run = folder_job_run;
+		job->job.arg = job;
+		zip->queued_bytes += job->in_size + job->out_size;
+		__archive_thread_pool_submit(zip->pool, &job->job);
+		zip->pending_jobs++;
+		zip->next_job_folder++;
+	}
+
+	job = &zip->jobs[zip->first_job];
+	if (zip->pending_jobs == 0 || job->folder_index != zip->folder_index) {
+		archive_set_error(&(a->archive),
+		    ARCHIVE_ERRNO_MISC, "Damaged 7-Zip archive");
+		return (-1);
+	}
+	__archive_thread_pool_wait(zip->pool, &job->job);
+	zip->first_job = (zip->first_job + 1) % zip->njobs;
+	zip->pending_jobs--;
+	zip->folder_job = job;
+	if (job->ret != ARCHIVE_OK) {
+		archive_copy_error(&a->archive, &job->shadow.archive);
+		return (-1);
+	}
+	if (zip->has_encrypted_entries ==
+	    ARCHIVE_READ_FORMAT_ENCRYPTION_DONT_KNOW)
+		zip->has_encrypted_entries = 0;
+
+	/* Let get_uncompressed_data() return the decoded folder. */
+	zip->codec = job->folder->coders[0].codec;
+	zip->codec2 = (unsigned long)-1;
+	zip->pack_stream_remaining = 0;
+	zip->pack_stream_inbytes_remaining = 0;
+	zip->folder_outbytes_remaining = 0;
+	zip->uncompressed_buffer_pointer = job->out;
+	zip->uncompressed_buffer_bytes_remaining = job->out_size;
+	return (1);
+}
+
+static void
+free_folder_jobs(struct _7zip *zip)
+{
+	int i;
+
+	/* Freeing the pool runs whatever is still queued. */
+	if (zip->pool != NULL)
+		__archive_thread_pool_free(zip->pool);
+	zip->pool = NULL;
+	if (zip->jobs == NULL)
+		return;
+	for (i = 0; i < zip->njobs; i++) {
+		free(zip->jobs[i].in);
+		free(zip->jobs[i].out);
+		free(zip->jobs[i].dec);
+		archive_string_free(&zip->jobs[i].shadow.archive.error_string);
+	}
+	free(zip->jobs);
+	zip->jobs = NULL;
+}
+
 /*
  * Brought from LZMA SDK.
  *
@@ -38,14 +38,13 @@
 #endif
 
 #include "archive.h"
-#ifndef HAVE_ZLIB_H
 #include "archive_crc32.h"
-#endif
 
 #include "archive_entry.h"
 #include "archive_entry_locale.h"
 #include "archive_ppmd7_private.h"
 #include "archive_entry_private.h"
+#include "archive_thread_pool_private.h"
 
 #ifdef HAVE_BLAKE2_H
 #include <blake2.h>
@@ -308,6 +307,50 @@ struct multivolume {
 	uint8_t* push_buf;
 };
 
+/* With the "threads" option, the files of a non-solid, single volume archive
+ * are decoded ahead of the reader on worker threads.
+ *
+ * When the file returned by rar5_read_header() can be decoded by a worker,
+ * its compressed data is read into memory and queued, and the base blocks
+ * that follow are parsed ahead without consuming them. Each further file
+ * that qualifies has its header and data read into memory as well and is
+ * queued, until the queue is full or a block turns up that has to be
+ * processed by the calling thread (stored files, service blocks, the end of
+ * archive marker, etc). rar5_read_header() later parses the saved headers
+ * again in archive order, so the entries look exactly the same as without
+ * the option, and rar5_read_data() returns each decoded file in one piece.
+ *
+ * Files bigger than JOB_MAX_SIZE are always decoded by the calling thread.
+ * There is one job per worker plus the one being returned, and no further
+ * file is queued once the compressed and decoded data of the queued ones
+ * would exceed JOB_QUEUE_MAX. */
+#define JOB_MAX_SIZE (64 * 1024 * 1024)
+#define JOB_QUEUE_MAX (256 * 1024 * 1024)
+
+/* Zeroed tail of the job buffers. Both the header parser (read_var) and the
+ * block decoder read a few bytes past the data they actually use. */
+#define JOB_SLACK 16
+
+struct rar5_job {
+	struct archive_thread_job job;
+
+	/* Private to the worker. The shadow archive collects its error, and
+	 * its format data points at `dec`, so the decoder can run on it
+	 * unchanged. */
+	struct archive_read shadow;
+	struct archive_format_descriptor format;
+	struct rar5* dec;
+
+	uint8_t* hdr;      /* Base block header, parsed again later. */
+	size_t hdr_size;
+	uint8_t* in;       /* Compressed data. */
+	size_t in_size;
+	uint8_t* out;      /* Decoded data. */
+	size_t out_size;
+	size_t out_len;
+	int ret;
+};
+
 /* Main context structure. */
 struct rar5 {
 	int header_initialized;
@@ -352,13 +395,38 @@ struct rar5 {
 	/* The header of currently processed RARv5 block. Used in main
 	 * decompression logic loop. */
 	struct compressed_block_header last_block_hdr;
+
+	/* If `buf` is set, read_ahead() and consume() operate on this memory
+	 * buffer instead of the archive. If `peek` is set, they look at the
+	 * archive `peek` without consuming anything. See struct rar5_job. */
+	struct {
+		struct archive_read* peek;
+		const uint8_t* buf;
+		size_t size;
+		size_t pos;
+	} mem;
+
+	/* Parallel decompression; see struct rar5_job. */
+	int threads;
+	struct archive_thread_pool* pool;
+	struct rar5_job* jobs;
+	int njobs;
+	int first_job;
+	int pending_jobs;           /* Includes `cur_job`. */
+	uint64_t queued_bytes;      /* Input and output of pending jobs. */
+	struct rar5_job* cur_job;   /* Job of the current file, if any. */
+	struct rar5_job scan;       /* Context used to parse ahead. */
+	struct archive_entry* scan_entry;
 };
 
 /* Forward function declarations. */
 
 static void rar5_signature(char *buf);
 static int verify_global_checksums(struct archive_read* a);
+static int rar5_read_data(struct archive_read *a, const void **buff,
+	size_t *size, int64_t *offset);
 static int rar5_read_data_skip(struct archive_read *a);
+static int rar5_init(struct rar5* rar);
 static int push_data_ready(struct archive_read* a, struct rar5* rar,
 	const uint8_t* buf, size_t size, int64_t offset);
 
@@ -881,10 +949,29 @@ static inline int get_archive_read(struct archive* a,
 static int read_ahead(struct archive_read* a, size_t how_many,
     const uint8_t** ptr)
 {
+	struct rar5* rar = get_context(a);
 	ssize_t avail = -1;
 	if(!ptr)
 		return 0;
 
+	if(rar->mem.buf) {
+		if(how_many > rar->mem.size + JOB_SLACK - rar->mem.pos)
+			return 0;
+
+		*ptr = rar->mem.buf + rar->mem.pos;
+		return 1;
+	}
+
+	if(rar->mem.peek) {
+		*ptr = __archive_read_ahead(rar->mem.peek,
+		    rar->mem.pos + how_many, &avail);
+		if(*ptr == NULL)
+			return 0;
+
+		*ptr += rar->mem.pos;
+		return 1;
+	}
+
 	*ptr = __archive_read_ahead(a, how_many, &avail);
 	if(*ptr == NULL) {
 		return 0;
@@ -894,8 +981,18 @@ static int read_ahead(struct archive_read* a, size_t how_many,
 }
 
 static int consume(struct archive_read* a, int64_t how_many) {
+	struct rar5* rar = get_context(a);
 	int ret;
 
+	if(rar->mem.buf || rar->mem.peek) {
+		if(how_many < 0 || (rar->mem.buf &&
+		    (uint64_t) how_many > rar->mem.size - rar->mem.pos))
+			return ARCHIVE_FATAL;
+
+		rar->mem.pos += (size_t) how_many;
+		return ARCHIVE_OK;
+	}
+
 	ret = how_many == __archive_read_consume(a, how_many)
 		? ARCHIVE_OK
 		: ARCHIVE_FATAL;
@@ -1175,13 +1272,29 @@ static int rar5_bid(struct archive_read* a, int best_bid) {
 
 static int rar5_options(struct archive_read *a, const char *key,
     const char *val) {
-	(void) a;
-	(void) key;
-	(void) val;
+	struct rar5* rar = get_context(a);
+
+	if(strcmp(key, "threads") == 0) {
+		char* endptr;
+
+		if(val == NULL)
+			return ARCHIVE_WARN;
+
+		errno = 0;
+		rar->threads = (int) strtoul(val, &endptr, 10);
+		if(errno != 0 || *endptr != '\0') {
+			rar->threads = 1;
+			return ARCHIVE_WARN;
+		}
+
+		if(rar->threads == 0)
+			rar->threads = __archive_thread_pool_cpus();
+
+		return ARCHIVE_OK;
+	}
 
-	/* No options supported in this version. Return the ARCHIVE_WARN code
-	 * to signal the options supervisor that the unpacker didn't handle
-	 * setting this option. */
+	/* Return the ARCHIVE_WARN code to signal the options supervisor that
+	 * the unpacker didn't handle setting this option. */
 
 	return ARCHIVE_WARN;
 }
@@ -2404,6 +2517,364 @@ fatal:
 	return (ARCHIVE_FATAL);
 }
 
+/* Returns non-zero if the file whose header has just been parsed into `rar`
+ * can be decoded by a worker thread. */
+static int job_eligible(struct rar5* rar) {
+	enum COMPRESSION_METHOD {
+		STORE = 0,
+	};
+
+	/* 0x02 is HEAD_FILE. */
+	return rar->generic.last_header_id == 0x02 &&
+	    !rar->generic.split_before && !rar->generic.split_after &&
+	    !rar->file.dir && !rar->file.service && !rar->file.solid &&
+	    rar->file.redir_type == REDIR_TYPE_NONE &&
+	    rar->cstate.method != STORE &&
+	    rar->file.bytes_remaining > 0 &&
+	    rar->file.bytes_remaining <= JOB_MAX_SIZE &&
+	    rar->file.unpacked_size >= 0 &&
+	    rar->file.unpacked_size <= JOB_MAX_SIZE;
+}
+
+/* Clears a worker or scanner context, keeping its filter deque. */
+static void reset_job_context(struct rar5* rar) {
+	struct cdeque filters;
+
+	free_filters(rar);
+	filters = rar->cstate.filters;
+	memset(rar, 0, sizeof(*rar));
+	rar->cstate.filters = filters;
+}
+
+/* Gives a job its own decoder context. */
+static int init_job_context(struct rar5_job* job) {
+	if(job->dec != NULL)
+		return ARCHIVE_OK;
+
+	job->dec = malloc(sizeof(*job->dec));
+	if(job->dec == NULL)
+		return ARCHIVE_FATAL;
+
+	if(ARCHIVE_OK != rar5_init(job->dec)) {
+		free(job->dec);
+		job->dec = NULL;
+		return ARCHIVE_FATAL;
+	}
+
+	job->format.data = job->dec;
+	job->shadow.format = &job->format;
+	return ARCHIVE_OK;
+}
+
+static int init_jobs(struct archive_read* a) {
+	struct rar5* rar = get_context(a);
+
+	rar->pool = __archive_thread_pool_new(rar->threads);
+	if(rar->pool == NULL)
+		goto fail;
+
+	/* Size the queue from the workers that actually run. */
+	rar->njobs = __archive_thread_pool_threads(rar->pool) + 1;
+	rar->jobs = calloc(rar->njobs, sizeof(*rar->jobs));
+	rar->scan_entry = archive_entry_new();
+	if(rar->jobs == NULL || rar->scan_entry == NULL ||
+	    ARCHIVE_OK != init_job_context(&rar->scan))
+		goto fail;
+
+	/* The other contexts are set up when their job is first used. */
+	return ARCHIVE_OK;
+
+fail:
+	archive_set_error(&a->archive, ENOMEM,
+	    "Can't allocate rar5 decompression threads");
+	return ARCHIVE_FATAL;
+}
+
+static void free_job(struct rar5_job* job) {
+	free(job->hdr);
+	free(job->in);
+	free(job->out);
+
+	if(job->dec != NULL) {
+		free(job->dec->cstate.window_buf);
+		free(job->dec->cstate.filtered_buf);
+		free_filters(job->dec);
+		cdeque_free(&job->dec->cstate.filters);
+		free(job->dec);
+	}
+
+	archive_string_free(&job->shadow.archive.error_string);
+}
+
+static void free_jobs(struct rar5* rar) {
+	int i;
+
+	/* Freeing the pool runs whatever is still queued. */
+	if(rar->pool != NULL)
+		__archive_thread_pool_free(rar->pool);
+
+	if(rar->jobs != NULL) {
+		for(i = 0; i < rar->njobs; i++)
+			free_job(&rar->jobs[i]);
+
+		free(rar->jobs);
+	}
+
+	free_job(&rar->scan);
+	archive_entry_free(rar->scan_entry);
+}
+
+/* Copies the next `size` bytes of the archive into a new buffer with a zeroed
+ * tail of JOB_SLACK bytes. */
+static int read_job_input(struct archive_read* a, uint8_t** buf,
+    size_t size)
+{
+	const void* p;
+	ssize_t avail;
+	size_t done = 0;
+
+	*buf = malloc(size + JOB_SLACK);
+	if(*buf == NULL) {
+		archive_set_error(&a->archive, ENOMEM,
+		    "Can't allocate memory for compressed data");
+		return ARCHIVE_FATAL;
+	}
+
+	memset(*buf + size, 0, JOB_SLACK);
+
+	while(done < size) {
+		p = __archive_read_ahead(a, 1, &avail);
+		if(p == NULL || avail <= 0) {
+			archive_set_error(&a->archive,
+			    ARCHIVE_ERRNO_FILE_FORMAT, "Truncated RAR5 file data");
+			return ARCHIVE_FATAL;
+		}
+
+		if((size_t) avail > size - done)
+			avail = (ssize_t) (size - done);
+
+		memcpy(*buf + done, p, avail);
+		__archive_read_consume(a, avail);
+		done += avail;
+	}
+
+	return ARCHIVE_OK;
+}
+
+/* Decodes a whole file. This runs on a worker thread, so it must only touch
+ * the job; errors end up in the job's shadow archive. */
+static void run_job(void* arg) {
+	struct rar5_job* job = (struct rar5_job*) arg;
+	struct archive_read* a = &job->shadow;
+	struct rar5* rar = job->dec;
+	const void* buf = NULL;
+	size_t size;
+	int64_t offset;
+	int ret;
+
+	job->out = malloc(job->out_size + 1);
+	if(job->out == NULL) {
+		archive_set_error(&a->archive, ENOMEM,
+		    "Can't allocate memory for decompressed data");
+		ret = ARCHIVE_FATAL;
+	} else do {
+		ret = rar5_read_data(a, &buf, &size, &offset);
+		if(ret != ARCHIVE_OK || size == 0)
+			continue;
+
+		if(offset < 0 || (uint64_t) offset > job->out_size ||
+		    size > job->out_size - (size_t) offset)
+		{
+			archive_set_error(&a->archive,
+			    ARCHIVE_ERRNO_PROGRAMMER,
+			    "Unpacker has written too many bytes");
+			ret = ARCHIVE_FATAL;
+			break;
+		}
+
+		memcpy(job->out + offset, buf, size);
+		if(job->out_len < (size_t) offset + size)
+			job->out_len = (size_t) offset + size;
+	} while(ret == ARCHIVE_OK);
+
+	job->ret = (ret == ARCHIVE_EOF) ? ARCHIVE_OK : ret;
+
+	/* Only the decoded data is needed from here on. */
+	free(job->in);
+	job->in = NULL;
+	free(rar->cstate.window_buf);
+	free(rar->cstate.filtered_buf);
+	rar->cstate.window_buf = NULL;
+	rar->cstate.filtered_buf = NULL;
+	free_filters(rar);
+}
+
+/* Hands the file whose header has been parsed into `src`, and whose data is
+ * in `job->in`, to a worker. */
+static void submit_job(struct rar5* rar, struct rar5_job* job,
+    const struct rar5* src)
+{
+	struct rar5* dec = job->dec;
+
+	reset_job_context(dec);
+	dec->file = src->file;
+	dec->cstate.method = src->cstate.method;
+	dec->cstate.version = src->cstate.version;
+	dec->cstate.window_size = src->cstate.window_size;
+	dec->cstate.block_parsing_finished = 1;
+	dec->cstate.all_filters_applied = 1;
+	dec->mem.buf = job->in;
+	dec->mem.size = job->in_size;
+
+	job->out_size = (size_t) src->file.unpacked_size;
+	job->out_len = 0;
+	rar->queued_bytes += job->in_size + job->out_size;
+	job->job.run = run_job;
+	job->job.arg = job;
+	__archive_thread_pool_submit(rar->pool, &job->job);
+}
+
+/* Hands the current file to a worker, unless that has been done already, and
+ * queues the files that follow it, up to the first one that has to be
+ * processed by the calling thread. */
+static int queue_jobs(struct archive_read* a) {
+	struct rar5* rar = get_context(a);
+	struct rar5* scan;
+	struct rar5_job* job;
+	int ret;
+
+	if(rar->jobs == NULL && ARCHIVE_OK != init_jobs(a))
+		return ARCHIVE_FATAL;
+
+	if(rar->cur_job == NULL) {
+		job = &rar->jobs[rar->first_job];
+		if(ARCHIVE_OK != init_job_context(job)) {
+			archive_set_error(&a->archive, ENOMEM,
+			    "Can't allocate rar5 decompression threads");
+			return ARCHIVE_FATAL;
+		}
+
+		job->in_size = rar->file.bytes_remaining;
+		if(ARCHIVE_OK != read_job_input(a, &job->in, job->in_size))
+			return ARCHIVE_FATAL;
+
+		submit_job(rar, job, rar);
+		rar->file.bytes_remaining = 0;
+		rar->cur_job = job;
+		rar->pending_jobs = 1;
+	}
+
+	scan = rar->scan.dec;
+	while(rar->pending_jobs < rar->njobs) {
+		job = &rar->jobs[
+		    (rar->first_job + rar->pending_jobs) % rar->njobs];
+
+		/* Parse the next base block without consuming it. Errors
+		 * are left for the calling thread to find when it gets
+		 * there. */
+		reset_job_context(scan);
+		scan->mem.peek = a;
+		ret = process_base_block(&rar->scan.shadow, rar->scan_entry);
+		scan->mem.peek = NULL;
+
+		if(ret != ARCHIVE_OK || !job_eligible(scan))
+			break;
+
+		if(rar->queued_bytes + scan->file.bytes_remaining +
+		    (uint64_t) scan->file.unpacked_size > JOB_QUEUE_MAX)
+			break;
+
+		if(ARCHIVE_OK != init_job_context(job)) {
+			archive_set_error(&a->archive, ENOMEM,
+			    "Can't allocate rar5 decompression threads");
+			return ARCHIVE_FATAL;
+		}
+
+		job->hdr_size = scan->mem.pos;
+		job->in_size = scan->file.bytes_remaining;
+		if(ARCHIVE_OK != read_job_input(a, &job->hdr, job->hdr_size) ||
+		    ARCHIVE_OK != read_job_input(a, &job->in, job->in_size))
+			return ARCHIVE_FATAL;
+
+		submit_job(rar, job, scan);
+		rar->pending_jobs++;
+	}
+
+	return ARCHIVE_OK;
+}
+
+/* Returns the next queued file by parsing its saved header again. */
+static int read_queued_header(struct archive_read* a,
+    struct archive_entry* entry)
+{
+	struct rar5* rar = get_context(a);
+	struct rar5_job* job = &rar->jobs[rar->first_job];
+	int ret;
+
+	rar->mem.buf = job->hdr;
+	rar->mem.size = job->hdr_size;
+	rar->mem.pos = 0;
+	ret = process_base_block(a, entry);
+	rar->mem.buf = NULL;
+
+	free(job->hdr);
+	job->hdr = NULL;
+
+	if(ret != ARCHIVE_OK) {
+		if(ret != ARCHIVE_FATAL) {
+			archive_set_error(&a->archive,
+			    ARCHIVE_ERRNO_PROGRAMMER,
+			    "Internal unpacker error");
+		}
+
+		return ARCHIVE_FATAL;
+	}
+
+	/* The worker has the data of this file already. */
+	rar->file.bytes_remaining = 0;
+	rar->cur_job = job;
+
+	return queue_jobs(a);
+}
+
+/* Waits for the job of the current file and recycles it. */
+static void release_job(struct rar5* rar) {
+	struct rar5_job* job = rar->cur_job;
+
+	__archive_thread_pool_wait(rar->pool, &job->job);
+	free(job->out);
+	job->out = NULL;
+	rar->queued_bytes -= job->in_size + job->out_size;
+
+	rar->first_job = (rar->first_job + 1) % rar->njobs;
+	rar->pending_jobs--;
+	rar->cur_job = NULL;
+}
+
+/* Returns the current file, decoded by a worker, in one piece. */
+static int read_job_data(struct archive_read* a, struct rar5* rar,
+    const void** buf, size_t* size, int64_t* offset)
+{
+	struct rar5_job* job = rar->cur_job;
+
+	if(rar->file.eof == 1)
+		return ARCHIVE_EOF;
+
+	__archive_thread_pool_wait(rar->pool, &job->job);
+	rar->file.eof = 1;
+
+	if(job->ret != ARCHIVE_OK) {
+		archive_copy_error(&a->archive, &job->shadow.archive);
+		return job->ret;
+	}
+
+	if(buf)    *buf = job->out;
+	if(size)   *size = job->out_len;
+	if(offset) *offset = 0;
+
+	return ARCHIVE_OK;
+}
+
 static int rar5_read_header(struct archive_read *a,
     struct archive_entry *entry)
 {
@@ -2425,11 +2896,23 @@ static int rar5_read_header(struct archive_read *a,
 		rar->skipped_magic = 1;
 	}
 
+	if(rar->cur_job != NULL)
+		release_job(rar);
+
+	if(rar->pending_jobs > 0)
+		return read_queued_header(a, entry);
+
 	do {
 		ret = process_base_block(a, entry);
 	} while(ret == ARCHIVE_RETRY ||
 			(rar->main.endarc > 0 && ret == ARCHIVE_OK));
 
+	if(ret == ARCHIVE_OK && rar->threads > 1 && !rar->main.solid &&
+	    !rar->main.volume && job_eligible(rar))
+	{
+		ret = queue_jobs(a);
+	}
+
 	return ret;
 }
 
@@ -2475,7 +2958,8 @@ static void update_crc(struct rar5* rar, const uint8_t* p, size_t to_read) {
 		 * `stored_crc32` info filled in. */
 		if(rar->file.stored_crc32 > 0) {
 			rar->file.calculated_crc32 =
-				crc32(rar->file.calculated_crc32, p, to_read);
+				__archive_crc32(rar->file.calculated_crc32,
+				    p, to_read);
 		}
 
 		/* Check if the file uses an optional BLAKE2sp checksum
@@ -4069,6 +4553,9 @@ static int rar5_read_data(struct archive_read *a, const void **buff,
 		return ARCHIVE_FAILED;
 	}
 
+	if(rar->cur_job != NULL)
+		return read_job_data(a, rar, buff, size, offset);
+
 	if(!rar->skip_mode && (rar->cstate.last_write_ptr > rar->file.unpacked_size)) {
 		archive_set_error(&a->archive, ARCHIVE_ERRNO_PROGRAMMER,
 		    "Unpacker has written too many bytes");
@@ -4181,6 +4668,8 @@ static int rar5_cleanup(struct archive_read *a) {
 	free_filters(rar);
 	cdeque_free(&rar->cstate.filters);
 
+	free_jobs(rar);
+
 	free(rar);
 	a->format->data = NULL;
 
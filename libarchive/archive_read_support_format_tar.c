@@ -45,6 +45,7 @@ __FBSDID("$FreeBSD: head/lib/libarchive/archive_read_support_format_tar.c 201161
 #include "archive_entry_locale.h"
 #include "archive_private.h"
 #include "archive_read_private.h"
+#include "archive_read_index_private.h"
 
 #define tar_min(a,b) ((a) < (b) ? (a) : (b))
 
@@ -132,6 +133,7 @@ struct tar {
 	struct archive_string	 line;
 	int			 pax_hdrcharset_binary;
 	int			 header_recursion_depth;
+	int64_t			 entry_header_offset;
 	int64_t			 entry_bytes_remaining;
 	int64_t			 entry_offset;
 	int64_t			 entry_padding;
@@ -156,6 +158,10 @@ struct tar {
 	int			 process_mac_extensions;
 	int			 read_concatenated_archives;
 	int			 realsize_override;
+	/* The "index-span" option, applied once "write-index" has
+	 * started recording; 0 if it was not given. */
+	int64_t			 index_span;
+	int			 index_recording;
 };
 
 static int	archive_block_is_null(const char *p);
@@ -203,6 +209,8 @@ static int	archive_read_format_tar_read_data(struct archive_read *a,
 static int	archive_read_format_tar_skip(struct archive_read *a);
 static int	archive_read_format_tar_read_header(struct archive_read *,
 		    struct archive_entry *);
+static int	archive_read_format_tar_seek_entry(struct archive_read *,
+		    const char *, struct archive_entry *);
 static int	checksum(struct archive_read *, const void *);
 static int 	pax_attribute(struct archive_read *, struct tar *,
 		    struct archive_entry *, const char *key, const char *value,
@@ -272,8 +280,13 @@ archive_read_support_format_tar(struct archive *_a)
 	    NULL,
 	    NULL);
 
-	if (r != ARCHIVE_OK)
+	if (r != ARCHIVE_OK) {
 		free(tar);
+		return (ARCHIVE_OK);
+	}
+	__archive_read_register_format_seek_entry(a,
+	    archive_read_format_tar_bid,
+	    archive_read_format_tar_seek_entry);
 	return (ARCHIVE_OK);
 }
 
@@ -454,6 +467,35 @@ archive_read_format_tar_options(struct archive_read *a,
 	} else if (strcmp(key, "read_concatenated_archives") == 0) {
 		tar->read_concatenated_archives = (val != NULL && val[0] != 0);
 		return (ARCHIVE_OK);
+	} else if (strcmp(key, "index") == 0 ||
+	    strcmp(key, "write-index") == 0) {
+		if (val == NULL || val[0] == 0) {
+			archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+			    "tar: %s option needs a file name", key);
+			return (ARCHIVE_FAILED);
+		}
+		if (key[0] == 'i')
+			return (__archive_read_index_load(a, val));
+		ret = __archive_read_index_record(a, val);
+		if (ret != ARCHIVE_OK)
+			return (ret);
+		tar->index_recording = 1;
+		if (tar->index_span > 0)
+			return (__archive_read_index_set_span(a,
+			    tar->index_span));
+		return (ARCHIVE_OK);
+	} else if (strcmp(key, "index-span") == 0) {
+		if (val == NULL || val[0] == 0 ||
+		    tar_atol10(val, strlen(val)) <= 0) {
+			archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+			    "tar: index-span option needs a positive size");
+			return (ARCHIVE_FAILED);
+		}
+		tar->index_span = tar_atol10(val, strlen(val));
+		if (tar->index_recording)
+			return (__archive_read_index_set_span(a,
+			    tar->index_span));
+		return (ARCHIVE_OK);
 	}
 
 	/* Note: The "warn" return is just to inform the options
@@ -526,6 +568,7 @@ archive_read_format_tar_read_header(struct archive_read *a,
 
 	tar = (struct tar *)(a->format->data);
 	tar->entry_offset = 0;
+	tar->entry_header_offset = -1;
 	gnu_clear_sparse_list(tar);
 	tar->realsize = -1; /* Mark this as "unset" */
 	tar->realsize_override = 0;
@@ -545,6 +588,13 @@ archive_read_format_tar_read_header(struct archive_read *a,
 
 	tar_flush_unconsumed(a, &unconsumed);
 
+	if (r == ARCHIVE_EOF && __archive_read_index_save(a) != ARCHIVE_OK)
+		return (ARCHIVE_FATAL);
+	if ((r == ARCHIVE_OK || r == ARCHIVE_WARN) &&
+	    __archive_read_index_add_entry(a, archive_entry_pathname(entry),
+	    tar->entry_header_offset) != ARCHIVE_OK)
+		return (ARCHIVE_FATAL);
+
 	/*
 	 * "non-sparse" files are really just sparse files with
 	 * a single block.
@@ -588,6 +638,55 @@ archive_read_format_tar_read_header(struct archive_read *a,
 	return (r);
 }
 
+/*
+ * Jump to an entry through a sidecar index loaded with the "index"
+ * option.  Compressed archives need checkpoints in the index for the
+ * decompressor to restart from.
+ */
+static int
+archive_read_format_tar_seek_entry(struct archive_read *a,
+    const char *pathname, struct archive_entry *entry)
+{
+	struct tar *tar = (struct tar *)(a->format->data);
+	const char *name;
+	int64_t offset, r;
+	int ret;
+
+	offset = __archive_read_index_find_entry(a, pathname);
+	if (offset < 0) {
+		archive_set_error(&a->archive, ENOENT,
+		    "%s: entry not found in index", pathname);
+		return (ARCHIVE_FAILED);
+	}
+	r = __archive_read_seek(a, offset, SEEK_SET);
+	if (r == ARCHIVE_FAILED) {
+		archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+		    "Can't seek to %s in this archive", pathname);
+		return (ARCHIVE_FAILED);
+	}
+	if (r < 0)
+		return (ARCHIVE_FATAL);
+
+	/* Forget what was left of the previous entry. */
+	tar->entry_bytes_remaining = 0;
+	tar->entry_bytes_unconsumed = 0;
+	tar->entry_padding = 0;
+	tar->header_recursion_depth = 0;
+	gnu_clear_sparse_list(tar);
+
+	archive_entry_clear(entry);
+	ret = archive_read_format_tar_read_header(a, entry);
+	if (ret != ARCHIVE_OK && ret != ARCHIVE_WARN)
+		return (ARCHIVE_FATAL);
+	name = archive_entry_pathname(entry);
+	if (name == NULL || strcmp(name, pathname) != 0) {
+		archive_set_error(&a->archive, ARCHIVE_ERRNO_FILE_FORMAT,
+		    "Index does not match archive");
+		return (ARCHIVE_FATAL);
+	}
+	return (ret);
+}
+
 static int
 archive_read_format_tar_read_data(struct archive_read *a,
     const void **buff, size_t *size, int64_t *offset)
@@ -751,6 +850,11 @@ tar_read_header(struct archive_read *a, struct tar *tar,
 		 */
 	}
 
+	/* Remember where the first header of this entry starts. */
+	if (tar->entry_header_offset < 0)
+		tar->entry_header_offset =
+		    archive_filter_bytes(&a->archive, 0);
+
 	/*
 	 * Note: If the checksum fails and we return ARCHIVE_RETRY,
 	 * then the client is likely to just retry.  This is a very
@@ -1134,7 +1238,9 @@ read_body_to_string(struct archive_read *a, struct tar *tar,
 {
 	int64_t size;
 	const struct archive_entry_header_ustar *header;
-	const void *src;
+	struct archive_read_iov iov[2];
+	size_t copied, len;
+	int i, niov;
 
 	(void)tar; /* UNUSED */
 	header = (const struct archive_entry_header_ustar *)h;
@@ -1154,14 +1260,22 @@ read_body_to_string(struct archive_read *a, struct tar *tar,
 
 	tar_flush_unconsumed(a, unconsumed);
 
-	/* Read the body into the string. */
+	/* Read the body into the string.  A body that spans two input
+	 * blocks is gathered from both rather than joined first. */
 	*unconsumed = (size_t)((size + 511) & ~ 511);
-	src = __archive_read_ahead(a, *unconsumed, NULL);
-	if (src == NULL) {
+	niov = __archive_read_ahead_iov(a, *unconsumed, iov);
+	if (niov <= 0) {
 		*unconsumed = 0;
 		return (ARCHIVE_FATAL);
 	}
-	memcpy(as->s, src, (size_t)size);
+	copied = 0;
+	for (i = 0; i < niov && copied < (size_t)size; i++) {
+		len = iov[i].len;
+		if (len > (size_t)size - copied)
+			len = (size_t)size - copied;
+		memcpy(as->s + copied, iov[i].buff, len);
+		copied += len;
+	}
 	as->s[size] = '\0';
 	as->length = (size_t)size;
 	return (ARCHIVE_OK);
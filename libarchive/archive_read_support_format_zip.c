@@ -74,9 +74,7 @@ __FBSDID("$FreeBSD: head/lib/libarchive/archive_read_support_format_zip.c 201102
 #include "archive_read_private.h"
 #include "archive_ppmd8_private.h"
 
-#ifndef HAVE_ZLIB_H
 #include "archive_crc32.h"
-#endif
 
 struct zip_entry {
 	struct archive_rb_node	node;
@@ -87,6 +85,7 @@ struct zip_entry {
 	int64_t			gid;
 	int64_t			uid;
 	struct archive_string	rsrcname;
+	struct archive_string	name; /* From central directory. */
 	time_t			mtime;
 	time_t			atime;
 	time_t			ctime;
@@ -154,6 +153,10 @@ struct zip {
 	struct zip_entry	*zip_entries;
 	struct archive_rb_tree	tree;
 	struct archive_rb_tree	tree_rsrc;
+	char			tree_walk_started;
+	/* Entries of tree sorted by name, built on first seek. */
+	struct zip_entry	**name_index;
+	size_t			name_index_count;
 
 	/* Bytes read but not yet consumed via __archive_read_consume() */
 	size_t			unconsumed;
@@ -405,7 +408,7 @@ crypt_derive_key_sha1(const void *p, int size, unsigned char *key,
 static unsigned long
 real_crc32(unsigned long crc, const void *buff, size_t len)
 {
-	return crc32(crc, buff, (unsigned int)len);
+	return __archive_crc32(crc, buff, len);
 }
 
 /* Used by "ignorecrc32" option to speed up tests. */
@@ -1751,7 +1754,12 @@ zip_read_data_zipx_xz(struct archive_read *a, const void **buff,
 		return (ARCHIVE_FATAL);
 	}
 
-	in_bytes = zipmin(zip->entry_bytes_remaining, bytes_avail);
+	/* When streaming an entry whose size follows its data, the xz
+	 * stream itself tells us where it ends. */
+	if (zip->entry->zip_flags & ZIP_LENGTH_AT_END)
+		in_bytes = bytes_avail;
+	else
+		in_bytes = zipmin(zip->entry_bytes_remaining, bytes_avail);
 	zip->zipx_lzma_stream.next_in = compressed_buf;
 	zip->zipx_lzma_stream.avail_in = in_bytes;
 	zip->zipx_lzma_stream.total_in = 0;
@@ -1780,7 +1788,8 @@ zip_read_data_zipx_xz(struct archive_read *a, const void **buff,
 			lzma_end(&zip->zipx_lzma_stream);
 			zip->zipx_lzma_valid = 0;
 
-			if((int64_t) zip->zipx_lzma_stream.total_in !=
+			if (0 == (zip->entry->zip_flags & ZIP_LENGTH_AT_END) &&
+			    (int64_t) zip->zipx_lzma_stream.total_in !=
 			    zip->entry_bytes_remaining)
 			{
 				archive_set_error(&a->archive,
@@ -2324,7 +2333,11 @@ zip_read_data_zipx_zstd(struct archive_read *a, const void **buff,
 		return (ARCHIVE_FATAL);
 	}
 
-	in_bytes = zipmin(zip->entry_bytes_remaining, bytes_avail);
+	/* As with xz, a streamed entry ends where its zstd frame does. */
+	if (zip->entry->zip_flags & ZIP_LENGTH_AT_END)
+		in_bytes = bytes_avail;
+	else
+		in_bytes = zipmin(zip->entry_bytes_remaining, bytes_avail);
 	if(in_bytes < 1) {
 		/* zstd doesn't complain when caller feeds avail_in == 0.
 		 * It will actually return success in this case, which is
@@ -2352,7 +2365,9 @@ zip_read_data_zipx_zstd(struct archive_read *a, const void **buff,
 
 	/* Check end of the stream. */
 	if (ret == 0) {
-		if ((in.pos == in.size) && (out.pos < out.size)) {
+		if ((in.pos == in.size ||
+		    (zip->entry->zip_flags & ZIP_LENGTH_AT_END)) &&
+		    (out.pos < out.size)) {
 			zip->end_of_entry = 1;
 			ZSTD_freeDStream(zip->zstdstream);
 			zip->zstdstream_valid = 0;
@@ -3113,10 +3128,12 @@ archive_read_format_zip_cleanup(struct archive_read *a)
 		while (zip_entry != NULL) {
 			next_zip_entry = zip_entry->next;
 			archive_string_free(&zip_entry->rsrcname);
+			archive_string_free(&zip_entry->name);
 			free(zip_entry);
 			zip_entry = next_zip_entry;
 		}
 	}
+	free(zip->name_index);
 	free(zip->decrypted_buffer);
 	if (zip->cctx_valid)
 		archive_decrypto_aes_ctr_release(&zip->cctx);
@@ -3841,7 +3858,9 @@ slurp_central_directory(struct archive_read *a, struct archive_entry* entry,
 			zip->has_encrypted_entries = 1;
 		}
 		zip_entry->compression = (char)archive_le16dec(p + 10);
-		zip_entry->mtime = zip_time(p + 12);
+		/* The mtime at p + 12 is skipped: the local file header
+		 * carries it too and mktime() is too slow to spend on
+		 * every entry up front. */
 		zip_entry->crc32 = archive_le32dec(p + 16);
 		if (zip_entry->zip_flags & ZIP_LENGTH_AT_END)
 			zip_entry->decdat = p[13];
@@ -3895,6 +3914,7 @@ slurp_central_directory(struct archive_read *a, struct archive_entry* entry,
 		    extra_length, zip_entry)) {
 			return ARCHIVE_FATAL;
 		}
+		archive_strncpy(&zip_entry->name, p, filename_length);
 
 		/*
 		 * Mac resource fork files are stored under the
@@ -4129,47 +4149,18 @@ exit_mac_metadata:
 	return (ret);
 }
 
+/*
+ * Read the local file header of zip->entry, along with its Mac
+ * metadata if any.
+ */
 static int
-archive_read_format_zip_seekable_read_header(struct archive_read *a,
-	struct archive_entry *entry)
+zip_read_seekable_entry(struct archive_read *a, struct archive_entry *entry,
+    struct zip *zip)
 {
-	struct zip *zip = (struct zip *)a->format->data;
 	struct zip_entry *rsrc;
 	int64_t offset;
 	int r, ret = ARCHIVE_OK;
 
-	/*
-	 * It should be sufficient to call archive_read_next_header() for
-	 * a reader to determine if an entry is encrypted or not. If the
-	 * encryption of an entry is only detectable when calling
-	 * archive_read_data(), so be it. We'll do the same check there
-	 * as well.
-	 */
-	if (zip->has_encrypted_entries ==
-			ARCHIVE_READ_FORMAT_ENCRYPTION_DONT_KNOW)
-		zip->has_encrypted_entries = 0;
-
-	a->archive.archive_format = ARCHIVE_FORMAT_ZIP;
-	if (a->archive.archive_format_name == NULL)
-		a->archive.archive_format_name = "ZIP";
-
-	if (zip->zip_entries == NULL) {
-		r = slurp_central_directory(a, entry, zip);
-		if (r != ARCHIVE_OK)
-			return r;
-		/* Get first entry whose local header offset is lower than
-		 * other entries in the archive file. */
-		zip->entry =
-		    (struct zip_entry *)ARCHIVE_RB_TREE_MIN(&zip->tree);
-	} else if (zip->entry != NULL) {
-		/* Get next entry in local header offset order. */
-		zip->entry = (struct zip_entry *)__archive_rb_tree_iterate(
-		    &zip->tree, &zip->entry->node, ARCHIVE_RB_DIR_RIGHT);
-	}
-
-	if (zip->entry == NULL)
-		return ARCHIVE_EOF;
-
 	if (zip->entry->rsrcname.s)
 		rsrc = (struct zip_entry *)__archive_rb_tree_find_node(
 		    &zip->tree_rsrc, zip->entry->rsrcname.s);
@@ -4206,6 +4197,144 @@ archive_read_format_zip_seekable_read_header(struct archive_read *a,
 	return (ret);
 }
 
+static int
+zip_seekable_read_directory(struct archive_read *a,
+	struct archive_entry *entry, struct zip *zip)
+{
+	/*
+	 * It should be sufficient to call archive_read_next_header() for
+	 * a reader to determine if an entry is encrypted or not. If the
+	 * encryption of an entry is only detectable when calling
+	 * archive_read_data(), so be it. We'll do the same check there
+	 * as well.
+	 */
+	if (zip->has_encrypted_entries ==
+			ARCHIVE_READ_FORMAT_ENCRYPTION_DONT_KNOW)
+		zip->has_encrypted_entries = 0;
+
+	a->archive.archive_format = ARCHIVE_FORMAT_ZIP;
+	if (a->archive.archive_format_name == NULL)
+		a->archive.archive_format_name = "ZIP";
+
+	if (zip->zip_entries != NULL)
+		return (ARCHIVE_OK);
+	return (slurp_central_directory(a, entry, zip));
+}
+
+static int
+archive_read_format_zip_seekable_read_header(struct archive_read *a,
+	struct archive_entry *entry)
+{
+	struct zip *zip = (struct zip *)a->format->data;
+	int r;
+
+	r = zip_seekable_read_directory(a, entry, zip);
+	if (r != ARCHIVE_OK)
+		return r;
+	if (!zip->tree_walk_started) {
+		/* Get first entry whose local header offset is lower than
+		 * other entries in the archive file. */
+		zip->entry =
+		    (struct zip_entry *)ARCHIVE_RB_TREE_MIN(&zip->tree);
+		zip->tree_walk_started = 1;
+	} else if (zip->entry != NULL) {
+		/* Get next entry in local header offset order. */
+		zip->entry = (struct zip_entry *)__archive_rb_tree_iterate(
+		    &zip->tree, &zip->entry->node, ARCHIVE_RB_DIR_RIGHT);
+	}
+
+	if (zip->entry == NULL)
+		return ARCHIVE_EOF;
+
+	return (zip_read_seekable_entry(a, entry, zip));
+}
+
+static int
+cmp_name_index(const void *p1, const void *p2)
+{
+	const struct zip_entry *e1 = *(const struct zip_entry * const *)p1;
+	const struct zip_entry *e2 = *(const struct zip_entry * const *)p2;
+	int r;
+
+	r = strcmp(e1->name.s, e2->name.s);
+	if (r != 0)
+		return (r);
+	if (e1->local_header_offset < e2->local_header_offset)
+		return (-1);
+	return (e1->local_header_offset > e2->local_header_offset);
+}
+
+static int
+build_name_index(struct archive_read *a, struct zip *zip)
+{
+	struct archive_rb_node *n;
+	size_t count = 0;
+
+	ARCHIVE_RB_TREE_FOREACH(n, &zip->tree)
+		count++;
+	zip->name_index = calloc(count ? count : 1,
+	    sizeof(*zip->name_index));
+	if (zip->name_index == NULL) {
+		archive_set_error(&a->archive, ENOMEM,
+		    "Can't allocate zip name index");
+		return (ARCHIVE_FATAL);
+	}
+	count = 0;
+	ARCHIVE_RB_TREE_FOREACH(n, &zip->tree) {
+		struct zip_entry *e = (struct zip_entry *)n;
+		if (e->name.s != NULL)
+			zip->name_index[count++] = e;
+	}
+	qsort(zip->name_index, count, sizeof(*zip->name_index),
+	    cmp_name_index);
+	zip->name_index_count = count;
+	return (ARCHIVE_OK);
+}
+
+/*
+ * Look up an entry by its central directory name and read its
+ * header.  When a name occurs more than once, the last copy in the
+ * archive wins, as it would on extraction.
+ */
+static int
+archive_read_format_zip_seek_entry(struct archive_read *a,
+	const char *pathname, struct archive_entry *entry)
+{
+	struct zip *zip = (struct zip *)a->format->data;
+	size_t lo, hi, mid;
+	int r;
+
+	r = zip_seekable_read_directory(a, entry, zip);
+	if (r != ARCHIVE_OK)
+		return r;
+	if (zip->name_index == NULL) {
+		r = build_name_index(a, zip);
+		if (r != ARCHIVE_OK)
+			return r;
+	}
+
+	/* Find the first element whose name sorts after pathname. */
+	lo = 0;
+	hi = zip->name_index_count;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (strcmp(zip->name_index[mid]->name.s, pathname) <= 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == 0 || strcmp(zip->name_index[lo - 1]->name.s, pathname)) {
+		archive_set_error(&a->archive, ENOENT,
+		    "%s: entry not found", pathname);
+		return (ARCHIVE_FAILED);
+	}
+
+	archive_entry_clear(entry);
+	zip->entry = zip->name_index[lo - 1];
+	zip->tree_walk_started = 1;
+	return (zip_read_seekable_entry(a, entry, zip));
+}
+
 /*
  * We're going to seek for the next header anyway, so we don't
  * need to bother doing anything here.
@@ -4262,8 +4391,13 @@ archive_read_support_format_zip_seekable(struct archive *_a)
 	    archive_read_support_format_zip_capabilities_seekable,
 	    archive_read_format_zip_has_encrypted_entries);
 
-	if (r != ARCHIVE_OK)
+	if (r != ARCHIVE_OK) {
 		free(zip);
+		return (ARCHIVE_OK);
+	}
+	__archive_read_register_format_seek_entry(a,
+	    archive_read_format_zip_seekable_bid,
+	    archive_read_format_zip_seek_entry);
 	return (ARCHIVE_OK);
 }
 
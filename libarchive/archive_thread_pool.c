@@ -0,0 +1,330 @@
+/*-
+ * Copyright (c) 2026 The libarchive developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "archive_platform.h"
+__FBSDID("$FreeBSD$");
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#if defined(HAVE_PTHREAD_H) && defined(HAVE_LIBPTHREAD)
+#include <pthread.h>
+#define ARCHIVE_THREAD_POOL_USE_PTHREAD
+#endif
+
+#include "archive.h"
+#include "archive_thread_pool_private.h"
+
+/* Upper bound on the number of worker threads in one pool. */
+#define MAX_THREADS	256
+
+#define JOB_QUEUED	1
+#define JOB_RUNNING	2
+#define JOB_DONE	3
+
+struct archive_thread_pool {
+	int			  nthreads;
+#ifdef ARCHIVE_THREAD_POOL_USE_PTHREAD
+	pthread_t		 *threads;
+	pthread_mutex_t		  lock;
+	pthread_cond_t		  work;	/* Signaled when a job is queued. */
+	pthread_cond_t		  done;	/* Signaled when a job finished. */
+	struct archive_thread_job *first;
+	struct archive_thread_job **last;
+	int			  shutdown;
+#endif
+};
+
+int
+__archive_thread_pool_cpus(void)
+{
+#if defined(_WIN32) && !defined(__CYGWIN__)
+	SYSTEM_INFO si;
+
+	GetSystemInfo(&si);
+	if (si.dwNumberOfProcessors > 0)
+		return ((int)si.dwNumberOfProcessors);
+#elif defined(_SC_NPROCESSORS_ONLN)
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (n > MAX_THREADS)
+		return (MAX_THREADS);
+	if (n > 0)
+		return ((int)n);
+#endif
+	return (1);
+}
+
+#ifdef ARCHIVE_THREAD_POOL_USE_PTHREAD
+
+static void *
+worker_main(void *arg)
+{
+	struct archive_thread_pool *pool = arg;
+	struct archive_thread_job *job;
+
+	pthread_mutex_lock(&pool->lock);
+	for (;;) {
+		while (pool->first == NULL && !pool->shutdown)
+			pthread_cond_wait(&pool->work, &pool->lock);
+		if (pool->first == NULL)
+			break;
+		job = pool->first;
+		pool->first = job->next;
+		if (pool->first == NULL)
+			pool->last = &pool->first;
+		job->state = JOB_RUNNING;
+		pthread_mutex_unlock(&pool->lock);
+
+		job->run(job->arg);
+
+		pthread_mutex_lock(&pool->lock);
+		job->state = JOB_DONE;
+		pthread_cond_broadcast(&pool->done);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return (NULL);
+}
+
+#endif /* ARCHIVE_THREAD_POOL_USE_PTHREAD */
+
+struct archive_thread_pool *
+__archive_thread_pool_new(int threads)
+{
+	struct archive_thread_pool *pool;
+
+	pool = calloc(1, sizeof(*pool));
+	if (pool == NULL)
+		return (NULL);
+	if (threads > MAX_THREADS)
+		threads = MAX_THREADS;
+#ifdef ARCHIVE_THREAD_POOL_USE_PTHREAD
+	pool->first = NULL;
+	pool->last = &pool->first;
+	if (threads <= 1)
+		return (pool);
+	pool->threads = calloc(threads, sizeof(pool->threads[0]));
+	if (pool->threads == NULL) {
+		free(pool);
+		return (NULL);
+	}
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work, NULL);
+	pthread_cond_init(&pool->done, NULL);
+	/* If the system refuses to give us as many threads as asked
+	 * for, just run with the ones we got. */
+	while (pool->nthreads < threads) {
+		if (pthread_create(&pool->threads[pool->nthreads], NULL,
+		    worker_main, pool) != 0)
+			break;
+		pool->nthreads++;
+	}
+	if (pool->nthreads == 0) {
+		pthread_cond_destroy(&pool->done);
+		pthread_cond_destroy(&pool->work);
+		pthread_mutex_destroy(&pool->lock);
+		free(pool->threads);
+		pool->threads = NULL;
+	}
+#else
+	(void)threads; /* UNUSED */
+#endif
+	return (pool);
+}
+
+int
+__archive_thread_pool_threads(struct archive_thread_pool *pool)
+{
+	return (pool->nthreads);
+}
+
+void
+__archive_thread_pool_submit(struct archive_thread_pool *pool,
+    struct archive_thread_job *job)
+{
+	job->next = NULL;
+#ifdef ARCHIVE_THREAD_POOL_USE_PTHREAD
+	if (pool->nthreads > 0) {
+		pthread_mutex_lock(&pool->lock);
+		job->state = JOB_QUEUED;
+		*pool->last = job;
+		pool->last = &job->next;
+		pthread_cond_signal(&pool->work);
+		pthread_mutex_unlock(&pool->lock);
+		return;
+	}
+#else
+	(void)pool; /* UNUSED */
+#endif
+	job->state = JOB_RUNNING;
+	job->run(job->arg);
+	job->state = JOB_DONE;
+}
+
+void
+__archive_thread_pool_wait(struct archive_thread_pool *pool,
+    struct archive_thread_job *job)
+{
+#ifdef ARCHIVE_THREAD_POOL_USE_PTHREAD
+	struct archive_thread_job **jp;
+
+	if (pool->nthreads == 0)
+		return;
+	pthread_mutex_lock(&pool->lock);
+	if (job->state == JOB_QUEUED) {
+		/* Nobody has started it yet; run it here rather than
+		 * sit idle. */
+		for (jp = &pool->first; *jp != job; jp = &(*jp)->next)
+			continue;
+		*jp = job->next;
+		if (pool->last == &job->next)
+			pool->last = jp;
+		job->state = JOB_RUNNING;
+		pthread_mutex_unlock(&pool->lock);
+		job->run(job->arg);
+		pthread_mutex_lock(&pool->lock);
+		job->state = JOB_DONE;
+	}
+	while (job->state != JOB_DONE)
+		pthread_cond_wait(&pool->done, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+#else
+	(void)pool; /* UNUSED */
+	(void)job; /* UNUSED */
+#endif
+}
+
+void
+__archive_thread_pool_free(struct archive_thread_pool *pool)
+{
+	if (pool == NULL)
+		return;
+#ifdef ARCHIVE_THREAD_POOL_USE_PTHREAD
+	if (pool->nthreads > 0) {
+		int i;
+
+		pthread_mutex_lock(&pool->lock);
+		pool->shutdown = 1;
+		pthread_cond_broadcast(&pool->work);
+		pthread_mutex_unlock(&pool->lock);
+		for (i = 0; i < pool->nthreads; i++)
+			pthread_join(pool->threads[i], NULL);
+		pthread_cond_destroy(&pool->done);
+		pthread_cond_destroy(&pool->work);
+		pthread_mutex_destroy(&pool->lock);
+	}
+	free(pool->threads);
+#endif
+	free(pool);
+}
+
+int
+__archive_thread_ring_init(struct archive_thread_ring *ring, int threads,
+    size_t slot_size, void (*run)(void *))
+{
+	struct archive_thread_job *job;
+	int i, n;
+
+	ring->pool = __archive_thread_pool_new(threads);
+	if (ring->pool == NULL)
+		return (ARCHIVE_FATAL);
+	n = __archive_thread_pool_threads(ring->pool);
+	ring->nslots = (n > 0 ? n : 1) * 2;
+	ring->slots = calloc(ring->nslots, slot_size);
+	if (ring->slots == NULL) {
+		__archive_thread_pool_free(ring->pool);
+		ring->pool = NULL;
+		return (ARCHIVE_FATAL);
+	}
+	ring->slot_size = slot_size;
+	ring->first = 0;
+	ring->pending = 0;
+	for (i = 0; i < ring->nslots; i++) {
+		job = (struct archive_thread_job *)
+		    (ring->slots + i * slot_size);
+		job->run = run;
+		job->arg = job;
+	}
+	return (ARCHIVE_OK);
+}
+
+void *
+__archive_thread_ring_next(struct archive_thread_ring *ring)
+{
+	if (ring->pending == ring->nslots)
+		return (NULL);
+	return (__archive_thread_ring_pending(ring, ring->pending));
+}
+
+void
+__archive_thread_ring_submit(struct archive_thread_ring *ring)
+{
+	__archive_thread_pool_submit(ring->pool,
+	    __archive_thread_ring_pending(ring, ring->pending));
+	ring->pending++;
+}
+
+void *
+__archive_thread_ring_reap(struct archive_thread_ring *ring)
+{
+	struct archive_thread_job *job;
+
+	if (ring->pending == 0)
+		return (NULL);
+	job = __archive_thread_ring_pending(ring, 0);
+	__archive_thread_pool_wait(ring->pool, job);
+	ring->first = (ring->first + 1) % ring->nslots;
+	ring->pending--;
+	return (job);
+}
+
+void *
+__archive_thread_ring_pending(struct archive_thread_ring *ring, int i)
+{
+	return (ring->slots +
+	    ((ring->first + i) % ring->nslots) * ring->slot_size);
+}
+
+void
+__archive_thread_ring_free(struct archive_thread_ring *ring,
+    void (*release)(void *))
+{
+	int i;
+
+	if (ring->pool == NULL)
+		return;
+	/* Let the workers finish before the slots go away. */
+	__archive_thread_pool_free(ring->pool);
+	ring->pool = NULL;
+	if (release != NULL) {
+		for (i = 0; i < ring->nslots; i++)
+			release(ring->slots + i * ring->slot_size);
+	}
+	free(ring->slots);
+	ring->slots = NULL;
+}
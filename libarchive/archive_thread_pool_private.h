@@ -0,0 +1,113 @@
+/*-
+ * Copyright (c) 2026 The libarchive developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef ARCHIVE_THREAD_POOL_PRIVATE_H_INCLUDED
+#define ARCHIVE_THREAD_POOL_PRIVATE_H_INCLUDED
+
+#ifndef __LIBARCHIVE_BUILD
+#error This header is only to be used internally to libarchive.
+#endif
+
+/*
+ * A minimal worker pool used by filters and formats that can split
+ * their work into independent jobs.
+ *
+ * The caller owns every job structure.  Jobs are submitted in the
+ * order the caller wants to consume them and are then waited for in
+ * that same order, which keeps the output of the archive stream
+ * deterministic regardless of which worker ran which job.
+ *
+ * Workers never touch the archive object; a job must only work on
+ * memory the caller handed to it.  On platforms without thread
+ * support, or when a pool has a single thread, jobs run synchronously
+ * inside __archive_thread_pool_submit().
+ */
+struct archive_thread_pool;
+
+struct archive_thread_job {
+	void			(*run)(void *);
+	void			 *arg;
+	/* The following fields are private to the pool. */
+	struct archive_thread_job *next;
+	int			  state;
+};
+
+/* Returns the number of online processors, at least 1. */
+int	__archive_thread_pool_cpus(void);
+/* Create a pool with the given number of worker threads.
+ * Returns NULL on memory allocation failure. */
+struct archive_thread_pool *__archive_thread_pool_new(int threads);
+/* Number of worker threads actually running; 0 means jobs run
+ * synchronously. */
+int	__archive_thread_pool_threads(struct archive_thread_pool *);
+void	__archive_thread_pool_submit(struct archive_thread_pool *,
+	    struct archive_thread_job *);
+/* Block until the given job has run.  A job that no worker has picked
+ * up yet is run by the calling thread. */
+void	__archive_thread_pool_wait(struct archive_thread_pool *,
+	    struct archive_thread_job *);
+/* Run any remaining jobs, stop the workers and release the pool. */
+void	__archive_thread_pool_free(struct archive_thread_pool *);
+
+/*
+ * An ordered ring of job slots on top of a pool, for callers that
+ * fill in one job at a time and consume the results in that same
+ * order.  A slot is a caller structure of slot_size bytes whose first
+ * member is its struct archive_thread_job.  There are two slots for
+ * every worker, so that each worker has a job queued behind the one
+ * it is running while the caller fills in the next.
+ */
+struct archive_thread_ring {
+	struct archive_thread_pool *pool;	/* NULL until initialized. */
+	char			 *slots;
+	size_t			  slot_size;
+	int			  nslots;
+	int			  first;	/* Oldest pending slot. */
+	int			  pending;	/* Submitted, not yet reaped. */
+};
+
+/* Create the pool and the zeroed slots, whose jobs call run() with
+ * the slot as argument.  Returns ARCHIVE_FATAL on memory allocation
+ * failure, leaving the ring uninitialized. */
+int	__archive_thread_ring_init(struct archive_thread_ring *, int threads,
+	    size_t slot_size, void (*run)(void *));
+/* The slot to fill in the next job in, or NULL while every slot is
+ * pending and the oldest must be reaped first. */
+void	*__archive_thread_ring_next(struct archive_thread_ring *);
+/* Submit the slot __archive_thread_ring_next() returned. */
+void	__archive_thread_ring_submit(struct archive_thread_ring *);
+/* Wait for the oldest pending job and return its slot, or NULL if
+ * nothing is pending.  The slot is reused once the caller asks for
+ * the next one. */
+void	*__archive_thread_ring_reap(struct archive_thread_ring *);
+/* The i-th slot, counting from the oldest pending one; those from
+ * ring->pending up to ring->nslots - 1 are free. */
+void	*__archive_thread_ring_pending(struct archive_thread_ring *, int);
+/* Run any pending jobs, stop the workers, pass every slot to
+ * release(), if not NULL, and free the slots. */
+void	__archive_thread_ring_free(struct archive_thread_ring *,
+	    void (*release)(void *));
+
+#endif /* ARCHIVE_THREAD_POOL_PRIVATE_H_INCLUDED */
@@ -580,6 +580,44 @@ __archive_ensure_cloexec_flag(int fd)
 #endif
 }
 
+/*
+ * Return the number of zero bytes at the start of the buffer.
+ * Sparse file handling calls this on every block it writes or
+ * reads, so the bulk of the buffer is tested a word at a time.
+ */
+size_t
+__archive_zero_run(const void *buff, size_t size)
+{
+	const unsigned char *p = (const unsigned char *)buff;
+	const unsigned char *end = p + size;
+	uint64_t w[4];
+
+	/* Step to an aligned address a byte at a time. */
+	while (p < end && ((uintptr_t)p & (sizeof(w[0]) - 1)) != 0) {
+		if (*p != 0)
+			return (p - (const unsigned char *)buff);
+		p++;
+	}
+	/* OR four words together so that there is a single branch
+	 * per 32 bytes; the compiler turns this into vector loads. */
+	while ((size_t)(end - p) >= sizeof(w)) {
+		memcpy(w, p, sizeof(w));
+		if ((w[0] | w[1] | w[2] | w[3]) != 0)
+			break;
+		p += sizeof(w);
+	}
+	while ((size_t)(end - p) >= sizeof(w[0])) {
+		memcpy(w, p, sizeof(w[0]));
+		if (w[0] != 0)
+			break;
+		p += sizeof(w[0]);
+	}
+	/* Find the exact byte. */
+	while (p < end && *p == 0)
+		p++;
+	return (p - (const unsigned char *)buff);
+}
+
 /*
  * Utility function to sort a group of strings using quicksort.
  */
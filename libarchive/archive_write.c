@@ -34,12 +34,18 @@ __FBSDID("$FreeBSD: head/lib/libarchive/archive_write.c 201099 2009-12-28 03:03:
  * needlessly bloating statically-linked clients.
  */
 
+#ifdef HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
 #ifdef HAVE_SYS_WAIT_H
 #include <sys/wait.h>
 #endif
 #ifdef HAVE_ERRNO_H
 #include <errno.h>
 #endif
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
 #ifdef HAVE_LIMITS_H
 #include <limits.h>
 #endif
@@ -69,6 +75,8 @@ static int	_archive_write_free(struct archive *);
 static int	_archive_write_header(struct archive *, struct archive_entry *);
 static int	_archive_write_finish_entry(struct archive *);
 static ssize_t	_archive_write_data(struct archive *, const void *, size_t);
+static int	archive_write_client_write(struct archive_write_filter *,
+		    const void *, size_t);
 
 struct archive_none {
 	size_t buffer_size;
@@ -77,6 +85,9 @@ struct archive_none {
 	char *next;
 };
 
+/* Chunk size for entry data read from a file descriptor. */
+#define	READ_FD_BUFF_SIZE	(64 * 1024)
+
 static const struct archive_vtable
 archive_write_vtable = {
 	.archive_close = _archive_write_close,
@@ -112,6 +123,7 @@ archive_write_new(void)
 	 */
 	a->bytes_per_block = 10240;
 	a->bytes_in_last_block = -1;	/* Default */
+	a->client_fd = -1;
 
 	/* Initialize a block of nulls for padding purposes. */
 	a->null_length = 1024;
@@ -310,6 +322,346 @@ __archive_write_output(struct archive_write *a, const void *buff, size_t length)
 	return (__archive_write_filter(a->filter_first, buff, length));
 }
 
+static ssize_t
+read_at(int fd, void *buff, size_t length, int64_t offset)
+{
+	ssize_t bytes;
+
+	do {
+#if defined(HAVE_PREAD)
+		bytes = pread(fd, buff, length, (off_t)offset);
+#else
+		if (lseek(fd, (off_t)offset, SEEK_SET) < 0)
+			return (-1);
+		bytes = read(fd, buff, length);
+#endif
+	} while (bytes < 0 && errno == EINTR);
+	return (bytes);
+}
+
+#if defined(HAVE_COPY_FILE_RANGE) || defined(HAVE_SPLICE)
+/*
+ * Have the kernel copy length bytes of fd, starting at offset, to the
+ * client's descriptor.  Returns the bytes copied, 0 at the end of fd,
+ * or -1 if the kernel cannot copy between these two files.
+ */
+static ssize_t
+kernel_copy(struct archive_write *a, int fd, int64_t offset, size_t length)
+{
+	off_t off = (off_t)offset;
+	size_t done = 0;
+	ssize_t bytes;
+
+	while (done < length) {
+		bytes = -1;
+#if defined(HAVE_COPY_FILE_RANGE)
+		if (a->client_fd_type == S_IFREG)
+			bytes = copy_file_range(fd, &off, a->client_fd, NULL,
+			    length - done, 0);
+#endif
+#if defined(HAVE_SPLICE)
+		if (a->client_fd_type == S_IFIFO)
+			bytes = splice(fd, &off, a->client_fd, NULL,
+			    length - done, 0);
+#endif
+		if (bytes < 0 && errno == EINTR)
+			continue;
+		if (bytes <= 0)
+			return (done > 0 ? (ssize_t)done : bytes);
+		done += bytes;
+	}
+	return (done);
+}
+#endif
+
+/*
+ * Write length bytes of fd, starting at offset, to the output.  When no
+ * filter transforms the data and the client writes to a file or pipe,
+ * the kernel copies the whole blocks; pieces that share a block with
+ * other data still go through the block buffer, so the output is the
+ * same as with __archive_write_output().  Returns the bytes written,
+ * fewer if fd ends early, or ARCHIVE_WARN, before writing anything, if
+ * the caller should read the data and write it as usual.
+ */
+ssize_t
+__archive_write_output_fd(struct archive_write *a, int fd, int64_t offset,
+    size_t length)
+{
+#if defined(HAVE_COPY_FILE_RANGE) || defined(HAVE_SPLICE)
+	struct archive_write_filter *f = a->filter_first;
+	struct archive_none *state;
+	char *buff = NULL;
+	size_t done = 0, n;
+	ssize_t bytes;
+	int kernel = 1, r;
+
+	if (a->client_fd < 0 || f == NULL ||
+	    f->write != archive_write_client_write ||
+	    f->state != ARCHIVE_WRITE_FILTER_STATE_OPEN)
+		return (ARCHIVE_WARN);
+#if !defined(HAVE_COPY_FILE_RANGE)
+	if (a->client_fd_type == S_IFREG)
+		return (ARCHIVE_WARN);
+#endif
+	state = (struct archive_none *)f->data;
+	while (done < length) {
+		n = length - done;
+		if (kernel && (state->buffer_size == 0 ||
+		    (state->avail == state->buffer_size &&
+		     n >= state->buffer_size))) {
+			if (state->buffer_size > 0)
+				n -= n % state->buffer_size;
+			bytes = kernel_copy(a, fd, offset + done, n);
+			if (bytes > 0) {
+				f->bytes_written += bytes;
+				done += bytes;
+			} else
+				/* Unsupported, or the end of fd; the read
+				 * below tells which. */
+				kernel = 0;
+			continue;
+		}
+		/* Fill up the block that is being buffered. */
+		if (state->avail < state->buffer_size && n > state->avail)
+			n = state->avail;
+		if (n > READ_FD_BUFF_SIZE)
+			n = READ_FD_BUFF_SIZE;
+		if (buff == NULL &&
+		    (buff = malloc(READ_FD_BUFF_SIZE)) == NULL) {
+			archive_set_error(&a->archive, ENOMEM,
+			    "Can't allocate read buffer");
+			return (ARCHIVE_FATAL);
+		}
+		bytes = read_at(fd, buff, n, offset + done);
+		if (bytes < 0) {
+			archive_set_error(&a->archive, errno, "Read error");
+			free(buff);
+			return (ARCHIVE_FATAL);
+		}
+		if (bytes == 0)
+			break;
+		r = __archive_write_filter(f, buff, bytes);
+		if (r != ARCHIVE_OK) {
+			free(buff);
+			return (r);
+		}
+		done += bytes;
+	}
+	free(buff);
+	return (done);
+#else
+	(void)a; /* UNUSED */
+	(void)fd; /* UNUSED */
+	(void)offset; /* UNUSED */
+	(void)length; /* UNUSED */
+	return (ARCHIVE_WARN);
+#endif
+}
+
+/*
+ * Note the descriptor the client writes to, if it is a regular file,
+ * which formats may rewrite in place, or a pipe the kernel can copy
+ * file data to.
+ */
+void
+__archive_write_set_client_fd(struct archive *_a, int fd)
+{
+#if defined(HAVE_PWRITE) || defined(HAVE_COPY_FILE_RANGE) || \
+    defined(HAVE_SPLICE)
+	struct archive_write *a = (struct archive_write *)_a;
+	struct stat st;
+	int flags;
+
+	if (fstat(fd, &st) != 0)
+		return;
+	if (S_ISREG(st.st_mode)) {
+		a->client_fd = fd;
+		a->client_fd_type = S_IFREG;
+		a->client_fd_offset = lseek(fd, 0, SEEK_CUR);
+		/* Rewriting needs to read back, and pwrite(2) ignores
+		 * the offset in append mode. */
+		flags = fcntl(fd, F_GETFL);
+		if (flags == -1 || (flags & O_ACCMODE) != O_RDWR ||
+		    (flags & O_APPEND) != 0)
+			a->client_fd_offset = -1;
+	}
+#if defined(HAVE_SPLICE)
+	if (S_ISFIFO(st.st_mode)) {
+		a->client_fd = fd;
+		a->client_fd_type = S_IFIFO;
+	}
+#endif
+#else
+	(void)_a; /* UNUSED */
+	(void)fd; /* UNUSED */
+#endif
+}
+
+/*
+ * Return non-zero if the formats may read back and rewrite the output:
+ * no filter transforms it and the client writes to a regular file that
+ * is open for reading as well.
+ */
+int
+__archive_write_seekable(struct archive_write *a)
+{
+#if defined(HAVE_PWRITE)
+	struct archive_write_filter *f = a->filter_first;
+
+	return (a->client_fd >= 0 && a->client_fd_type == S_IFREG &&
+	    a->client_fd_offset >= 0 && f != NULL &&
+	    f->write == archive_write_client_write &&
+	    f->state == ARCHIVE_WRITE_FILTER_STATE_OPEN);
+#else
+	(void)a; /* UNUSED */
+	return (0);
+#endif
+}
+
+/*
+ * Overwrite output at offset.  The part still in the block buffer is
+ * changed there, the rest with pwrite(2); anything past the end of the
+ * output is appended.
+ */
+int
+__archive_write_output_at(struct archive_write *a, int64_t offset,
+    const void *_buff, size_t length)
+{
+#if defined(HAVE_PWRITE)
+	struct archive_write_filter *f = a->filter_first;
+	struct archive_none *state = (struct archive_none *)f->data;
+	const char *buff = (const char *)_buff;
+	int64_t end, flushed;
+	ssize_t bytes;
+	size_t n;
+
+	end = f->bytes_written;
+	flushed = end - (state->buffer_size - state->avail);
+	if (offset < 0 || offset > end) {
+		archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+		    "Invalid output offset");
+		return (ARCHIVE_FATAL);
+	}
+	while (length > 0 && offset < flushed) {
+		n = length;
+		if ((int64_t)n > flushed - offset)
+			n = (size_t)(flushed - offset);
+		bytes = pwrite(a->client_fd, buff, n,
+		    (off_t)(a->client_fd_offset + offset));
+		if (bytes < 0 && errno == EINTR)
+			continue;
+		if (bytes <= 0) {
+			archive_set_error(&a->archive, errno,
+			    "Can't rewrite output");
+			return (ARCHIVE_FATAL);
+		}
+		buff += bytes;
+		offset += bytes;
+		length -= bytes;
+	}
+	if (length > 0 && offset < end) {
+		n = length;
+		if ((int64_t)n > end - offset)
+			n = (size_t)(end - offset);
+		memcpy(state->buffer + (offset - flushed), buff, n);
+		buff += n;
+		length -= n;
+	}
+	return (__archive_write_filter(f, buff, length));
+#else
+	(void)offset; /* UNUSED */
+	(void)_buff; /* UNUSED */
+	(void)length; /* UNUSED */
+	archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+	    "Can't rewrite output");
+	return (ARCHIVE_FATAL);
+#endif
+}
+
+/*
+ * Read back length bytes of output, starting at offset.
+ */
+int
+__archive_write_read_output(struct archive_write *a, int64_t offset,
+    void *_buff, size_t length)
+{
+	struct archive_write_filter *f = a->filter_first;
+	struct archive_none *state = (struct archive_none *)f->data;
+	char *buff = (char *)_buff;
+	int64_t end, flushed;
+	ssize_t bytes;
+	size_t n;
+
+	end = f->bytes_written;
+	flushed = end - (state->buffer_size - state->avail);
+	if (offset < 0 || offset + (int64_t)length > end) {
+		archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+		    "Invalid output offset");
+		return (ARCHIVE_FATAL);
+	}
+	while (length > 0 && offset < flushed) {
+		n = length;
+		if ((int64_t)n > flushed - offset)
+			n = (size_t)(flushed - offset);
+		bytes = read_at(a->client_fd, buff, n,
+		    a->client_fd_offset + offset);
+		if (bytes <= 0) {
+			archive_set_error(&a->archive, errno,
+			    "Can't read back output");
+			return (ARCHIVE_FATAL);
+		}
+		buff += bytes;
+		offset += bytes;
+		length -= bytes;
+	}
+	if (length > 0)
+		memcpy(buff, state->buffer + (offset - flushed), length);
+	return (ARCHIVE_OK);
+}
+
+/*
+ * Move length bytes of output from one offset to another, extending the
+ * output if the target runs past its end.
+ */
+int
+__archive_write_move_output(struct archive_write *a, int64_t from,
+    int64_t to, int64_t length)
+{
+	int64_t end, done;
+	char *buff;
+	size_t n;
+	int r;
+
+	end = a->filter_first->bytes_written;
+	if (to + length > end) {
+		r = __archive_write_nulls(a, (size_t)(to + length - end));
+		if (r != ARCHIVE_OK)
+			return (r);
+	}
+	buff = malloc(READ_FD_BUFF_SIZE);
+	if (buff == NULL) {
+		archive_set_error(&a->archive, ENOMEM,
+		    "Can't allocate move buffer");
+		return (ARCHIVE_FATAL);
+	}
+	r = ARCHIVE_OK;
+	for (done = 0; done < length && r == ARCHIVE_OK; done += n) {
+		int64_t off;
+
+		n = READ_FD_BUFF_SIZE;
+		if ((int64_t)n > length - done)
+			n = (size_t)(length - done);
+		/* Copy from the end when moving forward, so that no
+		 * source byte is overwritten before it is read. */
+		off = (to > from) ? length - done - (int64_t)n : done;
+		r = __archive_write_read_output(a, from + off, buff, n);
+		if (r == ARCHIVE_OK)
+			r = __archive_write_output_at(a, to + off, buff, n);
+	}
+	free(buff);
+	return (r);
+}
+
 int
 __archive_write_nulls(struct archive_write *a, size_t length)
 {
@@ -355,6 +707,7 @@ archive_write_client_open(struct archive_write_filter *f)
 	state->next = state->buffer;
 	state->avail = state->buffer_size;
 	f->data = state;
+	a->client_fd = -1;
 
 	if (a->client_opener == NULL)
 		return (ARCHIVE_OK);
@@ -521,6 +874,7 @@ archive_write_client_close(struct archive_write_filter *f)
 	}
 	if (a->client_closer)
 		(*a->client_closer)(&a->archive, a->client_data);
+	a->client_fd = -1;
 	free(state->buffer);
 	free(state);
 
@@ -790,6 +1144,63 @@ _archive_write_data(struct archive *_a, const void *buff, size_t s)
 	return ((a->format_write_data)(a, buff, s));
 }
 
+/*
+ * Write s bytes of entry data read from fd, starting at offset.
+ */
+la_ssize_t
+archive_write_data_from_fd(struct archive *_a, int fd, la_int64_t offset,
+    size_t s)
+{
+	struct archive_write *a = (struct archive_write *)_a;
+	const size_t max_write = INT_MAX;
+	char *buff;
+	size_t done = 0, n;
+	ssize_t bytes, w;
+
+	if (_a->magic == ARCHIVE_WRITE_MAGIC) {
+		archive_check_magic(&a->archive, ARCHIVE_WRITE_MAGIC,
+		    ARCHIVE_STATE_DATA, "archive_write_data_from_fd");
+		if (s > max_write)
+			s = max_write;
+		archive_clear_error(&a->archive);
+		if (a->format_write_data_fd != NULL) {
+			bytes = (a->format_write_data_fd)(a, fd, offset, s);
+			if (bytes != ARCHIVE_WARN)
+				return (bytes);
+		}
+	}
+
+	/* Read the data and write it as archive_write_data() would. */
+	buff = malloc(READ_FD_BUFF_SIZE);
+	if (buff == NULL) {
+		archive_set_error(_a, ENOMEM, "Can't allocate read buffer");
+		return (ARCHIVE_FATAL);
+	}
+	while (done < s) {
+		n = s - done;
+		if (n > READ_FD_BUFF_SIZE)
+			n = READ_FD_BUFF_SIZE;
+		bytes = read_at(fd, buff, n, offset + done);
+		if (bytes < 0) {
+			archive_set_error(_a, errno, "Read error");
+			free(buff);
+			return (ARCHIVE_FATAL);
+		}
+		if (bytes == 0)
+			break;
+		w = archive_write_data(_a, buff, bytes);
+		if (w < 0) {
+			free(buff);
+			return (w);
+		}
+		done += w;
+		if (w < bytes)
+			break;
+	}
+	free(buff);
+	return (done);
+}
+
 static struct archive_write_filter *
 filter_lookup(struct archive *_a, int n)
 {
@@ -44,6 +44,7 @@ __FBSDID("$FreeBSD: head/lib/libarchive/archive_write_set_compression_bzip2.c 20
 
 #include "archive.h"
 #include "archive_private.h"
+#include "archive_thread_pool_private.h"
 #include "archive_write_private.h"
 
 #if ARCHIVE_VERSION_NUMBER < 4000000
@@ -55,13 +56,41 @@ archive_write_set_compression_bzip2(struct archive *a)
 }
 #endif
 
+#if defined(HAVE_BZLIB_H) && defined(BZ_CONFIG_ERROR)
+/*
+ * With the "threads" option, input is cut into chunks of one block
+ * size each, which are compressed concurrently into complete bzip2
+ * streams, in the manner of pbzip2.  The streams are written out in
+ * order; bzip2 decompressors treat concatenated streams as one.
+ */
+struct bzip2_chunk {
+	struct archive_thread_job job;
+	int		 level;
+	int		 ret;
+	char		*in;
+	size_t		 in_len;
+	char		*out;
+	size_t		 out_size;
+	size_t		 out_len;
+};
+#endif
+
 struct private_data {
 	int		 compression_level;
+	int		 threads;
 #if defined(HAVE_BZLIB_H) && defined(BZ_CONFIG_ERROR)
 	bz_stream	 stream;
 	int64_t		 total_in;
 	char		*compressed;
 	size_t		 compressed_buffer_size;
+
+	/* Parallel compression. */
+	struct archive_thread_pool *pool;
+	struct bzip2_chunk *chunks;
+	int		 nchunks;
+	int		 chunk_head;	/* Oldest submitted chunk. */
+	int		 chunk_count;	/* Chunks submitted. */
+	size_t		 chunk_size;
 #else
 	struct archive_write_program_data *pdata;
 #endif
@@ -94,6 +123,7 @@ archive_write_add_filter_bzip2(struct archive *_a)
 		return (ARCHIVE_FATAL);
 	}
 	data->compression_level = 9; /* default */
+	data->threads = 1;
 
 	f->data = data;
 	f->options = &archive_compressor_bzip2_options;
@@ -139,6 +169,21 @@ archive_compressor_bzip2_options(struct archive_write_filter *f,
 			data->compression_level = 1;
 		return (ARCHIVE_OK);
 	}
+	if (strcmp(key, "threads") == 0) {
+		char *endptr;
+
+		if (value == NULL)
+			return (ARCHIVE_WARN);
+		errno = 0;
+		data->threads = (int)strtoul(value, &endptr, 10);
+		if (errno != 0 || *endptr != '\0') {
+			data->threads = 1;
+			return (ARCHIVE_WARN);
+		}
+		if (data->threads == 0)
+			data->threads = __archive_thread_pool_cpus();
+		return (ARCHIVE_OK);
+	}
 
 	/* Note: The "warn" return is just to inform the options
 	 * supervisor that we didn't handle it.  It will generate
@@ -157,6 +202,9 @@ archive_compressor_bzip2_options(struct archive_write_filter *f,
 	(st)->stream.next_in = (char *)(uintptr_t)(const void *)(src)
 static int drive_compressor(struct archive_write_filter *,
 		    struct private_data *, int finishing);
+static int bzip2_mt_write(struct archive_write_filter *,
+		    const void *, size_t);
+static int bzip2_mt_close(struct archive_write_filter *);
 
 /*
  * Setup callback.
@@ -188,6 +236,24 @@ archive_compressor_bzip2_open(struct archive_write_filter *f)
 		}
 	}
 
+	if (data->threads > 1) {
+		data->nchunks = data->threads * 2;
+		data->chunks = (struct bzip2_chunk *)calloc(data->nchunks,
+		    sizeof(data->chunks[0]));
+		data->pool = __archive_thread_pool_new(data->threads);
+		if (data->chunks == NULL || data->pool == NULL) {
+			archive_set_error(f->archive, ENOMEM,
+			    "Can't allocate data for compression");
+			return (ARCHIVE_FATAL);
+		}
+		data->chunk_size = data->compression_level * 100000;
+		data->chunk_head = 0;
+		data->chunk_count = 0;
+		f->write = bzip2_mt_write;
+		f->close = bzip2_mt_close;
+		return (ARCHIVE_OK);
+	}
+
 	memset(&data->stream, 0, sizeof(data->stream));
 	data->stream.next_out = data->compressed;
 	data->stream.avail_out = data->compressed_buffer_size;
@@ -285,6 +351,16 @@ archive_compressor_bzip2_free(struct archive_write_filter *f)
 {
 	struct private_data *data = (struct private_data *)f->data;
 	free(data->compressed);
+	__archive_thread_pool_free(data->pool);
+	if (data->chunks != NULL) {
+		int i;
+
+		for (i = 0; i < data->nchunks; i++) {
+			free(data->chunks[i].in);
+			free(data->chunks[i].out);
+		}
+		free(data->chunks);
+	}
 	free(data);
 	f->data = NULL;
 	return (ARCHIVE_OK);
@@ -347,6 +423,139 @@ drive_compressor(struct archive_write_filter *f,
 	}
 }
 
+/*
+ * Compress one chunk into a complete stream on a worker thread.
+ */
+static void
+bzip2_chunk_compress(void *arg)
+{
+	struct bzip2_chunk *c = (struct bzip2_chunk *)arg;
+	unsigned int out_len = (unsigned int)c->out_size;
+	char empty = 0;
+
+	/* bzlib refuses a NULL source even when it is empty. */
+	c->ret = BZ2_bzBuffToBuffCompress(c->out, &out_len,
+	    c->in != NULL ? c->in : &empty,
+	    (unsigned int)c->in_len, c->level, 0, 30);
+	c->out_len = out_len;
+}
+
+/*
+ * Hand the chunk being filled to the workers.
+ */
+static int
+bzip2_mt_submit(struct archive_write_filter *f, struct private_data *data)
+{
+	struct bzip2_chunk *c;
+
+	c = &data->chunks[(data->chunk_head + data->chunk_count)
+	    % data->nchunks];
+	if (c->out == NULL) {
+		/* bzip2 output never exceeds the input by more
+		 * than 1% plus 600 bytes. */
+		c->out_size = data->chunk_size + data->chunk_size / 100 + 600;
+		c->out = (char *)malloc(c->out_size);
+		if (c->out == NULL) {
+			archive_set_error(f->archive, ENOMEM,
+			    "Can't allocate data for compression buffer");
+			return (ARCHIVE_FATAL);
+		}
+	}
+	c->level = data->compression_level;
+	c->job.run = bzip2_chunk_compress;
+	c->job.arg = c;
+	__archive_thread_pool_submit(data->pool, &c->job);
+	data->chunk_count++;
+	return (ARCHIVE_OK);
+}
+
+/*
+ * Wait for the oldest chunk and write out its compressed data.
+ */
+static int
+bzip2_mt_flush(struct archive_write_filter *f, struct private_data *data)
+{
+	struct bzip2_chunk *c;
+	int ret;
+
+	c = &data->chunks[data->chunk_head];
+	__archive_thread_pool_wait(data->pool, &c->job);
+	if (c->ret != BZ_OK) {
+		archive_set_error(f->archive, ARCHIVE_ERRNO_PROGRAMMER,
+		    "Bzip2 compression failed;"
+		    " BZ2_bzBuffToBuffCompress() returned %d", c->ret);
+		return (ARCHIVE_FATAL);
+	}
+	ret = __archive_write_filter(f->next_filter, c->out, c->out_len);
+	if (ret != ARCHIVE_OK)
+		return (ARCHIVE_FATAL);
+	data->total_in += c->in_len;
+	c->in_len = 0;
+	data->chunk_head = (data->chunk_head + 1) % data->nchunks;
+	data->chunk_count--;
+	return (ARCHIVE_OK);
+}
+
+static int
+bzip2_mt_write(struct archive_write_filter *f, const void *buff,
+    size_t length)
+{
+	struct private_data *data = (struct private_data *)f->data;
+	const char *p = (const char *)buff;
+	struct bzip2_chunk *c;
+	size_t n;
+	int ret;
+
+	while (length > 0) {
+		if (data->chunk_count == data->nchunks &&
+		    (ret = bzip2_mt_flush(f, data)) != ARCHIVE_OK)
+			return (ret);
+		c = &data->chunks[(data->chunk_head + data->chunk_count)
+		    % data->nchunks];
+		if (c->in == NULL) {
+			c->in = (char *)malloc(data->chunk_size);
+			if (c->in == NULL) {
+				archive_set_error(f->archive, ENOMEM,
+				    "Can't allocate data for compression");
+				return (ARCHIVE_FATAL);
+			}
+		}
+		n = data->chunk_size - c->in_len;
+		if (n > length)
+			n = length;
+		memcpy(c->in + c->in_len, p, n);
+		c->in_len += n;
+		p += n;
+		length -= n;
+		if (c->in_len == data->chunk_size &&
+		    (ret = bzip2_mt_submit(f, data)) != ARCHIVE_OK)
+			return (ret);
+	}
+	return (ARCHIVE_OK);
+}
+
+static int
+bzip2_mt_close(struct archive_write_filter *f)
+{
+	struct private_data *data = (struct private_data *)f->data;
+	struct bzip2_chunk *c;
+	int ret = ARCHIVE_OK;
+
+	/* Compress the partial last chunk, if any.  An empty one is
+	 * only needed to produce a valid stream for empty input.  A
+	 * full ring means the last chunk was just submitted. */
+	if (data->chunk_count < data->nchunks) {
+		c = &data->chunks[(data->chunk_head + data->chunk_count)
+		    % data->nchunks];
+		if (c->in_len > 0 ||
+		    (data->total_in == 0 && data->chunk_count == 0))
+			ret = bzip2_mt_submit(f, data);
+	}
+	while (ret == ARCHIVE_OK && data->chunk_count > 0)
+		ret = bzip2_mt_flush(f, data);
+	return (ret);
+}
+
 #else /* HAVE_BZLIB_H && BZ_CONFIG_ERROR */
 
 static int
@@ -42,8 +42,10 @@ __FBSDID("$FreeBSD: head/lib/libarchive/archive_write_set_compression_gzip.c 201
 #endif
 
 #include "archive.h"
+#include "archive_endian.h"
 #include "archive_private.h"
 #include "archive_string.h"
+#include "archive_thread_pool_private.h"
 #include "archive_write_private.h"
 
 #if ARCHIVE_VERSION_NUMBER < 4000000
@@ -57,15 +59,76 @@ archive_write_set_compression_gzip(struct archive *a)
 
 /* Don't compile this if we don't have zlib. */
 
+#ifdef HAVE_ZLIB_H
+/*
+ * With the "threads" option, input is cut into chunks that are
+ * deflated concurrently, in the manner of pigz.  Each chunk is primed
+ * with the last 32KiB of the preceding input as its dictionary and,
+ * except for the last one, ends with a sync flush so that the
+ * compressed chunks concatenate into a single deflate stream.  Their
+ * CRCs are combined into the one gzip trailer.  A reader has to
+ * inflate such a stream from the start on a single thread.
+ *
+ * With the "bgzf" option, each chunk of BGZF_CHUNK_SIZE bytes is
+ * instead a gzip member of its own, as bgzip writes them: no
+ * dictionary, and a "BC" extra subfield recording the compressed size
+ * of the member, which lets a reader find the members without
+ * inflating them and inflate them in parallel.  The stream ends with
+ * the empty BGZF end-of-file member.
+ */
+#define GZIP_CHUNK_SIZE		(128 * 1024)
+#define GZIP_WINDOW_SIZE	(32 * 1024)
+#define BGZF_CHUNK_SIZE		0xff00
+#define BGZF_HEADER_SIZE	18
+#define BGZF_MAX_MEMBER		65536
+
+static const unsigned char bgzf_eof[28] = {
+	0x1f, 0x8b, 0x08, 0x04, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0xff, 0x06, 0x00, 0x42, 0x43, 0x02, 0x00,
+	0x1b, 0x00, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00
+};
+
+struct gzip_chunk {
+	struct archive_thread_job job;
+	z_stream	 stream;
+	char		 stream_valid;
+	char		 last;
+	char		 bgzf;	/* A member of its own. */
+	int		 level;
+	int		 ret;
+	unsigned char	*in;
+	size_t		 in_len;
+	unsigned char	 dict[GZIP_WINDOW_SIZE];
+	size_t		 dict_len;
+	unsigned char	*out;
+	size_t		 out_size;
+	size_t		 out_len;
+	unsigned long	 crc;
+};
+#endif
+
 struct private_data {
 	int		 compression_level;
 	int		 timestamp;
+	int		 threads;
+	int		 bgzf;
 #ifdef HAVE_ZLIB_H
 	z_stream	 stream;
 	int64_t		 total_in;
 	unsigned char	*compressed;
 	size_t		 compressed_buffer_size;
 	unsigned long	 crc;
+
+	/* Parallel compression. */
+	struct archive_thread_pool *pool;
+	struct gzip_chunk *chunks;
+	int		 nchunks;
+	int		 chunk_head;	/* Oldest submitted chunk. */
+	int		 chunk_count;	/* Chunks submitted. */
+	size_t		 chunk_size;
+	unsigned char	 window[GZIP_WINDOW_SIZE];
+	size_t		 window_len;
 #else
 	struct archive_write_program_data *pdata;
 #endif
@@ -88,6 +151,9 @@ static int archive_compressor_gzip_free(struct archive_write_filter *);
 #ifdef HAVE_ZLIB_H
 static int drive_compressor(struct archive_write_filter *,
 		    struct private_data *, int finishing);
+static int gzip_mt_write(struct archive_write_filter *,
+		    const void *, size_t);
+static int gzip_mt_close(struct archive_write_filter *);
 #endif
 
 
@@ -115,6 +181,7 @@ archive_write_add_filter_gzip(struct archive *_a)
 	f->free = &archive_compressor_gzip_free;
 	f->code = ARCHIVE_FILTER_GZIP;
 	f->name = "gzip";
+	data->threads = 1;
 #ifdef HAVE_ZLIB_H
 	data->compression_level = Z_DEFAULT_COMPRESSION;
 	return (ARCHIVE_OK);
@@ -139,6 +206,18 @@ archive_compressor_gzip_free(struct archive_write_filter *f)
 
 #ifdef HAVE_ZLIB_H
 	free(data->compressed);
+	__archive_thread_pool_free(data->pool);
+	if (data->chunks != NULL) {
+		int i;
+
+		for (i = 0; i < data->nchunks; i++) {
+			if (data->chunks[i].stream_valid)
+				deflateEnd(&(data->chunks[i].stream));
+			free(data->chunks[i].in);
+			free(data->chunks[i].out);
+		}
+		free(data->chunks);
+	}
 #else
 	__archive_write_program_free(data->pdata);
 #endif
@@ -167,6 +246,25 @@ archive_compressor_gzip_options(struct archive_write_filter *f, const char *key,
 		data->timestamp = (value == NULL)?-1:1;
 		return (ARCHIVE_OK);
 	}
+	if (strcmp(key, "bgzf") == 0) {
+		data->bgzf = value != NULL;
+		return (ARCHIVE_OK);
+	}
+	if (strcmp(key, "threads") == 0) {
+		char *endptr;
+
+		if (value == NULL)
+			return (ARCHIVE_WARN);
+		errno = 0;
+		data->threads = (int)strtoul(value, &endptr, 10);
+		if (errno != 0 || *endptr != '\0') {
+			data->threads = 1;
+			return (ARCHIVE_WARN);
+		}
+		if (data->threads == 0)
+			data->threads = __archive_thread_pool_cpus();
+		return (ARCHIVE_OK);
+	}
 
 	/* Note: The "warn" return is just to inform the options
 	 * supervisor that we didn't handle it.  It will generate
@@ -175,6 +273,33 @@ archive_compressor_gzip_options(struct archive_write_filter *f, const char *key,
 }
 
 #ifdef HAVE_ZLIB_H
+/*
+ * Fill in the 10-byte gzip member header.
+ */
+static void
+gzip_header(struct private_data *data, unsigned char *p, int flags)
+{
+	p[0] = 0x1f; /* GZip signature bytes */
+	p[1] = 0x8b;
+	p[2] = 0x08; /* "Deflate" compression */
+	p[3] = (unsigned char)flags;
+	if (data->timestamp >= 0) {
+		time_t t = time(NULL);
+		p[4] = (uint8_t)(t)&0xff;  /* Timestamp */
+		p[5] = (uint8_t)(t>>8)&0xff;
+		p[6] = (uint8_t)(t>>16)&0xff;
+		p[7] = (uint8_t)(t>>24)&0xff;
+	} else
+		memset(&p[4], 0, 4);
+	if (data->compression_level == 9)
+		p[8] = 2;
+	else if (data->compression_level == 1)
+		p[8] = 4;
+	else
+		p[8] = 0;
+	p[9] = 3; /* OS=Unix */
+}
+
 /*
  * Setup callback.
  */
@@ -210,28 +335,48 @@ archive_compressor_gzip_open(struct archive_write_filter *f)
 	data->stream.avail_out = (uInt)data->compressed_buffer_size;
 
 	/* Prime output buffer with a gzip header. */
-	data->compressed[0] = 0x1f; /* GZip signature bytes */
-	data->compressed[1] = 0x8b;
-	data->compressed[2] = 0x08; /* "Deflate" compression */
-	data->compressed[3] = 0; /* No options */
-	if (data->timestamp >= 0) {
-		time_t t = time(NULL);
-		data->compressed[4] = (uint8_t)(t)&0xff;  /* Timestamp */
-		data->compressed[5] = (uint8_t)(t>>8)&0xff;
-		data->compressed[6] = (uint8_t)(t>>16)&0xff;
-		data->compressed[7] = (uint8_t)(t>>24)&0xff;
-	} else
-		memset(&data->compressed[4], 0, 4);
-    if (data->compression_level == 9)
-	    data->compressed[8] = 2;
-    else if(data->compression_level == 1)
-	    data->compressed[8] = 4;
-    else
-	    data->compressed[8] = 0;
-	data->compressed[9] = 3; /* OS=Unix */
+	gzip_header(data, data->compressed, 0);
 	data->stream.next_out += 10;
 	data->stream.avail_out -= 10;
 
+	if (data->threads > 1 || data->bgzf) {
+		int i;
+
+		/* The chunks and the pool of an earlier stream are
+		 * reused; whatever was left in them is dropped. */
+		if (data->chunks == NULL) {
+			data->nchunks = data->threads * 2;
+			data->chunks = (struct gzip_chunk *)calloc(
+			    data->nchunks, sizeof(data->chunks[0]));
+		}
+		if (data->pool == NULL)
+			data->pool = __archive_thread_pool_new(data->threads);
+		if (data->chunks == NULL || data->pool == NULL) {
+			archive_set_error(f->archive, ENOMEM,
+			    "Can't allocate data for compression");
+			return (ARCHIVE_FATAL);
+		}
+		for (; data->chunk_count > 0; data->chunk_count--) {
+			__archive_thread_pool_wait(data->pool,
+			    &data->chunks[data->chunk_head].job);
+			data->chunk_head = (data->chunk_head + 1)
+			    % data->nchunks;
+		}
+		for (i = 0; i < data->nchunks; i++)
+			data->chunks[i].in_len = 0;
+		data->chunk_head = 0;
+		data->window_len = 0;
+		data->total_in = 0;
+		data->chunk_size = data->bgzf ?
+		    BGZF_CHUNK_SIZE : GZIP_CHUNK_SIZE;
+		f->write = gzip_mt_write;
+		f->close = gzip_mt_close;
+		if (data->bgzf)
+			return (ARCHIVE_OK);
+		return (__archive_write_filter(f->next_filter,
+		    data->compressed, 10));
+	}
+
 	f->write = archive_compressor_gzip_write;
 
 	/* Initialize compression library. */
@@ -392,6 +537,225 @@ drive_compressor(struct archive_write_filter *f,
 	}
 }
 
+/*
+ * Deflate one chunk on a worker thread.
+ */
+static void
+gzip_chunk_compress(void *arg)
+{
+	struct gzip_chunk *c = (struct gzip_chunk *)arg;
+	unsigned char *p;
+	int ret;
+
+	if (!c->stream_valid) {
+		c->ret = deflateInit2(&(c->stream), c->level, Z_DEFLATED,
+		    -15, 8, Z_DEFAULT_STRATEGY);
+		if (c->ret != Z_OK)
+			return;
+		c->stream_valid = 1;
+	} else if ((c->ret = deflateReset(&(c->stream))) != Z_OK)
+		return;
+	if (c->dict_len > 0 && (c->ret = deflateSetDictionary(&(c->stream),
+	    c->dict, (uInt)c->dict_len)) != Z_OK)
+		return;
+
+	c->crc = crc32(crc32(0L, NULL, 0), c->in, (uInt)c->in_len);
+	c->stream.next_in = c->in;
+	c->stream.avail_in = (uInt)c->in_len;
+	/* A BGZF member's header is already in place. */
+	c->out_len = c->bgzf ? BGZF_HEADER_SIZE : 0;
+	for (;;) {
+		if (c->out_len == c->out_size) {
+			p = (unsigned char *)realloc(c->out, c->out_size * 2);
+			if (p == NULL) {
+				c->ret = Z_MEM_ERROR;
+				return;
+			}
+			c->out = p;
+			c->out_size *= 2;
+		}
+		c->stream.next_out = c->out + c->out_len;
+		c->stream.avail_out = (uInt)(c->out_size - c->out_len);
+		ret = deflate(&(c->stream), c->last ? Z_FINISH : Z_SYNC_FLUSH);
+		c->out_len = c->out_size - c->stream.avail_out;
+		if (ret == Z_STREAM_END ||
+		    (ret == Z_OK && !c->last && c->stream.avail_out != 0))
+			break;
+		if (ret != Z_OK) {
+			c->ret = ret;
+			return;
+		}
+	}
+	if (c->bgzf) {
+		/* The trailer, and the size of the whole member less
+		 * one in the "BC" subfield. */
+		p = c->out + c->out_len;
+		if (c->out_len + 8 > c->out_size ||
+		    c->out_len + 8 > BGZF_MAX_MEMBER) {
+			c->ret = Z_BUF_ERROR;
+			return;
+		}
+		archive_le32enc(p, (uint32_t)c->crc);
+		archive_le32enc(p + 4, (uint32_t)c->in_len);
+		c->out_len += 8;
+		archive_le16enc(c->out + 16, (uint16_t)(c->out_len - 1));
+	}
+	c->ret = Z_OK;
+}
+
+/*
+ * Hand the chunk being filled to the workers.
+ */
+static int
+gzip_mt_submit(struct archive_write_filter *f, struct private_data *data,
+    int last)
+{
+	struct gzip_chunk *c;
+
+	c = &data->chunks[(data->chunk_head + data->chunk_count)
+	    % data->nchunks];
+	if (c->out == NULL) {
+		c->out_size = compressBound(GZIP_CHUNK_SIZE) + 64;
+		c->out = (unsigned char *)malloc(c->out_size);
+		if (c->out == NULL) {
+			archive_set_error(f->archive, ENOMEM,
+			    "Can't allocate data for compression buffer");
+			return (ARCHIVE_FATAL);
+		}
+	}
+	c->level = data->compression_level;
+	c->last = last;
+	c->bgzf = data->bgzf;
+	if (data->bgzf) {
+		/* Every member is complete in itself. */
+		c->last = 1;
+		gzip_header(data, c->out, 4);
+		archive_le16enc(c->out + 10, 6);	/* XLEN */
+		c->out[12] = 'B';
+		c->out[13] = 'C';
+		archive_le16enc(c->out + 14, 2);
+	}
+	memcpy(c->dict, data->window, data->window_len);
+	c->dict_len = data->window_len;
+
+	/* The tail of this chunk primes the next one; only the last
+	 * chunk can be shorter than the window. */
+	if (!last && !data->bgzf) {
+		memcpy(data->window, c->in + c->in_len - GZIP_WINDOW_SIZE,
+		    GZIP_WINDOW_SIZE);
+		data->window_len = GZIP_WINDOW_SIZE;
+	}
+
+	c->job.run = gzip_chunk_compress;
+	c->job.arg = c;
+	__archive_thread_pool_submit(data->pool, &c->job);
+	data->chunk_count++;
+	return (ARCHIVE_OK);
+}
+
+/*
+ * Wait for the oldest chunk and write out its compressed data.
+ */
+static int
+gzip_mt_flush(struct archive_write_filter *f, struct private_data *data)
+{
+	struct gzip_chunk *c;
+	int ret;
+
+	c = &data->chunks[data->chunk_head];
+	__archive_thread_pool_wait(data->pool, &c->job);
+	if (c->ret != Z_OK) {
+		archive_set_error(f->archive, ARCHIVE_ERRNO_MISC,
+		    "GZip compression failed:"
+		    " deflate() call returned status %d", c->ret);
+		return (ARCHIVE_FATAL);
+	}
+	ret = __archive_write_filter(f->next_filter, c->out, c->out_len);
+	if (ret != ARCHIVE_OK)
+		return (ARCHIVE_FATAL);
+	data->crc = crc32_combine(data->crc, c->crc, (z_off_t)c->in_len);
+	data->total_in += c->in_len;
+	c->in_len = 0;
+	data->chunk_head = (data->chunk_head + 1) % data->nchunks;
+	data->chunk_count--;
+	return (ARCHIVE_OK);
+}
+
+static int
+gzip_mt_write(struct archive_write_filter *f, const void *buff,
+    size_t length)
+{
+	struct private_data *data = (struct private_data *)f->data;
+	const unsigned char *p = (const unsigned char *)buff;
+	struct gzip_chunk *c;
+	size_t n;
+	int ret;
+
+	while (length > 0) {
+		if (data->chunk_count == data->nchunks &&
+		    (ret = gzip_mt_flush(f, data)) != ARCHIVE_OK)
+			return (ret);
+		c = &data->chunks[(data->chunk_head + data->chunk_count)
+		    % data->nchunks];
+		if (c->in == NULL) {
+			c->in = (unsigned char *)malloc(GZIP_CHUNK_SIZE);
+			if (c->in == NULL) {
+				archive_set_error(f->archive, ENOMEM,
+				    "Can't allocate data for compression");
+				return (ARCHIVE_FATAL);
+			}
+		}
+		n = data->chunk_size - c->in_len;
+		if (n > length)
+			n = length;
+		memcpy(c->in + c->in_len, p, n);
+		c->in_len += n;
+		p += n;
+		length -= n;
+		if (c->in_len == data->chunk_size &&
+		    (ret = gzip_mt_submit(f, data, 0)) != ARCHIVE_OK)
+			return (ret);
+	}
+	return (ARCHIVE_OK);
+}
+
+static int
+gzip_mt_close(struct archive_write_filter *f)
+{
+	struct private_data *data = (struct private_data *)f->data;
+	struct gzip_chunk *c;
+	unsigned char trailer[8];
+	int ret;
+
+	/* The last, possibly empty, chunk finishes the deflate stream;
+	 * BGZF has an empty member of its own for that. */
+	if (data->chunk_count == data->nchunks &&
+	    (ret = gzip_mt_flush(f, data)) != ARCHIVE_OK)
+		return (ret);
+	c = &data->chunks[(data->chunk_head + data->chunk_count)
+	    % data->nchunks];
+	ret = ARCHIVE_OK;
+	if (!data->bgzf || c->in_len > 0)
+		ret = gzip_mt_submit(f, data, 1);
+	while (ret == ARCHIVE_OK && data->chunk_count > 0)
+		ret = gzip_mt_flush(f, data);
+	if (ret != ARCHIVE_OK)
+		return (ret);
+	if (data->bgzf)
+		return (__archive_write_filter(f->next_filter, bgzf_eof,
+		    sizeof(bgzf_eof)));
+
+	trailer[0] = (uint8_t)(data->crc)&0xff;
+	trailer[1] = (uint8_t)(data->crc >> 8)&0xff;
+	trailer[2] = (uint8_t)(data->crc >> 16)&0xff;
+	trailer[3] = (uint8_t)(data->crc >> 24)&0xff;
+	trailer[4] = (uint8_t)(data->total_in)&0xff;
+	trailer[5] = (uint8_t)(data->total_in >> 8)&0xff;
+	trailer[6] = (uint8_t)(data->total_in >> 16)&0xff;
+	trailer[7] = (uint8_t)(data->total_in >> 24)&0xff;
+	return (__archive_write_filter(f->next_filter, trailer, 8));
+}
+
 #else /* HAVE_ZLIB_H */
 
 static int
@@ -401,6 +765,11 @@ archive_compressor_gzip_open(struct archive_write_filter *f)
 	struct archive_string as;
 	int r;
 
+	if (data->bgzf) {
+		archive_set_error(f->archive, ARCHIVE_ERRNO_MISC,
+		    "BGZF output needs zlib");
+		return (ARCHIVE_FATAL);
+	}
 	archive_string_init(&as);
 	archive_strcpy(&as, "gzip");
 
@@ -222,6 +222,9 @@ struct archive_write_disk {
 	struct archive	archive;
 
 	mode_t			 user_umask;
+	/* Set when user_umask was handed in; see
+	 * __archive_write_disk_set_umask(). */
+	int			 user_umask_set;
 	struct fixup_entry	*fixup_list;
 	struct fixup_entry	*current_fixup;
 	int64_t			 user_uid;
@@ -379,6 +382,7 @@ static ssize_t	hfs_write_data_block(struct archive_write_disk *,
 		    const char *, size_t);
 static int	fixup_appledouble(struct archive_write_disk *, const char *);
 static int	older(struct stat *, struct archive_entry *);
+static void	preallocate_file(struct archive_write_disk *);
 static int	restore_entry(struct archive_write_disk *);
 static int	set_mac_metadata(struct archive_write_disk *, const char *,
 				 const void *, size_t);
@@ -553,6 +557,52 @@ archive_write_disk_set_options(struct archive *_a, int flags)
 	return (ARCHIVE_OK);
 }
 
+/*
+ * Used by archive_read_extract2() to configure the disk writers of its
+ * worker threads like the one the client handed in.
+ */
+int
+__archive_write_disk_get_options(struct archive *_a)
+{
+	struct archive_write_disk *a = (struct archive_write_disk *)_a;
+
+	return (a->flags);
+}
+
+__LA_MODE_T
+__archive_write_disk_get_umask(struct archive *_a)
+{
+	struct archive_write_disk *a = (struct archive_write_disk *)_a;
+
+	return (a->user_umask);
+}
+
+/*
+ * Used for the disk writers of archive_read_extract2()'s worker
+ * threads.  Changing the umask, even briefly, affects every thread of
+ * the process, so they must never query it themselves.
+ */
+void
+__archive_write_disk_set_umask(struct archive *_a, __LA_MODE_T mask)
+{
+	struct archive_write_disk *a = (struct archive_write_disk *)_a;
+
+	a->user_umask = mask;
+	a->user_umask_set = 1;
+}
+
+/*
+ * Whether the last header opened a file for its data to be written to;
+ * archive_read_extract2() only hands open files to its workers.
+ */
+int
+__archive_write_disk_has_file(struct archive *_a)
+{
+	struct archive_write_disk *a = (struct archive_write_disk *)_a;
+
+	return (a->fd >= 0);
+}
+
 
 /*
  * Extract this entry to disk.
@@ -632,7 +682,8 @@ _archive_write_disk_header(struct archive *_a, struct archive_entry *entry)
 	 * user edits their umask during the extraction for some
 	 * reason.
 	 */
-	umask(a->user_umask = umask(0));
+	if (!a->user_umask_set)
+		umask(a->user_umask = umask(0));
 
 	/* Figure out what we need to do for this entry. */
 	a->todo = TODO_MODE_BASE;
@@ -934,11 +985,57 @@ _archive_write_disk_header(struct archive *_a, struct archive_entry *entry)
 	if (a->fd < 0) {
 		archive_entry_set_size(entry, 0);
 		a->filesize = 0;
-	}
+	} else if ((a->flags & ARCHIVE_EXTRACT_PREALLOCATE) != 0 &&
+	    (a->todo & TODO_HFS_COMPRESSION) == 0)
+		preallocate_file(a);
 
 	return (ret);
 }
 
+#if defined(HAVE_FALLOCATE) || defined(HAVE_POSIX_FALLOCATE)
+static int
+allocate_range(int fd, int64_t offset, int64_t length)
+{
+#if defined(HAVE_FALLOCATE)
+	/* Unlike posix_fallocate(), this never falls back to writing
+	 * zeros on filesystems that cannot reserve space. */
+	return (fallocate(fd, 0, (off_t)offset, (off_t)length));
+#else
+	return (posix_fallocate(fd, (off_t)offset, (off_t)length));
+#endif
+}
+#endif
+
+/*
+ * Reserve the space of a regular file before its data arrives, so
+ * that the filesystem can lay it out in a few extents rather than
+ * extending it on every write.  Only the data regions of a sparse
+ * file are reserved; with ARCHIVE_EXTRACT_SPARSE and no sparse map
+ * the holes are not known yet, so nothing is.  Failure is harmless:
+ * the writes allocate the space as usual.
+ */
+static void
+preallocate_file(struct archive_write_disk *a)
+{
+#if defined(HAVE_FALLOCATE) || defined(HAVE_POSIX_FALLOCATE)
+	int64_t offset, length;
+
+	if (a->filesize <= 0)
+		return;
+	if (archive_entry_sparse_reset(a->entry) > 0) {
+		while (archive_entry_sparse_next(a->entry,
+		    &offset, &length) == ARCHIVE_OK) {
+			if (length > 0 &&
+			    allocate_range(a->fd, offset, length) != 0)
+				break;
+		}
+	} else if ((a->flags & ARCHIVE_EXTRACT_SPARSE) == 0)
+		(void)allocate_range(a->fd, 0, a->filesize);
+#else
+	(void)a; /* UNUSED */
+#endif
+}
+
 int
 archive_write_disk_set_skip_file(struct archive *_a, la_int64_t d, la_int64_t i)
 {
@@ -957,6 +1054,10 @@ write_data_block(struct archive_write_disk *a, const char *buff, size_t size)
 	uint64_t start_size = size;
 	ssize_t bytes_written = 0;
 	ssize_t block_size = 0, bytes_to_write;
+#ifdef HAVE_PWRITE
+	/* Write at explicit offsets rather than seeking first. */
+	int use_pwrite = (a->flags & ARCHIVE_EXTRACT_PREALLOCATE) != 0;
+#endif
 
 	if (size == 0)
 		return (ARCHIVE_OK);
@@ -990,17 +1091,14 @@ write_data_block(struct archive_write_disk *a, const char *buff, size_t size)
 			bytes_to_write = size;
 		} else {
 			/* We're sparsifying the file. */
-			const char *p, *end;
 			int64_t block_end;
+			size_t zeros, n;
 
 			/* Skip leading zero bytes. */
-			for (p = buff, end = buff + size; p < end; ++p) {
-				if (*p != '\0')
-					break;
-			}
-			a->offset += p - buff;
-			size -= p - buff;
-			buff = p;
+			zeros = __archive_zero_run(buff, size);
+			a->offset += zeros;
+			size -= zeros;
+			buff += zeros;
 			if (size == 0)
 				break;
 
@@ -1009,21 +1107,42 @@ write_data_block(struct archive_write_disk *a, const char *buff, size_t size)
 			    = (a->offset / block_size + 1) * block_size;
 
 			/* If the adjusted write would cross block boundary,
-			 * truncate it to the block boundary. */
+			 * truncate it to the block boundary, then extend it
+			 * over the following blocks up to the next one that
+			 * is all zeros, so that a run of data blocks takes a
+			 * single write and a hole a single seek. */
 			bytes_to_write = size;
-			if (a->offset + bytes_to_write > block_end)
+			if (a->offset + bytes_to_write > block_end) {
 				bytes_to_write = block_end - a->offset;
+				while ((size_t)bytes_to_write < size) {
+					n = size - bytes_to_write;
+					if (n > (size_t)block_size)
+						n = block_size;
+					if (__archive_zero_run(
+					    buff + bytes_to_write, n) == n)
+						break;
+					bytes_to_write += n;
+				}
+			}
 		}
-		/* Seek if necessary to the specified offset. */
-		if (a->offset != a->fd_offset) {
-			if (lseek(a->fd, a->offset, SEEK_SET) < 0) {
-				archive_set_error(&a->archive, errno,
-				    "Seek failed");
-				return (ARCHIVE_FATAL);
+#ifdef HAVE_PWRITE
+		if (use_pwrite)
+			bytes_written = pwrite(a->fd, buff, bytes_to_write,
+			    (off_t)a->offset);
+		else
+#endif
+		{
+			/* Seek if necessary to the specified offset. */
+			if (a->offset != a->fd_offset) {
+				if (lseek(a->fd, a->offset, SEEK_SET) < 0) {
+					archive_set_error(&a->archive, errno,
+					    "Seek failed");
+					return (ARCHIVE_FATAL);
+				}
+				a->fd_offset = a->offset;
 			}
-			a->fd_offset = a->offset;
+			bytes_written = write(a->fd, buff, bytes_to_write);
 		}
-		bytes_written = write(a->fd, buff, bytes_to_write);
 		if (bytes_written < 0) {
 			archive_set_error(&a->archive, errno, "Write failed");
 			return (ARCHIVE_WARN);
@@ -41,5 +41,9 @@ struct archive_write_disk;
 
 int archive_write_disk_set_acls(struct archive *, int, const char *,
     struct archive_acl *, __LA_MODE_T);
+int __archive_write_disk_get_options(struct archive *);
+__LA_MODE_T __archive_write_disk_get_umask(struct archive *);
+void __archive_write_disk_set_umask(struct archive *, __LA_MODE_T);
+int __archive_write_disk_has_file(struct archive *);
 
 #endif
@@ -61,6 +61,7 @@ __FBSDID("$FreeBSD$");
 #include "archive_string.h"
 #include "archive_entry.h"
 #include "archive_private.h"
+#include "archive_write_disk_private.h"
 
 #ifndef O_BINARY
 #define O_BINARY 0
@@ -133,6 +134,9 @@ struct archive_write_disk {
 	struct archive	archive;
 
 	mode_t			 user_umask;
+	/* Set when user_umask was handed in; see
+	 * __archive_write_disk_set_umask(). */
+	int			 user_umask_set;
 	struct fixup_entry	*fixup_list;
 	struct fixup_entry	*current_fixup;
 	int64_t			 user_uid;
@@ -788,6 +792,52 @@ archive_write_disk_set_options(struct archive *_a, int flags)
 	return (ARCHIVE_OK);
 }
 
+/*
+ * Used by archive_read_extract2() to configure the disk writers of its
+ * worker threads like the one the client handed in.
+ */
+int
+__archive_write_disk_get_options(struct archive *_a)
+{
+	struct archive_write_disk *a = (struct archive_write_disk *)_a;
+
+	return (a->flags);
+}
+
+__LA_MODE_T
+__archive_write_disk_get_umask(struct archive *_a)
+{
+	struct archive_write_disk *a = (struct archive_write_disk *)_a;
+
+	return (a->user_umask);
+}
+
+/*
+ * Used for the disk writers of archive_read_extract2()'s worker
+ * threads.  Changing the umask, even briefly, affects every thread of
+ * the process, so they must never query it themselves.
+ */
+void
+__archive_write_disk_set_umask(struct archive *_a, __LA_MODE_T mask)
+{
+	struct archive_write_disk *a = (struct archive_write_disk *)_a;
+
+	a->user_umask = mask;
+	a->user_umask_set = 1;
+}
+
+/*
+ * Whether the last header opened a file for its data to be written to;
+ * archive_read_extract2() only hands open files to its workers.
+ */
+int
+__archive_write_disk_has_file(struct archive *_a)
+{
+	struct archive_write_disk *a = (struct archive_write_disk *)_a;
+
+	return (a->fh != INVALID_HANDLE_VALUE);
+}
+
 
 /*
  * Extract this entry to disk.
@@ -861,7 +911,8 @@ _archive_write_disk_header(struct archive *_a, struct archive_entry *entry)
 	 * user edits their umask during the extraction for some
 	 * reason.
 	 */
-	umask(a->user_umask = umask(0));
+	if (!a->user_umask_set)
+		umask(a->user_umask = umask(0));
 
 	/* Figure out what we need to do for this entry. */
 	a->todo = TODO_MODE_BASE;
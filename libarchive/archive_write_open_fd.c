@@ -49,6 +49,7 @@ __FBSDID("$FreeBSD: head/lib/libarchive/archive_write_open_fd.c 201093 2009-12-2
 #endif
 
 #include "archive.h"
+#include "archive_write_private.h"
 
 struct write_fd_data {
 	int		fd;
@@ -94,6 +95,7 @@ file_open(struct archive *a, void *client_data)
 	 */
 	if (S_ISREG(st.st_mode))
 		archive_write_set_skip_file(a, st.st_dev, st.st_ino);
+	__archive_write_set_client_fd(a, mine->fd);
 
 	/*
 	 * If client hasn't explicitly set the last block handling,
@@ -48,6 +48,7 @@ __FBSDID("$FreeBSD: head/lib/libarchive/archive_write_open_filename.c 191165 200
 #include "archive.h"
 #include "archive_private.h"
 #include "archive_string.h"
+#include "archive_write_private.h"
 
 #ifndef O_BINARY
 #define O_BINARY 0
@@ -175,7 +176,15 @@ file_open(struct archive *a, void *client_data)
 		}
 		return (ARCHIVE_FATAL);
 	}
-	mine->fd = open(mbs, flags, 0666);
+	/*
+	 * Open regular files for reading too, so that formats which
+	 * fill in their headers at close can read back what they wrote.
+	 */
+	mine->fd = -1;
+	if (stat(mbs, &st) == 0 ? S_ISREG(st.st_mode) : errno == ENOENT)
+		mine->fd = open(mbs, (flags & ~O_WRONLY) | O_RDWR, 0666);
+	if (mine->fd < 0)
+		mine->fd = open(mbs, flags, 0666);
 	__archive_ensure_cloexec_flag(mine->fd);
 #endif
 	if (mine->fd < 0) {
@@ -214,6 +223,7 @@ file_open(struct archive *a, void *client_data)
 	 */
 	if (S_ISREG(st.st_mode))
 		archive_write_set_skip_file(a, st.st_dev, st.st_ino);
+	__archive_write_set_client_fd(a, mine->fd);
 
 	return (ARCHIVE_OK);
 }
@@ -72,6 +72,22 @@ struct archive_write_filter *__archive_write_allocate_filter(struct archive *);
 int __archive_write_output(struct archive_write *, const void *, size_t);
 int __archive_write_nulls(struct archive_write *, size_t);
 int __archive_write_filter(struct archive_write_filter *, const void *, size_t);
+ssize_t __archive_write_output_fd(struct archive_write *, int, int64_t, size_t);
+/*
+ * Random access to the output, for formats that write file data at its
+ * final offset and fill in the header at close.  Offsets count from the
+ * first byte the format wrote; only use these when
+ * __archive_write_seekable() says so.
+ */
+int __archive_write_seekable(struct archive_write *);
+int __archive_write_output_at(struct archive_write *, int64_t,
+    const void *, size_t);
+int __archive_write_read_output(struct archive_write *, int64_t,
+    void *, size_t);
+int __archive_write_move_output(struct archive_write *, int64_t, int64_t,
+    int64_t);
+/* Called by the open callbacks of clients that write to a descriptor. */
+void __archive_write_set_client_fd(struct archive *, int);
 
 struct archive_write {
 	struct archive	archive;
@@ -91,6 +107,13 @@ struct archive_write {
 	archive_close_callback	*client_closer;
 	archive_free_callback	*client_freer;
 	void			*client_data;
+	/* Descriptor the client writes to, if it is a regular file or
+	 * a pipe the kernel can copy file data to; -1 otherwise. */
+	int			 client_fd;
+	int			 client_fd_type;
+	/* Where the output starts in a regular file; -1 if the file
+	 * cannot be rewritten in place. */
+	int64_t			 client_fd_offset;
 
 	/*
 	 * Blocking information.  Note that bytes_in_last_block is
@@ -121,6 +144,11 @@ struct archive_write {
 		    struct archive_entry *);
 	ssize_t	(*format_write_data)(struct archive_write *,
 		    const void *buff, size_t);
+	/* Optional: like format_write_data, but for data read from a
+	 * file; ARCHIVE_WARN has the caller read it and use
+	 * format_write_data instead. */
+	ssize_t	(*format_write_data_fd)(struct archive_write *,
+		    int fd, int64_t offset, size_t);
 	int	(*format_close)(struct archive_write *);
 	int	(*format_free)(struct archive_write *);
 
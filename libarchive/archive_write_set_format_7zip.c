@@ -29,6 +29,7 @@ __FBSDID("$FreeBSD$");
 #ifdef HAVE_ERRNO_H
 #include <errno.h>
 #endif
+#include <stddef.h>
 #include <stdlib.h>
 #ifdef HAVE_BZLIB_H
 #include <bzlib.h>
@@ -41,9 +42,7 @@ __FBSDID("$FreeBSD$");
 #endif
 
 #include "archive.h"
-#ifndef HAVE_ZLIB_H
 #include "archive_crc32.h"
-#endif
 #include "archive_endian.h"
 #include "archive_entry.h"
 #include "archive_entry_locale.h"
@@ -51,6 +50,7 @@ __FBSDID("$FreeBSD$");
 #include "archive_private.h"
 #include "archive_rb.h"
 #include "archive_string.h"
+#include "archive_thread_pool_private.h"
 #include "archive_write_private.h"
 #include "archive_write_set_format_private.h"
 
@@ -124,6 +124,7 @@ struct la_zstream {
 #define PPMD7_DEFAULT_MEM_SIZE	(1 << 24)
 
 struct ppmd_stream {
+	struct la_zstream	*lastrm;
 	int			 stat;
 	CPpmd7			 ppmd7_context;
 	CPpmd7z_RangeEnc	 range_enc;
@@ -168,9 +169,55 @@ struct file {
 	signed int		 dir:1;
 };
 
+/*
+ * A folder is a run of file contents compressed as one stream.  By
+ * default all files go into a single folder; the "solid-block-size"
+ * option starts a new one once a folder holds that many bytes.
+ */
+struct _7z_folder {
+	uint64_t		 pack_size;
+	uint64_t		 unpack_size;
+	size_t			 num_files;
+};
+
+/*
+ * With the "threads" option, folder data is buffered and compressed
+ * on worker threads; finished jobs are appended to the temporary file
+ * in order.  LZMA2 data is cut into chunks of three times the
+ * dictionary size, each compressed as an independent LZMA2 stream; an
+ * LZMA2 stream opens with a dictionary reset, so the chunks of a folder
+ * join into a single stream once the end marker of all but the last
+ * is dropped.  Other codecs cannot be joined that way, so they need
+ * "solid-block-size" and compress a whole folder per job, which keeps
+ * such folders below _7Z_JOB_MAX_SIZE; larger files are compressed
+ * directly in a folder of their own.
+ */
+#define _7Z_JOB_MAX_SIZE	(64 * 1024 * 1024)
+
+struct _7z_job {
+	struct archive_thread_job job;
+	/* Collects the encoder's error messages. */
+	struct archive		 archive;
+	struct la_zstream	 stream;
+	unsigned		 compression;
+	int			 level;
+	int			 last;	/* Ends its folder. */
+	size_t			 folder;
+	unsigned char		*in;
+	size_t			 in_len;
+	size_t			 in_size;
+	unsigned char		*out;
+	size_t			 out_len;
+	size_t			 out_size;
+	int			 ret;
+};
+
 struct _7zip {
 	int			 temp_fd;
 	uint64_t		 temp_offset;
+	/* File contents and the header go straight to the output, after
+	 * room for the signature header; see write_to_temp(). */
+	int			 direct;
 
 	struct file		*cur_file;
 	size_t			 total_number_entry;
@@ -191,10 +238,22 @@ struct _7zip {
 
 	unsigned		 opt_compression;
 	int			 opt_compression_level;
+	uint64_t		 opt_solid_block_size;
 
 	struct la_zstream	 stream;
 	struct coder		 coder;
 
+	struct _7z_folder	*folders;
+	size_t			 folder_count;
+	size_t			 folder_alloc;
+	int			 folder_queued;	/* Data goes to jobs. */
+
+	/* Parallel compression; see struct _7z_job. */
+	int			 threads;
+	struct archive_thread_ring jobs;
+	struct _7z_job		*cur_job;	/* Job collecting data. */
+	size_t			 chunk_size;
+
 	struct archive_string_conv *sconv;
 
 	/*
@@ -270,6 +329,8 @@ static int	compression_init_encoder_ppmd(struct archive *,
 static int	compression_code_ppmd(struct archive *,
 		    struct la_zstream *, enum la_zaction);
 static int	compression_end_ppmd(struct archive *, struct la_zstream *);
+static int	compression_init_encoder(struct archive *,
+		    struct la_zstream *, unsigned, int);
 static int	_7z_compression_init_encoder(struct archive_write *, unsigned,
 		    int);
 static int	compression_code(struct archive *,
@@ -277,6 +338,11 @@ static int	compression_code(struct archive *,
 static int	compression_end(struct archive *,
 		    struct la_zstream *);
 static int	enc_uint64(struct archive_write *, uint64_t);
+static int	_7z_next_folder(struct archive_write *, int);
+static int	_7z_end_folder(struct archive_write *);
+static ssize_t	_7z_queue_data(struct archive_write *, const void *, size_t);
+static int	_7z_job_drain(struct archive_write *);
+static void	_7z_job_release(void *);
 static int	make_header(struct archive_write *, uint64_t, uint64_t,
 		    uint64_t, int, struct coder *);
 static int	make_streamsInfo(struct archive_write *, uint64_t, uint64_t,
@@ -320,6 +386,7 @@ archive_write_set_format_7zip(struct archive *_a)
 	zip->opt_compression = _7Z_COPY;
 #endif
 	zip->opt_compression_level = 6;
+	zip->threads = 1;
 
 	a->format_data = zip;
 
@@ -413,11 +480,65 @@ _7z_options(struct archive_write *a, const char *key, const char *value)
 		zip->opt_compression_level = value[0] - '0';
 		return (ARCHIVE_OK);
 	}
+	if (strcmp(key, "solid-block-size") == 0) {
+		/* A byte count, optionally followed by K, M or G. */
+		const char *p = value;
+		uint64_t size = 0;
+
+		if (p == NULL || *p < '0' || *p > '9')
+			goto illegal;
+		for (; *p >= '0' && *p <= '9'; p++) {
+			if (size > (UINT64_MAX - 9) / 10)
+				goto illegal;
+			size = size * 10 + (*p - '0');
+		}
+		switch (*p) {
+		case 'G': case 'g':
+			if (size > UINT64_MAX >> 10)
+				goto illegal;
+			size <<= 10;
+			/* FALLTHROUGH */
+		case 'M': case 'm':
+			if (size > UINT64_MAX >> 10)
+				goto illegal;
+			size <<= 10;
+			/* FALLTHROUGH */
+		case 'K': case 'k':
+			if (size > UINT64_MAX >> 10)
+				goto illegal;
+			size <<= 10;
+			p++;
+			break;
+		}
+		if (*p != '\0')
+			goto illegal;
+		zip->opt_solid_block_size = size;
+		return (ARCHIVE_OK);
+	}
+	if (strcmp(key, "threads") == 0) {
+		char *endptr;
+
+		if (value == NULL)
+			goto illegal;
+		errno = 0;
+		zip->threads = (int)strtoul(value, &endptr, 10);
+		if (errno != 0 || *endptr != '\0') {
+			zip->threads = 1;
+			goto illegal;
+		}
+		if (zip->threads == 0)
+			zip->threads = __archive_thread_pool_cpus();
+		return (ARCHIVE_OK);
+	}
 
 	/* Note: The "warn" return is just to inform the options
 	 * supervisor that we didn't handle it.  It will generate
 	 * a suitable error if no one used this option. */
 	return (ARCHIVE_WARN);
+illegal:
+	archive_set_error(&(a->archive), ARCHIVE_ERRNO_MISC,
+	    "Illegal value `%s'", value);
+	return (ARCHIVE_FAILED);
 }
 
 static int
@@ -425,7 +546,7 @@ _7z_write_header(struct archive_write *a, struct archive_entry *entry)
 {
 	struct _7zip *zip;
 	struct file *file;
-	int r;
+	int full, queued, r, r2;
 
 	zip = (struct _7zip *)a->format_data;
 	zip->cur_file = NULL;
@@ -473,16 +594,33 @@ _7z_write_header(struct archive_write *a, struct archive_entry *entry)
 	}
 
 	/*
-	 * Init compression.
+	 * Pick the folder for the file, starting a new one when the
+	 * current one is full or its data goes elsewhere.
 	 */
-	if ((zip->total_number_entry - zip->total_number_empty_entry) == 1) {
-		r = _7z_compression_init_encoder(a, zip->opt_compression,
-			zip->opt_compression_level);
-		if (r < 0) {
+	queued = zip->threads > 1 && zip->opt_compression != _7Z_COPY &&
+	    (zip->opt_compression == _7Z_LZMA2 ||
+	     (zip->opt_solid_block_size > 0 &&
+	      file->size <= _7Z_JOB_MAX_SIZE));
+	if (zip->folder_count == 0 || queued != zip->folder_queued) {
+		full = 1;
+	} else {
+		struct _7z_folder *folder =
+		    &zip->folders[zip->folder_count - 1];
+
+		full = zip->opt_solid_block_size > 0 &&
+		    folder->unpack_size >= zip->opt_solid_block_size;
+		if (queued && zip->opt_compression != _7Z_LZMA2 &&
+		    folder->unpack_size + file->size > _7Z_JOB_MAX_SIZE)
+			full = 1;
+	}
+	if (full) {
+		r2 = _7z_next_folder(a, queued);
+		if (r2 < 0) {
 			file_free(file);
 			return (ARCHIVE_FATAL);
 		}
 	}
+	zip->folders[zip->folder_count - 1].num_files++;
 
 	/* Register a non-empty file. */
 	file_register(zip, file);
@@ -503,10 +641,15 @@ _7z_write_header(struct archive_write *a, struct archive_entry *entry)
 	if (archive_entry_filetype(entry) == AE_IFLNK) {
 		ssize_t bytes;
 		const void *p = (const void *)archive_entry_symlink(entry);
-		bytes = compress_out(a, p, (size_t)file->size, ARCHIVE_Z_RUN);
+		if (zip->folder_queued)
+			bytes = _7z_queue_data(a, p, (size_t)file->size);
+		else
+			bytes = compress_out(a, p, (size_t)file->size,
+			    ARCHIVE_Z_RUN);
 		if (bytes < 0)
 			return ((int)bytes);
-		zip->entry_crc32 = crc32(zip->entry_crc32, p, (unsigned)bytes);
+		zip->folders[zip->folder_count - 1].unpack_size += bytes;
+		zip->entry_crc32 = __archive_crc32(zip->entry_crc32, p, bytes);
 		zip->entry_bytes_remaining -= bytes;
 	}
 
@@ -514,7 +657,9 @@ _7z_write_header(struct archive_write *a, struct archive_entry *entry)
 }
 
 /*
- * Write data to a temporary file.
+ * Write data to a temporary file.  When the output can be rewritten in
+ * place, write it there instead, after 32 bytes reserved for the
+ * signature header, which _7z_close() fills in.
  */
 static int
 write_to_temp(struct archive_write *a, const void *buff, size_t s)
@@ -522,22 +667,38 @@ write_to_temp(struct archive_write *a, const void *buff, size_t s)
 	struct _7zip *zip;
 	const unsigned char *p;
 	ssize_t ws;
+	int r;
 
 	zip = (struct _7zip *)a->format_data;
 
 	/*
 	 * Open a temporary file.
 	 */
-	if (zip->temp_fd == -1) {
+	if (zip->temp_fd == -1 && !zip->direct) {
 		zip->temp_offset = 0;
-		zip->temp_fd = __archive_mktemp(NULL);
-		if (zip->temp_fd < 0) {
-			archive_set_error(&a->archive, errno,
-			    "Couldn't create temporary file");
-			return (ARCHIVE_FATAL);
+		if (__archive_write_seekable(a)) {
+			r = __archive_write_nulls(a, 32);
+			if (r != ARCHIVE_OK)
+				return (r);
+			zip->direct = 1;
+		} else {
+			zip->temp_fd = __archive_mktemp(NULL);
+			if (zip->temp_fd < 0) {
+				archive_set_error(&a->archive, errno,
+				    "Couldn't create temporary file");
+				return (ARCHIVE_FATAL);
+			}
 		}
 	}
 
+	if (zip->direct) {
+		r = __archive_write_output(a, buff, s);
+		if (r != ARCHIVE_OK)
+			return (r);
+		zip->temp_offset += s;
+		return (ARCHIVE_OK);
+	}
+
 	p = (const unsigned char *)buff;
 	while (s) {
 		ws = write(zip->temp_fd, p, s);
@@ -564,7 +725,7 @@ compress_out(struct archive_write *a, const void *buff, size_t s,
 		return (0);
 
 	if ((zip->crc32flg & PRECODE_CRC32) && s)
-		zip->precode_crc32 = crc32(zip->precode_crc32, buff,
+		zip->precode_crc32 = __archive_crc32(zip->precode_crc32, buff,
 		    (unsigned)s);
 	zip->stream.next_in = (const unsigned char *)buff;
 	zip->stream.avail_in = s;
@@ -580,8 +741,9 @@ compress_out(struct archive_write *a, const void *buff, size_t s,
 			zip->stream.next_out = zip->wbuff;
 			zip->stream.avail_out = sizeof(zip->wbuff);
 			if (zip->crc32flg & ENCODED_CRC32)
-				zip->encoded_crc32 = crc32(zip->encoded_crc32,
-				    zip->wbuff, sizeof(zip->wbuff));
+				zip->encoded_crc32 = __archive_crc32(
+				    zip->encoded_crc32, zip->wbuff,
+				    sizeof(zip->wbuff));
 			if (run == ARCHIVE_Z_FINISH && r != ARCHIVE_EOF)
 				continue;
 		}
@@ -593,7 +755,7 @@ compress_out(struct archive_write *a, const void *buff, size_t s,
 		if (write_to_temp(a, zip->wbuff, (size_t)bytes) != ARCHIVE_OK)
 			return (ARCHIVE_FATAL);
 		if ((zip->crc32flg & ENCODED_CRC32) && bytes)
-			zip->encoded_crc32 = crc32(zip->encoded_crc32,
+			zip->encoded_crc32 = __archive_crc32(zip->encoded_crc32,
 			    zip->wbuff, (unsigned)bytes);
 	}
 
@@ -612,10 +774,14 @@ _7z_write_data(struct archive_write *a, const void *buff, size_t s)
 		s = (size_t)zip->entry_bytes_remaining;
 	if (s == 0 || zip->cur_file == NULL)
 		return (0);
-	bytes = compress_out(a, buff, s, ARCHIVE_Z_RUN);
+	if (zip->folder_queued)
+		bytes = _7z_queue_data(a, buff, s);
+	else
+		bytes = compress_out(a, buff, s, ARCHIVE_Z_RUN);
 	if (bytes < 0)
 		return (bytes);
-	zip->entry_crc32 = crc32(zip->entry_crc32, buff, (unsigned)bytes);
+	zip->folders[zip->folder_count - 1].unpack_size += bytes;
+	zip->entry_crc32 = __archive_crc32(zip->entry_crc32, buff, bytes);
 	zip->entry_bytes_remaining -= bytes;
 	return (bytes);
 }
@@ -647,6 +813,290 @@ _7z_finish_entry(struct archive_write *a)
 	return (ARCHIVE_OK);
 }
 
+/*
+ * Adopt the coder properties of the first encoder to finish; every
+ * folder is encoded with the same settings.
+ */
+static void
+_7z_take_props(struct _7zip *zip, struct la_zstream *lastrm)
+{
+	if (zip->coder.props == NULL && lastrm->props != NULL) {
+		zip->coder.prop_size = lastrm->prop_size;
+		zip->coder.props = lastrm->props;
+		lastrm->prop_size = 0;
+		lastrm->props = NULL;
+	}
+}
+
+static void
+_7z_job_run(void *arg)
+{
+	struct _7z_job *job = arg;
+	struct la_zstream *strm = &(job->stream);
+	int r;
+
+	job->out_len = 0;
+	job->ret = compression_init_encoder(&(job->archive), strm,
+	    job->compression, job->level);
+	if (job->ret != ARCHIVE_OK)
+		return;
+	strm->next_in = job->in;
+	strm->avail_in = job->in_len;
+	strm->next_out = job->out;
+	strm->avail_out = job->out_size;
+	for (;;) {
+		if (strm->avail_out == 0) {
+			size_t size = job->out_size > 0 ?
+			    job->out_size * 2 : job->in_len / 2 + 64 * 1024;
+			unsigned char *p = realloc(job->out, size);
+
+			if (p == NULL) {
+				archive_set_error(&(job->archive), ENOMEM,
+				    "Can't allocate memory");
+				job->ret = ARCHIVE_FATAL;
+				break;
+			}
+			job->out = p;
+			job->out_size = size;
+			strm->next_out = p + strm->total_out;
+			strm->avail_out = size - (size_t)strm->total_out;
+		}
+		r = compression_code(&(job->archive), strm, ARCHIVE_Z_FINISH);
+		if (r == ARCHIVE_EOF)
+			break;
+		if (r != ARCHIVE_OK) {
+			job->ret = ARCHIVE_FATAL;
+			break;
+		}
+	}
+	job->out_len = (size_t)strm->total_out;
+	/* Drop the end marker; the next chunk carries on the stream. */
+	if (job->compression == _7Z_LZMA2 && !job->last &&
+	    job->out_len > 0 && job->out[job->out_len - 1] == 0)
+		job->out_len--;
+	/* Release the encoder but keep its properties for the header. */
+	strm->end(&(job->archive), strm);
+}
+
+static void
+_7z_job_release(void *arg)
+{
+	struct _7z_job *job = arg;
+
+	free(job->stream.props);
+	free(job->in);
+	free(job->out);
+	archive_string_free(&(job->archive.error_string));
+}
+
+/*
+ * Wait for the oldest job and append its output to the temporary file.
+ */
+static int
+_7z_job_reap(struct archive_write *a)
+{
+	struct _7zip *zip = (struct _7zip *)a->format_data;
+	struct _7z_job *job = __archive_thread_ring_reap(&(zip->jobs));
+
+	_7z_take_props(zip, &(job->stream));
+	free(job->stream.props);
+	job->stream.props = NULL;
+	job->stream.prop_size = 0;
+	if (job->ret != ARCHIVE_OK) {
+		archive_copy_error(&(a->archive), &(job->archive));
+		return (ARCHIVE_FATAL);
+	}
+	zip->folders[job->folder].pack_size += job->out_len;
+	return (write_to_temp(a, job->out, job->out_len));
+}
+
+static int
+_7z_job_drain(struct archive_write *a)
+{
+	struct _7zip *zip = (struct _7zip *)a->format_data;
+	int r;
+
+	while (zip->jobs.pending > 0) {
+		r = _7z_job_reap(a);
+		if (r < 0)
+			return (r);
+	}
+	return (ARCHIVE_OK);
+}
+
+static void
+_7z_job_submit(struct _7zip *zip)
+{
+	__archive_thread_ring_submit(&(zip->jobs));
+	zip->cur_job = NULL;
+}
+
+/*
+ * Start collecting data for the current folder into a free job.
+ */
+static int
+_7z_job_get(struct archive_write *a)
+{
+	struct _7zip *zip = (struct _7zip *)a->format_data;
+	struct _7z_job *job;
+	int r;
+
+	if (zip->jobs.pool == NULL) {
+		if (__archive_thread_ring_init(&(zip->jobs), zip->threads,
+		    sizeof(struct _7z_job), _7z_job_run) != ARCHIVE_OK) {
+			archive_set_error(&(a->archive), ENOMEM,
+			    "Can't allocate memory");
+			return (ARCHIVE_FATAL);
+		}
+#if HAVE_LZMA_H
+		if (zip->opt_compression == _7Z_LZMA2) {
+			lzma_options_lzma lzma_opt;
+
+			lzma_opt.dict_size = LZMA_DICT_SIZE_DEFAULT;
+			lzma_lzma_preset(&lzma_opt,
+			    zip->opt_compression_level);
+			zip->chunk_size = (size_t)lzma_opt.dict_size * 3;
+			if (zip->chunk_size < 1024 * 1024)
+				zip->chunk_size = 1024 * 1024;
+		}
+#endif
+	}
+	if ((job = __archive_thread_ring_next(&(zip->jobs))) == NULL) {
+		r = _7z_job_reap(a);
+		if (r < 0)
+			return (r);
+		job = __archive_thread_ring_next(&(zip->jobs));
+	}
+	job->compression = zip->opt_compression;
+	job->level = zip->opt_compression_level;
+	job->last = 0;
+	job->folder = zip->folder_count - 1;
+	job->in_len = 0;
+	zip->cur_job = job;
+	return (ARCHIVE_OK);
+}
+
+static ssize_t
+_7z_queue_data(struct archive_write *a, const void *buff, size_t s)
+{
+	struct _7zip *zip = (struct _7zip *)a->format_data;
+	const unsigned char *p = buff;
+	struct _7z_job *job;
+	size_t limit, n, total = s;
+	int r;
+
+	limit = zip->chunk_size > 0 ? zip->chunk_size : _7Z_JOB_MAX_SIZE;
+	while (s > 0) {
+		job = zip->cur_job;
+		if (job != NULL && zip->chunk_size > 0 &&
+		    job->in_len == zip->chunk_size) {
+			_7z_job_submit(zip);
+			job = NULL;
+		}
+		if (job == NULL) {
+			r = _7z_job_get(a);
+			if (r < 0)
+				return (r);
+			job = zip->cur_job;
+		}
+		n = s;
+		if (zip->chunk_size > 0 && n > zip->chunk_size - job->in_len)
+			n = zip->chunk_size - job->in_len;
+		if (job->in_len + n > job->in_size) {
+			size_t size = job->in_size > 0 ?
+			    job->in_size : 64 * 1024;
+			unsigned char *q;
+
+			while (size < job->in_len + n)
+				size *= 2;
+			if (size > limit && limit >= job->in_len + n)
+				size = limit;
+			q = realloc(job->in, size);
+			if (q == NULL) {
+				archive_set_error(&(a->archive), ENOMEM,
+				    "Can't allocate memory");
+				return (ARCHIVE_FATAL);
+			}
+			job->in = q;
+			job->in_size = size;
+		}
+		memcpy(job->in + job->in_len, p, n);
+		job->in_len += n;
+		p += n;
+		s -= n;
+	}
+	return ((ssize_t)total);
+}
+
+/*
+ * Finish the current folder.
+ */
+static int
+_7z_end_folder(struct archive_write *a)
+{
+	struct _7zip *zip = (struct _7zip *)a->format_data;
+	ssize_t r;
+
+	if (zip->folder_count == 0)
+		return (ARCHIVE_OK);
+	if (zip->folder_queued) {
+		if (zip->cur_job == NULL) {
+			r = _7z_job_get(a);
+			if (r < 0)
+				return ((int)r);
+		}
+		zip->cur_job->last = 1;
+		_7z_job_submit(zip);
+		return (ARCHIVE_OK);
+	}
+	r = compress_out(a, NULL, 0, ARCHIVE_Z_FINISH);
+	if (r < 0)
+		return ((int)r);
+	zip->folders[zip->folder_count - 1].pack_size = zip->stream.total_out;
+	_7z_take_props(zip, &(zip->stream));
+	return (ARCHIVE_OK);
+}
+
+/*
+ * Finish the current folder and start a new one whose data is either
+ * queued for the workers or compressed right away.
+ */
+static int
+_7z_next_folder(struct archive_write *a, int queued)
+{
+	struct _7zip *zip = (struct _7zip *)a->format_data;
+	int r;
+
+	r = _7z_end_folder(a);
+	if (r < 0)
+		return (r);
+	if (zip->folder_count == zip->folder_alloc) {
+		size_t n = zip->folder_alloc > 0 ? zip->folder_alloc * 2 : 8;
+		struct _7z_folder *p;
+
+		p = realloc(zip->folders, n * sizeof(*p));
+		if (p == NULL) {
+			archive_set_error(&(a->archive), ENOMEM,
+			    "Can't allocate memory");
+			return (ARCHIVE_FATAL);
+		}
+		zip->folders = p;
+		zip->folder_alloc = n;
+	}
+	memset(&zip->folders[zip->folder_count], 0, sizeof(*zip->folders));
+	zip->folder_count++;
+	zip->folder_queued = queued;
+	if (queued)
+		return (ARCHIVE_OK);
+
+	/* Let the queued folders land in the temporary file first. */
+	r = _7z_job_drain(a);
+	if (r < 0)
+		return (r);
+	return (_7z_compression_init_encoder(a, zip->opt_compression,
+	    zip->opt_compression_level));
+}
+
 static int
 flush_wbuff(struct archive_write *a)
 {
@@ -724,18 +1174,21 @@ _7z_close(struct archive_write *a)
 		struct archive_rb_node *n;
 		uint64_t data_offset, data_size, data_unpacksize;
 		unsigned header_compression;
+		size_t i;
 
-		r = (int)compress_out(a, NULL, 0, ARCHIVE_Z_FINISH);
+		r = _7z_end_folder(a);
+		if (r < 0)
+			return (r);
+		r = _7z_job_drain(a);
 		if (r < 0)
 			return (r);
 		data_offset = 0;
-		data_size = zip->stream.total_out;
-		data_unpacksize = zip->stream.total_in;
+		data_size = data_unpacksize = 0;
+		for (i = 0; i < zip->folder_count; i++) {
+			data_size += zip->folders[i].pack_size;
+			data_unpacksize += zip->folders[i].unpack_size;
+		}
 		zip->coder.codec = zip->opt_compression;
-		zip->coder.prop_size = zip->stream.prop_size;
-		zip->coder.props = zip->stream.props;
-		zip->stream.prop_size = 0;
-		zip->stream.props = NULL;
 		zip->total_number_nonempty_entry =
 		    zip->total_number_entry - zip->total_number_empty_entry;
 
@@ -842,6 +1295,10 @@ _7z_close(struct archive_write *a)
 	archive_le32enc(&wb[8], crc32(0, &wb[12], 20));/* Start Header CRC */
 	zip->wbuff_remaining -= 32;
 
+	/* Everything else is already in place. */
+	if (zip->direct)
+		return (__archive_write_output_at(a, 0, wb, 32));
+
 	/*
 	 * Read all file contents and an encoded header from the temporary
 	 * file and write out it.
@@ -891,7 +1348,10 @@ make_substreamsInfo(struct archive_write *a, struct coder *coders)
 	if (r < 0)
 		return (r);
 
-	if (zip->total_number_nonempty_entry > 1 && coders->codec != _7Z_COPY) {
+	if (zip->total_number_nonempty_entry > zip->folder_count &&
+	    coders->codec != _7Z_COPY) {
+		size_t fi, n;
+
 		/*
 		 * Make NumUnPackStream.
 		 */
@@ -899,25 +1359,29 @@ make_substreamsInfo(struct archive_write *a, struct coder *coders)
 		if (r < 0)
 			return (r);
 
-		/* Write numUnpackStreams */
-		r = enc_uint64(a, zip->total_number_nonempty_entry);
-		if (r < 0)
-			return (r);
+		/* Write numUnpackStreams of each folder. */
+		for (fi = 0; fi < zip->folder_count; fi++) {
+			r = enc_uint64(a, zip->folders[fi].num_files);
+			if (r < 0)
+				return (r);
+		}
 
 		/*
-		 * Make kSize.
+		 * Make kSize; the size of the last file in a folder
+		 * is implied.
 		 */
 		r = enc_uint64(a, kSize);
 		if (r < 0)
 			return (r);
 		file = zip->file_list.first;
-		for (;file != NULL; file = file->next) {
-			if (file->next == NULL ||
-			    file->next->size == 0)
-				break;
-			r = enc_uint64(a, file->size);
-			if (r < 0)
-				return (r);
+		for (fi = 0; fi < zip->folder_count; fi++) {
+			for (n = 1; n < zip->folders[fi].num_files; n++) {
+				r = enc_uint64(a, file->size);
+				if (r < 0)
+					return (r);
+				file = file->next;
+			}
+			file = file->next;
 		}
 	}
 
@@ -964,6 +1428,8 @@ make_streamsInfo(struct archive_write *a, uint64_t offset, uint64_t pack_size,
 
 	if (coders->codec == _7Z_COPY)
 		numFolders = (int)zip->total_number_nonempty_entry;
+	else if (substrm)
+		numFolders = (int)zip->folder_count;
 	else
 		numFolders = 1;
 
@@ -989,7 +1455,7 @@ make_streamsInfo(struct archive_write *a, uint64_t offset, uint64_t pack_size,
 	if (r < 0)
 		return (r);
 
-	if (numFolders > 1) {
+	if (numFolders > 1 && coders->codec == _7Z_COPY) {
 		struct file *file = zip->file_list.first;
 		for (;file != NULL; file = file->next) {
 			if (file->size == 0)
@@ -998,6 +1464,12 @@ make_streamsInfo(struct archive_write *a, uint64_t offset, uint64_t pack_size,
 			if (r < 0)
 				return (r);
 		}
+	} else if (numFolders > 1) {
+		for (fi = 0; fi < numFolders; fi++) {
+			r = enc_uint64(a, zip->folders[fi].pack_size);
+			if (r < 0)
+				return (r);
+		}
 	} else {
 		/* Write size. */
 		r = enc_uint64(a, pack_size);
@@ -1086,7 +1558,7 @@ make_streamsInfo(struct archive_write *a, uint64_t offset, uint64_t pack_size,
 	if (r < 0)
 		return (r);
 
-	if (numFolders > 1) {
+	if (numFolders > 1 && coders->codec == _7Z_COPY) {
 		struct file *file = zip->file_list.first;
 		for (;file != NULL; file = file->next) {
 			if (file->size == 0)
@@ -1096,6 +1568,12 @@ make_streamsInfo(struct archive_write *a, uint64_t offset, uint64_t pack_size,
 				return (r);
 		}
 
+	} else if (numFolders > 1) {
+		for (fi = 0; fi < numFolders; fi++) {
+			r = enc_uint64(a, zip->folders[fi].unpack_size);
+			if (r < 0)
+				return (r);
+		}
 	} else {
 		/* Write UnPackSize. */
 		r = enc_uint64(a, unpack_size);
@@ -1461,9 +1939,11 @@ _7z_free(struct archive_write *a)
 	if (zip->temp_fd >= 0)
 		close(zip->temp_fd);
 
+	__archive_thread_ring_free(&(zip->jobs), _7z_job_release);
 	file_free_register(zip);
 	compression_end(&(a->archive), &(zip->stream));
 	free(zip->coder.props);
+	free(zip->folders);
 	free(zip);
 
 	return (ARCHIVE_OK);
@@ -2105,10 +2585,9 @@ compression_init_encoder_lzma2(struct archive *a,
 static void
 ppmd_write(void *p, Byte b)
 {
-	struct archive_write *a = ((IByteOut *)p)->a;
-	struct _7zip *zip = (struct _7zip *)(a->format_data);
-	struct la_zstream *lastrm = &(zip->stream);
-	struct ppmd_stream *strm;
+	struct ppmd_stream *strm = (struct ppmd_stream *)((char *)p -
+	    offsetof(struct ppmd_stream, byteout));
+	struct la_zstream *lastrm = strm->lastrm;
 
 	if (lastrm->avail_out) {
 		*lastrm->next_out++ = b;
@@ -2116,7 +2595,6 @@ ppmd_write(void *p, Byte b)
 		lastrm->total_out++;
 		return;
 	}
-	strm = (struct ppmd_stream *)lastrm->real_stream;
 	if (strm->buff_ptr < strm->buff_end) {
 		*strm->buff_ptr++ = b;
 		strm->buff_bytes++;
@@ -2171,6 +2649,7 @@ compression_init_encoder_ppmd(struct archive *a,
 		return (ARCHIVE_FATAL);
 	}
 	__archive_ppmd7_functions.Ppmd7_Init(&(strm->ppmd7_context), maxOrder);
+	strm->lastrm = lastrm;
 	strm->byteout.a = (struct archive_write *)a;
 	strm->byteout.Write = ppmd_write;
 	strm->range_enc.Stream = &(strm->byteout);
@@ -2249,50 +2728,57 @@ compression_end_ppmd(struct archive *a, struct la_zstream *lastrm)
  * Universal compressor initializer.
  */
 static int
-_7z_compression_init_encoder(struct archive_write *a, unsigned compression,
-    int compression_level)
+compression_init_encoder(struct archive *a, struct la_zstream *lastrm,
+    unsigned compression, int compression_level)
 {
-	struct _7zip *zip;
 	int r;
 
-	zip = (struct _7zip *)a->format_data;
 	switch (compression) {
 	case _7Z_DEFLATE:
-		r = compression_init_encoder_deflate(
-		    &(a->archive), &(zip->stream),
+		r = compression_init_encoder_deflate(a, lastrm,
 		    compression_level, 0);
 		break;
 	case _7Z_BZIP2:
-		r = compression_init_encoder_bzip2(
-		    &(a->archive), &(zip->stream),
+		r = compression_init_encoder_bzip2(a, lastrm,
 		    compression_level);
 		break;
 	case _7Z_LZMA1:
-		r = compression_init_encoder_lzma1(
-		    &(a->archive), &(zip->stream),
+		r = compression_init_encoder_lzma1(a, lastrm,
 		    compression_level);
 		break;
 	case _7Z_LZMA2:
-		r = compression_init_encoder_lzma2(
-		    &(a->archive), &(zip->stream),
+		r = compression_init_encoder_lzma2(a, lastrm,
 		    compression_level);
 		break;
 	case _7Z_PPMD:
-		r = compression_init_encoder_ppmd(
-		    &(a->archive), &(zip->stream),
+		r = compression_init_encoder_ppmd(a, lastrm,
 		    PPMD7_DEFAULT_ORDER, PPMD7_DEFAULT_MEM_SIZE);
 		break;
 	case _7Z_COPY:
 	default:
-		r = compression_init_encoder_copy(
-		    &(a->archive), &(zip->stream));
+		r = compression_init_encoder_copy(a, lastrm);
 		break;
 	}
 	if (r == ARCHIVE_OK) {
-		zip->stream.total_in = 0;
+		lastrm->total_in = 0;
+		lastrm->total_out = 0;
+	}
+	return (r);
+}
+
+static int
+_7z_compression_init_encoder(struct archive_write *a, unsigned compression,
+    int compression_level)
+{
+	struct _7zip *zip;
+	int r;
+
+	zip = (struct _7zip *)a->format_data;
+	r = compression_init_encoder(&(a->archive), &(zip->stream),
+	    compression, compression_level);
+	if (r == ARCHIVE_OK) {
 		zip->stream.next_out = zip->wbuff;
 		zip->stream.avail_out = sizeof(zip->wbuff);
-		zip->stream.total_out = 0;
 	}
 
 	return (r);
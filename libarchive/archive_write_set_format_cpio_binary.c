@@ -47,6 +47,8 @@ __FBSDID("$FreeBSD: head/lib/libarchive/archive_write_set_format_cpio.c 201170 2
 
 static ssize_t	archive_write_binary_data(struct archive_write *,
 		    const void *buff, size_t s);
+static ssize_t	archive_write_binary_data_fd(struct archive_write *,
+		    int fd, int64_t offset, size_t s);
 static int	archive_write_binary_close(struct archive_write *);
 static int	archive_write_binary_free(struct archive_write *);
 static int	archive_write_binary_finish_entry(struct archive_write *);
@@ -196,6 +198,7 @@ archive_write_set_format_cpio_binary(struct archive *_a, int format)
 	a->format_options = archive_write_binary_options;
 	a->format_write_header = archive_write_binary_header;
 	a->format_write_data = archive_write_binary_data;
+	a->format_write_data_fd = archive_write_binary_data_fd;
 	a->format_finish_entry = archive_write_binary_finish_entry;
 	a->format_close = archive_write_binary_close;
 	a->format_free = archive_write_binary_free;
@@ -571,6 +574,22 @@ archive_write_binary_data(struct archive_write *a, const void *buff, size_t s)
 		return (ret);
 }
 
+static ssize_t
+archive_write_binary_data_fd(struct archive_write *a, int fd, int64_t offset,
+    size_t s)
+{
+	struct cpio *cpio;
+	ssize_t bytes;
+
+	cpio = (struct cpio *)a->format_data;
+	if (s > cpio->entry_bytes_remaining)
+		s = (size_t)cpio->entry_bytes_remaining;
+	bytes = __archive_write_output_fd(a, fd, offset, s);
+	if (bytes > 0)
+		cpio->entry_bytes_remaining -= bytes;
+	return (bytes);
+}
+
 static int
 archive_write_binary_close(struct archive_write *a)
 {
@@ -596,6 +615,7 @@ archive_write_binary_free(struct archive_write *a)
 	free(cpio->ino_list);
 	free(cpio);
 	a->format_data = NULL;
+	a->format_write_data_fd = NULL;
 	return (ARCHIVE_OK);
 }
 
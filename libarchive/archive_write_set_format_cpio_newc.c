@@ -48,6 +48,8 @@ __FBSDID("$FreeBSD: head/lib/libarchive/archive_write_set_format_cpio_newc.c 201
 
 static ssize_t	archive_write_newc_data(struct archive_write *,
 		    const void *buff, size_t s);
+static ssize_t	archive_write_newc_data_fd(struct archive_write *,
+		    int fd, int64_t offset, size_t s);
 static int	archive_write_newc_close(struct archive_write *);
 static int	archive_write_newc_free(struct archive_write *);
 static int	archive_write_newc_finish_entry(struct archive_write *);
@@ -127,6 +129,7 @@ archive_write_set_format_cpio_newc(struct archive *_a)
 	a->format_options = archive_write_newc_options;
 	a->format_write_header = archive_write_newc_header;
 	a->format_write_data = archive_write_newc_data;
+	a->format_write_data_fd = archive_write_newc_data_fd;
 	a->format_finish_entry = archive_write_newc_finish_entry;
 	a->format_close = archive_write_newc_close;
 	a->format_free = archive_write_newc_free;
@@ -389,6 +392,22 @@ archive_write_newc_data(struct archive_write *a, const void *buff, size_t s)
 		return (ret);
 }
 
+static ssize_t
+archive_write_newc_data_fd(struct archive_write *a, int fd, int64_t offset,
+    size_t s)
+{
+	struct cpio *cpio;
+	ssize_t bytes;
+
+	cpio = (struct cpio *)a->format_data;
+	if (s > cpio->entry_bytes_remaining)
+		s = (size_t)cpio->entry_bytes_remaining;
+	bytes = __archive_write_output_fd(a, fd, offset, s);
+	if (bytes > 0)
+		cpio->entry_bytes_remaining -= bytes;
+	return (bytes);
+}
+
 /*
  * Format a number into the specified field.
  */
@@ -443,6 +462,7 @@ archive_write_newc_free(struct archive_write *a)
 	cpio = (struct cpio *)a->format_data;
 	free(cpio);
 	a->format_data = NULL;
+	a->format_write_data_fd = NULL;
 	return (ARCHIVE_OK);
 }
 
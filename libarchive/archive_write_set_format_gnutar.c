@@ -160,6 +160,8 @@ static int      archive_write_gnutar_header(struct archive_write *,
 		    struct archive_entry *entry);
 static ssize_t	archive_write_gnutar_data(struct archive_write *a, const void *buff,
 		    size_t s);
+static ssize_t	archive_write_gnutar_data_fd(struct archive_write *a, int fd,
+		    int64_t offset, size_t s);
 static int	archive_write_gnutar_free(struct archive_write *);
 static int	archive_write_gnutar_close(struct archive_write *);
 static int	archive_write_gnutar_finish_entry(struct archive_write *);
@@ -187,6 +189,7 @@ archive_write_set_format_gnutar(struct archive *_a)
 	a->format_options = archive_write_gnutar_options;
 	a->format_write_header = archive_write_gnutar_header;
 	a->format_write_data = archive_write_gnutar_data;
+	a->format_write_data_fd = archive_write_gnutar_data_fd;
 	a->format_close = archive_write_gnutar_close;
 	a->format_free = archive_write_gnutar_free;
 	a->format_finish_entry = archive_write_gnutar_finish_entry;
@@ -238,6 +241,7 @@ archive_write_gnutar_free(struct archive_write *a)
 	gnutar = (struct gnutar *)a->format_data;
 	free(gnutar);
 	a->format_data = NULL;
+	a->format_write_data_fd = NULL;
 	return (ARCHIVE_OK);
 }
 
@@ -270,6 +274,22 @@ archive_write_gnutar_data(struct archive_write *a, const void *buff, size_t s)
 	return (s);
 }
 
+static ssize_t
+archive_write_gnutar_data_fd(struct archive_write *a, int fd, int64_t offset,
+    size_t s)
+{
+	struct gnutar *gnutar;
+	ssize_t bytes;
+
+	gnutar = (struct gnutar *)a->format_data;
+	if (s > gnutar->entry_bytes_remaining)
+		s = (size_t)gnutar->entry_bytes_remaining;
+	bytes = __archive_write_output_fd(a, fd, offset, s);
+	if (bytes > 0)
+		gnutar->entry_bytes_remaining -= bytes;
+	return (bytes);
+}
+
 static int
 archive_write_gnutar_header(struct archive_write *a,
      struct archive_entry *entry)
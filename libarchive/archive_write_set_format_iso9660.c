@@ -56,6 +56,7 @@
 #include "archive_entry_locale.h"
 #include "archive_private.h"
 #include "archive_rb.h"
+#include "archive_thread_pool_private.h"
 #include "archive_write_private.h"
 
 #if defined(_WIN32) && !defined(__CYGWIN__)
@@ -86,6 +87,21 @@
 #define FD_1_44M_SIZE		(1024 * 1440)
 #define FD_2_88M_SIZE		(1024 * 2880)
 #define MULTI_EXTENT_SIZE	(ARCHIVE_LITERAL_LL(1) << 32)	/* 4Gi bytes. */
+/*
+ * File contents are spooled to a temporary file until there are
+ * DIRECT_THRESHOLD bytes of them.  If the output can then be rewritten
+ * in place, the spooled contents move to the output, behind room left
+ * for the volume descriptors, path tables and directories, and the rest
+ * is written there directly.  The room is the "metadata-reserve" option
+ * or, by default, twice ENTRY_ESTIMATE bytes plus the name for each
+ * entry seen so far, once more for Joliet, at least METADATA_RESERVE
+ * bytes.  Metadata that still does not fit moves the contents further
+ * back in the output when the image is closed, which costs a rewrite
+ * of them.
+ */
+#define DIRECT_THRESHOLD	(16 * 1024 * 1024)
+#define METADATA_RESERVE	(2 * 1024 * 1024)
+#define ENTRY_ESTIMATE		192
 #define MAX_DEPTH		8
 #define RR_CE_SIZE		28		/* SUSP "CE" extension size */
 
@@ -682,6 +698,17 @@ struct iso9660 {
 	/* A file stream of a temporary file, which file contents
 	 * save to until ISO image can be created. */
 	int			 temp_fd;
+	/* The file contents are written to the output, starting at
+	 * direct_offset, rather than to the temporary file; temp_pos
+	 * stands in for its file pointer and temp_end for its size. */
+	int			 direct;
+	int64_t			 direct_offset;
+	int64_t			 temp_pos;
+	int64_t			 temp_end;
+	/* Metadata bytes expected for the entries so far, and the
+	 * "metadata-reserve" option, 0 if it was not given. */
+	int64_t			 metadata_estimate;
+	int64_t			 metadata_reserve;
 
 	struct isofile		*cur_file;
 	struct isoent		*cur_dirent;
@@ -783,6 +810,15 @@ struct iso9660 {
 		int		 stream_valid;
 		int64_t		 remaining;
 		int		 compression_level;
+
+		/*
+		 * With the "zisofs-threads" option, each block is
+		 * compressed on a worker thread; finished blocks are
+		 * written out in order.
+		 */
+		int		 threads;
+		struct archive_thread_ring jobs;
+		struct zisofs_job *cur_job;
 #endif
 	} zisofs;
 
@@ -945,6 +981,13 @@ static int	wb_consume(struct archive_write *, size_t);
 static int	wb_set_offset(struct archive_write *, int64_t);
 #endif
 static int	write_null(struct archive_write *, size_t);
+static int	move_contents_to_output(struct archive_write *);
+static int	make_room_for_metadata(struct archive_write *, int);
+static void	temp_seek(struct archive_write *, int64_t);
+#ifdef HAVE_ZLIB_H
+static int64_t	temp_tell(struct archive_write *);
+#endif
+static ssize_t	temp_read(struct archive_write *, void *, size_t);
 static int	write_VD_terminator(struct archive_write *);
 static int	set_file_identifier(unsigned char *, int, int, enum vdc,
 		    struct archive_write *, struct vdd *,
@@ -1126,6 +1169,7 @@ archive_write_set_format_iso9660(struct archive *_a)
 	iso9660->zisofs.block_pointers_allocated = 0;
 	iso9660->zisofs.stream_valid = 0;
 	iso9660->zisofs.compression_level = 9;
+	iso9660->zisofs.threads = 1;
 	memset(&(iso9660->zisofs.stream), 0,
 	    sizeof(iso9660->zisofs.stream));
 #endif
@@ -1450,6 +1494,26 @@ iso9660_options(struct archive_write *a, const char *key, const char *value)
 			return (ARCHIVE_OK);
 		}
 		break;
+	case 'm':
+		if (strcmp(key, "metadata-reserve") == 0) {
+			/* A byte count; 0 sizes the room from the
+			 * entries. */
+			uint64_t size = 0;
+
+			p = value;
+			if (p == NULL || *p == '\0')
+				goto invalid_value;
+			for (; *p >= '0' && *p <= '9'; p++) {
+				if (size > (SIZE_MAX / 2 - 9) / 10)
+					goto invalid_value;
+				size = size * 10 + (*p - '0');
+			}
+			if (*p != '\0')
+				goto invalid_value;
+			iso9660->metadata_reserve = (int64_t)size;
+			return (ARCHIVE_OK);
+		}
+		break;
 	case 'p':
 		if (strcmp(key, "pad") == 0) {
 			iso9660->opt.pad = value != NULL;
@@ -1504,6 +1568,31 @@ iso9660_options(struct archive_write *a, const char *key, const char *value)
 			}
 			return (ARCHIVE_OK);
 		}
+		if (strcmp(key, "zisofs-threads") == 0) {
+#ifdef HAVE_ZLIB_H
+			char *endptr;
+
+			if (value == NULL)
+				goto invalid_value;
+			errno = 0;
+			iso9660->zisofs.threads =
+			    (int)strtoul(value, &endptr, 10);
+			if (errno != 0 || *endptr != '\0') {
+				iso9660->zisofs.threads = 1;
+				goto invalid_value;
+			}
+			if (iso9660->zisofs.threads == 0)
+				iso9660->zisofs.threads =
+				    __archive_thread_pool_cpus();
+			return (ARCHIVE_OK);
+#else
+			archive_set_error(&a->archive,
+			    ARCHIVE_ERRNO_MISC,
+			    "``zisofs-threads'' "
+			    "is not supported on this platform.");
+			return (ARCHIVE_FATAL);
+#endif
+		}
 		break;
 	}
 
@@ -1575,6 +1664,10 @@ iso9660_write_header(struct archive_write *a, struct archive_entry *entry)
 		isofile_free(file);
 		return (r);
 	}
+	iso9660->metadata_estimate += ENTRY_ESTIMATE +
+	    archive_strlen(&(file->basename)) +
+	    2 * (archive_strlen(&(file->basename)) < 64 ?
+	    archive_strlen(&(file->basename)) : 64);
 
 	isofile_add_entry(iso9660, file);
 	isoent = isoent_new(file);
@@ -1616,7 +1709,7 @@ iso9660_write_header(struct archive_write *a, struct archive_entry *entry)
 	/*
 	 * Prepare to save the contents of the file.
 	 */
-	if (iso9660->temp_fd < 0) {
+	if (iso9660->temp_fd < 0 && !iso9660->direct) {
 		iso9660->temp_fd = __archive_mktemp(NULL);
 		if (iso9660->temp_fd < 0) {
 			archive_set_error(&a->archive, errno,
@@ -1624,6 +1717,12 @@ iso9660_write_header(struct archive_write *a, struct archive_entry *entry)
 			return (ARCHIVE_FATAL);
 		}
 	}
+	if (!iso9660->direct && wb_offset(a) >= DIRECT_THRESHOLD &&
+	    __archive_write_seekable(a)) {
+		r = move_contents_to_output(a);
+		if (r != ARCHIVE_OK)
+			return (ARCHIVE_FATAL);
+	}
 
 	/* Save an offset of current file in temporary file. */
 	file->content.offset_of_temp = wb_offset(a);
@@ -1636,6 +1735,131 @@ iso9660_write_header(struct archive_write *a, struct archive_entry *entry)
 	return (ret);
 }
 
+/*
+ * Copy the contents spooled so far to the output, after room for the
+ * metadata, and write the rest of them there.
+ */
+static int
+move_contents_to_output(struct archive_write *a)
+{
+	struct iso9660 *iso9660 = a->format_data;
+	unsigned char *buff;
+	int64_t pos, end, reserve;
+	ssize_t rs;
+	int r;
+
+	reserve = iso9660->metadata_reserve;
+	if (reserve == 0) {
+		reserve = 2 * iso9660->metadata_estimate;
+		if (reserve < METADATA_RESERVE)
+			reserve = METADATA_RESERVE;
+	}
+	reserve = (reserve + LOGICAL_BLOCK_SIZE - 1) &
+	    ~(int64_t)(LOGICAL_BLOCK_SIZE - 1);
+	pos = lseek(iso9660->temp_fd, 0, SEEK_CUR);
+	end = lseek(iso9660->temp_fd, 0, SEEK_END);
+	if (pos < 0 || end < 0 ||
+	    lseek(iso9660->temp_fd, 0, SEEK_SET) < 0) {
+		archive_set_error(&a->archive, errno,
+		    "Can't seek temporary file");
+		return (ARCHIVE_FATAL);
+	}
+	r = __archive_write_nulls(a, (size_t)reserve);
+	if (r != ARCHIVE_OK)
+		return (r);
+	buff = malloc(wb_buffmax());
+	if (buff == NULL) {
+		archive_set_error(&a->archive, ENOMEM,
+		    "Can't allocate memory");
+		return (ARCHIVE_FATAL);
+	}
+	while ((rs = read(iso9660->temp_fd, buff, wb_buffmax())) > 0) {
+		r = __archive_write_output(a, buff, rs);
+		if (r != ARCHIVE_OK)
+			break;
+	}
+	free(buff);
+	if (rs < 0) {
+		archive_set_error(&a->archive, errno,
+		    "Can't read temporary file(%jd)", (intmax_t)rs);
+		return (ARCHIVE_FATAL);
+	}
+	if (r != ARCHIVE_OK)
+		return (r);
+	close(iso9660->temp_fd);
+	iso9660->temp_fd = -1;
+	iso9660->direct = 1;
+	iso9660->direct_offset = reserve;
+	iso9660->temp_pos = pos;
+	iso9660->temp_end = end;
+	return (ARCHIVE_OK);
+}
+
+/*
+ * Move the file contents in the output further back if the metadata,
+ * which ends at the given block, does not fit in front of them.  That
+ * reads and writes all of them again; a larger "metadata-reserve"
+ * avoids it.
+ */
+static int
+make_room_for_metadata(struct archive_write *a, int blocks)
+{
+	struct iso9660 *iso9660 = a->format_data;
+	struct isoent *catalog;
+	int64_t offset;
+
+	if ((catalog = iso9660->el_torito.catalog) != NULL)
+		blocks += (int)((archive_entry_size(catalog->file->entry) +
+		    LOGICAL_BLOCK_SIZE -1) >> LOGICAL_BLOCK_BITS);
+	offset = (int64_t)blocks << LOGICAL_BLOCK_BITS;
+	if (offset <= iso9660->direct_offset)
+		return (ARCHIVE_OK);
+	if (__archive_write_move_output(a, iso9660->direct_offset, offset,
+	    iso9660->temp_end) != ARCHIVE_OK)
+		return (ARCHIVE_FATAL);
+	iso9660->direct_offset = offset;
+	return (ARCHIVE_OK);
+}
+
+static void
+temp_seek(struct archive_write *a, int64_t offset)
+{
+	struct iso9660 *iso9660 = a->format_data;
+
+	if (iso9660->direct)
+		iso9660->temp_pos = offset;
+	else
+		lseek(iso9660->temp_fd, offset, SEEK_SET);
+}
+
+#ifdef HAVE_ZLIB_H
+static int64_t
+temp_tell(struct archive_write *a)
+{
+	struct iso9660 *iso9660 = a->format_data;
+
+	if (iso9660->direct)
+		return (iso9660->temp_pos);
+	return (lseek(iso9660->temp_fd, 0, SEEK_CUR));
+}
+#endif
+
+static ssize_t
+temp_read(struct archive_write *a, void *buff, size_t s)
+{
+	struct iso9660 *iso9660 = a->format_data;
+
+	if (!iso9660->direct)
+		return (read(iso9660->temp_fd, buff, s));
+	if ((int64_t)s > iso9660->temp_end - iso9660->temp_pos)
+		s = (size_t)(iso9660->temp_end - iso9660->temp_pos);
+	if (__archive_write_read_output(a,
+	    iso9660->direct_offset + iso9660->temp_pos, buff, s) != ARCHIVE_OK)
+		return (-1);
+	iso9660->temp_pos += s;
+	return (s);
+}
+
 static int
 write_to_temp(struct archive_write *a, const void *buff, size_t s)
 {
@@ -1643,6 +1867,16 @@ write_to_temp(struct archive_write *a, const void *buff, size_t s)
 	ssize_t written;
 	const unsigned char *b;
 
+	if (iso9660->direct) {
+		if (__archive_write_output_at(a,
+		    iso9660->direct_offset + iso9660->temp_pos, buff, s)
+		    != ARCHIVE_OK)
+			return (ARCHIVE_FATAL);
+		iso9660->temp_pos += s;
+		if (iso9660->temp_end < iso9660->temp_pos)
+			iso9660->temp_end = iso9660->temp_pos;
+		return (ARCHIVE_OK);
+	}
 	b = (const unsigned char *)buff;
 	while (s) {
 		written = write(iso9660->temp_fd, b, s);
@@ -1712,7 +1946,7 @@ write_iso9660_data(struct archive_write *a, const void *buff, size_t s)
 	struct iso9660 *iso9660 = a->format_data;
 	size_t ws;
 
-	if (iso9660->temp_fd < 0) {
+	if (iso9660->temp_fd < 0 && !iso9660->direct) {
 		archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
 		    "Couldn't create temporary file");
 		return (ARCHIVE_FATAL);
@@ -1975,6 +2209,14 @@ iso9660_close(struct archive_write *a)
 		blocks += RRIP_ER_BLOCK;
 	}
 
+	/* Make sure the metadata fits in front of the file contents
+	 * already written to the output. */
+	if (iso9660->direct) {
+		ret = make_room_for_metadata(a, blocks);
+		if (ret < 0)
+			return (ret);
+	}
+
 	/* Setup the locations of all file contents. */
  	isoent_setup_file_location(iso9660, blocks);
 	blocks += iso9660->total_file_block;
@@ -3627,7 +3869,10 @@ wb_write_out(struct archive_write *a)
 
 	wsize = sizeof(iso9660->wbuff) - iso9660->wbuff_remaining;
 	nw = wsize % LOGICAL_BLOCK_SIZE;
-	if (iso9660->wbuff_type == WB_TO_STREAM)
+	if (iso9660->wbuff_type == WB_TO_STREAM && iso9660->direct)
+		r = __archive_write_output_at(a, iso9660->wbuff_offset,
+		    iso9660->wbuff, wsize - nw);
+	else if (iso9660->wbuff_type == WB_TO_STREAM)
 		r = __archive_write_output(a, iso9660->wbuff, wsize - nw);
 	else
 		r = write_to_temp(a, iso9660->wbuff, wsize - nw);
@@ -3664,11 +3909,17 @@ wb_consume(struct archive_write *a, size_t size)
 
 #ifdef HAVE_ZLIB_H
 
+/*
+ * Move the write position within the temporary file.  Everything
+ * buffered is written out first; wbuff then restarts at the logical
+ * block containing the new position, with the bytes in front of it
+ * read back so that wbuff_offset stays on a block boundary.
+ */
 static int
 wb_set_offset(struct archive_write *a, int64_t off)
 {
 	struct iso9660 *iso9660 = (struct iso9660 *)a->format_data;
-	int64_t used, ext_bytes;
+	int64_t used, base;
 
 	if (iso9660->wbuff_type != WB_TO_TEMP) {
 		archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
@@ -3677,46 +3928,43 @@ wb_set_offset(struct archive_write *a, int64_t off)
 	}
 
 	used = sizeof(iso9660->wbuff) - iso9660->wbuff_remaining;
-	if (iso9660->wbuff_offset + used > iso9660->wbuff_tail)
-		iso9660->wbuff_tail = iso9660->wbuff_offset + used;
-	if (iso9660->wbuff_offset < iso9660->wbuff_written) {
-		if (used > 0 &&
-		    write_to_temp(a, iso9660->wbuff, (size_t)used) != ARCHIVE_OK)
-			return (ARCHIVE_FATAL);
-		iso9660->wbuff_offset = iso9660->wbuff_written;
-		lseek(iso9660->temp_fd, iso9660->wbuff_offset, SEEK_SET);
-		iso9660->wbuff_remaining = sizeof(iso9660->wbuff);
-		used = 0;
-	}
-	if (off < iso9660->wbuff_offset) {
-		/*
-		 * Write out waiting data.
-		 */
-		if (used > 0) {
-			if (wb_write_out(a) != ARCHIVE_OK)
-				return (ARCHIVE_FATAL);
-		}
-		lseek(iso9660->temp_fd, off, SEEK_SET);
-		iso9660->wbuff_offset = off;
-		iso9660->wbuff_remaining = sizeof(iso9660->wbuff);
-	} else if (off <= iso9660->wbuff_tail) {
-		iso9660->wbuff_remaining = (size_t)
-		    (sizeof(iso9660->wbuff) - (off - iso9660->wbuff_offset));
-	} else {
-		ext_bytes = off - iso9660->wbuff_tail;
-		iso9660->wbuff_remaining = (size_t)(sizeof(iso9660->wbuff)
-		   - (iso9660->wbuff_tail - iso9660->wbuff_offset));
-		while (ext_bytes >= (int64_t)iso9660->wbuff_remaining) {
-			if (write_null(a, (size_t)iso9660->wbuff_remaining)
-			    != ARCHIVE_OK)
+	if (used > 0 &&
+	    write_to_temp(a, iso9660->wbuff, (size_t)used) != ARCHIVE_OK)
+		return (ARCHIVE_FATAL);
+	if (iso9660->wbuff_offset + used > iso9660->wbuff_written)
+		iso9660->wbuff_written = iso9660->wbuff_offset + used;
+	if (iso9660->wbuff_written > iso9660->wbuff_tail)
+		iso9660->wbuff_tail = iso9660->wbuff_written;
+
+	if (off > iso9660->wbuff_tail) {
+		/* Fill the gap with zeros. */
+		memset(iso9660->wbuff, 0, sizeof(iso9660->wbuff));
+		temp_seek(a, iso9660->wbuff_tail);
+		while (iso9660->wbuff_tail < off) {
+			size_t ns = sizeof(iso9660->wbuff);
+
+			if ((int64_t)ns > off - iso9660->wbuff_tail)
+				ns = (size_t)(off - iso9660->wbuff_tail);
+			if (write_to_temp(a, iso9660->wbuff, ns) != ARCHIVE_OK)
 				return (ARCHIVE_FATAL);
-			ext_bytes -= iso9660->wbuff_remaining;
+			iso9660->wbuff_tail += ns;
 		}
-		if (ext_bytes > 0) {
-			if (write_null(a, (size_t)ext_bytes) != ARCHIVE_OK)
-				return (ARCHIVE_FATAL);
+		iso9660->wbuff_written = iso9660->wbuff_tail;
+	}
+	base = off - (off % LOGICAL_BLOCK_SIZE);
+	iso9660->wbuff_remaining = sizeof(iso9660->wbuff);
+	temp_seek(a, base);
+	if (off > base) {
+		if (temp_read(a, iso9660->wbuff, (size_t)(off - base))
+		    != off - base) {
+			archive_set_error(&a->archive, errno,
+			    "Can't read temporary file");
+			return (ARCHIVE_FATAL);
 		}
+		temp_seek(a, base);
+		iso9660->wbuff_remaining -= (size_t)(off - base);
 	}
+	iso9660->wbuff_offset = base;
 	return (ARCHIVE_OK);
 }
 
@@ -4480,10 +4728,9 @@ write_directory_descriptors(struct archive_write *a, struct vdd *vdd)
 static int
 write_file_contents(struct archive_write *a, int64_t offset, int64_t size)
 {
-	struct iso9660 *iso9660 = a->format_data;
 	int r;
 
-	lseek(iso9660->temp_fd, offset, SEEK_SET);
+	temp_seek(a, offset);
 
 	while (size) {
 		size_t rsize;
@@ -4494,7 +4741,7 @@ write_file_contents(struct archive_write *a, int64_t offset, int64_t size)
 		rsize = wb_remaining(a);
 		if (rsize > (size_t)size)
 			rsize = (size_t)size;
-		rs = read(iso9660->temp_fd, wb, rsize);
+		rs = temp_read(a, wb, rsize);
 		if (rs <= 0) {
 			archive_set_error(&a->archive, errno,
 			    "Can't read temporary file(%jd)", (intmax_t)rs);
@@ -4526,6 +4773,16 @@ write_file_descriptors(struct archive_write *a)
 			return (r);
 	}
 
+	/* The file contents are already in the output; skip over them. */
+	if (iso9660->direct) {
+		r = wb_write_out(a);
+		if (r < 0)
+			return (r);
+		iso9660->wbuff_offset =
+		    iso9660->direct_offset + iso9660->temp_end;
+		return (ARCHIVE_OK);
+	}
+
 	/* Write the boot file contents. */
 	if (iso9660->el_torito.boot != NULL) {
 		file = iso9660->el_torito.boot->file;
@@ -5432,6 +5689,13 @@ _isoent_file_location(struct iso9660 *iso9660, struct isoent *isoent,
 	}
 }
 
+static inline int
+direct_location(struct iso9660 *iso9660, struct content *con)
+{
+	return ((int)((iso9660->direct_offset + con->offset_of_temp)
+	    >> LOGICAL_BLOCK_BITS));
+}
+
 /*
  * Setup file locations.
  */
@@ -5447,6 +5711,7 @@ isoent_setup_file_location(struct iso9660 *iso9660, int location)
 	int joliet;
 	int symlocation;
 	int total_block;
+	int base_location = location;
 
 	iso9660->total_file_block = 0;
 	if ((isoent = iso9660->el_torito.catalog) != NULL) {
@@ -5456,7 +5721,20 @@ isoent_setup_file_location(struct iso9660 *iso9660, int location)
 		location += block;
 		iso9660->total_file_block += block;
 	}
+	if (iso9660->direct) {
+		/*
+		 * The file contents are already in place; they end up
+		 * where they were written, behind the metadata.
+		 */
+		location = (int)(iso9660->direct_offset >> LOGICAL_BLOCK_BITS);
+		iso9660->total_file_block = location - base_location +
+		    (int)((iso9660->temp_end + LOGICAL_BLOCK_SIZE - 1)
+		      >> LOGICAL_BLOCK_BITS);
+	}
 	if ((isoent = iso9660->el_torito.boot) != NULL) {
+		if (iso9660->direct)
+			location = direct_location(iso9660,
+			    &(isoent->file->content));
 		isoent->file->content.location = location;
 		size = fd_boot_image_size(iso9660->el_torito.media_type);
 		if (size == 0)
@@ -5464,7 +5742,8 @@ isoent_setup_file_location(struct iso9660 *iso9660, int location)
 		block = ((int)size + LOGICAL_BLOCK_SIZE -1)
 		    >> LOGICAL_BLOCK_BITS;
 		location += block;
-		iso9660->total_file_block += block;
+		if (!iso9660->direct)
+			iso9660->total_file_block += block;
 		isoent->file->content.blocks = block;
 	}
 
@@ -5512,6 +5791,12 @@ isoent_setup_file_location(struct iso9660 *iso9660, int location)
 
 		file->cur_content = &(file->content);
 		do {
+			if (iso9660->direct) {
+				file->cur_content->location = direct_location(
+				    iso9660, file->cur_content);
+				file->cur_content = file->cur_content->next;
+				continue;
+			}
 			file->cur_content->location = location;
 			location += file->cur_content->blocks;
 			total_block += file->cur_content->blocks;
@@ -7320,8 +7605,7 @@ setup_boot_information(struct archive_write *a)
 	unsigned char buff[4096];
 
 	np = iso9660->el_torito.boot;
-	lseek(iso9660->temp_fd,
-	    np->file->content.offset_of_temp + 64, SEEK_SET);
+	temp_seek(a, np->file->content.offset_of_temp + 64);
 	size = archive_entry_size(np->file->entry) - 64;
 	if (size <= 0) {
 		archive_set_error(&a->archive, errno,
@@ -7338,7 +7622,7 @@ setup_boot_information(struct archive_write *a)
 		else
 			rsize = (size_t)size;
 
-		rs = read(iso9660->temp_fd, buff, rsize);
+		rs = temp_read(a, buff, rsize);
 		if (rs <= 0) {
 			archive_set_error(&a->archive, errno,
 			    "Can't read temporary file(%jd)",
@@ -7364,8 +7648,7 @@ setup_boot_information(struct archive_write *a)
 	memset(buff+16, 0, 40);
 
 	/* Overwrite the boot file. */
-	lseek(iso9660->temp_fd,
-	    np->file->content.offset_of_temp + 8, SEEK_SET);
+	temp_seek(a, np->file->content.offset_of_temp + 8);
 	return (write_to_temp(a, buff, 56));
 }
 
@@ -7450,6 +7733,9 @@ zisofs_init(struct archive_write *a,  struct isofile *file)
 	r = zisofs_init_zstream(a);
 	if (r != ARCHIVE_OK)
 		return (ARCHIVE_FATAL);
+	/* Drop a partial block of a file that turned out to be
+	 * compressed by mkzftree already. */
+	iso9660->zisofs.cur_job = NULL;
 
 	/* Mark file->zisofs to create RRIP 'ZF' Use Entry. */
 	file->zisofs.header_size = ZF_HEADER_SIZE >> 2;
@@ -7591,6 +7877,176 @@ zisofs_detect_magic(struct archive_write *a, const void *buff, size_t s)
 
 #ifdef HAVE_ZLIB_H
 
+/*
+ * One zisofs block handed to a worker thread.
+ */
+struct zisofs_job {
+	struct archive_thread_job job;
+	unsigned char	 in[ZF_BLOCK_SIZE];
+	size_t		 in_len;
+	unsigned char	*out;
+	size_t		 out_size;
+	size_t		 out_len;
+	int		 level;
+	int		 allzero;
+	int		 ret;
+	z_stream	 stream;
+	int		 stream_valid;
+};
+
+static void
+zisofs_job_run(void *arg)
+{
+	struct zisofs_job *job = (struct zisofs_job *)arg;
+	size_t i;
+
+	/* A full block of zeros is not stored at all. */
+	job->allzero = 1;
+	for (i = 0; i < job->in_len; i++) {
+		if (job->in[i]) {
+			job->allzero = 0;
+			break;
+		}
+	}
+	job->out_len = 0;
+	if (job->allzero && job->in_len == ZF_BLOCK_SIZE) {
+		job->ret = Z_STREAM_END;
+		return;
+	}
+
+	if (job->stream_valid)
+		job->ret = deflateReset(&(job->stream));
+	else {
+		job->ret = deflateInit(&(job->stream), job->level);
+		job->stream_valid = job->ret == Z_OK;
+	}
+	if (job->ret != Z_OK)
+		return;
+	job->stream.next_in = job->in;
+	job->stream.avail_in = (uInt)job->in_len;
+	job->stream.next_out = job->out;
+	job->stream.avail_out = (uInt)job->out_size;
+	job->ret = deflate(&(job->stream), Z_FINISH);
+	job->out_len = job->out_size - job->stream.avail_out;
+}
+
+static void
+zisofs_job_release(void *arg)
+{
+	struct zisofs_job *job = arg;
+
+	if (job->stream_valid)
+		deflateEnd(&(job->stream));
+	free(job->out);
+}
+
+/*
+ * Wait for the oldest block and append it to the temporary file.
+ */
+static int
+zisofs_job_reap(struct archive_write *a)
+{
+	struct iso9660 *iso9660 = a->format_data;
+	struct zisofs_job *job =
+	    __archive_thread_ring_reap(&(iso9660->zisofs.jobs));
+
+	if (job->ret != Z_STREAM_END) {
+		archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+		    "Compression failed:"
+		    " deflate() call returned status %d", job->ret);
+		return (ARCHIVE_FATAL);
+	}
+	if (job->out_len > 0 &&
+	    wb_write_to_temp(a, job->out, job->out_len) != ARCHIVE_OK)
+		return (ARCHIVE_FATAL);
+	iso9660->zisofs.total_size += job->out_len;
+	iso9660->cur_file->cur_content->size += job->out_len;
+	iso9660->zisofs.block_pointers_idx ++;
+	archive_le32enc(&(iso9660->zisofs.block_pointers[
+	    iso9660->zisofs.block_pointers_idx]),
+		(uint32_t)iso9660->zisofs.total_size);
+	return (ARCHIVE_OK);
+}
+
+static int
+zisofs_job_drain(struct archive_write *a)
+{
+	struct iso9660 *iso9660 = a->format_data;
+	int r;
+
+	if (iso9660->zisofs.cur_job != NULL) {
+		__archive_thread_ring_submit(&(iso9660->zisofs.jobs));
+		iso9660->zisofs.cur_job = NULL;
+	}
+	while (iso9660->zisofs.jobs.pending > 0) {
+		r = zisofs_job_reap(a);
+		if (r < 0)
+			return (r);
+	}
+	return (ARCHIVE_OK);
+}
+
+/*
+ * Split data into zisofs blocks and queue them for the workers.
+ */
+static int
+zisofs_job_write(struct archive_write *a, const void *buff, size_t s)
+{
+	struct iso9660 *iso9660 = a->format_data;
+	struct zisofs_job *job;
+	const unsigned char *b = buff;
+	size_t avail;
+	int r;
+
+	if (iso9660->zisofs.jobs.pool == NULL &&
+	    __archive_thread_ring_init(&(iso9660->zisofs.jobs),
+	    iso9660->zisofs.threads, sizeof(struct zisofs_job),
+	    zisofs_job_run) != ARCHIVE_OK)
+		goto nomem;
+
+	while (s) {
+		job = iso9660->zisofs.cur_job;
+		if (job == NULL) {
+			job = __archive_thread_ring_next(
+			    &(iso9660->zisofs.jobs));
+			if (job == NULL) {
+				r = zisofs_job_reap(a);
+				if (r < 0)
+					return (r);
+				job = __archive_thread_ring_next(
+				    &(iso9660->zisofs.jobs));
+			}
+			if (job->out == NULL) {
+				job->out_size = compressBound(ZF_BLOCK_SIZE);
+				job->out = malloc(job->out_size);
+				if (job->out == NULL)
+					goto nomem;
+			}
+			job->in_len = 0;
+			job->level = iso9660->zisofs.compression_level;
+			iso9660->zisofs.cur_job = job;
+		}
+		avail = ZF_BLOCK_SIZE - job->in_len;
+		if (avail > s)
+			avail = s;
+		memcpy(job->in + job->in_len, b, avail);
+		job->in_len += avail;
+		iso9660->zisofs.remaining -= avail;
+		b += avail;
+		s -= avail;
+		if (job->in_len == ZF_BLOCK_SIZE ||
+		    iso9660->zisofs.remaining <= 0) {
+			__archive_thread_ring_submit(&(iso9660->zisofs.jobs));
+			iso9660->zisofs.cur_job = NULL;
+		}
+	}
+	return (ARCHIVE_OK);
+nomem:
+	archive_set_error(&a->archive, ENOMEM,
+	    "Can't allocate memory for zisofs threads");
+	return (ARCHIVE_FATAL);
+}
+
 /*
  * Compress data and write it to a temporary file.
  */
@@ -7604,6 +8060,9 @@ zisofs_write_to_temp(struct archive_write *a, const void *buff, size_t s)
 	size_t avail, csize;
 	int flush, r;
 
+	if (iso9660->zisofs.threads > 1)
+		return (zisofs_job_write(a, buff, s));
+
 	zstrm = &(iso9660->zisofs.stream);
 	zstrm->next_out = wb_buffptr(a);
 	zstrm->avail_out = (uInt)wb_remaining(a);
@@ -7642,6 +8101,7 @@ zisofs_write_to_temp(struct archive_write *a, const void *buff, size_t s)
 		 * If current data block are all zero, we do not use
 		 * compressed data.
 		 */
+		r = Z_OK;
 		if (flush == Z_FINISH && iso9660->zisofs.allzero &&
 		    avail + zstrm->total_in == ZF_BLOCK_SIZE) {
 			if (iso9660->zisofs.block_offset !=
@@ -7657,14 +8117,20 @@ zisofs_write_to_temp(struct archive_write *a, const void *buff, size_t s)
 				    iso9660->zisofs.block_offset;
 				file->cur_content->size -= diff;
 				iso9660->zisofs.total_size -= diff;
+				zstrm->next_out = wb_buffptr(a);
+				zstrm->avail_out = (uInt)wb_remaining(a);
 			}
 			zstrm->avail_in = 0;
+			/* Nothing of this block is kept. */
+			r = Z_STREAM_END;
 		}
 
 		/*
-		 * Compress file data.
+		 * Compress file data.  At the end of a block, keep
+		 * going until deflate() has flushed all of its output.
 		 */
-		while (zstrm->avail_in > 0) {
+		while (zstrm->avail_in > 0 ||
+		    (flush == Z_FINISH && r != Z_STREAM_END)) {
 			csize = zstrm->total_out;
 			r = deflate(zstrm, flush);
 			switch (r) {
@@ -7716,6 +8182,10 @@ zisofs_finish_entry(struct archive_write *a)
 	size_t s;
 	int64_t tail;
 
+	if (iso9660->zisofs.jobs.pool != NULL &&
+	    zisofs_job_drain(a) != ARCHIVE_OK)
+		return (ARCHIVE_FATAL);
+
 	/* Direct temp file stream to zisofs temp file stream. */
 	archive_entry_set_size(file->entry, iso9660->zisofs.total_size);
 
@@ -7785,6 +8255,7 @@ zisofs_free(struct archive_write *a)
 	struct iso9660 *iso9660 = a->format_data;
 	int ret = ARCHIVE_OK;
 
+	__archive_thread_ring_free(&(iso9660->zisofs.jobs), zisofs_job_release);
 	free(iso9660->zisofs.block_pointers);
 	if (iso9660->zisofs.stream_valid &&
 	    deflateEnd(&(iso9660->zisofs.stream)) != Z_OK) {
@@ -8013,7 +8484,7 @@ zisofs_extract(struct archive_write *a, struct zisofs_extract *zisofs,
 		if (r < 0)
 			return (r);
 	}
-	zisofs->pz_offset += (uint32_t)bytes;
+	zisofs->pz_offset += (uint32_t)(bytes - avail);
 	return (bytes - avail);
 }
 
@@ -8022,12 +8493,12 @@ zisofs_rewind_boot_file(struct archive_write *a)
 {
 	struct iso9660 *iso9660 = a->format_data;
 	struct isofile *file;
-	unsigned char *rbuff;
+	unsigned char *rbuff, *p;
 	ssize_t r;
 	size_t remaining, rbuff_size;
 	struct zisofs_extract zext;
 	int64_t read_offset, write_offset, new_offset;
-	int fd, ret = ARCHIVE_OK;
+	int ret = ARCHIVE_OK;
 
 	file = iso9660->el_torito.boot->file;
 	/*
@@ -8044,7 +8515,6 @@ zisofs_rewind_boot_file(struct archive_write *a)
 	zext.pz_uncompressed_size = file->zisofs.uncompressed_size;
 	zext.pz_log2_bs = file->zisofs.log2_bs;
 
-	fd = iso9660->temp_fd;
 	new_offset = wb_offset(a);
 	read_offset = file->content.offset_of_temp;
 	remaining = (size_t)file->content.size;
@@ -8063,15 +8533,15 @@ zisofs_rewind_boot_file(struct archive_write *a)
 		ssize_t rs;
 
 		/* Get the current file pointer. */
-		write_offset = lseek(fd, 0, SEEK_CUR);
+		write_offset = temp_tell(a);
 
 		/* Change the file pointer to read. */
-		lseek(fd, read_offset, SEEK_SET);
+		temp_seek(a, read_offset);
 
 		rsize = rbuff_size;
 		if (rsize > remaining)
 			rsize = remaining;
-		rs = read(iso9660->temp_fd, rbuff, rsize);
+		rs = temp_read(a, rbuff, rsize);
 		if (rs <= 0) {
 			archive_set_error(&a->archive, errno,
 			    "Can't read temporary file(%jd)", (intmax_t)rs);
@@ -8082,9 +8552,17 @@ zisofs_rewind_boot_file(struct archive_write *a)
 		read_offset += rs;
 
 		/* Put the file pointer back to write. */
-		lseek(fd, write_offset, SEEK_SET);
+		temp_seek(a, write_offset);
 
-		r = zisofs_extract(a, &zext, rbuff, rs);
+		/* zisofs_extract() handles at most one block a call. */
+		p = rbuff;
+		do {
+			r = zisofs_extract(a, &zext, p, rs);
+			if (r < 0)
+				break;
+			p += r;
+			rs -= r;
+		} while (rs > 0);
 		if (r < 0) {
 			ret = (int)r;
 			break;
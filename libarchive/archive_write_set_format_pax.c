@@ -83,6 +83,8 @@ static int		 add_pax_acl(struct archive_write *,
 			    struct archive_entry *, struct pax *, int);
 static ssize_t		 archive_write_pax_data(struct archive_write *,
 			     const void *, size_t);
+static ssize_t		 archive_write_pax_data_fd(struct archive_write *,
+			     int, int64_t, size_t);
 static int		 archive_write_pax_close(struct archive_write *);
 static int		 archive_write_pax_free(struct archive_write *);
 static int		 archive_write_pax_finish_entry(struct archive_write *);
@@ -151,6 +153,7 @@ archive_write_set_format_pax(struct archive *_a)
 	a->format_options = archive_write_pax_options;
 	a->format_write_header = archive_write_pax_header;
 	a->format_write_data = archive_write_pax_data;
+	a->format_write_data_fd = archive_write_pax_data_fd;
 	a->format_close = archive_write_pax_close;
 	a->format_free = archive_write_pax_free;
 	a->format_finish_entry = archive_write_pax_finish_entry;
@@ -1795,6 +1798,7 @@ archive_write_pax_free(struct archive_write *a)
 	sparse_list_clear(pax);
 	free(pax);
 	a->format_data = NULL;
+	a->format_write_data_fd = NULL;
 	return (ARCHIVE_OK);
 }
 
@@ -1822,20 +1826,15 @@ archive_write_pax_finish_entry(struct archive_write *a)
 	return (ret);
 }
 
-static ssize_t
-archive_write_pax_data(struct archive_write *a, const void *buff, size_t s)
+/*
+ * According to GNU PAX format 1.0, write a sparse map
+ * before the body.
+ */
+static int
+write_sparse_map(struct archive_write *a, struct pax *pax)
 {
-	struct pax *pax;
-	size_t ws;
-	size_t total;
 	int ret;
 
-	pax = (struct pax *)a->format_data;
-
-	/*
-	 * According to GNU PAX format 1.0, write a sparse map
-	 * before the body.
-	 */
 	if (archive_strlen(&(pax->sparse_map))) {
 		ret = __archive_write_output(a, pax->sparse_map.s,
 		    archive_strlen(&(pax->sparse_map)));
@@ -1846,6 +1845,22 @@ archive_write_pax_data(struct archive_write *a, const void *buff, size_t s)
 			return (ret);
 		archive_string_empty(&(pax->sparse_map));
 	}
+	return (ARCHIVE_OK);
+}
+
+static ssize_t
+archive_write_pax_data(struct archive_write *a, const void *buff, size_t s)
+{
+	struct pax *pax;
+	size_t ws;
+	size_t total;
+	int ret;
+
+	pax = (struct pax *)a->format_data;
+
+	ret = write_sparse_map(a, pax);
+	if (ret != ARCHIVE_OK)
+		return (ret);
 
 	total = 0;
 	while (total < s) {
@@ -1883,6 +1898,61 @@ archive_write_pax_data(struct archive_write *a, const void *buff, size_t s)
 	return (total);
 }
 
+static ssize_t
+archive_write_pax_data_fd(struct archive_write *a, int fd, int64_t offset,
+    size_t s)
+{
+	struct pax *pax;
+	size_t ws;
+	size_t total;
+	ssize_t bytes;
+	int ret;
+
+	pax = (struct pax *)a->format_data;
+
+	/* Make sure the output takes data from fd before writing. */
+	bytes = __archive_write_output_fd(a, fd, offset, 0);
+	if (bytes < 0)
+		return (bytes);
+	ret = write_sparse_map(a, pax);
+	if (ret != ARCHIVE_OK)
+		return (ret);
+
+	total = 0;
+	while (total < s) {
+		while (pax->sparse_list != NULL &&
+		    pax->sparse_list->remaining == 0) {
+			struct sparse_block *sb = pax->sparse_list->next;
+			free(pax->sparse_list);
+			pax->sparse_list = sb;
+		}
+
+		if (pax->sparse_list == NULL)
+			return (total);
+
+		ws = s - total;
+		if (ws > pax->sparse_list->remaining)
+			ws = (size_t)pax->sparse_list->remaining;
+
+		if (pax->sparse_list->is_hole) {
+			/* Current block is hole thus we do not write
+			 * the body. */
+			pax->sparse_list->remaining -= ws;
+			total += ws;
+			continue;
+		}
+
+		bytes = __archive_write_output_fd(a, fd, offset + total, ws);
+		if (bytes < 0)
+			return (bytes);
+		pax->sparse_list->remaining -= bytes;
+		total += bytes;
+		if ((size_t)bytes < ws)
+			break;
+	}
+	return (total);
+}
+
 static int
 has_non_ASCII(const char *_p)
 {
@@ -150,6 +150,8 @@ static const char template_header[] = {
 
 static ssize_t	archive_write_ustar_data(struct archive_write *a, const void *buff,
 		    size_t s);
+static ssize_t	archive_write_ustar_data_fd(struct archive_write *a, int fd,
+		    int64_t offset, size_t s);
 static int	archive_write_ustar_free(struct archive_write *);
 static int	archive_write_ustar_close(struct archive_write *);
 static int	archive_write_ustar_finish_entry(struct archive_write *);
@@ -196,6 +198,7 @@ archive_write_set_format_ustar(struct archive *_a)
 	a->format_options = archive_write_ustar_options;
 	a->format_write_header = archive_write_ustar_header;
 	a->format_write_data = archive_write_ustar_data;
+	a->format_write_data_fd = archive_write_ustar_data_fd;
 	a->format_close = archive_write_ustar_close;
 	a->format_free = archive_write_ustar_free;
 	a->format_finish_entry = archive_write_ustar_finish_entry;
@@ -725,6 +728,7 @@ archive_write_ustar_free(struct archive_write *a)
 	ustar = (struct ustar *)a->format_data;
 	free(ustar);
 	a->format_data = NULL;
+	a->format_write_data_fd = NULL;
 	return (ARCHIVE_OK);
 }
 
@@ -756,3 +760,19 @@ archive_write_ustar_data(struct archive_write *a, const void *buff, size_t s)
 		return (ret);
 	return (s);
 }
+
+static ssize_t
+archive_write_ustar_data_fd(struct archive_write *a, int fd, int64_t offset,
+    size_t s)
+{
+	struct ustar *ustar;
+	ssize_t bytes;
+
+	ustar = (struct ustar *)a->format_data;
+	if (s > ustar->entry_bytes_remaining)
+		s = (size_t)ustar->entry_bytes_remaining;
+	bytes = __archive_write_output_fd(a, fd, offset, s);
+	if (bytes > 0)
+		ustar->entry_bytes_remaining -= bytes;
+	return (bytes);
+}
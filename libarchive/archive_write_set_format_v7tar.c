@@ -125,6 +125,8 @@ static const char template_header[] = {
 
 static ssize_t	archive_write_v7tar_data(struct archive_write *a, const void *buff,
 		    size_t s);
+static ssize_t	archive_write_v7tar_data_fd(struct archive_write *a, int fd,
+		    int64_t offset, size_t s);
 static int	archive_write_v7tar_free(struct archive_write *);
 static int	archive_write_v7tar_close(struct archive_write *);
 static int	archive_write_v7tar_finish_entry(struct archive_write *);
@@ -173,6 +175,7 @@ archive_write_set_format_v7tar(struct archive *_a)
 	a->format_options = archive_write_v7tar_options;
 	a->format_write_header = archive_write_v7tar_header;
 	a->format_write_data = archive_write_v7tar_data;
+	a->format_write_data_fd = archive_write_v7tar_data_fd;
 	a->format_close = archive_write_v7tar_close;
 	a->format_free = archive_write_v7tar_free;
 	a->format_finish_entry = archive_write_v7tar_finish_entry;
@@ -605,6 +608,7 @@ archive_write_v7tar_free(struct archive_write *a)
 	v7tar = (struct v7tar *)a->format_data;
 	free(v7tar);
 	a->format_data = NULL;
+	a->format_write_data_fd = NULL;
 	return (ARCHIVE_OK);
 }
 
@@ -636,3 +640,19 @@ archive_write_v7tar_data(struct archive_write *a, const void *buff, size_t s)
 		return (ret);
 	return (s);
 }
+
+static ssize_t
+archive_write_v7tar_data_fd(struct archive_write *a, int fd, int64_t offset,
+    size_t s)
+{
+	struct v7tar *v7tar;
+	ssize_t bytes;
+
+	v7tar = (struct v7tar *)a->format_data;
+	if (s > v7tar->entry_bytes_remaining)
+		s = (size_t)v7tar->entry_bytes_remaining;
+	bytes = __archive_write_output_fd(a, fd, offset, s);
+	if (bytes > 0)
+		v7tar->entry_bytes_remaining -= bytes;
+	return (bytes);
+}
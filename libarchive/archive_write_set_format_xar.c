@@ -54,6 +54,7 @@ __FBSDID("$FreeBSD$");
 #include "archive_private.h"
 #include "archive_rb.h"
 #include "archive_string.h"
+#include "archive_thread_pool_private.h"
 #include "archive_write_private.h"
 
 /*
@@ -109,6 +110,20 @@ enum sumalg {
 	CKSUM_MD5 = 2
 };
 
+/*
+ * File data is spooled to a temporary file until there are
+ * DIRECT_THRESHOLD bytes of it.  If the output can then be rewritten in
+ * place, the spooled data moves to the output, behind room left for the
+ * TOC, and the rest is written there directly.  The room is the
+ * "toc-reserve" option or, by default, twice TOC_ENTRY_ESTIMATE bytes
+ * plus the name for each entry seen so far, at least TOC_RESERVE bytes.
+ * A TOC that still does not fit moves the heap further back in the
+ * output when the archive is closed, which costs a rewrite of it.
+ */
+#define DIRECT_THRESHOLD	(8 * 1024 * 1024)
+#define TOC_RESERVE		(256 * 1024)
+#define TOC_ENTRY_ESTIMATE	128
+
 #define MD5_SIZE	16
 #define SHA1_SIZE	20
 #define MAX_SUM_SIZE	20
@@ -176,6 +191,34 @@ struct heap_data {
 	struct chksumval	 e_sum;		/* extracted checksum.	*/
 };
 
+/*
+ * With the "threads" option, the data of entries up to
+ * XAR_JOB_MAX_SIZE is buffered, then compressed and checksummed on a
+ * worker thread while the caller goes on with the next entries.
+ * Finished jobs are appended to the heap in the order of the entries.
+ */
+#define XAR_JOB_MAX_SIZE	(16 * 1024 * 1024)
+
+struct xar_job {
+	struct archive_thread_job job;
+	/* Collects the encoder's error messages. */
+	struct archive		 archive;
+	struct la_zstream	 stream;
+	struct file		*file;
+	enum enctype		 compression;
+	int			 level;
+	enum sumalg		 sumalg;
+	unsigned char		*in;
+	size_t			 in_len;
+	size_t			 in_size;
+	unsigned char		*out;
+	size_t			 out_len;
+	size_t			 out_size;
+	struct chksumval	 a_sum;
+	struct chksumval	 e_sum;
+	int			 ret;
+};
+
 struct file {
 	struct archive_rb_node	 rbnode;
 
@@ -228,6 +271,14 @@ struct hardlink {
 struct xar {
 	int			 temp_fd;
 	uint64_t		 temp_offset;
+	/* The heap is written to the output, starting at heap_offset,
+	 * rather than to the temporary file. */
+	int			 direct;
+	uint64_t		 heap_offset;
+	/* Size of the gap between the TOC and the heap contents. */
+	uint64_t		 heap_shift;
+	/* Deflated TOC bytes expected for the entries so far. */
+	uint64_t		 toc_estimate;
 
 	int			 file_idx;
 	struct file		*root;
@@ -243,11 +294,15 @@ struct xar {
 	enum enctype		 opt_compression;
 	int			 opt_compression_level;
 	uint32_t		 opt_threads;
+	uint64_t		 opt_toc_reserve;
 
 	struct chksumwork	 a_sumwrk;	/* archived checksum.	*/
 	struct chksumwork	 e_sumwrk;	/* extracted checksum.	*/
 	struct la_zstream	 stream;
 	struct archive_string_conv *sconv;
+
+	struct archive_thread_ring jobs;
+	struct xar_job		*cur_job;	/* Collecting data. */
 	/*
 	 * Compressed data buffer.
 	 */
@@ -324,12 +379,19 @@ static int	compression_code_lzma(struct archive *,
 		    struct la_zstream *, enum la_zaction);
 static int	compression_end_lzma(struct archive *, struct la_zstream *);
 #endif
+static int	compression_init_encoder(struct archive *,
+		    struct la_zstream *, enum enctype, int, int);
 static int	xar_compression_init_encoder(struct archive_write *);
 static int	compression_code(struct archive *,
 		    struct la_zstream *, enum la_zaction);
 static int	compression_end(struct archive *,
 		    struct la_zstream *);
 static int	save_xattrs(struct archive_write *, struct file *);
+static int	move_heap_to_output(struct archive_write *);
+static int	flush_wbuff(struct archive_write *);
+static int	copy_out(struct archive_write *, uint64_t, uint64_t);
+static int	xar_job_get(struct archive_write *, struct file *);
+static int	xar_job_drain(struct archive_write *);
 static int	getalgsize(enum sumalg);
 static const char *getalgname(enum sumalg);
 
@@ -516,13 +578,31 @@ xar_options(struct archive_write *a, const char *key, const char *value)
 			    value);
 			return (ARCHIVE_FAILED);
 		}
-		if (xar->opt_threads == 0) {
-#ifdef HAVE_LZMA_STREAM_ENCODER_MT
-			xar->opt_threads = lzma_cputhreads();
-#else
-			xar->opt_threads = 1;
-#endif
+		if (xar->opt_threads == 0)
+			xar->opt_threads = __archive_thread_pool_cpus();
+		return (ARCHIVE_OK);
+	}
+	if (strcmp(key, "toc-reserve") == 0) {
+		/* A byte count; 0 sizes the room from the entries. */
+		const char *p = value;
+		uint64_t size = 0;
+
+		if (p == NULL || *p == '\0')
+			return (ARCHIVE_FAILED);
+		for (; *p >= '0' && *p <= '9'; p++) {
+			if (size > (SIZE_MAX / 2 - 9) / 10)
+				break;
+			size = size * 10 + (*p - '0');
+		}
+		if (*p != '\0') {
+			archive_set_error(&(a->archive),
+			    ARCHIVE_ERRNO_MISC,
+			    "Illegal value `%s'",
+			    value);
+			return (ARCHIVE_FAILED);
 		}
+		xar->opt_toc_reserve = size;
+		return (ARCHIVE_OK);
 	}
 
 	/* Note: The "warn" return is just to inform the options
@@ -569,6 +649,8 @@ xar_write_header(struct archive_write *a, struct archive_entry *entry)
 		file_free(file);
 		return (r2);
 	}
+	xar->toc_estimate += TOC_ENTRY_ESTIMATE +
+	    archive_strlen(&(file->basename));
 
 	/* Add entry into tree */
 	file_entry = file->entry;
@@ -592,7 +674,7 @@ xar_write_header(struct archive_write *a, struct archive_entry *entry)
 	/*
 	 * Prepare to save the contents of the file.
 	 */
-	if (xar->temp_fd == -1) {
+	if (xar->temp_fd == -1 && !xar->direct) {
 		int algsize;
 		xar->temp_offset = 0;
 		xar->temp_fd = __archive_mktemp(NULL);
@@ -611,8 +693,20 @@ xar_write_header(struct archive_write *a, struct archive_entry *entry)
 			xar->temp_offset = algsize;
 		}
 	}
+	if (!xar->direct && xar->temp_offset >= DIRECT_THRESHOLD &&
+	    __archive_write_seekable(a)) {
+		r = move_heap_to_output(a);
+		if (r != ARCHIVE_OK)
+			return (r);
+	}
 
 	if (archive_entry_hardlink(file->entry) == NULL) {
+		/* Keep the heap in the order of the entries. */
+		if (archive_entry_xattr_count(file->entry) > 0) {
+			r = xar_job_drain(a);
+			if (r != ARCHIVE_OK)
+				return (r);
+		}
 		r = save_xattrs(a, file);
 		if (r != ARCHIVE_OK)
 			return (ARCHIVE_FATAL);
@@ -638,11 +732,23 @@ xar_write_header(struct archive_write *a, struct archive_entry *entry)
 		}
 	}
 
-	/* Save a offset of current file in temporary file. */
-	file->data.temp_offset = xar->temp_offset;
 	file->data.size = archive_entry_size(file->entry);
 	file->data.compression = xar->opt_compression;
 	xar->bytes_remaining = archive_entry_size(file->entry);
+	if (xar->bytes_remaining > 0) {
+		if (xar->opt_threads > 1 &&
+		    xar->bytes_remaining <= XAR_JOB_MAX_SIZE) {
+			r = xar_job_get(a, file);
+			return (r != ARCHIVE_OK ? r : r2);
+		}
+		/* Keep the heap in the order of the entries. */
+		r = xar_job_drain(a);
+		if (r != ARCHIVE_OK)
+			return (r);
+	}
+
+	/* Save a offset of current file in temporary file. */
+	file->data.temp_offset = xar->temp_offset;
 	checksum_init(&(xar->a_sumwrk), xar->opt_sumalg);
 	checksum_init(&(xar->e_sumwrk), xar->opt_sumalg);
 	r = xar_compression_init_encoder(a);
@@ -653,14 +759,61 @@ xar_write_header(struct archive_write *a, struct archive_entry *entry)
 		return (r2);
 }
 
+/*
+ * Copy the heap spooled so far to the output, after room for the header
+ * and the TOC, and write the rest of it there.
+ */
+static int
+move_heap_to_output(struct archive_write *a)
+{
+	struct xar *xar;
+	uint64_t reserve;
+	int algsize, r;
+
+	xar = (struct xar *)a->format_data;
+	reserve = xar->opt_toc_reserve;
+	if (reserve == 0) {
+		reserve = 2 * xar->toc_estimate;
+		if (reserve < TOC_RESERVE)
+			reserve = TOC_RESERVE;
+	}
+	/* The heap starts with the checksum of the TOC, which is not
+	 * known yet. */
+	algsize = getalgsize(xar->opt_toc_sumalg);
+	r = __archive_write_nulls(a,
+	    (size_t)(HEADER_SIZE + reserve + algsize));
+	if (r != ARCHIVE_OK)
+		return (r);
+	xar->wbuff_remaining = sizeof(xar->wbuff);
+	r = copy_out(a, algsize, xar->temp_offset - algsize);
+	if (r != ARCHIVE_OK)
+		return (r);
+	r = flush_wbuff(a);
+	if (r != ARCHIVE_OK)
+		return (r);
+	close(xar->temp_fd);
+	xar->temp_fd = -1;
+	xar->heap_offset = HEADER_SIZE + reserve;
+	xar->direct = 1;
+	return (ARCHIVE_OK);
+}
+
 static int
 write_to_temp(struct archive_write *a, const void *buff, size_t s)
 {
 	struct xar *xar;
 	const unsigned char *p;
 	ssize_t ws;
+	int r;
 
 	xar = (struct xar *)a->format_data;
+	if (xar->direct) {
+		r = __archive_write_output(a, buff, s);
+		if (r != ARCHIVE_OK)
+			return (r);
+		xar->temp_offset += s;
+		return (ARCHIVE_OK);
+	}
 	p = (const unsigned char *)buff;
 	while (s) {
 		ws = write(xar->temp_fd, p, s);
@@ -691,7 +844,11 @@ xar_write_data(struct archive_write *a, const void *buff, size_t s)
 		s = (size_t)xar->bytes_remaining;
 	if (s == 0 || xar->cur_file == NULL)
 		return (0);
-	if (xar->cur_file->data.compression == NONE) {
+	if (xar->cur_job != NULL) {
+		memcpy(xar->cur_job->in + xar->cur_job->in_len, buff, s);
+		xar->cur_job->in_len += s;
+		rsize = s;
+	} else if (xar->cur_file->data.compression == NONE) {
 		checksum_update(&(xar->e_sumwrk), buff, s);
 		checksum_update(&(xar->a_sumwrk), buff, s);
 		size = rsize = s;
@@ -767,7 +924,8 @@ xar_write_data(struct archive_write *a, const void *buff, size_t s)
 	}
 #endif
 
-	if (xar->cur_file->data.compression == NONE) {
+	if (xar->cur_job == NULL &&
+	    xar->cur_file->data.compression == NONE) {
 		if (write_to_temp(a, buff, size) != ARCHIVE_OK)
 			return (ARCHIVE_FATAL);
 		xar->cur_file->data.length += size;
@@ -800,13 +958,173 @@ xar_finish_entry(struct archive_write *a)
 			return (w);
 	}
 	file = xar->cur_file;
+	xar->cur_file = NULL;
+	if (xar->cur_job != NULL) {
+		__archive_thread_ring_submit(&(xar->jobs));
+		xar->cur_job = NULL;
+		return (ARCHIVE_OK);
+	}
 	checksum_final(&(xar->e_sumwrk), &(file->data.e_sum));
 	checksum_final(&(xar->a_sumwrk), &(file->data.a_sum));
-	xar->cur_file = NULL;
 
 	return (ARCHIVE_OK);
 }
 
+static void
+xar_job_run(void *arg)
+{
+	struct xar_job *job = arg;
+	struct la_zstream *strm = &(job->stream);
+	struct chksumwork sumwrk;
+	int r;
+
+	checksum_init(&sumwrk, job->sumalg);
+	checksum_update(&sumwrk, job->in, job->in_len);
+	checksum_final(&sumwrk, &(job->e_sum));
+	job->ret = ARCHIVE_OK;
+	if (job->compression == NONE) {
+		job->a_sum = job->e_sum;
+		return;
+	}
+
+	job->out_len = 0;
+	job->ret = compression_init_encoder(&(job->archive), strm,
+	    job->compression, job->level, 1);
+	if (job->ret != ARCHIVE_OK)
+		return;
+	strm->next_in = job->in;
+	strm->avail_in = job->in_len;
+	strm->total_in = 0;
+	strm->next_out = job->out;
+	strm->avail_out = job->out_size;
+	strm->total_out = 0;
+	for (;;) {
+		if (strm->avail_out == 0) {
+			size_t size = job->out_size > 0 ?
+			    job->out_size * 2 : job->in_len / 2 + 64 * 1024;
+			unsigned char *p = realloc(job->out, size);
+
+			if (p == NULL) {
+				archive_set_error(&(job->archive), ENOMEM,
+				    "Can't allocate memory");
+				job->ret = ARCHIVE_FATAL;
+				break;
+			}
+			job->out = p;
+			job->out_size = size;
+			strm->next_out = p + strm->total_out;
+			strm->avail_out = size - (size_t)strm->total_out;
+		}
+		r = compression_code(&(job->archive), strm, ARCHIVE_Z_FINISH);
+		if (r == ARCHIVE_EOF)
+			break;
+		if (r != ARCHIVE_OK) {
+			job->ret = ARCHIVE_FATAL;
+			break;
+		}
+	}
+	job->out_len = (size_t)strm->total_out;
+	compression_end(&(job->archive), strm);
+
+	checksum_init(&sumwrk, job->sumalg);
+	checksum_update(&sumwrk, job->out, job->out_len);
+	checksum_final(&sumwrk, &(job->a_sum));
+}
+
+static void
+xar_job_release(void *arg)
+{
+	struct xar_job *job = arg;
+
+	compression_end(&(job->archive), &(job->stream));
+	free(job->in);
+	free(job->out);
+	archive_string_free(&(job->archive.error_string));
+}
+
+/*
+ * Wait for the oldest job and append its output to the heap.
+ */
+static int
+xar_job_reap(struct archive_write *a)
+{
+	struct xar *xar = (struct xar *)a->format_data;
+	struct xar_job *job = __archive_thread_ring_reap(&(xar->jobs));
+	struct file *file = job->file;
+
+	if (job->ret != ARCHIVE_OK) {
+		archive_copy_error(&(a->archive), &(job->archive));
+		return (ARCHIVE_FATAL);
+	}
+	file->data.temp_offset = xar->temp_offset;
+	file->data.e_sum = job->e_sum;
+	file->data.a_sum = job->a_sum;
+	if (job->compression == NONE) {
+		file->data.length = job->in_len;
+		return (write_to_temp(a, job->in, job->in_len));
+	}
+	file->data.length = job->out_len;
+	return (write_to_temp(a, job->out, job->out_len));
+}
+
+static int
+xar_job_drain(struct archive_write *a)
+{
+	struct xar *xar = (struct xar *)a->format_data;
+	int r;
+
+	while (xar->jobs.pending > 0) {
+		r = xar_job_reap(a);
+		if (r != ARCHIVE_OK)
+			return (r);
+	}
+	return (ARCHIVE_OK);
+}
+
+/*
+ * Start collecting the data of a file into a free job.
+ */
+static int
+xar_job_get(struct archive_write *a, struct file *file)
+{
+	struct xar *xar = (struct xar *)a->format_data;
+	struct xar_job *job;
+	size_t size;
+	int r;
+
+	if (xar->jobs.pool == NULL &&
+	    __archive_thread_ring_init(&(xar->jobs), xar->opt_threads,
+	    sizeof(struct xar_job), xar_job_run) != ARCHIVE_OK)
+		goto nomem;
+	if ((job = __archive_thread_ring_next(&(xar->jobs))) == NULL) {
+		r = xar_job_reap(a);
+		if (r != ARCHIVE_OK)
+			return (r);
+		job = __archive_thread_ring_next(&(xar->jobs));
+	}
+	size = (size_t)xar->bytes_remaining;
+	if (job->in_size < size) {
+		free(job->in);
+		job->in = malloc(size);
+		if (job->in == NULL) {
+			job->in_size = 0;
+			goto nomem;
+		}
+		job->in_size = size;
+	}
+	job->in_len = 0;
+	job->file = file;
+	job->compression = xar->opt_compression;
+	job->level = xar->opt_compression_level;
+	job->sumalg = xar->opt_sumalg;
+	xar->cur_job = job;
+	return (ARCHIVE_OK);
+nomem:
+	archive_set_error(&a->archive, ENOMEM,
+	    "Can't allocate memory for compression threads");
+	return (ARCHIVE_FATAL);
+}
+
 static int
 xmlwrite_string_attr(struct archive_write *a, xmlTextWriterPtr writer,
 	const char *key, const char *value,
@@ -979,13 +1297,16 @@ static int
 xmlwrite_heap(struct archive_write *a, xmlTextWriterPtr writer,
 	struct heap_data *heap)
 {
+	struct xar *xar;
 	const char *encname;
 	int r;
 
+	xar = (struct xar *)a->format_data;
 	r = xmlwrite_fstring(a, writer, "length", "%ju", heap->length);
 	if (r < 0)
 		return (ARCHIVE_FATAL);
-	r = xmlwrite_fstring(a, writer, "offset", "%ju", heap->temp_offset);
+	r = xmlwrite_fstring(a, writer, "offset", "%ju",
+	    heap->temp_offset + xar->heap_shift);
 	if (r < 0)
 		return (ARCHIVE_FATAL);
 	r = xmlwrite_fstring(a, writer, "size", "%ju", heap->size);
@@ -1530,12 +1851,14 @@ make_file_entry(struct archive_write *a, xmlTextWriterPtr writer,
 /*
  * Make the TOC
  */
+/*
+ * Write the TOC to bp as XML.
+ */
 static int
-make_toc(struct archive_write *a)
+make_toc_xml(struct archive_write *a, xmlBufferPtr bp)
 {
 	struct xar *xar;
 	struct file *np;
-	xmlBufferPtr bp;
 	xmlTextWriterPtr writer;
 	int algsize;
 	int r, ret;
@@ -1547,14 +1870,6 @@ make_toc(struct archive_write *a)
 	/*
 	 * Initialize xml writer.
 	 */
-	writer = NULL;
-	bp = xmlBufferCreate();
-	if (bp == NULL) {
-		archive_set_error(&a->archive, ENOMEM,
-		    "xmlBufferCreate() "
-		    "couldn't create xml buffer");
-		goto exit_toc;
-	}
 	writer = xmlNewTextWriterMemory(bp, 0);
 	if (writer == NULL) {
 		archive_set_error(&a->archive,
@@ -1630,7 +1945,8 @@ make_toc(struct archive_write *a)
 		/*
 		 * Record the offset of the value of checksum of TOC
 		 */
-		r = xmlwrite_string(a, writer, "offset", "0");
+		r = xmlwrite_fstring(a, writer, "offset", "%ju",
+		    (uintmax_t)xar->heap_shift);
 		if (r < 0)
 			goto exit_toc;
 
@@ -1730,6 +2046,197 @@ make_toc(struct archive_write *a)
 	    strlen((const char *)bp->content), bp->content);
 #endif
 
+	ret = ARCHIVE_OK;
+exit_toc:
+	if (writer)
+		xmlFreeTextWriter(writer);
+
+	return (ret);
+}
+
+/*
+ * Write the TOC in front of a heap that is already in the output.
+ *
+ * The heap starts right after the TOC and the offsets in the TOC count
+ * from there, so the length of the TOC and the offsets depend on each
+ * other.  The room left for the TOC is shared between the TOC and a gap
+ * at the start of the heap that no offset points into.  The TOC is
+ * built for a guess at its length, deflated with a sync flush, and
+ * closed with stored blocks that pad it to exactly that length with
+ * white space in front of the closing </xar> tag.  If the TOC does not
+ * fit in the room, the heap moves back.
+ */
+static int
+write_toc_in_place(struct archive_write *a, xmlBufferPtr bp)
+{
+	struct xar *xar;
+	z_stream strm;
+	unsigned char *buff, *p;
+	const unsigned char *tail;
+	size_t buff_size, tail_len, used, need, slack, pad, n;
+	uint64_t room, length;
+	uLong adler;
+	int pass, r;
+
+	xar = (struct xar *)a->format_data;
+	buff = NULL;
+	buff_size = 0;
+	tail = NULL;
+	tail_len = used = 0;
+	adler = 0;
+	room = xar->heap_offset - HEADER_SIZE;
+	length = room;
+	for (pass = 0;; pass++) {
+		xar->heap_shift = room - length;
+		xmlBufferEmpty(bp);
+		r = make_toc_xml(a, bp);
+		if (r != ARCHIVE_OK)
+			goto exit_toc;
+		/* Find the closing tag, which goes after the padding. */
+		for (tail_len = 6; tail_len <= (size_t)bp->use; tail_len++) {
+			tail = bp->content + bp->use - tail_len;
+			if (memcmp(tail, "</xar>", 6) == 0)
+				break;
+		}
+		if (tail_len > (size_t)bp->use) {
+			archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+			    "Internal error: no end of the TOC");
+			r = ARCHIVE_FATAL;
+			goto exit_toc;
+		}
+
+		memset(&strm, 0, sizeof(strm));
+		if (deflateInit(&strm, 6) != Z_OK) {
+			archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+			    "Internal error initializing compression library");
+			r = ARCHIVE_FATAL;
+			goto exit_toc;
+		}
+		n = deflateBound(&strm, (uLong)(bp->use - tail_len)) + 16;
+		if (n > buff_size) {
+			free(buff);
+			buff_size = n;
+			buff = malloc(buff_size);
+			if (buff == NULL) {
+				deflateEnd(&strm);
+				archive_set_error(&a->archive, ENOMEM,
+				    "Can't allocate memory for the TOC");
+				r = ARCHIVE_FATAL;
+				goto exit_toc;
+			}
+		}
+		strm.next_in = (Bytef *)(uintptr_t)(const void *)bp->content;
+		strm.avail_in = (uInt)(bp->use - tail_len);
+		strm.next_out = buff;
+		strm.avail_out = (uInt)buff_size;
+		r = deflate(&strm, Z_SYNC_FLUSH);
+		used = strm.total_out;
+		adler = strm.adler;
+		deflateEnd(&strm);
+		if (r != Z_OK || strm.avail_in != 0) {
+			archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+			    "Compression failed");
+			r = ARCHIVE_FATAL;
+			goto exit_toc;
+		}
+
+		/* The deflated TOC, a stored block with the closing tag
+		 * and the Adler-32 trailer. */
+		need = used + 5 + tail_len + 4;
+		slack = need / 256 + 64;
+		if (need <= length && (pass > 0 || length - need <= slack))
+			break;
+		if (need > length && length == room) {
+			r = __archive_write_move_output(a, xar->heap_offset,
+			    xar->heap_offset + need - room, xar->temp_offset);
+			if (r != ARCHIVE_OK)
+				goto exit_toc;
+			xar->heap_offset += need - room;
+			room = length = need;
+			break;
+		}
+		length = need + slack;
+		if (length > room)
+			length = room;
+	}
+
+	if (buff_size < length) {
+		p = realloc(buff, (size_t)length);
+		if (p == NULL) {
+			archive_set_error(&a->archive, ENOMEM,
+			    "Can't allocate memory for the TOC");
+			r = ARCHIVE_FATAL;
+			goto exit_toc;
+		}
+		buff = p;
+	}
+	/* Pad with stored blocks of at most 65535 bytes each; the last
+	 * one ends the stream. */
+	p = buff + used;
+	pad = (size_t)length - used - 4;
+	xar->toc.size = bp->use - tail_len;
+	for (;;) {
+		n = pad - 5;
+		if (n > 0xffff) {
+			n = pad - 10 - tail_len;
+			if (n > 0xffff)
+				n = 0xffff;
+			p[0] = 0;
+		} else
+			p[0] = 1;
+		archive_le16enc(p + 1, (uint16_t)n);
+		archive_le16enc(p + 3, (uint16_t)~n);
+		if (p[0]) {
+			memset(p + 5, ' ', n - tail_len);
+			memcpy(p + 5 + n - tail_len, tail, tail_len);
+		} else
+			memset(p + 5, ' ', n);
+		adler = adler32(adler, p + 5, (uInt)n);
+		xar->toc.size += n;
+		p += 5 + n;
+		pad -= 5 + n;
+		if (pad == 0)
+			break;
+	}
+	archive_be32enc(p, (uint32_t)adler);
+
+	xar->toc.length = length;
+	xar->toc.compression = GZIP;
+	checksum_init(&(xar->a_sumwrk), xar->opt_toc_sumalg);
+	checksum_update(&(xar->a_sumwrk), buff, (size_t)length);
+	checksum_final(&(xar->a_sumwrk), &(xar->toc.a_sum));
+	r = __archive_write_output_at(a, HEADER_SIZE, buff, (size_t)length);
+exit_toc:
+	free(buff);
+	return (r);
+}
+
+static int
+make_toc(struct archive_write *a)
+{
+	struct xar *xar;
+	xmlBufferPtr bp;
+	int r, ret;
+
+	xar = (struct xar *)a->format_data;
+
+	ret = ARCHIVE_FATAL;
+
+	bp = xmlBufferCreate();
+	if (bp == NULL) {
+		archive_set_error(&a->archive, ENOMEM,
+		    "xmlBufferCreate() "
+		    "couldn't create xml buffer");
+		return (ARCHIVE_FATAL);
+	}
+	if (xar->direct) {
+		ret = write_toc_in_place(a, bp);
+		goto exit_toc;
+	}
+	r = make_toc_xml(a, bp);
+	if (r != ARCHIVE_OK)
+		goto exit_toc;
+
 	/*
 	 * Compress the TOC and calculate the sum of the TOC.
 	 */
@@ -1772,10 +2279,7 @@ make_toc(struct archive_write *a)
 
 	ret = ARCHIVE_OK;
 exit_toc:
-	if (writer)
-		xmlFreeTextWriter(writer);
-	if (bp)
-		xmlBufferFree(bp);
+	xmlBufferFree(bp);
 
 	return (ret);
 }
@@ -1854,6 +2358,10 @@ xar_close(struct archive_write *a)
 	if (xar->root->children.first == NULL)
 		return (ARCHIVE_OK);
 
+	r = xar_job_drain(a);
+	if (r != ARCHIVE_OK)
+		return (r);
+
 	/* Save the length of all file extended attributes and contents. */
 	length = xar->temp_offset;
 
@@ -1877,6 +2385,16 @@ xar_close(struct archive_write *a)
 	archive_be32enc(&wb[24], xar->toc.a_sum.alg);
 	xar->wbuff_remaining -= HEADER_SIZE;
 
+	/* The TOC and the heap are in place; fill in the header and the
+	 * checksum of the TOC. */
+	if (xar->direct) {
+		r = __archive_write_output_at(a, 0, wb, HEADER_SIZE);
+		if (r == ARCHIVE_OK && xar->toc.a_sum.len)
+			r = __archive_write_output_at(a, xar->heap_offset,
+			    xar->toc.a_sum.val, xar->toc.a_sum.len);
+		return (r);
+	}
+
 	/*
 	 * Write the TOC
 	 */
@@ -1920,6 +2438,7 @@ xar_free(struct archive_write *a)
 	archive_string_free(&(xar->cur_dirstr));
 	archive_string_free(&(xar->tstr));
 	archive_string_free(&(xar->vstr));
+	__archive_thread_ring_free(&(xar->jobs), xar_job_release);
 	file_free_hardlinks(xar);
 	file_free_register(xar);
 	compression_end(&(a->archive), &(xar->stream));
@@ -3067,37 +3586,34 @@ compression_init_encoder_xz(struct archive *a,
 #endif
 
 static int
-xar_compression_init_encoder(struct archive_write *a)
+compression_init_encoder(struct archive *a, struct la_zstream *lastrm,
+    enum enctype compression, int level, int threads)
 {
-	struct xar *xar;
-	int r;
-
-	xar = (struct xar *)a->format_data;
-	switch (xar->opt_compression) {
+	switch (compression) {
 	case GZIP:
-		r = compression_init_encoder_gzip(
-		    &(a->archive), &(xar->stream),
-		    xar->opt_compression_level, 1);
-		break;
+		return (compression_init_encoder_gzip(a, lastrm, level, 1));
 	case BZIP2:
-		r = compression_init_encoder_bzip2(
-		    &(a->archive), &(xar->stream),
-		    xar->opt_compression_level);
-		break;
+		return (compression_init_encoder_bzip2(a, lastrm, level));
 	case LZMA:
-		r = compression_init_encoder_lzma(
-		    &(a->archive), &(xar->stream),
-		    xar->opt_compression_level);
-		break;
+		return (compression_init_encoder_lzma(a, lastrm, level));
 	case XZ:
-		r = compression_init_encoder_xz(
-		    &(a->archive), &(xar->stream),
-		    xar->opt_compression_level, xar->opt_threads);
-		break;
+		return (compression_init_encoder_xz(a, lastrm, level,
+		    threads));
 	default:
-		r = ARCHIVE_OK;
-		break;
+		return (ARCHIVE_OK);
 	}
+}
+
+static int
+xar_compression_init_encoder(struct archive_write *a)
+{
+	struct xar *xar;
+	int r;
+
+	xar = (struct xar *)a->format_data;
+	r = compression_init_encoder(&(a->archive), &(xar->stream),
+	    xar->opt_compression, xar->opt_compression_level,
+	    xar->opt_threads);
 	if (r == ARCHIVE_OK) {
 		xar->stream.total_in = 0;
 		xar->stream.next_out = xar->wbuff;
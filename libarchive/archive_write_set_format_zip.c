@@ -47,6 +47,12 @@ __FBSDID("$FreeBSD: head/lib/libarchive/archive_write_set_format_zip.c 201168 20
 #ifdef HAVE_ZLIB_H
 #include <zlib.h>
 #endif
+#ifdef HAVE_LZMA_H
+#include <lzma.h>
+#endif
+#ifdef HAVE_ZSTD_H
+#include <zstd.h>
+#endif
 
 #include "archive.h"
 #include "archive_cryptor_private.h"
@@ -56,12 +62,11 @@ __FBSDID("$FreeBSD: head/lib/libarchive/archive_write_set_format_zip.c 201168 20
 #include "archive_hmac_private.h"
 #include "archive_private.h"
 #include "archive_random_private.h"
+#include "archive_thread_pool_private.h"
 #include "archive_write_private.h"
 #include "archive_write_set_format_private.h"
 
-#ifndef HAVE_ZLIB_H
 #include "archive_crc32.h"
-#endif
 
 #define ZIP_ENTRY_FLAG_ENCRYPTED	(1<<0)
 #define ZIP_ENTRY_FLAG_LENGTH_AT_END	(1<<3)
@@ -73,7 +78,9 @@ __FBSDID("$FreeBSD: head/lib/libarchive/archive_write_set_format_zip.c 201168 20
 enum compression {
 	COMPRESSION_UNSPECIFIED = -1,
 	COMPRESSION_STORE = 0,
-	COMPRESSION_DEFLATE = 8
+	COMPRESSION_DEFLATE = 8,
+	COMPRESSION_ZSTD = 93,
+	COMPRESSION_XZ = 95
 };
 
 #ifdef HAVE_ZLIB_H
@@ -119,6 +126,33 @@ struct trad_enc_ctx {
 	uint32_t keys[3];
 };
 
+/*
+ * With the "threads" option, entries are queued rather than written
+ * as they arrive: their data is buffered and compressed on a worker
+ * thread.  Finished entries are written out in order by replaying the
+ * usual header/data/finish sequence over the compressed data, so the
+ * offsets and the central directory come out exactly as they would
+ * without threads.  Larger files and encrypted entries are written
+ * directly once everything queued before them has been written.
+ */
+#define ZIP_JOB_MAX_SIZE	(16 * 1024 * 1024)
+
+struct zip_job {
+	struct archive_thread_job job;
+	struct archive_entry *entry;
+	enum compression compression;
+	int level;
+	unsigned long (*crc32func)(unsigned long, const void *, size_t);
+	unsigned char *in;
+	size_t in_len;
+	size_t in_size;
+	unsigned char *out;
+	size_t out_len;
+	size_t out_size;
+	uint32_t crc;
+	int ret;
+};
+
 struct zip {
 
 	int64_t entry_offset;
@@ -158,6 +192,8 @@ struct zip {
 	struct archive_string_conv *sconv_default;
 	enum compression requested_compression;
 	int deflate_compression_level;
+	int zstd_compression_level;
+	int xz_compression_level;
 	int init_default_conversion;
 	enum encryption  encryption_type;
 
@@ -168,9 +204,22 @@ struct zip {
 
 #ifdef HAVE_ZLIB_H
 	z_stream stream;
+#endif
+#if HAVE_ZSTD_H && HAVE_LIBZSTD_COMPRESSOR
+	ZSTD_CStream *zstd_stream;
+#endif
+#if HAVE_LZMA_H && HAVE_LIBLZMA
+	lzma_stream lzma_stream;
+	int lzma_valid;
 #endif
 	size_t len_buf;
 	unsigned char *buf;
+
+	/* Parallel compression; see struct zip_job. */
+	int threads;
+	struct archive_thread_ring jobs;
+	struct zip_job *collecting;	/* Entry whose data is arriving. */
+	struct zip_job *replay;		/* Entry being written out. */
 };
 
 /* Don't call this min or MIN, since those are already defined
@@ -198,6 +247,9 @@ static int init_traditional_pkware_encryption(struct archive_write *);
 static int is_traditional_pkware_encryption_supported(void);
 static int init_winzip_aes_encryption(struct archive_write *);
 static int is_winzip_aes_encryption_supported(int encryption);
+static int zip_queue_entry(struct archive_write *, struct archive_entry *);
+static int zip_drain(struct archive_write *);
+static void zip_job_release(void *);
 
 static unsigned char *
 cd_alloc(struct zip *zip, size_t length)
@@ -237,7 +289,7 @@ cd_alloc(struct zip *zip, size_t length)
 static unsigned long
 real_crc32(unsigned long crc, const void *buff, size_t len)
 {
-	return crc32(crc, buff, (unsigned int)len);
+	return __archive_crc32(crc, buff, len);
 }
 
 static unsigned long
@@ -276,12 +328,52 @@ archive_write_zip_options(struct archive_write *a, const char *key,
 		} else if (strcmp(val, "store") == 0) {
 			zip->requested_compression = COMPRESSION_STORE;
 			ret = ARCHIVE_OK;
+		} else if (strcmp(val, "zstd") == 0) {
+#if HAVE_ZSTD_H && HAVE_LIBZSTD_COMPRESSOR
+			zip->requested_compression = COMPRESSION_ZSTD;
+			ret = ARCHIVE_OK;
+#else
+			archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+			    "zstd compression not supported");
+#endif
+		} else if (strcmp(val, "xz") == 0) {
+#if HAVE_LZMA_H && HAVE_LIBLZMA
+			zip->requested_compression = COMPRESSION_XZ;
+			ret = ARCHIVE_OK;
+#else
+			archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+			    "xz compression not supported");
+#endif
 		}
 		return (ret);
 	} else if (strcmp(key, "compression-level") == 0) {
-		if (val == NULL || !(val[0] >= '0' && val[0] <= '9') || val[1] != '\0') {
+		if (val == NULL)
+			return (ARCHIVE_WARN);
+#if HAVE_ZSTD_H && HAVE_LIBZSTD_COMPRESSOR
+		/* zstd and xz keep their own level, so that switching
+		 * methods between entries keeps each one's setting. */
+		if (zip->requested_compression == COMPRESSION_ZSTD) {
+			char *endptr;
+			long level;
+
+			errno = 0;
+			level = strtol(val, &endptr, 10);
+			if (errno != 0 || *endptr != '\0' || endptr == val ||
+			    level < 1 || level > ZSTD_maxCLevel())
+				return (ARCHIVE_WARN);
+			zip->zstd_compression_level = (int)level;
+			return (ARCHIVE_OK);
+		}
+#endif
+		if (!(val[0] >= '0' && val[0] <= '9') || val[1] != '\0') {
 			return ARCHIVE_WARN;
 		}
+#if HAVE_LZMA_H && HAVE_LIBLZMA
+		if (zip->requested_compression == COMPRESSION_XZ) {
+			zip->xz_compression_level = val[0] - '0';
+			return (ARCHIVE_OK);
+		}
+#endif
 
 		if (val[0] == '0') {
 			zip->requested_compression = COMPRESSION_STORE;
@@ -372,6 +464,20 @@ archive_write_zip_options(struct archive_write *a, const char *key,
 				ret = ARCHIVE_FATAL;
 		}
 		return (ret);
+	} else if (strcmp(key, "threads") == 0) {
+		char *endptr;
+
+		if (val == NULL)
+			return (ARCHIVE_WARN);
+		errno = 0;
+		zip->threads = (int)strtoul(val, &endptr, 10);
+		if (errno != 0 || *endptr != '\0') {
+			zip->threads = 1;
+			return (ARCHIVE_WARN);
+		}
+		if (zip->threads == 0)
+			zip->threads = __archive_thread_pool_cpus();
+		return (ARCHIVE_OK);
 	} else if (strcmp(key, "zip64") == 0) {
 		/*
 		 * Bias decisions about Zip64: force them to be
@@ -445,6 +551,62 @@ archive_write_zip_set_compression_store(struct archive *_a)
 	return (ret);
 }
 
+int
+archive_write_zip_set_compression_zstd(struct archive *_a)
+{
+	struct archive_write *a = (struct archive_write *)_a;
+	int ret = ARCHIVE_FAILED;
+
+	archive_check_magic(_a, ARCHIVE_WRITE_MAGIC,
+		ARCHIVE_STATE_NEW | ARCHIVE_STATE_HEADER | ARCHIVE_STATE_DATA,
+		"archive_write_zip_set_compression_zstd");
+	if (a->archive.archive_format != ARCHIVE_FORMAT_ZIP) {
+		archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+		"Can only use archive_write_zip_set_compression_zstd"
+		" with zip format");
+		ret = ARCHIVE_FATAL;
+	} else {
+#if HAVE_ZSTD_H && HAVE_LIBZSTD_COMPRESSOR
+		struct zip *zip = a->format_data;
+		zip->requested_compression = COMPRESSION_ZSTD;
+		ret = ARCHIVE_OK;
+#else
+		archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+			"zstd compression not supported");
+		ret = ARCHIVE_FAILED;
+#endif
+	}
+	return (ret);
+}
+
+int
+archive_write_zip_set_compression_xz(struct archive *_a)
+{
+	struct archive_write *a = (struct archive_write *)_a;
+	int ret = ARCHIVE_FAILED;
+
+	archive_check_magic(_a, ARCHIVE_WRITE_MAGIC,
+		ARCHIVE_STATE_NEW | ARCHIVE_STATE_HEADER | ARCHIVE_STATE_DATA,
+		"archive_write_zip_set_compression_xz");
+	if (a->archive.archive_format != ARCHIVE_FORMAT_ZIP) {
+		archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+		"Can only use archive_write_zip_set_compression_xz"
+		" with zip format");
+		ret = ARCHIVE_FATAL;
+	} else {
+#if HAVE_LZMA_H && HAVE_LIBLZMA
+		struct zip *zip = a->format_data;
+		zip->requested_compression = COMPRESSION_XZ;
+		ret = ARCHIVE_OK;
+#else
+		archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+			"xz compression not supported");
+		ret = ARCHIVE_FAILED;
+#endif
+	}
+	return (ret);
+}
+
 int
 archive_write_set_format_zip(struct archive *_a)
 {
@@ -469,8 +631,15 @@ archive_write_set_format_zip(struct archive *_a)
 	zip->requested_compression = COMPRESSION_UNSPECIFIED;
 #ifdef HAVE_ZLIB_H
 	zip->deflate_compression_level = Z_DEFAULT_COMPRESSION;
+#endif
+#if HAVE_ZSTD_H && HAVE_LIBZSTD_COMPRESSOR
+	zip->zstd_compression_level = 3; /* Same as the zstd filter. */
+#endif
+#if HAVE_LZMA_H && HAVE_LIBLZMA
+	zip->xz_compression_level = LZMA_PRESET_DEFAULT;
 #endif
 	zip->crc32func = real_crc32;
+	zip->threads = 1;
 
 	/* A buffer used for both compression and encryption. */
 	zip->len_buf = 65536;
@@ -532,6 +701,17 @@ archive_write_zip_header(struct archive_write *a, struct archive_entry *entry)
 		return ARCHIVE_FAILED;
 	};
 
+	if (zip->threads > 1 && zip->replay == NULL) {
+		if (zip->encryption_type == ENCRYPTION_NONE &&
+		    (type != AE_IFREG || (archive_entry_size_is_set(entry) &&
+		     archive_entry_size(entry) <= ZIP_JOB_MAX_SIZE)))
+			return (zip_queue_entry(a, entry));
+		/* This one is written directly, after the queued ones. */
+		ret = zip_drain(a);
+		if (ret != ARCHIVE_OK)
+			return (ret);
+	}
+
 	/* If we're not using Zip64, reject large files. */
 	if (zip->flags & ZIP_FLAG_AVOID_ZIP64) {
 		/* Reject entries over 4GB. */
@@ -775,6 +955,11 @@ archive_write_zip_header(struct archive_write *a, struct archive_entry *entry)
 		}
 	}
 
+	/* APPNOTE 6.3.7 lists zstd and xz under version 6.3. */
+	if ((zip->entry_compression == COMPRESSION_ZSTD ||
+	    zip->entry_compression == COMPRESSION_XZ) && version_needed < 63)
+		version_needed = 63;
+
 	/* Format the local header. */
 	memset(local_header, 0, sizeof(local_header));
 	memcpy(local_header, "PK\003\004", 4);
@@ -986,7 +1171,8 @@ archive_write_zip_header(struct archive_write *a, struct archive_entry *entry)
 	}
 
 #ifdef HAVE_ZLIB_H
-	if (zip->entry_compression == COMPRESSION_DEFLATE) {
+	if (zip->entry_compression == COMPRESSION_DEFLATE &&
+	    zip->replay == NULL) {
 		zip->stream.zalloc = Z_NULL;
 		zip->stream.zfree = Z_NULL;
 		zip->stream.opaque = Z_NULL;
@@ -1000,16 +1186,94 @@ archive_write_zip_header(struct archive_write *a, struct archive_entry *entry)
 		}
 	}
 #endif
+#if HAVE_ZSTD_H && HAVE_LIBZSTD_COMPRESSOR
+	if (zip->entry_compression == COMPRESSION_ZSTD &&
+	    zip->replay == NULL) {
+		/* The stream is reused for every zstd entry. */
+		if (zip->zstd_stream == NULL)
+			zip->zstd_stream = ZSTD_createCStream();
+		if (zip->zstd_stream == NULL ||
+		    ZSTD_isError(ZSTD_initCStream(zip->zstd_stream,
+		    zip->zstd_compression_level))) {
+			archive_set_error(&a->archive, ENOMEM,
+			    "Can't init zstd compressor");
+			return (ARCHIVE_FATAL);
+		}
+	}
+#endif
+#if HAVE_LZMA_H && HAVE_LIBLZMA
+	if (zip->entry_compression == COMPRESSION_XZ &&
+	    zip->replay == NULL) {
+		lzma_stream lzma_init = LZMA_STREAM_INIT;
+
+		/* An entry that was never finished leaves its encoder
+		 * behind. */
+		if (zip->lzma_valid)
+			lzma_end(&zip->lzma_stream);
+		zip->lzma_valid = 0;
+		zip->lzma_stream = lzma_init;
+		if (lzma_easy_encoder(&zip->lzma_stream,
+		    zip->xz_compression_level, LZMA_CHECK_CRC32) != LZMA_OK) {
+			archive_set_error(&a->archive, ENOMEM,
+			    "Can't init xz compressor");
+			return (ARCHIVE_FATAL);
+		}
+		zip->lzma_valid = 1;
+	}
+#endif
 
 	return (ret2);
 }
 
+/*
+ * Encrypt, if needed, and write out the first len bytes of zip->buf.
+ */
+static int
+write_compressed_buf(struct archive_write *a, size_t len)
+{
+	struct zip *zip = a->format_data;
+	int ret;
+
+	if (zip->tctx_valid) {
+		trad_enc_encrypt_update(&zip->tctx,
+		    zip->buf, len, zip->buf, len);
+	} else if (zip->cctx_valid) {
+		size_t outl = len;
+		ret = archive_encrypto_aes_ctr_update(&zip->cctx,
+		    zip->buf, len, zip->buf, &outl);
+		if (ret < 0) {
+			archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+			    "Failed to encrypt file");
+			return (ARCHIVE_FAILED);
+		}
+		archive_hmac_sha1_update(&zip->hctx, zip->buf, len);
+	}
+	ret = __archive_write_output(a, zip->buf, len);
+	if (ret != ARCHIVE_OK)
+		return (ret);
+	zip->entry_compressed_written += len;
+	zip->written_bytes += len;
+	return (ARCHIVE_OK);
+}
+
 static ssize_t
 archive_write_zip_data(struct archive_write *a, const void *buff, size_t s)
 {
 	int ret;
 	struct zip *zip = a->format_data;
 
+	if (zip->collecting != NULL) {
+		struct zip_job *job = zip->collecting;
+
+		/* The buffer was sized from the entry; drop the excess
+		 * just as entry_uncompressed_limit does below. */
+		if (s > job->in_size - job->in_len)
+			s = job->in_size - job->in_len;
+		memcpy(job->in + job->in_len, buff, s);
+		job->in_len += s;
+		return (s);
+	}
+
 	if ((int64_t)s > zip->entry_uncompressed_limit)
 		s = (size_t)zip->entry_uncompressed_limit;
 	zip->entry_uncompressed_written += s;
@@ -1093,37 +1357,68 @@ archive_write_zip_data(struct archive_write *a, const void *buff, size_t s)
 			if (ret == Z_STREAM_ERROR)
 				return (ARCHIVE_FATAL);
 			if (zip->stream.avail_out == 0) {
-				if (zip->tctx_valid) {
-					trad_enc_encrypt_update(&zip->tctx,
-					    zip->buf, zip->len_buf,
-					    zip->buf, zip->len_buf);
-				} else if (zip->cctx_valid) {
-					size_t outl = zip->len_buf;
-					ret = archive_encrypto_aes_ctr_update(
-					    &zip->cctx,
-					    zip->buf, zip->len_buf,
-					    zip->buf, &outl);
-					if (ret < 0) {
-						archive_set_error(&a->archive,
-						    ARCHIVE_ERRNO_MISC,
-						    "Failed to encrypt file");
-						return (ARCHIVE_FAILED);
-					}
-					archive_hmac_sha1_update(&zip->hctx,
-					    zip->buf, zip->len_buf);
-				}
-				ret = __archive_write_output(a, zip->buf,
-					zip->len_buf);
+				ret = write_compressed_buf(a, zip->len_buf);
 				if (ret != ARCHIVE_OK)
 					return (ret);
-				zip->entry_compressed_written += zip->len_buf;
-				zip->written_bytes += zip->len_buf;
 				zip->stream.next_out = zip->buf;
 				zip->stream.avail_out = (uInt)zip->len_buf;
 			}
 		} while (zip->stream.avail_in != 0);
 		break;
 #endif
+#if HAVE_ZSTD_H && HAVE_LIBZSTD_COMPRESSOR
+	case COMPRESSION_ZSTD:
+	{
+		ZSTD_inBuffer in;
+		ZSTD_outBuffer out;
+		size_t zret;
+
+		in.src = buff;
+		in.size = s;
+		in.pos = 0;
+		do {
+			out.dst = zip->buf;
+			out.size = zip->len_buf;
+			out.pos = 0;
+			zret = ZSTD_compressStream(zip->zstd_stream, &out, &in);
+			if (ZSTD_isError(zret)) {
+				archive_set_error(&a->archive,
+				    ARCHIVE_ERRNO_MISC,
+				    "Zstd compression failed: %s",
+				    ZSTD_getErrorName(zret));
+				return (ARCHIVE_FATAL);
+			}
+			if (out.pos > 0) {
+				ret = write_compressed_buf(a, out.pos);
+				if (ret != ARCHIVE_OK)
+					return (ret);
+			}
+		} while (in.pos < in.size);
+		break;
+	}
+#endif
+#if HAVE_LZMA_H && HAVE_LIBLZMA
+	case COMPRESSION_XZ:
+		zip->lzma_stream.next_in = buff;
+		zip->lzma_stream.avail_in = s;
+		do {
+			zip->lzma_stream.next_out = zip->buf;
+			zip->lzma_stream.avail_out = zip->len_buf;
+			if (lzma_code(&zip->lzma_stream, LZMA_RUN) != LZMA_OK) {
+				archive_set_error(&a->archive,
+				    ARCHIVE_ERRNO_MISC,
+				    "xz compression failed");
+				return (ARCHIVE_FATAL);
+			}
+			if (zip->lzma_stream.avail_out < zip->len_buf) {
+				ret = write_compressed_buf(a,
+				    zip->len_buf - zip->lzma_stream.avail_out);
+				if (ret != ARCHIVE_OK)
+					return (ret);
+			}
+		} while (zip->lzma_stream.avail_in != 0);
+		break;
+#endif
 
 	case COMPRESSION_UNSPECIFIED:
 	default:
@@ -1146,8 +1441,17 @@ archive_write_zip_finish_entry(struct archive_write *a)
 	struct zip *zip = a->format_data;
 	int ret;
 
+	if (zip->collecting != NULL) {
+		/* Compress it in the background; it is written out
+		 * by zip_write_job(). */
+		__archive_thread_ring_submit(&zip->jobs);
+		zip->collecting = NULL;
+		return (ARCHIVE_OK);
+	}
+
 #if HAVE_ZLIB_H
-	if (zip->entry_compression == COMPRESSION_DEFLATE) {
+	if (zip->entry_compression == COMPRESSION_DEFLATE &&
+	    zip->replay == NULL) {
 		for (;;) {
 			size_t remainder;
 
@@ -1155,28 +1459,9 @@ archive_write_zip_finish_entry(struct archive_write *a)
 			if (ret == Z_STREAM_ERROR)
 				return (ARCHIVE_FATAL);
 			remainder = zip->len_buf - zip->stream.avail_out;
-			if (zip->tctx_valid) {
-				trad_enc_encrypt_update(&zip->tctx,
-				    zip->buf, remainder, zip->buf, remainder);
-			} else if (zip->cctx_valid) {
-				size_t outl = remainder;
-				ret = archive_encrypto_aes_ctr_update(
-				    &zip->cctx, zip->buf, remainder,
-				    zip->buf, &outl);
-				if (ret < 0) {
-					archive_set_error(&a->archive,
-					    ARCHIVE_ERRNO_MISC,
-					    "Failed to encrypt file");
-					return (ARCHIVE_FAILED);
-				}
-				archive_hmac_sha1_update(&zip->hctx,
-				    zip->buf, remainder);
-			}
-			ret = __archive_write_output(a, zip->buf, remainder);
+			ret = write_compressed_buf(a, remainder);
 			if (ret != ARCHIVE_OK)
 				return (ret);
-			zip->entry_compressed_written += remainder;
-			zip->written_bytes += remainder;
 			zip->stream.next_out = zip->buf;
 			if (zip->stream.avail_out != 0)
 				break;
@@ -1184,6 +1469,54 @@ archive_write_zip_finish_entry(struct archive_write *a)
 		}
 		deflateEnd(&zip->stream);
 	}
+#endif
+#if HAVE_ZSTD_H && HAVE_LIBZSTD_COMPRESSOR
+	if (zip->entry_compression == COMPRESSION_ZSTD &&
+	    zip->replay == NULL) {
+		ZSTD_outBuffer out;
+		size_t zret;
+
+		do {
+			out.dst = zip->buf;
+			out.size = zip->len_buf;
+			out.pos = 0;
+			zret = ZSTD_endStream(zip->zstd_stream, &out);
+			if (ZSTD_isError(zret)) {
+				archive_set_error(&a->archive,
+				    ARCHIVE_ERRNO_MISC,
+				    "Zstd compression failed: %s",
+				    ZSTD_getErrorName(zret));
+				return (ARCHIVE_FATAL);
+			}
+			ret = write_compressed_buf(a, out.pos);
+			if (ret != ARCHIVE_OK)
+				return (ret);
+		} while (zret != 0);
+	}
+#endif
+#if HAVE_LZMA_H && HAVE_LIBLZMA
+	if (zip->entry_compression == COMPRESSION_XZ &&
+	    zip->replay == NULL) {
+		int r;
+
+		do {
+			zip->lzma_stream.next_out = zip->buf;
+			zip->lzma_stream.avail_out = zip->len_buf;
+			r = lzma_code(&zip->lzma_stream, LZMA_FINISH);
+			if (r != LZMA_OK && r != LZMA_STREAM_END) {
+				archive_set_error(&a->archive,
+				    ARCHIVE_ERRNO_MISC,
+				    "xz compression failed");
+				return (ARCHIVE_FATAL);
+			}
+			ret = write_compressed_buf(a,
+			    zip->len_buf - zip->lzma_stream.avail_out);
+			if (ret != ARCHIVE_OK)
+				return (ret);
+		} while (r != LZMA_STREAM_END);
+		lzma_end(&zip->lzma_stream);
+		zip->lzma_valid = 0;
+	}
 #endif
 	if (zip->hctx_valid) {
 		uint8_t hmac[20];
@@ -1286,6 +1619,10 @@ archive_write_zip_close(struct archive_write *a)
 	struct cd_segment *segment;
 	int ret;
 
+	ret = zip_drain(a);
+	if (ret != ARCHIVE_OK)
+		return (ret);
+
 	offset_start = zip->written_bytes;
 	segment = zip->central_directory;
 	while (segment != NULL) {
@@ -1365,6 +1702,14 @@ archive_write_zip_free(struct archive_write *a)
 	}
 	free(zip->buf);
 	archive_entry_free(zip->entry);
+#if HAVE_ZSTD_H && HAVE_LIBZSTD_COMPRESSOR
+	ZSTD_freeCStream(zip->zstd_stream);
+#endif
+#if HAVE_LZMA_H && HAVE_LIBLZMA
+	if (zip->lzma_valid)
+		lzma_end(&zip->lzma_stream);
+#endif
+	__archive_thread_ring_free(&zip->jobs, zip_job_release);
 	if (zip->cctx_valid)
 		archive_encrypto_aes_ctr_release(&zip->cctx);
 	if (zip->hctx_valid)
@@ -1376,6 +1721,239 @@ archive_write_zip_free(struct archive_write *a)
 	return (ARCHIVE_OK);
 }
 
+/*
+ * Make sure the job's output buffer holds at least size bytes.
+ */
+static int
+zip_job_reserve(struct zip_job *job, size_t size)
+{
+	if (job->out_size < size) {
+		free(job->out);
+		job->out = malloc(size);
+		job->out_size = job->out != NULL ? size : 0;
+	}
+	return (job->out != NULL ? 0 : -1);
+}
+
+static void
+zip_job_release(void *arg)
+{
+	struct zip_job *job = arg;
+
+	archive_entry_free(job->entry);
+	free(job->in);
+	free(job->out);
+}
+
+static void
+zip_job_run(void *arg)
+{
+	struct zip_job *job = arg;
+
+	job->crc = (uint32_t)job->crc32func(job->crc32func(0, NULL, 0),
+	    job->in, job->in_len);
+	job->ret = ARCHIVE_OK;
+#ifdef HAVE_ZLIB_H
+	if (job->compression == COMPRESSION_DEFLATE) {
+		z_stream strm;
+		size_t bound;
+
+		memset(&strm, 0, sizeof(strm));
+		if (deflateInit2(&strm, job->level, Z_DEFLATED, -15, 8,
+		    Z_DEFAULT_STRATEGY) != Z_OK) {
+			job->ret = ARCHIVE_FATAL;
+			return;
+		}
+		bound = deflateBound(&strm, (uLong)job->in_len);
+		if (zip_job_reserve(job, bound) != 0) {
+			deflateEnd(&strm);
+			job->ret = ARCHIVE_FATAL;
+			return;
+		}
+		strm.next_in = job->in;
+		strm.avail_in = (uInt)job->in_len;
+		strm.next_out = job->out;
+		strm.avail_out = (uInt)job->out_size;
+		if (deflate(&strm, Z_FINISH) != Z_STREAM_END)
+			job->ret = ARCHIVE_FATAL;
+		job->out_len = job->out_size - strm.avail_out;
+		deflateEnd(&strm);
+	}
+#endif
+#if HAVE_ZSTD_H && HAVE_LIBZSTD_COMPRESSOR
+	if (job->compression == COMPRESSION_ZSTD) {
+		size_t zret;
+
+		if (zip_job_reserve(job, ZSTD_compressBound(job->in_len)) != 0) {
+			job->ret = ARCHIVE_FATAL;
+			return;
+		}
+		zret = ZSTD_compress(job->out, job->out_size, job->in,
+		    job->in_len, job->level);
+		if (ZSTD_isError(zret))
+			job->ret = ARCHIVE_FATAL;
+		else
+			job->out_len = zret;
+	}
+#endif
+#if HAVE_LZMA_H && HAVE_LIBLZMA
+	if (job->compression == COMPRESSION_XZ) {
+		size_t pos = 0;
+
+		if (zip_job_reserve(job,
+		    lzma_stream_buffer_bound(job->in_len)) != 0) {
+			job->ret = ARCHIVE_FATAL;
+			return;
+		}
+		if (lzma_easy_buffer_encode(job->level, LZMA_CHECK_CRC32,
+		    NULL, job->in, job->in_len, job->out, &pos,
+		    job->out_size) != LZMA_OK)
+			job->ret = ARCHIVE_FATAL;
+		job->out_len = pos;
+	}
+#endif
+}
+
+/*
+ * Write out a compressed entry by running it through the ordinary
+ * header and finish code at the current archive position.
+ */
+static int
+zip_write_job(struct archive_write *a, struct zip_job *job)
+{
+	struct zip *zip = a->format_data;
+	enum compression requested = zip->requested_compression;
+	const void *p;
+	size_t len;
+	int ret, ret2;
+
+	zip->replay = job;
+	zip->requested_compression = job->compression;
+	ret = archive_write_zip_header(a, job->entry);
+	zip->requested_compression = requested;
+	if (ret < ARCHIVE_WARN)
+		goto done;
+	if (job->ret != ARCHIVE_OK) {
+		archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+		    "Can't compress %s", archive_entry_pathname(job->entry));
+		ret = ARCHIVE_FATAL;
+		goto done;
+	}
+	if (zip->entry_compression != COMPRESSION_STORE) {
+		p = job->out;
+		len = job->out_len;
+	} else {
+		p = job->in;
+		len = job->in_len;
+	}
+	if (len > 0 && __archive_write_output(a, p, len) != ARCHIVE_OK) {
+		ret = ARCHIVE_FATAL;
+		goto done;
+	}
+	zip->entry_compressed_written += len;
+	zip->written_bytes += len;
+	zip->entry_uncompressed_written += job->in_len;
+	zip->entry_uncompressed_limit -= job->in_len;
+	if (job->in_len > 0)
+		zip->entry_crc32 = job->crc;
+	ret2 = archive_write_zip_finish_entry(a);
+	if (ret2 < ret)
+		ret = ret2;
+done:
+	zip->replay = NULL;
+	return (ret);
+}
+
+/*
+ * Wait for the oldest queued entry and write it out.
+ */
+static int
+zip_reap(struct archive_write *a)
+{
+	struct zip *zip = a->format_data;
+	struct zip_job *job = __archive_thread_ring_reap(&zip->jobs);
+
+	return (job != NULL ? zip_write_job(a, job) : ARCHIVE_OK);
+}
+
+static int
+zip_drain(struct archive_write *a)
+{
+	struct zip *zip = a->format_data;
+	int ret = ARCHIVE_OK, r;
+
+	while (zip->jobs.pending > 0) {
+		r = zip_reap(a);
+		if (r < ret)
+			ret = r;
+		if (ret == ARCHIVE_FATAL)
+			break;
+	}
+	return (ret);
+}
+
+/*
+ * Start collecting the data of an entry into a free job slot.
+ */
+static int
+zip_queue_entry(struct archive_write *a, struct archive_entry *entry)
+{
+	struct zip *zip = a->format_data;
+	struct zip_job *job;
+	size_t size;
+	int ret = ARCHIVE_OK;
+
+	if (zip->jobs.pool == NULL &&
+	    __archive_thread_ring_init(&zip->jobs, zip->threads,
+	    sizeof(struct zip_job), zip_job_run) != ARCHIVE_OK)
+		goto nomem;
+	if ((job = __archive_thread_ring_next(&zip->jobs)) == NULL) {
+		ret = zip_reap(a);
+		if (ret < ARCHIVE_WARN)
+			return (ret);
+		job = __archive_thread_ring_next(&zip->jobs);
+	}
+
+	archive_entry_free(job->entry);
+	job->entry = archive_entry_clone(entry);
+	if (job->entry == NULL)
+		goto nomem;
+	job->compression = zip->requested_compression;
+	if (job->compression == COMPRESSION_UNSPECIFIED)
+		job->compression = COMPRESSION_DEFAULT;
+	switch (job->compression) {
+	case COMPRESSION_ZSTD:
+		job->level = zip->zstd_compression_level;
+		break;
+	case COMPRESSION_XZ:
+		job->level = zip->xz_compression_level;
+		break;
+	default:
+		job->level = zip->deflate_compression_level;
+		break;
+	}
+	job->crc32func = zip->crc32func;
+	size = archive_entry_filetype(entry) == AE_IFREG ?
+	    (size_t)archive_entry_size(entry) : 0;
+	if (job->in_size < size || job->in == NULL) {
+		free(job->in);
+		/* Never hand memcpy() a NULL buffer, even for no data. */
+		job->in = malloc(size > 0 ? size : 1);
+		if (job->in == NULL) {
+			job->in_size = 0;
+			goto nomem;
+		}
+	}
+	job->in_size = size;
+	job->in_len = 0;
+	job->out_len = 0;
+	zip->collecting = job;
+	return (ret);
+nomem:
+	archive_set_error(&a->archive, ENOMEM, "Can't allocate zip data");
+	return (ARCHIVE_FATAL);
+}
+
 /* Convert into MSDOS-style date/time. */
 static unsigned int
 dos_time(const time_t unix_time)
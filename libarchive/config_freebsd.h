@@ -158,9 +158,12 @@
 #define HAVE_PIPE 1
 #define HAVE_POLL 1
 #define HAVE_POLL_H 1
+#define HAVE_POSIX_FADVISE 1
 #define HAVE_POSIX_SPAWNP 1
+#define HAVE_PREAD 1
 #define HAVE_PTHREAD_H 1
 #define HAVE_PWD_H 1
+#define HAVE_PWRITE 1
 #define HAVE_READDIR_R 1
 #define HAVE_READLINK 1
 #define HAVE_READLINKAT 1
@@ -249,6 +252,10 @@
 #define HAVE_UTIMENSAT 1
 #endif
 
+#if __FreeBSD_version >= 1300037
+#define HAVE_COPY_FILE_RANGE 1
+#endif
+
 /* FreeBSD 4 and earlier lack intmax_t/uintmax_t */
 #if __FreeBSD__ < 5
 #define intmax_t int64_t
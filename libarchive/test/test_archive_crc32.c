@@ -0,0 +1,97 @@
+/*-
+ * Copyright (c) 2026 The libarchive developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "test.h"
+
+#define __LIBARCHIVE_BUILD
+#include <archive_crc32.h>
+
+/*
+ * __archive_crc32() picks a kernel at run time; whichever it picks
+ * must agree with the bit-at-a-time definition of CRC-32 for every
+ * length, alignment and split of the input.
+ */
+
+static unsigned long
+reference_crc32(unsigned long crc, const unsigned char *p, size_t len)
+{
+	int i;
+
+	crc ^= 0xffffffffUL;
+	while (len--) {
+		crc ^= *p++;
+		for (i = 0; i < 8; i++)
+			crc = (crc >> 1) ^ (0xedb88320UL & (0 - (crc & 1)));
+	}
+	return (crc ^ 0xffffffffUL);
+}
+
+DEFINE_TEST(test_archive_crc32)
+{
+	unsigned char *buff;
+	unsigned long crc, expected;
+	size_t size = 4096 + 64;
+	size_t i, offset, len, split;
+	unsigned int seed = 1;
+
+	assertEqualInt(0, __archive_crc32(0, NULL, 0));
+	assertEqualInt(0xcbf43926UL, __archive_crc32(0, "123456789", 9));
+
+	buff = malloc(size);
+	if (!assert(buff != NULL))
+		return;
+	for (i = 0; i < size; i++) {
+		seed = seed * 1103515245 + 12345;
+		buff[i] = (unsigned char)(seed >> 16);
+	}
+
+	for (offset = 0; offset < 16; offset++) {
+		for (len = 0; len + offset <= size;
+		    len += (len < 300) ? 1 : 97) {
+			expected = reference_crc32(0, buff + offset, len);
+			crc = __archive_crc32(0, buff + offset, len);
+			failure("offset %d, length %d", (int)offset, (int)len);
+			assertEqualInt(expected, crc);
+		}
+	}
+
+	/* Continuing a CRC across calls gives the same result. */
+	expected = reference_crc32(0, buff, size);
+	for (split = 0; split <= size; split += 61) {
+		crc = __archive_crc32(0, buff, split);
+		crc = __archive_crc32(crc, buff + split, size - split);
+		failure("split at %d", (int)split);
+		assertEqualInt(expected, crc);
+	}
+
+	/* Blocks of zeros and of ones. */
+	memset(buff, 0, size);
+	assertEqualInt(reference_crc32(0, buff, size),
+	    __archive_crc32(0, buff, size));
+	memset(buff, 0xff, size);
+	assertEqualInt(reference_crc32(0x12345678UL, buff, size),
+	    __archive_crc32(0x12345678UL, buff, size));
+
+	free(buff);
+}
@@ -0,0 +1,210 @@
+/*-
+ * Copyright (c) 2026 The libarchive developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "test.h"
+
+#define __LIBARCHIVE_TEST
+#include "archive_pathmatch.h"
+
+/*
+ * archive_match indexes its patterns so that it only has to try a few
+ * of them against each pathname.  Check that it still gives exactly
+ * the answers of trying every pattern in turn, for patterns and
+ * pathnames built to hit the corner cases of archive_pathmatch().
+ */
+
+static const char *patterns[] = {
+	"a", "b", "a/b", "b/c", "a/b/c", "./a", "a/./b", "a//b", "/a",
+	"^a", "a$", "b$", "*.o", "a*", "*b", "a*c", "?", "a/?", "[ab]c",
+	"[ab", "b/", "a//", "..", ".git", ".", "x.o", "ab", "c/a", "a\\b",
+	"\\a", "*", "a/b/", "ab/c*", "^b", ".g*", "a/.", "bc", "[\\]ab]cd",
+	"[ab]]c",
+};
+
+static const char *elements[] = {
+	"a", "b", "c", ".", "", "..", ".git", "x.o", "ab", "bc", "a$", "^a",
+	"[ab", "a\\b", "]cd", "acd", "b]c",
+};
+
+#define NPATTERNS	(sizeof(patterns) / sizeof(patterns[0]))
+#define NELEMENTS	(sizeof(elements) / sizeof(elements[0]))
+
+/* Random choices for one run. */
+static uint64_t choices[2048];
+static size_t nchoices;
+
+static unsigned
+pick(unsigned n)
+{
+	assert(nchoices < sizeof(choices) / sizeof(choices[0]));
+	return ((unsigned)(choices[nchoices++] % n));
+}
+
+/* The matching rules of archive_match.c, applied to every pattern. */
+static int
+reference(const char **incl, int *incl_matches, int nincl,
+    const char **excl, int nexcl, int recursive, const char *path)
+{
+	int i, matched = 0;
+	int iflag = recursive ? PATHMATCH_NO_ANCHOR_END : 0;
+	int eflag = PATHMATCH_NO_ANCHOR_START | PATHMATCH_NO_ANCHOR_END;
+
+	for (i = 0; i < nincl; i++) {
+		if (incl_matches[i] == 0 &&
+		    archive_pathmatch(incl[i], path, iflag)) {
+			incl_matches[i]++;
+			matched = 1;
+		}
+	}
+	for (i = 0; i < nexcl; i++)
+		if (archive_pathmatch(excl[i], path, eflag))
+			return (1);
+	if (matched)
+		return (0);
+	for (i = 0; i < nincl; i++)
+		if (incl_matches[i] > 0 &&
+		    archive_pathmatch(incl[i], path, iflag))
+			return (0);
+	return (nincl > 0);
+}
+
+/* Strip one trailing '/' as archive_match does. */
+static const char *
+stripped(char *buff, size_t size, const char *p)
+{
+	size_t len = strlen(p);
+
+	if (len && p[len - 1] == '/')
+		len--;
+	if (len >= size)
+		len = size - 1;
+	memcpy(buff, p, len);
+	buff[len] = '\0';
+	return (buff);
+}
+
+static void
+run(unsigned seed, int recursive)
+{
+	struct archive *m;
+	struct archive_entry *ae;
+	const char *incl[8], *excl[8];
+	char incl_buff[8][64], excl_buff[8][64];
+	int incl_matches[8];
+	int nincl, nexcl, i, j, n, unmatched, failures = 0;
+	char path[256];
+
+	fill_with_pseudorandom_data_seed(seed, choices, sizeof(choices));
+	nchoices = 0;
+	nincl = pick(4);
+	nexcl = pick(8);
+
+	assert((m = archive_match_new()) != NULL);
+	assert((ae = archive_entry_new()) != NULL);
+	assertEqualIntA(m, ARCHIVE_OK,
+	    archive_match_set_inclusion_recursion(m, recursive));
+	for (i = 0; i < nincl; i++) {
+		j = pick(NPATTERNS);
+		assertEqualIntA(m, ARCHIVE_OK,
+		    archive_match_include_pattern(m, patterns[j]));
+		incl[i] = stripped(incl_buff[i], sizeof(incl_buff[i]),
+		    patterns[j]);
+		incl_matches[i] = 0;
+	}
+	for (i = 0; i < nexcl; i++) {
+		j = pick(NPATTERNS);
+		assertEqualIntA(m, ARCHIVE_OK,
+		    archive_match_exclude_pattern(m, patterns[j]));
+		excl[i] = stripped(excl_buff[i], sizeof(excl_buff[i]),
+		    patterns[j]);
+	}
+
+	for (n = 0; n < 200; n++) {
+		int elements_count;
+
+		path[0] = '\0';
+		switch (pick(4)) {
+		case 0: strcat(path, "/"); break;
+		case 1: strcat(path, "./"); break;
+		default: break;
+		}
+		elements_count = 1 + pick(4);
+		for (i = 0; i < elements_count; i++) {
+			if (i > 0)
+				strcat(path, "/");
+			strcat(path, elements[pick(NELEMENTS)]);
+		}
+		if (pick(4) == 0)
+			strcat(path, "/");
+
+		archive_entry_copy_pathname(ae, path);
+		if (archive_match_path_excluded(m, ae) != reference(incl,
+		    incl_matches, nincl, excl, nexcl, recursive, path)) {
+			if (failures++ < 5)
+				failure("path \"%s\", seed %u", path, seed);
+			assert(0);
+		}
+	}
+
+	for (unmatched = 0, i = 0; i < nincl; i++)
+		if (incl_matches[i] == 0)
+			unmatched++;
+	assertEqualInt(unmatched, archive_match_path_unmatched_inclusions(m));
+
+	archive_entry_free(ae);
+	assertEqualInt(ARCHIVE_OK, archive_match_free(m));
+}
+
+/* An escaped ']' does not end a character class. */
+static void
+escaped_class(void)
+{
+	struct archive *m;
+	struct archive_entry *ae;
+
+	assert((m = archive_match_new()) != NULL);
+	assert((ae = archive_entry_new()) != NULL);
+	assertEqualIntA(m, ARCHIVE_OK,
+	    archive_match_include_pattern(m, "[\\]ab]cd"));
+	archive_entry_copy_pathname(ae, "]cd");
+	assertEqualInt(0, archive_match_path_excluded(m, ae));
+	archive_entry_copy_pathname(ae, "acd");
+	assertEqualInt(0, archive_match_path_excluded(m, ae));
+	archive_entry_copy_pathname(ae, "ccd");
+	assertEqualInt(1, archive_match_path_excluded(m, ae));
+	archive_entry_free(ae);
+	assertEqualInt(ARCHIVE_OK, archive_match_free(m));
+}
+
+DEFINE_TEST(test_archive_match_path_index)
+{
+	unsigned seed;
+
+	escaped_class();
+
+	for (seed = 1; seed <= 500; seed++) {
+		run(seed, 1);
+		run(seed, 0);
+	}
+}
@@ -193,8 +193,171 @@ test_open_filename_wcs(void)
 
 }
 
+/*
+ * The mmap variant hands out the file in large mapped windows; make
+ * sure entries straddling a window boundary, skips over it and the
+ * seeking zip reader all work.
+ */
+#define BIG_SIZE	(17 * 1024 * 1024 + 100)
+
+static void
+read_mmap_tar(int skip_big)
+{
+	char buff[64];
+	struct archive_entry *ae;
+	struct archive *a;
+	char *big;
+	size_t i;
+
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_all(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_filter_all(a));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_open_filename_mmap(a, "test_mmap.tar", 10240));
+
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	assertEqualString("file", archive_entry_pathname(ae));
+	assertEqualIntA(a, 8, archive_read_data(a, buff, 10));
+	assertEqualMem(buff, "12345678", 8);
+
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	assertEqualString("big", archive_entry_pathname(ae));
+	assertEqualInt(BIG_SIZE, archive_entry_size(ae));
+	if (skip_big)
+		assertEqualIntA(a, ARCHIVE_OK, archive_read_data_skip(a));
+	else {
+		assert((big = malloc(BIG_SIZE)) != NULL);
+		assertEqualInt(BIG_SIZE, archive_read_data(a, big, BIG_SIZE));
+		for (i = 0; i < BIG_SIZE; i++)
+			if (big[i] != (char)(i % 251))
+				break;
+		assertEqualInt(BIG_SIZE, i);
+		free(big);
+	}
+
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	assertEqualString("file3", archive_entry_pathname(ae));
+	assertEqualIntA(a, 3, archive_read_data(a, buff, 10));
+	assertEqualMem(buff, "abc", 3);
+
+	assertEqualIntA(a, ARCHIVE_EOF, archive_read_next_header(a, &ae));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+}
+
+static void
+test_open_filename_mmap(void)
+{
+	char buff[64];
+	struct archive_entry *ae;
+	struct archive *a;
+	char *big;
+	size_t i;
+
+	assert((big = malloc(BIG_SIZE)) != NULL);
+	for (i = 0; i < BIG_SIZE; i++)
+		big[i] = (char)(i % 251);
+
+	assert((a = archive_write_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_format_ustar(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_add_filter_none(a));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_open_filename(a, "test_mmap.tar"));
+	assert((ae = archive_entry_new()) != NULL);
+	archive_entry_copy_pathname(ae, "file");
+	archive_entry_set_mode(ae, S_IFREG | 0755);
+	archive_entry_set_size(ae, 8);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_header(a, ae));
+	assertEqualIntA(a, 8, archive_write_data(a, "12345678", 8));
+	archive_entry_clear(ae);
+	archive_entry_copy_pathname(ae, "big");
+	archive_entry_set_mode(ae, S_IFREG | 0644);
+	archive_entry_set_size(ae, BIG_SIZE);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_header(a, ae));
+	assertEqualIntA(a, BIG_SIZE, archive_write_data(a, big, BIG_SIZE));
+	archive_entry_clear(ae);
+	archive_entry_copy_pathname(ae, "file3");
+	archive_entry_set_mode(ae, S_IFREG | 0644);
+	archive_entry_set_size(ae, 3);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_header(a, ae));
+	assertEqualIntA(a, 3, archive_write_data(a, "abc", 3));
+	archive_entry_free(ae);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+	free(big);
+
+	read_mmap_tar(0);
+	read_mmap_tar(1);
+
+	/* The seeking zip reader starts at the central directory. */
+	assert((a = archive_write_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_format_zip(a));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_open_filename(a, "test_mmap.zip"));
+	assert((ae = archive_entry_new()) != NULL);
+	archive_entry_copy_pathname(ae, "file");
+	archive_entry_set_mode(ae, S_IFREG | 0644);
+	archive_entry_set_size(ae, 8);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_header(a, ae));
+	assertEqualIntA(a, 8, archive_write_data(a, "12345678", 8));
+	archive_entry_free(ae);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_support_format_zip_seekable(a));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_open_filename_mmap(a, "test_mmap.zip", 10240));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	assertEqualString("file", archive_entry_pathname(ae));
+	assertEqualIntA(a, 8, archive_read_data(a, buff, 10));
+	assertEqualMem(buff, "12345678", 8);
+	assertEqualIntA(a, ARCHIVE_EOF, archive_read_next_header(a, &ae));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+
+	/* Errors are reported just like with the regular reader. */
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_all(a));
+	assertEqualIntA(a, ARCHIVE_FATAL,
+	    archive_read_open_filename_mmap(a, "nonexistent.tar", 512));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+
+	/* The wide-character variant maps the same file. */
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_all(a));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_open_filename_mmap_w(a, L"test_mmap.tar", 10240));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	assertEqualString("file", archive_entry_pathname(ae));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	assertEqualString("big", archive_entry_pathname(ae));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	assertEqualString("file3", archive_entry_pathname(ae));
+	assertEqualIntA(a, ARCHIVE_EOF, archive_read_next_header(a, &ae));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+
+#if !defined(_WIN32) || defined(__CYGWIN__)
+	/* A file cut short by someone else past the first window is
+	 * read() from then on instead of faulting on the next one. */
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_all(a));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_open_filename_mmap(a, "test_mmap.tar", 10240));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	assertEqualString("big", archive_entry_pathname(ae));
+	assertEqualInt(0, truncate("test_mmap.tar", 16 * 1024 * 1024 + 4096));
+	assert((big = malloc(BIG_SIZE)) != NULL);
+	assert(archive_read_data(a, big, BIG_SIZE) < BIG_SIZE);
+	free(big);
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+#endif
+}
+
 DEFINE_TEST(test_open_filename)
 {
 	test_open_filename_mbs();
 	test_open_filename_wcs();
+	test_open_filename_mmap();
 }
@@ -0,0 +1,183 @@
+/*-
+ * Copyright (c) 2026 The libarchive developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "test.h"
+
+/* Sizes around the usual 4096-byte direct I/O alignment, and a few
+ * larger than one read buffer. */
+static const size_t sizes[] = {
+	1, 511, 4095, 4096, 4097, 65536 + 17, 1024 * 1024,
+	3 * 1024 * 1024 + 123,
+};
+#define NFILES (sizeof(sizes) / sizeof(sizes[0]))
+
+static unsigned char
+pattern(size_t file, size_t i)
+{
+	return (unsigned char)(i * 7 + (i >> 9) + file);
+}
+
+#if defined(O_DIRECT) && !defined(_WIN32)
+/*
+ * Non-zero if an aligned read through O_DIRECT works on the file, which
+ * some filesystems refuse at open() and others at read().
+ */
+static int
+can_direct_io(const char *path)
+{
+	char *buff, *aligned;
+	ssize_t bytes;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_DIRECT);
+	if (fd < 0)
+		return (0);
+	bytes = -1;
+	if ((buff = malloc(2 * 4096)) != NULL) {
+		aligned = buff + (4096 - (uintptr_t)buff % 4096);
+		bytes = read(fd, aligned, 4096);
+		free(buff);
+	}
+	close(fd);
+	return (bytes == 4096);
+}
+
+/* Non-zero if this process has the file open with O_DIRECT. */
+static int
+open_with_direct_io(const char *path)
+{
+	struct stat st, fst;
+	int fd, fl;
+
+	if (stat(path, &st) != 0)
+		return (0);
+	for (fd = 0; fd < 1024; fd++) {
+		if (fstat(fd, &fst) != 0 || fst.st_dev != st.st_dev ||
+		    fst.st_ino != st.st_ino)
+			continue;
+		fl = fcntl(fd, F_GETFL);
+		if (fl != -1 && (fl & O_DIRECT) != 0)
+			return (1);
+	}
+	return (0);
+}
+#endif
+
+/*
+ * Read every file under "top" and check its contents.  If direct is
+ * set, the largest file has to be read with O_DIRECT.
+ */
+static void
+read_tree(int flags, int threads, int direct, unsigned char *got)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	const void *p;
+	size_t size, i, file, len, seen = 0;
+	int64_t offset;
+	int r;
+
+	assert((ae = archive_entry_new()) != NULL);
+	assert((a = archive_read_disk_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_disk_set_behavior(a, flags));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_disk_set_threads(a, threads));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_disk_open(a, "top"));
+	while ((r = archive_read_next_header2(a, ae)) == ARCHIVE_OK) {
+		if (archive_read_disk_can_descend(a))
+			assertEqualIntA(a, ARCHIVE_OK,
+			    archive_read_disk_descend(a));
+		if (archive_entry_filetype(ae) != AE_IFREG)
+			continue;
+		file = (size_t)atoi(archive_entry_pathname(ae) + 5);
+		assert(file < NFILES);
+		len = sizes[file];
+		assertEqualInt(len, archive_entry_size(ae));
+		memset(got, 0, len);
+		while ((r = archive_read_data_block(a, &p, &size,
+		    &offset)) == ARCHIVE_OK) {
+			assert(offset >= 0 && (size_t)offset + size <= len);
+			memcpy(got + offset, p, size);
+#if defined(O_DIRECT) && !defined(_WIN32)
+			/* The first block leaves the offset aligned. */
+			if (direct && file == NFILES - 1 && offset == 0) {
+				failure("%d threads", threads);
+				assert(open_with_direct_io(
+				    archive_entry_pathname(ae)));
+			}
+#else
+			(void)direct;
+#endif
+		}
+		assertEqualIntA(a, ARCHIVE_EOF, r);
+		for (i = 0; i < len; i++)
+			if (got[i] != pattern(file, i))
+				break;
+		failure("file %d, flags %x, %d threads", (int)file, flags,
+		    threads);
+		assertEqualInt(len, i);
+		seen++;
+	}
+	assertEqualIntA(a, ARCHIVE_EOF, r);
+	assertEqualInt(NFILES, seen);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+	archive_entry_free(ae);
+}
+
+DEFINE_TEST(test_read_disk_direct_io)
+{
+	unsigned char *buff;
+	char name[64];
+	size_t f, i, max = 0;
+	int direct = 0;
+
+	for (f = 0; f < NFILES; f++)
+		if (max < sizes[f])
+			max = sizes[f];
+	assert((buff = malloc(max)) != NULL);
+	if (buff == NULL)
+		return;
+	assertMakeDir("top", 0755);
+	for (f = 0; f < NFILES; f++) {
+		for (i = 0; i < sizes[f]; i++)
+			buff[i] = pattern(f, i);
+		snprintf(name, sizeof(name), "top/f%d", (int)f);
+		assertMakeBinFile(name, 0644, sizes[f], buff);
+	}
+
+	read_tree(0, 1, 0, buff);
+	read_tree(0, 2, 0, buff);
+#if defined(O_DIRECT) && !defined(_WIN32)
+	direct = can_direct_io(name);
+	if (!direct) {
+		skipping("O_DIRECT reads are not supported on this filesystem;"
+		    " not checking that they were used");
+	}
+#endif
+	read_tree(ARCHIVE_READDISK_DIRECT_IO, 1, direct, buff);
+	read_tree(ARCHIVE_READDISK_DIRECT_IO, 2, direct, buff);
+	free(buff);
+}
@@ -0,0 +1,101 @@
+/*-
+ * Copyright (c) 2026 The libarchive developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "test.h"
+
+/*
+ * Walk the tree and record every entry's path, type and size as one
+ * line of text, in traversal order.
+ */
+static void
+walk(char *out, size_t outsize, int threads, int logical)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	size_t used = 0;
+	int r;
+
+	assert((ae = archive_entry_new()) != NULL);
+	assert((a = archive_read_disk_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_disk_set_threads(a, threads));
+	if (logical)
+		assertEqualIntA(a, ARCHIVE_OK,
+		    archive_read_disk_set_symlink_logical(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_disk_open(a, "top"));
+	while ((r = archive_read_next_header2(a, ae)) == ARCHIVE_OK) {
+		used += snprintf(out + used, outsize - used, "%s %o %d\n",
+		    archive_entry_pathname(ae),
+		    (unsigned)archive_entry_filetype(ae),
+		    (int)archive_entry_size(ae));
+		assert(used < outsize);
+		if (archive_read_disk_can_descend(a))
+			assertEqualIntA(a, ARCHIVE_OK,
+			    archive_read_disk_descend(a));
+	}
+	assertEqualIntA(a, ARCHIVE_EOF, r);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+	archive_entry_free(ae);
+}
+
+DEFINE_TEST(test_read_disk_threads)
+{
+	static char serial[16384], parallel[16384];
+	struct archive *a;
+	char name[64], data[300];
+	int i;
+
+	memset(data, 'x', sizeof(data));
+	assertMakeDir("top", 0755);
+	/* More entries than one prefetch chunk, with varying sizes. */
+	for (i = 0; i < 150; i++) {
+		snprintf(name, sizeof(name), "top/f%03d", i);
+		assertMakeBinFile(name, 0644, i * 2, data);
+	}
+	assertMakeDir("top/sub", 0755);
+	for (i = 0; i < 40; i++) {
+		snprintf(name, sizeof(name), "top/sub/g%03d", i);
+		assertMakeBinFile(name, 0644, i, data);
+	}
+	assertMakeDir("top/sub/empty", 0755);
+	if (canSymlink()) {
+		assertMakeSymlink("top/ln", "f100", 0);
+		assertMakeSymlink("top/lnsub", "sub", 1);
+		assertMakeSymlink("top/dangling", "nonexistent", 0);
+	}
+
+	assert((a = archive_read_disk_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_read_disk_set_threads(a, -1));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+
+	for (i = 0; i < 2; i++) {
+		walk(serial, sizeof(serial), 1, i);
+		walk(parallel, sizeof(parallel), 4, i);
+		/* 150 + 40 files, three directories and the links. */
+		assert(strlen(serial) > 193 * 10);
+		assertEqualString(serial, parallel);
+	}
+}
@@ -0,0 +1,299 @@
+/*-
+ * Copyright (c) 2026 The libarchive developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "test.h"
+
+#define BUFF_SIZE	8000000
+#define DATA_SIZE	1200000
+#define NFILES		200
+/* Deep enough that the path exceeds PATH_MAX everywhere. */
+#define DEEP_DIRS	26
+
+static void
+add_file(struct archive *a, const char *name, const char *data, size_t size,
+    time_t mtime)
+{
+	struct archive_entry *ae;
+
+	assert((ae = archive_entry_new()) != NULL);
+	archive_entry_copy_pathname(ae, name);
+	archive_entry_set_mode(ae, AE_IFREG | 0644);
+	archive_entry_set_mtime(ae, mtime, 0);
+	archive_entry_set_size(ae, size);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_header(a, ae));
+	assertEqualIntA(a, (int)size, (int)archive_write_data(a, data, size));
+	archive_entry_free(ae);
+}
+
+static void
+deep_name(char *name, size_t size, const char *leaf)
+{
+	char dir[201];
+	int i;
+
+	memset(dir, 'x', 199);
+	dir[199] = '/';
+	dir[200] = '\0';
+	name[0] = '\0';
+	for (i = 0; i < DEEP_DIRS; i++)
+		strncat(name, dir, size - strlen(name) - 1);
+	strncat(name, leaf, size - strlen(name) - 1);
+}
+
+/*
+ * Extract every entry, counting the entries that fail to restore and
+ * the failures reported only when the archive is closed.
+ */
+static void
+extract_all(const char *buff, size_t used, int flags, int *warnings,
+    int *late)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	int r;
+
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_all(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_extract_set_threads(a, 4));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_open_memory(a, buff, used));
+	*warnings = 0;
+	while (archive_read_next_header(a, &ae) == ARCHIVE_OK) {
+		r = archive_read_extract(a, ae, flags);
+		if (r == ARCHIVE_WARN)
+			(*warnings)++;
+		else
+			assertEqualIntA(a, ARCHIVE_OK, r);
+	}
+	/* Files still being restored are waited for here. */
+	*late = 0;
+	r = archive_read_close(a);
+	if (r == ARCHIVE_WARN) {
+		(*late)++;
+		assert(archive_error_string(a) != NULL);
+	} else
+		assertEqualIntA(a, ARCHIVE_OK, r);
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+}
+
+DEFINE_TEST(test_read_extract_threads)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	char *buff, *data, name[64], deep[DEEP_DIRS * 200 + 64];
+	size_t used, size;
+	int i, warnings, late;
+
+	assertUmask(022);
+	buff = malloc(BUFF_SIZE);
+	data = malloc(DATA_SIZE);
+	if (!assert(buff != NULL && data != NULL)) {
+		free(buff);
+		free(data);
+		return;
+	}
+	fill_with_pseudorandom_data(data, DATA_SIZE);
+
+	assert((a = archive_write_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_format_pax(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_add_filter_none(a));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_open_memory(a, buff, BUFF_SIZE, &used));
+	assert((ae = archive_entry_new()) != NULL);
+	archive_entry_copy_pathname(ae, "d");
+	archive_entry_set_mode(ae, AE_IFDIR | 0755);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_header(a, ae));
+	archive_entry_free(ae);
+	/* Many small files, restored by the workers. */
+	for (i = 0; i < NFILES; i++) {
+		snprintf(name, sizeof(name), "d/f%03d", i);
+		add_file(a, name, data + i, (i * 997) % 20000, 86400 + i);
+	}
+	/* A file larger than the per-job limit is restored in line. */
+	add_file(a, "big", data, DATA_SIZE, 86400);
+	/* A later copy of a queued path must win. */
+	add_file(a, "d/f007", "replaced", 8, 86400);
+	/* A hard link to a queued file waits for it to land. */
+	assert((ae = archive_entry_new()) != NULL);
+	archive_entry_copy_pathname(ae, "link");
+	archive_entry_copy_hardlink(ae, "d/f010");
+	archive_entry_set_mode(ae, AE_IFREG | 0644);
+	archive_entry_set_size(ae, 0);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_header(a, ae));
+	archive_entry_free(ae);
+	/* Paths too long for the system are restored from an
+	 * intermediate directory by the calling thread, among small
+	 * files queued for the workers. */
+	for (i = 0; i < 4; i++) {
+		snprintf(name, sizeof(name), "f%d", i);
+		deep_name(deep, sizeof(deep), name);
+		add_file(a, deep, data + i, 100 + i, 86400);
+		snprintf(name, sizeof(name), "e%d", i);
+		add_file(a, name, data + i, 100 + i, 86400);
+	}
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+
+	extract_all(buff, used, ARCHIVE_EXTRACT_TIME, &warnings, &late);
+	assertEqualInt(0, warnings);
+	assertEqualInt(0, late);
+
+	for (i = 0; i < NFILES; i++) {
+		snprintf(name, sizeof(name), "d/f%03d", i);
+		if (i == 7)
+			continue;
+		size = (i * 997) % 20000;
+		assertFileContents(data + i, (int)size, name);
+		assertFileMode(name, 0644);
+		assertFileMtime(name, 86400 + i, 0);
+	}
+	assertFileContents("replaced", 8, "d/f007");
+	assertFileContents(data, DATA_SIZE, "big");
+	assertIsHardlink("link", "d/f010");
+	assertFileMtime("d/f010", 86400 + 10, 0);
+	memset(deep, 'x', 199);
+	deep[199] = '\0';
+	for (i = 0; i < DEEP_DIRS; i++)
+		assertChdir(deep);
+	for (i = 0; i < 4; i++) {
+		snprintf(name, sizeof(name), "f%d", i);
+		assertFileContents(data + i, 100 + i, name);
+	}
+	for (i = 0; i < DEEP_DIRS; i++)
+		assertChdir("..");
+	for (i = 0; i < 4; i++) {
+		snprintf(name, sizeof(name), "e%d", i);
+		assertFileContents(data + i, 100 + i, name);
+	}
+
+	/* Every file exists now, so a second pass that must not
+	 * overwrite anything fails for each of them, small files that
+	 * would go to the workers included, as each is extracted. */
+	extract_all(buff, used, ARCHIVE_EXTRACT_NO_OVERWRITE, &warnings,
+	    &late);
+	assert(warnings >= NFILES + 2);
+	assertEqualInt(0, late);
+	assertFileContents("replaced", 8, "d/f007");
+
+	free(data);
+	free(buff);
+}
+
+#define NPAIRS	40
+
+/*
+ * Restore entries one by one or with workers, into dir, and record
+ * what each extract call returned.
+ */
+static void
+extract_into(const char *dir, const char *buff, size_t used, int threads,
+    int *results)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	int n = 0;
+
+	assertMakeDir(dir, 0755);
+	assertChdir(dir);
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_all(a));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_extract_set_threads(a, threads));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_open_memory(a, buff, used));
+	while (archive_read_next_header(a, &ae) == ARCHIVE_OK)
+		results[n++] = archive_read_extract(a, ae, 0);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+	assertChdir("..");
+}
+
+DEFINE_TEST(test_read_extract_threads_overlap)
+{
+	struct archive *a;
+	struct stat st1, st2;
+	char *buff, *data, name[64], name2[64];
+	int results1[4 * NPAIRS], results2[4 * NPAIRS];
+	size_t used;
+	int i, r1, r2;
+
+	assertUmask(022);
+	buff = malloc(BUFF_SIZE);
+	data = malloc(DATA_SIZE);
+	if (!assert(buff != NULL && data != NULL)) {
+		free(buff);
+		free(data);
+		return;
+	}
+	fill_with_pseudorandom_data(data, DATA_SIZE);
+
+	/* Small files, each queued right after one whose path is the
+	 * directory above it or a file below it. */
+	assert((a = archive_write_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_format_pax(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_add_filter_none(a));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_open_memory(a, buff, BUFF_SIZE, &used));
+	for (i = 0; i < NPAIRS; i++) {
+		snprintf(name, sizeof(name), "x%d", i);
+		add_file(a, name, data + i, 5000 + i, 86400);
+		snprintf(name, sizeof(name), "x%d/y", i);
+		add_file(a, name, data + i + 1, 6000 + i, 86400);
+		snprintf(name, sizeof(name), "z%d/w", i);
+		add_file(a, name, data + i + 2, 7000 + i, 86400);
+		snprintf(name, sizeof(name), "z%d", i);
+		add_file(a, name, data + i + 3, 8000 + i, 86400);
+	}
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+
+	/* The workers leave the same files behind as the calling
+	 * thread alone, and every entry reports how it went itself. */
+	extract_into("serial", buff, used, 1, results1);
+	extract_into("threads", buff, used, 4, results2);
+	for (i = 0; i < 4 * NPAIRS; i++) {
+		failure("entry %d", i);
+		assertEqualInt(results1[i], results2[i]);
+	}
+	for (i = 0; i < 4 * NPAIRS; i++) {
+		snprintf(name, sizeof(name), "serial/%c%d%s", "xxzz"[i % 4],
+		    i / 4, i % 4 == 1 ? "/y" : i % 4 == 2 ? "/w" : "");
+		snprintf(name2, sizeof(name2), "threads/%s", name + 7);
+		r1 = lstat(name, &st1);
+		r2 = lstat(name2, &st2);
+		failure("%s", name2);
+		assertEqualInt(r1, r2);
+		if (r1 != 0 || r2 != 0)
+			continue;
+		failure("%s", name2);
+		assertEqualInt(st1.st_mode, st2.st_mode);
+		if (S_ISREG(st1.st_mode)) {
+			failure("%s", name2);
+			assertEqualInt(st1.st_size, st2.st_size);
+		}
+	}
+
+	free(data);
+	free(buff);
+}
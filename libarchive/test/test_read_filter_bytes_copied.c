@@ -0,0 +1,85 @@
+/*-
+ * Copyright (c) 2026 The libarchive developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "test.h"
+
+/*
+ * A pax header whose body straddles two input blocks is gathered
+ * from both blocks, so only the tail of the first block has to be
+ * copied.  File data is handed out straight from the input blocks.
+ */
+DEFINE_TEST(test_read_filter_bytes_copied)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	char *buff, *name, *data, *rbuff;
+	size_t buffsize = 100000, used, namelen = 12000, datasize = 50000;
+	int64_t copied, passed;
+
+	assert((buff = malloc(buffsize)) != NULL);
+	assert((name = malloc(namelen + 1)) != NULL);
+	assert((data = malloc(datasize)) != NULL);
+	assert((rbuff = malloc(datasize)) != NULL);
+	memset(name, 'a', namelen);
+	name[namelen] = '\0';
+	memset(data, 'x', datasize);
+
+	assert((a = archive_write_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_format_pax(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_add_filter_none(a));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_open_memory(a, buff, buffsize, &used));
+	assert((ae = archive_entry_new()) != NULL);
+	archive_entry_copy_pathname(ae, name);
+	archive_entry_set_mode(ae, AE_IFREG | 0644);
+	archive_entry_set_size(ae, datasize);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_header(a, ae));
+	archive_entry_free(ae);
+	assertEqualInt(datasize, archive_write_data(a, data, datasize));
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_all(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_filter_all(a));
+	assertEqualIntA(a, ARCHIVE_OK, read_open_memory(a, buff, used, 10240));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	assertEqualString(name, archive_entry_pathname(ae));
+	assertEqualInt(datasize, archive_read_data(a, rbuff, datasize));
+	assertEqualMem(data, rbuff, datasize);
+	assertEqualIntA(a, ARCHIVE_EOF, archive_read_next_header(a, &ae));
+
+	copied = archive_read_filter_bytes_copied(a, 0);
+	passed = archive_read_filter_bytes_passed(a, 0);
+	failure("copied %d bytes, passed %d bytes", (int)copied, (int)passed);
+	assert(copied < (int64_t)namelen);
+	assert(passed >= (int64_t)datasize);
+	assertEqualInt(-1, archive_read_filter_bytes_copied(a, 5));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+
+	free(rbuff);
+	free(data);
+	free(name);
+	free(buff);
+}
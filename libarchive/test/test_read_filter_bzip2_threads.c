@@ -0,0 +1,207 @@
+/*-
+ * Copyright (c) 2026 The libarchive developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "test.h"
+
+/*
+ * The compatibility samples hold several concatenated streams, one
+ * of them followed by garbage; the threaded reader has to handle
+ * both just like the serial one.
+ */
+static void
+verify(const char *name, const char *threads)
+{
+	const char *n[7] = { "f1", "f2", "f3", "d1/f1", "d1/f2", "d1/f3", NULL };
+	struct archive_entry *ae;
+	struct archive *a;
+	int i;
+
+	assert((a = archive_read_new()) != NULL);
+	if (ARCHIVE_OK != archive_read_support_filter_bzip2(a)) {
+		skipping("Unsupported bzip2");
+		assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+		return;
+	}
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_all(a));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_set_filter_option(a, "bzip2", "threads", threads));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_open_filename(a, name, 2));
+	for (i = 0; i < 6; ++i) {
+		failure("Could not read file %d (%s) from %s", i, n[i], name);
+		assertEqualIntA(a, ARCHIVE_OK,
+		    archive_read_next_header(a, &ae));
+		assertEqualString(n[i], archive_entry_pathname(ae));
+	}
+	assertEqualIntA(a, ARCHIVE_EOF, archive_read_next_header(a, &ae));
+	assertEqualInt(archive_filter_code(a, 0), ARCHIVE_FILTER_BZIP2);
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+}
+
+/*
+ * Damage in the middle of the data must be reported, never
+ * silently skipped.
+ */
+static void
+verify_truncated(const char *name)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	char *buff;
+	size_t size;
+	int r;
+
+	buff = slurpfile(&size, "%s", name);
+	assert(buff != NULL);
+	if (buff == NULL)
+		return;
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_filter_bzip2(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_all(a));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_set_filter_option(a, "bzip2", "threads", "4"));
+	/* Cut the first stream short.  Opening already decodes the
+	 * first block, so the error can show up right there. */
+	r = archive_read_open_memory(a, buff, 60);
+	while (r == ARCHIVE_OK)
+		r = archive_read_next_header(a, &ae);
+	assertEqualInt(ARCHIVE_FATAL, r);
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+	free(buff);
+}
+
+/*
+ * The symbol map near the start of a block tells which byte values
+ * occur, 16 at a time.  Data made of just these bytes spells out the
+ * block magic number or the end-of-stream one there, in every block,
+ * so the reader has to put each block back together.
+ */
+static const unsigned char block_magic_set[] = {
+	0x21, 0x23, 0x24, 0x27, 0x2a, 0x2d, 0x2e,
+	0x31, 0x33, 0x36, 0x37, 0x39, 0x3b, 0x3c, 0x3f,
+	0x70, 0x90, 0xf0
+};
+static const unsigned char eos_magic_set[] = {
+	0x31, 0x35, 0x37, 0x3a, 0x3b, 0x3c,
+	0x51, 0x53, 0x58, 0x5b,
+	0x60, 0x70, 0x90, 0xa0, 0xb0, 0xe0
+};
+
+#define FALSE_MAGIC_SIZE	400000
+
+static void
+verify_false_magic(const unsigned char *set, size_t nset,
+    const unsigned char *magic)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	char *data, *buff, *rbuff;
+	size_t buffsize = FALSE_MAGIC_SIZE, used, i, prev = nset;
+	ssize_t r;
+
+	assert(NULL != (data = malloc(FALSE_MAGIC_SIZE)));
+	assert(NULL != (buff = malloc(buffsize)));
+	assert(NULL != (rbuff = malloc(FALSE_MAGIC_SIZE)));
+	/* No runs of four, which would add run lengths to the map. */
+	fill_with_pseudorandom_data_seed(1, data, FALSE_MAGIC_SIZE);
+	for (i = 0; i < FALSE_MAGIC_SIZE; i++) {
+		size_t c;
+
+		c = (unsigned char)data[i] % nset;
+		if (c == prev)
+			c = (c + 1) % nset;
+		data[i] = (char)set[c];
+		prev = c;
+	}
+
+	assert((a = archive_write_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_format_raw(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_add_filter_bzip2(a));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_set_filter_option(a, NULL, "compression-level", "1"));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_open_memory(a, buff, buffsize, &used));
+	assert((ae = archive_entry_new()) != NULL);
+	archive_entry_copy_pathname(ae, "data");
+	archive_entry_set_mode(ae, AE_IFREG | 0644);
+	archive_entry_set_size(ae, FALSE_MAGIC_SIZE);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_header(a, ae));
+	archive_entry_free(ae);
+	assertEqualInt(FALSE_MAGIC_SIZE,
+	    archive_write_data(a, data, FALSE_MAGIC_SIZE));
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+
+	/* The map of the first block starts 105 bits into it, after
+	 * the magic number, CRC, flag and origin pointer. */
+	for (i = 0; i < 48; i++) {
+		size_t bit = 32 + 105 + i;
+		if (((buff[bit / 8] >> (7 - bit % 8)) & 1) !=
+		    ((magic[i / 8] >> (7 - i % 8)) & 1))
+			break;
+	}
+	assertEqualInt(48, i);
+
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_filter_bzip2(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_raw(a));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_set_filter_option(a, "bzip2", "threads", "3"));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_open_memory(a, buff, used));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	for (i = 0; i < FALSE_MAGIC_SIZE; i += r) {
+		r = archive_read_data(a, rbuff + i, FALSE_MAGIC_SIZE - i);
+		if (r <= 0)
+			break;
+	}
+	assertEqualInt(FALSE_MAGIC_SIZE, i);
+	assertEqualMem(data, rbuff, FALSE_MAGIC_SIZE);
+	assertEqualIntA(a, ARCHIVE_EOF, archive_read_next_header(a, &ae));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+	free(data);
+	free(buff);
+	free(rbuff);
+}
+
+DEFINE_TEST(test_read_filter_bzip2_threads)
+{
+	struct archive *a;
+
+	extract_reference_file("test_compat_bzip2_1.tbz");
+	extract_reference_file("test_compat_bzip2_2.tbz");
+	verify("test_compat_bzip2_1.tbz", "4");
+	verify("test_compat_bzip2_2.tbz", "4");
+	verify("test_compat_bzip2_1.tbz", "0");
+	verify_truncated("test_compat_bzip2_1.tbz");
+	verify_false_magic(block_magic_set, sizeof(block_magic_set),
+	    (const unsigned char *)"\x31\x41\x59\x26\x53\x59");
+	verify_false_magic(eos_magic_set, sizeof(eos_magic_set),
+	    (const unsigned char *)"\x17\x72\x45\x38\x50\x90");
+
+	/* Invalid values are rejected. */
+	assert((a = archive_read_new()) != NULL);
+	assert(archive_read_support_filter_bzip2(a) >= ARCHIVE_WARN);
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_read_set_filter_option(a, "bzip2", "threads", "many"));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+}
@@ -0,0 +1,104 @@
+/*-
+ * Copyright (c) 2026 The libarchive developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "test.h"
+
+/*
+ * The sample is a tar archive compressed as BGZF blocks: every gzip
+ * member records its own compressed size in a "BC" extra subfield.
+ * The third member is an ordinary gzip member without that subfield,
+ * so the threaded reader has to switch to serial decoding for it and
+ * back again.  The archive ends with the empty BGZF EOF marker.
+ */
+static void
+verify(const char *options)
+{
+	const char *reference = "test_read_filter_gzip_threads.tar.gz";
+	struct archive_entry *ae;
+	struct archive *a;
+	char *buff, *p;
+	size_t size = 200000;
+	int i, r;
+
+	assert((a = archive_read_new()) != NULL);
+	r = archive_read_support_filter_gzip(a);
+	if (r == ARCHIVE_WARN) {
+		skipping("gzip reading not fully supported on this platform");
+		assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+		return;
+	}
+	assertEqualIntA(a, ARCHIVE_OK, r);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_all(a));
+	if (options != NULL)
+		assertEqualIntA(a, ARCHIVE_OK,
+		    archive_read_set_options(a, options));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_open_filename(a, reference, 10240));
+
+	assert((buff = malloc(size + 1)) != NULL);
+	for (i = 0, p = buff; i < 25000; i++, p += 8)
+		sprintf(p, "%07d\n", i % 4000);
+
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	assertEqualString("file1", archive_entry_pathname(ae));
+	assertEqualInt(size, archive_entry_size(ae));
+	p = malloc(size);
+	assertEqualInt(size, archive_read_data(a, p, size));
+	assertEqualMem(buff, p, size);
+	free(p);
+	free(buff);
+
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	assertEqualString("file2", archive_entry_pathname(ae));
+	assertEqualInt(13, archive_entry_size(ae));
+
+	/* Verify the end-of-archive. */
+	assertEqualIntA(a, ARCHIVE_EOF, archive_read_next_header(a, &ae));
+
+	/* Verify that the format detection worked. */
+	assertEqualInt(archive_filter_code(a, 0), ARCHIVE_FILTER_GZIP);
+	assertEqualString(archive_filter_name(a, 0), "gzip");
+	assertEqualInt(archive_format(a), ARCHIVE_FORMAT_TAR_USTAR);
+
+	assertEqualInt(ARCHIVE_OK, archive_read_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+}
+
+DEFINE_TEST(test_read_filter_gzip_threads)
+{
+	struct archive *a;
+
+	extract_reference_file("test_read_filter_gzip_threads.tar.gz");
+	verify(NULL);
+	verify("gzip:threads=1");
+	verify("gzip:threads=4");
+	verify("gzip:threads=0");
+
+	/* Invalid values are rejected. */
+	assert((a = archive_read_new()) != NULL);
+	assert(archive_read_support_filter_gzip(a) >= ARCHIVE_WARN);
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_read_set_filter_option(a, "gzip", "threads", "many"));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+}
@@ -0,0 +1,129 @@
+/*-
+ * Copyright (c) 2026 The libarchive developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "test.h"
+
+/*
+ * Write an xz stream with the threaded encoder, which splits the
+ * data into several blocks, and read it back with and without the
+ * threaded decoder.
+ */
+
+static void
+verify(const char *options, const char *buff, size_t used,
+    const char *data, size_t datasize)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	char *rbuff;
+
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_all(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_filter_all(a));
+	if (options != NULL)
+		assertEqualIntA(a, ARCHIVE_OK,
+		    archive_read_set_options(a, options));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_open_memory(a, buff, used));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	assertEqualString("file", archive_entry_pathname(ae));
+	assertEqualInt(datasize, archive_entry_size(ae));
+	assert((rbuff = malloc(datasize)) != NULL);
+	assertEqualInt(datasize, archive_read_data(a, rbuff, datasize));
+	assertEqualMem(data, rbuff, datasize);
+	free(rbuff);
+	assertEqualIntA(a, ARCHIVE_EOF, archive_read_next_header(a, &ae));
+	assertEqualInt(ARCHIVE_FILTER_XZ, archive_filter_code(a, 0));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+}
+
+DEFINE_TEST(test_read_filter_xz_threads)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	char *buff, *data;
+	size_t buffsize, datasize, used;
+	size_t i;
+	int r;
+
+	datasize = 4 * 1024 * 1024;
+	buffsize = datasize + 100000;
+	assert(NULL != (buff = (char *)malloc(buffsize)));
+	assert(NULL != (data = (char *)malloc(datasize)));
+	for (i = 0; i < datasize; i++)
+		data[i] = "0123456789abcdef"[(i * 7 + i / 1000) % 16];
+
+	assert((a = archive_write_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_format_ustar(a));
+	r = archive_write_add_filter_xz(a);
+	if (r != ARCHIVE_OK) {
+		skipping("xz writing not supported on this platform");
+		assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+		free(buff);
+		free(data);
+		return;
+	}
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_set_filter_option(a, NULL, "compression-level", "0"));
+	/* Without a threaded encoder this yields a single-block stream,
+	 * which the threaded decoder must handle as well. */
+	archive_write_set_filter_option(a, NULL, "threads", "4");
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_open_memory(a, buff, buffsize, &used));
+	assert((ae = archive_entry_new()) != NULL);
+	archive_entry_copy_pathname(ae, "file");
+	archive_entry_set_filetype(ae, AE_IFREG);
+	archive_entry_set_size(ae, datasize);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_header(a, ae));
+	archive_entry_free(ae);
+	assertEqualInt(datasize, archive_write_data(a, data, datasize));
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+
+	verify(NULL, buff, used, data, datasize);
+	verify("xz:threads=4", buff, used, data, datasize);
+	verify("xz:threads=0", buff, used, data, datasize);
+	verify("xz:threads=4,xz:memlimit=64M", buff, used, data, datasize);
+	/* A tiny budget falls back to single-threaded decoding. */
+	verify("xz:threads=4,xz:memlimit=1024", buff, used, data, datasize);
+
+	/* Invalid values are rejected. */
+	assert((a = archive_read_new()) != NULL);
+	assert(archive_read_support_filter_xz(a) >= ARCHIVE_WARN);
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_read_set_filter_option(a, "xz", "threads", "many"));
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_read_set_filter_option(a, "xz", "memlimit", "10X"));
+	/* 2^64 bytes, which does not fit. */
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_read_set_filter_option(a, "xz", "memlimit",
+	    "17179869184G"));
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_read_set_filter_option(a, "xz", "memlimit",
+	    "18014398509481984K"));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+
+	free(buff);
+	free(data);
+}
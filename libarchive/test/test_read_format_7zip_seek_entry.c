@@ -0,0 +1,182 @@
+/*-
+ * Copyright (c) 2026 The libarchive developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "test.h"
+
+/*
+ * Jump around a solid 7-Zip folder with archive_read_seek_entry(),
+ * with and without the "checkpoint-span" option.
+ */
+
+#define NFILES	60
+#define FSIZE	(100 * 1024)
+
+/*
+ * All files go into a single folder.  With threads, the LZMA2 writer
+ * resets the dictionary every few MiB, which gives the reader places
+ * to restart at.
+ */
+static int
+write_archive(const char *compression, char *buff, size_t buffsize,
+    size_t *used, char *data)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	char name[64];
+	int i;
+
+	assert((a = archive_write_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_format_7zip(a));
+	if (archive_write_set_format_option(a, "7zip", "compression",
+	    compression) != ARCHIVE_OK) {
+		assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+		return (0);
+	}
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_format_option(
+	    a, "7zip", "compression-level", "1"));
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_format_option(
+	    a, "7zip", "threads", "2"));
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_add_filter_none(a));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_open_memory(a, buff, buffsize, used));
+
+	assert((ae = archive_entry_new()) != NULL);
+	archive_entry_copy_pathname(ae, "dir/link");
+	archive_entry_set_mode(ae, AE_IFLNK | 0755);
+	archive_entry_copy_symlink(ae, "file0");
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_header(a, ae));
+	archive_entry_free(ae);
+
+	for (i = 0; i < NFILES; i++) {
+		fill_with_words_seed(i, data, FSIZE);
+		snprintf(name, sizeof(name), "dir/file%d", i);
+		assert((ae = archive_entry_new()) != NULL);
+		archive_entry_copy_pathname(ae, name);
+		archive_entry_set_mode(ae, AE_IFREG | 0644);
+		archive_entry_set_size(ae, FSIZE);
+		assertEqualIntA(a, ARCHIVE_OK, archive_write_header(a, ae));
+		archive_entry_free(ae);
+		assertEqualInt(FSIZE, archive_write_data(a, data, FSIZE));
+	}
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+	return (1);
+}
+
+static void
+verify_file(struct archive *a, struct archive_entry *ae, int i, char *data,
+    char *rbuff)
+{
+	char name[64];
+
+	snprintf(name, sizeof(name), "dir/file%d", i);
+	assertEqualString(name, archive_entry_pathname(ae));
+	assertEqualInt(FSIZE, archive_entry_size(ae));
+	fill_with_words_seed(i, data, FSIZE);
+	assertEqualInt(FSIZE, archive_read_data(a, rbuff, FSIZE));
+	assertEqualMem(data, rbuff, FSIZE);
+}
+
+static void
+verify(const char *buff, size_t used, const char *option, char *data,
+    char *rbuff)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	char name[64];
+	int i, n;
+
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_7zip(a));
+	if (option != NULL)
+		assertEqualIntA(a, ARCHIVE_OK,
+		    archive_read_set_options(a, option));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_open_memory(a, buff, used));
+
+	/* Look up entries before reading any header. */
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_read_seek_entry(a, "dir/missing", &ae));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_seek_entry(a, "dir/link", &ae));
+	assertEqualString("file0", archive_entry_symlink(ae));
+
+	/* Forwards and backwards through the folder. */
+	for (n = 0; n < 20; n++) {
+		i = (n * 37) % NFILES;
+		snprintf(name, sizeof(name), "dir/file%d", i);
+		assertEqualIntA(a, ARCHIVE_OK,
+		    archive_read_seek_entry(a, name, &ae));
+		verify_file(a, ae, i, data, rbuff);
+	}
+
+	/* Reading goes on after the entry found, whether or not its
+	 * data was read. */
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_seek_entry(a, "dir/file40", &ae));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_data_skip(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	verify_file(a, ae, 41, data, rbuff);
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_seek_entry(a, "dir/file20", &ae));
+	for (i = 20; i < NFILES; i++) {
+		if (i > 20)
+			assertEqualIntA(a, ARCHIVE_OK,
+			    archive_read_next_header(a, &ae));
+		if (i % 3 == 0)
+			verify_file(a, ae, i, data, rbuff);
+	}
+	assertEqualIntA(a, ARCHIVE_EOF, archive_read_next_header(a, &ae));
+
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+}
+
+DEFINE_TEST(test_read_format_7zip_seek_entry)
+{
+	static const char *compressions[] = { "lzma2", "deflate", "store" };
+	char *buff, *data, *rbuff;
+	size_t buffsize, used;
+	unsigned i;
+
+	buffsize = 2 * NFILES * FSIZE;
+	assert(NULL != (buff = (char *)malloc(buffsize)));
+	assert(NULL != (rbuff = (char *)malloc(FSIZE)));
+	assert(NULL != (data = (char *)malloc(FSIZE)));
+
+	for (i = 0; i < sizeof(compressions) / sizeof(compressions[0]); i++) {
+		if (!write_archive(compressions[i], buff, buffsize, &used,
+		    data)) {
+			skipping("%s compression not supported",
+			    compressions[i]);
+			continue;
+		}
+		verify(buff, used, NULL, data, rbuff);
+		verify(buff, used, "7zip:checkpoint-span=65536", data, rbuff);
+		verify(buff, used, "7zip:threads=2", data, rbuff);
+	}
+
+	free(data);
+	free(rbuff);
+	free(buff);
+}
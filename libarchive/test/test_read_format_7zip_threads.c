@@ -0,0 +1,207 @@
+/*-
+ * Copyright (c) 2026 The libarchive developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "test.h"
+
+/*
+ * The sample holds twelve files in seven folders: LZMA2 and Deflate
+ * folders with one to three files each, and a stored folder in the
+ * middle, which the threaded reader has to decode itself before it
+ * can queue the remaining folders again.  File N consists of
+ * 100 + 40 * N lines of the form "fileNN line NNNNN".
+ */
+static const char *reference = "test_read_format_7zip_threads.7z";
+
+static char *
+expected_contents(int n, size_t *size)
+{
+	char *buff, *p;
+	int i, lines = 100 + 40 * n;
+
+	*size = lines * 18;
+	assert((buff = malloc(*size + 1)) != NULL);
+	for (i = 0, p = buff; i < lines; i++, p += 18)
+		sprintf(p, "file%02d line %05d\n", n, i);
+	return (buff);
+}
+
+/*
+ * Read the sample with the given options; the data of every entry
+ * whose number is a multiple of `stride' is verified and the others
+ * are skipped.
+ */
+static void
+verify(const char *options, int stride)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	char name[16];
+	char *buff, *p;
+	size_t size;
+	int i;
+
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_filter_all(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_all(a));
+	if (options != NULL)
+		assertEqualIntA(a, ARCHIVE_OK,
+		    archive_read_set_options(a, options));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_open_filename(a, reference, 10240));
+
+	for (i = 0; i < 12; i++) {
+		assertEqualIntA(a, ARCHIVE_OK,
+		    archive_read_next_header(a, &ae));
+		snprintf(name, sizeof(name), "file%02d", i);
+		assertEqualString(name, archive_entry_pathname(ae));
+		buff = expected_contents(i, &size);
+		assertEqualInt(size, archive_entry_size(ae));
+		if (i % stride == 0) {
+			assert((p = malloc(size)) != NULL);
+			assertEqualInt(size, archive_read_data(a, p, size));
+			assertEqualMem(buff, p, size);
+			free(p);
+		}
+		free(buff);
+	}
+
+	/* Verify the end-of-archive. */
+	assertEqualIntA(a, ARCHIVE_EOF, archive_read_next_header(a, &ae));
+	assertEqualInt(12, archive_file_count(a));
+	assertEqualInt(ARCHIVE_FORMAT_7ZIP, archive_format(a));
+
+	assertEqualInt(ARCHIVE_OK, archive_read_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+}
+
+/*
+ * Read all of the entries' data into one buffer.
+ */
+static char *
+read_all(const char *refname, const char *options, size_t *size)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	char *buff = NULL, *p;
+	la_ssize_t bytes;
+	int r;
+
+	*size = 0;
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_filter_all(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_all(a));
+	if (options != NULL)
+		assertEqualIntA(a, ARCHIVE_OK,
+		    archive_read_set_options(a, options));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_open_filename(a, refname, 10240));
+	while ((r = archive_read_next_header(a, &ae)) == ARCHIVE_OK) {
+		p = realloc(buff, *size + archive_entry_size(ae) + 1);
+		assert(p != NULL);
+		buff = p;
+		bytes = archive_read_data(a, buff + *size,
+		    archive_entry_size(ae) + 1);
+		assertEqualInt(archive_entry_size(ae), bytes);
+		if (bytes > 0)
+			*size += bytes;
+	}
+	assertEqualIntA(a, ARCHIVE_EOF, r);
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+	return (buff);
+}
+
+static void
+compare(const char *refname)
+{
+	char *serial, *threaded;
+	size_t serial_size, threaded_size;
+
+	extract_reference_file(refname);
+	serial = read_all(refname, NULL, &serial_size);
+	threaded = read_all(refname, "7zip:threads=3", &threaded_size);
+	assertEqualInt(serial_size, threaded_size);
+	if (serial_size == threaded_size)
+		assertEqualMem(serial, threaded, serial_size);
+	free(serial);
+	free(threaded);
+}
+
+DEFINE_TEST(test_read_format_7zip_threads)
+{
+	struct archive *a;
+
+	assert((a = archive_read_new()) != NULL);
+	if (ARCHIVE_OK != archive_read_support_filter_xz(a) ||
+	    ARCHIVE_OK != archive_read_support_filter_gzip(a)) {
+		skipping("7zip:lzma2 or deflate decoding is not supported "
+		    "on this platform");
+		assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+		return;
+	}
+	/* Invalid values are rejected. */
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_7zip(a));
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_read_set_format_option(a, "7zip", "threads", "many"));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+
+	extract_reference_file(reference);
+	verify(NULL, 1);
+	verify("7zip:threads=1", 1);
+	verify("7zip:threads=2", 1);
+	verify("7zip:threads=4", 1);
+	verify("7zip:threads=0", 1);
+	/* Skip over most entries, and over whole folders. */
+	verify("7zip:threads=2", 3);
+	verify("7zip:threads=4", 5);
+	verify("7zip:threads=4", 100);
+}
+
+DEFINE_TEST(test_read_format_7zip_threads_codecs)
+{
+	struct archive *a;
+
+	assert((a = archive_read_new()) != NULL);
+	if (ARCHIVE_OK != archive_read_support_filter_xz(a)) {
+		skipping("7zip:lzma decoding is not supported on this "
+		    "platform");
+	} else {
+		compare("test_read_format_7zip_lzma1_lzma2.7z");
+		compare("test_read_format_7zip_bcj_lzma1.7z");
+		compare("test_read_format_7zip_bcj_lzma2.7z");
+		compare("test_read_format_7zip_delta4_lzma1.7z");
+		compare("test_read_format_7zip_bcj2_lzma2_1.7z");
+		compare("test_read_format_7zip_ppmd.7z");
+	}
+	if (ARCHIVE_OK != archive_read_support_filter_gzip(a)) {
+		skipping("7zip:deflate decoding is not supported on this "
+		    "platform");
+	} else
+		compare("test_read_format_7zip_bcj_deflate.7z");
+	if (ARCHIVE_OK != archive_read_support_filter_bzip2(a)) {
+		skipping("7zip:bzip2 decoding is not supported on this "
+		    "platform");
+	} else
+		compare("test_read_format_7zip_bcj_bzip2.7z");
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+}
@@ -0,0 +1,157 @@
+/*-
+ * Copyright (c) 2026 The libarchive developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "test.h"
+
+/*
+ * Read all of the entries' data into one buffer.  Returns non-zero if
+ * reading the archive failed somewhere along the way.
+ */
+static int
+read_all(const char *refname, const char *options, int stride,
+    char **buff, size_t *size)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	const char *name;
+	char *p;
+	la_ssize_t bytes;
+	int i, r, failed = 0;
+
+	*buff = NULL;
+	*size = 0;
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_filter_all(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_all(a));
+	if (options != NULL)
+		assertEqualIntA(a, ARCHIVE_OK,
+		    archive_read_set_options(a, options));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_open_filename(a, refname, 10240));
+	for (i = 0; (r = archive_read_next_header(a, &ae)) == ARCHIVE_OK;
+	    i++) {
+		/* Record the names of skipped entries, too. */
+		if ((name = archive_entry_pathname_utf8(ae)) == NULL)
+			name = "";
+		p = realloc(*buff, *size + strlen(name)
+		    + archive_entry_size(ae) + 1);
+		assert(p != NULL);
+		*buff = p;
+		memcpy(*buff + *size, name, strlen(name));
+		*size += strlen(name);
+		if (i % stride != 0 || archive_entry_filetype(ae) != AE_IFREG)
+			continue;
+		bytes = archive_read_data(a, *buff + *size,
+		    archive_entry_size(ae) + 1);
+		if (bytes < 0) {
+			failed = 1;
+			break;
+		}
+		assertEqualInt(archive_entry_size(ae), bytes);
+		*size += bytes;
+	}
+	if (r != ARCHIVE_OK && r != ARCHIVE_EOF)
+		failed = 1;
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+	return (failed);
+}
+
+/*
+ * The data read with the threads option has to be the same as
+ * without it, including where reading fails.
+ */
+static void
+compare(const char *refname, const char *options, int stride)
+{
+	char *serial, *threaded;
+	size_t serial_size, threaded_size;
+	int serial_failed, threaded_failed;
+
+	extract_reference_file(refname);
+	serial_failed = read_all(refname, NULL, stride, &serial,
+	    &serial_size);
+	threaded_failed = read_all(refname, options, stride, &threaded,
+	    &threaded_size);
+	assertEqualInt(serial_failed, threaded_failed);
+	if (!serial_failed) {
+		assertEqualInt(serial_size, threaded_size);
+		if (serial_size == threaded_size)
+			assertEqualMem(serial, threaded, serial_size);
+	}
+	free(serial);
+	free(threaded);
+}
+
+DEFINE_TEST(test_read_format_rar5_threads)
+{
+	static const char *reffile = "test_read_format_rar5_multiple_files.rar";
+	struct archive *a;
+
+	/* Invalid values are rejected. */
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_rar5(a));
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_read_set_format_option(a, "rar5", "threads", "many"));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+
+	compare(reffile, "rar5:threads=1", 1);
+	compare(reffile, "rar5:threads=2", 1);
+	compare(reffile, "rar5:threads=4", 1);
+	compare(reffile, "rar5:threads=0", 1);
+	/* Skip over some of the queued entries. */
+	compare(reffile, "rar5:threads=2", 2);
+	compare(reffile, "rar5:threads=2", 3);
+	compare(reffile, "rar5:threads=4", 100);
+}
+
+DEFINE_TEST(test_read_format_rar5_threads_samples)
+{
+	/* Solid and stored archives are read by the calling thread, the
+	 * others mix queued files with ones that are not. */
+	compare("test_read_format_rar5_compressed.rar", "rar5:threads=2", 1);
+	compare("test_read_format_rar5_blake2.rar", "rar5:threads=2", 1);
+	compare("test_read_format_rar5_arm.rar", "rar5:threads=2", 1);
+	compare("test_read_format_rar5_win32.rar", "rar5:threads=2", 1);
+	compare("test_read_format_rar5_fileattr.rar", "rar5:threads=2", 1);
+	compare("test_read_format_rar5_owner.rar", "rar5:threads=2", 1);
+	compare("test_read_format_rar5_symlink.rar", "rar5:threads=2", 1);
+	compare("test_read_format_rar5_hardlink.rar", "rar5:threads=2", 1);
+	compare("test_read_format_rar5_stored_manyfiles.rar",
+	    "rar5:threads=2", 1);
+	compare("test_read_format_rar5_multiple_files_solid.rar",
+	    "rar5:threads=2", 1);
+	compare("test_read_format_rar5_different_window_size.rar",
+	    "rar5:threads=2", 1);
+	/* Damaged archives fail the same way. */
+	compare("test_read_format_rar5_distance_overflow.rar",
+	    "rar5:threads=2", 1);
+	compare("test_read_format_rar5_invalid_dict_reference.rar",
+	    "rar5:threads=2", 1);
+	compare("test_read_format_rar5_window_buf_and_size_desync.rar",
+	    "rar5:threads=2", 1);
+	compare("test_read_format_rar5_truncated_huff.rar",
+	    "rar5:threads=2", 1);
+	compare("test_read_format_rar5_leftshift1.rar", "rar5:threads=2", 1);
+	compare("test_read_format_rar5_leftshift2.rar", "rar5:threads=2", 1);
+}
@@ -0,0 +1,237 @@
+/*-
+ * Copyright (c) 2026 The libarchive developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "test.h"
+
+#define ENTRIES		300
+#define ENTRY_SIZE	3000
+
+/* Text that deflate can't squeeze into a handful of blocks. */
+static void
+fill(char *buff, int n)
+{
+	fill_with_words_seed(n, buff, ENTRY_SIZE);
+	snprintf(buff, 16, "%d:", n);
+}
+
+/*
+ * Write an archive of ENTRIES files "fileN"; the last one replaces
+ * file5.  Returns ARCHIVE_OK or ARCHIVE_WARN if gzip is unavailable.
+ */
+static int
+make_archive(const char *name, int gzip)
+{
+	struct archive *a;
+	struct archive_entry *ae;
+	char path[32], data[ENTRY_SIZE];
+	int i, r;
+
+	assert((a = archive_write_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_format_pax(a));
+	if (gzip) {
+		r = archive_write_add_filter_gzip(a);
+		if (r != ARCHIVE_OK) {
+			assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+			return (ARCHIVE_WARN);
+		}
+	}
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_open_filename(a, name));
+	for (i = 0; i < ENTRIES; i++) {
+		if (i == ENTRIES - 1)
+			strcpy(path, "file5");
+		else
+			snprintf(path, sizeof(path), "file%d", i);
+		fill(data, i);
+		assert((ae = archive_entry_new()) != NULL);
+		archive_entry_copy_pathname(ae, path);
+		archive_entry_set_mode(ae, AE_IFREG | 0644);
+		archive_entry_set_size(ae, ENTRY_SIZE);
+		assertEqualIntA(a, ARCHIVE_OK, archive_write_header(a, ae));
+		archive_entry_free(ae);
+		assertEqualIntA(a, ENTRY_SIZE,
+		    archive_write_data(a, data, ENTRY_SIZE));
+	}
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_free(a));
+	return (ARCHIVE_OK);
+}
+
+static int64_t
+file_size(const char *name)
+{
+	struct stat st;
+
+	assertEqualInt(0, stat(name, &st));
+	return (st.st_size);
+}
+
+static struct archive *
+open_archive(const char *name, const char *options)
+{
+	struct archive *a;
+
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_tar(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_filter_all(a));
+	if (options != NULL)
+		assertEqualIntA(a, ARCHIVE_OK,
+		    archive_read_set_options(a, options));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_open_filename(a, name, 10240));
+	return (a);
+}
+
+static void
+record_index(const char *name, const char *options)
+{
+	struct archive *a;
+	struct archive_entry *ae;
+	int i;
+
+	a = open_archive(name, options);
+	for (i = 0; i < ENTRIES; i++)
+		assertEqualIntA(a, ARCHIVE_OK,
+		    archive_read_next_header(a, &ae));
+	assertEqualIntA(a, ARCHIVE_EOF, archive_read_next_header(a, &ae));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_free(a));
+}
+
+static void
+verify_entry(struct archive *a, int n, int contents)
+{
+	struct archive_entry *ae;
+	char path[32], data[ENTRY_SIZE], buff[ENTRY_SIZE];
+
+	snprintf(path, sizeof(path), "file%d", n);
+	fill(data, contents);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_seek_entry(a, path, &ae));
+	assertEqualString(path, archive_entry_pathname(ae));
+	assertEqualInt(ENTRY_SIZE, archive_entry_size(ae));
+	assertEqualIntA(a, ENTRY_SIZE,
+	    archive_read_data(a, buff, sizeof(buff)));
+	assertEqualMem(buff, data, ENTRY_SIZE);
+}
+
+static void
+verify_index(const char *name, const char *index)
+{
+	struct archive *a;
+	struct archive_entry *ae;
+	char options[64];
+
+	snprintf(options, sizeof(options), "tar:index=%s", index);
+	a = open_archive(name, options);
+
+	/* Forward, backward and back again. */
+	verify_entry(a, 200, 200);
+	verify_entry(a, 17, 17);
+	verify_entry(a, 298, 298);
+	verify_entry(a, 0, 0);
+	/* The later copy of a name wins. */
+	verify_entry(a, 5, ENTRIES - 1);
+
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_read_seek_entry(a, "nonexistent", &ae));
+
+	/* Sequential reading continues after the entry found. */
+	verify_entry(a, 150, 150);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	assertEqualString("file151", archive_entry_pathname(ae));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_free(a));
+}
+
+DEFINE_TEST(test_read_format_tar_index)
+{
+	struct archive *a;
+	struct archive_entry *ae;
+
+	assertEqualInt(ARCHIVE_OK, make_archive("test.tar", 0));
+	record_index("test.tar", "tar:write-index=test.tar.idx");
+	verify_index("test.tar", "test.tar.idx");
+
+	/* Without an index there is nothing to seek with. */
+	a = open_archive("test.tar", NULL);
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_read_seek_entry(a, "file3", &ae));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_free(a));
+}
+
+DEFINE_TEST(test_read_format_tar_index_gzip)
+{
+	struct archive *a;
+	struct archive_entry *ae;
+
+	if (make_archive("test.tar.gz", 1) != ARCHIVE_OK ||
+	    archive_zlib_version() == NULL) {
+		skipping("gzip is not supported on this platform");
+		return;
+	}
+
+	/* Checkpoints every 16KiB give a few dozen of them. */
+	record_index("test.tar.gz",
+	    "tar:write-index=test.tar.gz.idx,tar:index-span=16384");
+	verify_index("test.tar.gz", "test.tar.gz.idx");
+
+	/* The default span leaves a single checkpoint at the start. */
+	record_index("test.tar.gz", "tar:write-index=test2.idx");
+	verify_index("test.tar.gz", "test2.idx");
+	assert(file_size("test2.idx") < file_size("test.tar.gz.idx"));
+
+	/* The span applies whichever option comes first. */
+	record_index("test.tar.gz",
+	    "tar:index-span=16384,tar:write-index=test3.idx");
+	verify_index("test.tar.gz", "test3.idx");
+	assertEqualInt(file_size("test.tar.gz.idx"), file_size("test3.idx"));
+
+	/* An index without checkpoints can't find its way into
+	 * compressed data. */
+	assertEqualInt(ARCHIVE_OK, make_archive("test.tar", 0));
+	record_index("test.tar", "tar:write-index=test.tar.idx");
+	a = open_archive("test.tar.gz", "tar:index=test.tar.idx");
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_read_seek_entry(a, "file3", &ae));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_free(a));
+}
+
+DEFINE_TEST(test_read_format_tar_index_partial)
+{
+	struct archive *a;
+	struct archive_entry *ae;
+
+	assertEqualInt(ARCHIVE_OK, make_archive("test.tar", 0));
+
+	/* An abandoned recording leaves no index behind. */
+	a = open_archive("test.tar", "tar:write-index=test.idx");
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	assertFileExists("test.idx");
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_free(a));
+	assertFileNotExists("test.idx");
+
+	/* A file that isn't an index is refused. */
+	assertMakeFile("test.idx", 0644, "not an index at all, really");
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_tar(a));
+	assertEqualIntA(a, ARCHIVE_FATAL,
+	    archive_read_set_options(a, "tar:index=test.idx"));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_free(a));
+}
@@ -0,0 +1,189 @@
+/*-
+ * Copyright (c) 2026 The libarchive developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "test.h"
+
+#define ENTRIES	200
+
+/*
+ * Write a Zip archive with ENTRIES files, the last of which replaces
+ * an earlier entry of the same name.
+ */
+static size_t
+make_archive(char *buff, size_t buffsize, int deflate)
+{
+	struct archive *a;
+	struct archive_entry *ae;
+	char name[64], data[64];
+	size_t used;
+	int i;
+
+	assert((a = archive_write_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_format_zip(a));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_set_format_option(a, "zip", "compression",
+	    deflate ? "deflate" : "store"));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_open_memory(a, buff, buffsize, &used));
+
+	for (i = 0; i < ENTRIES; i++) {
+		if (i == ENTRIES - 1) {
+			strcpy(name, "dir/file7");
+			strcpy(data, "replacement");
+		} else {
+			snprintf(name, sizeof(name), "dir/file%d", i);
+			snprintf(data, sizeof(data), "contents of %d", i);
+		}
+		assert((ae = archive_entry_new()) != NULL);
+		archive_entry_copy_pathname(ae, name);
+		archive_entry_set_mode(ae, AE_IFREG | 0644);
+		archive_entry_set_size(ae, strlen(data));
+		assertEqualIntA(a, ARCHIVE_OK, archive_write_header(a, ae));
+		archive_entry_free(ae);
+		assertEqualIntA(a, (int)strlen(data),
+		    archive_write_data(a, data, strlen(data)));
+	}
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_free(a));
+	return (used);
+}
+
+static void
+verify_entry(struct archive *a, const char *name, const char *data)
+{
+	struct archive_entry *ae;
+	char buff[64];
+
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_seek_entry(a, name, &ae));
+	assertEqualString(name, archive_entry_pathname(ae));
+	assertEqualInt(strlen(data), archive_entry_size(ae));
+	assertEqualIntA(a, (int)strlen(data),
+	    archive_read_data(a, buff, sizeof(buff)));
+	assertEqualMem(buff, data, strlen(data));
+}
+
+static void
+verify_seek(const char *buff, size_t used)
+{
+	struct archive *a;
+	struct archive_entry *ae;
+	char data[64];
+
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_all(a));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    read_open_memory_seek(a, buff, used, 7));
+
+	/* Jump forward, then backward, without reading any headers. */
+	verify_entry(a, "dir/file150", "contents of 150");
+	verify_entry(a, "dir/file3", "contents of 3");
+	/* A partially read entry may be abandoned. */
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_seek_entry(a, "dir/file100", &ae));
+	verify_entry(a, "dir/file0", "contents of 0");
+
+	/* The last copy of a duplicated name wins. */
+	verify_entry(a, "dir/file7", "replacement");
+
+	/* A missing entry fails without losing our place. */
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_seek_entry(a, "dir/file42", &ae));
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_read_seek_entry(a, "dir/nonexistent", &ae));
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_read_seek_entry(a, "dir/file", &ae));
+	assertEqualIntA(a, 14, archive_read_data(a, data, sizeof(data)));
+	assertEqualMem(data, "contents of 42", 14);
+
+	/* Sequential reading resumes after the entry we jumped to. */
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	assertEqualString("dir/file43", archive_entry_pathname(ae));
+
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_free(a));
+}
+
+DEFINE_TEST(test_read_format_zip_seek_entry)
+{
+	size_t buffsize = 100000;
+	char *buff;
+	size_t used;
+
+	buff = malloc(buffsize);
+	used = make_archive(buff, buffsize, 0);
+	verify_seek(buff, used);
+#ifdef HAVE_ZLIB_H
+	used = make_archive(buff, buffsize, 1);
+	verify_seek(buff, used);
+#endif
+	free(buff);
+}
+
+DEFINE_TEST(test_read_format_zip_seek_entry_eof)
+{
+	struct archive *a;
+	struct archive_entry *ae;
+	size_t buffsize = 100000;
+	char *buff, data[64];
+	size_t used;
+	int i;
+
+	buff = malloc(buffsize);
+	used = make_archive(buff, buffsize, 0);
+
+	/* Seeking is allowed after the end of the archive is reached. */
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_all(a));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    read_open_memory_seek(a, buff, used, 7));
+	for (i = 0; i < ENTRIES; i++)
+		assertEqualIntA(a, ARCHIVE_OK,
+		    archive_read_next_header(a, &ae));
+	assertEqualIntA(a, ARCHIVE_EOF, archive_read_next_header(a, &ae));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_seek_entry(a, "dir/file9", &ae));
+	assertEqualIntA(a, 13, archive_read_data(a, data, sizeof(data)));
+	assertEqualMem(data, "contents of 9", 13);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_free(a));
+
+	/* A missing first lookup leaves sequential reading untouched. */
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_all(a));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    read_open_memory_seek(a, buff, used, 7));
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_read_seek_entry(a, "missing", &ae));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	assertEqualString("dir/file0", archive_entry_pathname(ae));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_free(a));
+
+	/* The streaming reader has no index to consult. */
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_all(a));
+	assertEqualIntA(a, ARCHIVE_OK, read_open_memory(a, buff, used, 7));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_read_seek_entry(a, "dir/file9", &ae));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_free(a));
+
+	free(buff);
+}
@@ -689,3 +689,97 @@ DEFINE_TEST(test_fully_sparse_files)
 	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
 	free(cwd);
 }
+
+DEFINE_TEST(test_sparse_scan)
+{
+#if defined(_WIN32) && !defined(__CYGWIN__)
+	skipping("ARCHIVE_READDISK_SCAN_SPARSE is not supported on Windows");
+#else
+	struct archive *a;
+	struct archive_entry *ae;
+	const void *buff;
+	size_t bytes_read;
+	int64_t offset, length;
+	char *data;
+	FILE *f;
+
+	/* Write a file out in full: data, two blocks of zeros, a block
+	 * with a little data in it and a trailing block of zeros. */
+	data = calloc(1, 5 * 4096);
+	if (!assert(data != NULL))
+		return;
+	memset(data, 'a', 4096);
+	memset(data + 3 * 4096 + 10, 'b', 100);
+	assert((f = fopen("dense", "wb")) != NULL);
+	assertEqualInt(5 * 4096, fwrite(data, 1, 5 * 4096, f));
+	assertEqualInt(0, fclose(f));
+	memset(data, 'c', 2 * 4096);
+	assert((f = fopen("full", "wb")) != NULL);
+	assertEqualInt(2 * 4096, fwrite(data, 1, 2 * 4096, f));
+	assertEqualInt(0, fclose(f));
+	free(data);
+
+	assert((a = archive_read_disk_new()) != NULL);
+
+	/* Without the flag, nothing is found. */
+	assert((ae = archive_entry_new()) != NULL);
+	archive_entry_copy_pathname(ae, "dense");
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_disk_entry_from_file(a, ae, -1, NULL));
+	assertEqualInt(0, archive_entry_sparse_count(ae));
+	archive_entry_free(ae);
+
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_disk_set_behavior(a,
+	    ARCHIVE_READDISK_SCAN_SPARSE));
+
+	/* Blocks of zeros become holes. */
+	assert((ae = archive_entry_new()) != NULL);
+	archive_entry_copy_pathname(ae, "dense");
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_disk_entry_from_file(a, ae, -1, NULL));
+	assertEqualInt(2, archive_entry_sparse_reset(ae));
+	assertEqualInt(ARCHIVE_OK,
+	    archive_entry_sparse_next(ae, &offset, &length));
+	assertEqualInt(0, offset);
+	assertEqualInt(4096, length);
+	assertEqualInt(ARCHIVE_OK,
+	    archive_entry_sparse_next(ae, &offset, &length));
+	assertEqualInt(3 * 4096, offset);
+	assertEqualInt(4096, length);
+	archive_entry_free(ae);
+
+	/* A file without a block of zeros has no holes. */
+	assert((ae = archive_entry_new()) != NULL);
+	archive_entry_copy_pathname(ae, "full");
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_disk_entry_from_file(a, ae, -1, NULL));
+	assertEqualInt(0, archive_entry_sparse_count(ae));
+	archive_entry_free(ae);
+
+	/* Reading the tree returns only the data blocks. */
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_disk_open(a, "dense"));
+	assert((ae = archive_entry_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header2(a, ae));
+	assertEqualInt(2, archive_entry_sparse_count(ae));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_data_block(a, &buff, &bytes_read, &offset));
+	assertEqualInt(0, offset);
+	assertEqualInt(4096, bytes_read);
+	assertEqualInt('a', ((const char *)buff)[4095]);
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_data_block(a, &buff, &bytes_read, &offset));
+	assertEqualInt(3 * 4096, offset);
+	assertEqualInt(4096, bytes_read);
+	assertEqualInt('b', ((const char *)buff)[10]);
+	/* The trailing hole is marked with an empty block. */
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_data_block(a, &buff, &bytes_read, &offset));
+	assertEqualInt(5 * 4096, offset);
+	assertEqualInt(0, bytes_read);
+	assertEqualIntA(a, ARCHIVE_EOF,
+	    archive_read_data_block(a, &buff, &bytes_read, &offset));
+	archive_entry_free(ae);
+
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+#endif
+}
@@ -0,0 +1,125 @@
+/*-
+ * Copyright (c) 2026 The libarchive developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "test.h"
+
+#if defined(_WIN32) && !defined(__CYGWIN__)
+#define	open _open
+#define	close _close
+#endif
+#ifndef O_BINARY
+#define	O_BINARY 0
+#endif
+
+#define	DATA_SIZE	100000
+
+/*
+ * Write three entries, taking their data from the file descriptor or
+ * from memory: all of the file, a part of it starting at an odd
+ * offset, and an entry larger than what is left of the file.
+ */
+static void
+write_archive(const char *name, int format, int filter, int from_fd,
+    const unsigned char *data, int fd)
+{
+	static const struct {
+		const char *name;
+		int64_t offset, size;
+	} entries[] = {
+		{ "all", 0, DATA_SIZE },
+		{ "part", 12345, 50000 },
+		{ "short", DATA_SIZE - 1000, 3000 },
+	};
+	struct archive_entry *ae;
+	struct archive *a;
+	size_t avail;
+	int i;
+
+	assert((a = archive_write_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_format(a, format));
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_add_filter(a, filter));
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_open_filename(a, name));
+	for (i = 0; i < 3; i++) {
+		avail = (size_t)(DATA_SIZE - entries[i].offset);
+		if ((int64_t)avail > entries[i].size)
+			avail = (size_t)entries[i].size;
+		assert((ae = archive_entry_new()) != NULL);
+		archive_entry_copy_pathname(ae, entries[i].name);
+		archive_entry_set_mode(ae, AE_IFREG | 0644);
+		archive_entry_set_mtime(ae, 1, 0);
+		archive_entry_set_size(ae, entries[i].size);
+		assertEqualIntA(a, ARCHIVE_OK, archive_write_header(a, ae));
+		archive_entry_free(ae);
+		if (from_fd)
+			assertEqualIntA(a, avail, archive_write_data_from_fd(a,
+			    fd, entries[i].offset, (size_t)entries[i].size));
+		else
+			assertEqualIntA(a, avail, archive_write_data(a,
+			    data + entries[i].offset, avail));
+	}
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+}
+
+DEFINE_TEST(test_write_data_from_fd)
+{
+	static const struct {
+		int format, filter;
+	} tests[] = {
+		{ ARCHIVE_FORMAT_TAR_PAX_RESTRICTED, ARCHIVE_FILTER_NONE },
+		{ ARCHIVE_FORMAT_TAR_USTAR, ARCHIVE_FILTER_NONE },
+		{ ARCHIVE_FORMAT_TAR_GNUTAR, ARCHIVE_FILTER_NONE },
+		{ ARCHIVE_FORMAT_CPIO_SVR4_NOCRC, ARCHIVE_FILTER_NONE },
+		{ ARCHIVE_FORMAT_CPIO_POSIX, ARCHIVE_FILTER_NONE },
+		/* The data has to go through a filter or format. */
+		{ ARCHIVE_FORMAT_TAR_USTAR, ARCHIVE_FILTER_COMPRESS },
+		{ ARCHIVE_FORMAT_ZIP, ARCHIVE_FILTER_NONE },
+	};
+	unsigned char *data;
+	char name[32], ref[32];
+	size_t i;
+	int fd;
+
+	assert((data = malloc(DATA_SIZE)) != NULL);
+	if (data == NULL)
+		return;
+	for (i = 0; i < DATA_SIZE; i++)
+		data[i] = (unsigned char)(i * 13 + (i >> 8));
+	assertMakeBinFile("data", 0644, DATA_SIZE, data);
+	fd = open("data", O_RDONLY | O_BINARY);
+	assert(fd >= 0);
+
+	for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+		snprintf(name, sizeof(name), "fd%d", (int)i);
+		write_archive(name, tests[i].format, tests[i].filter, 1,
+		    data, fd);
+		snprintf(ref, sizeof(ref), "mem%d", (int)i);
+		write_archive(ref, tests[i].format, tests[i].filter, 0,
+		    data, fd);
+		failure("test %d", (int)i);
+		assertEqualFile(name, ref);
+	}
+	close(fd);
+	free(data);
+}
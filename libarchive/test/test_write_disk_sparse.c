@@ -25,6 +25,52 @@
 #include "test.h"
 __FBSDID("$FreeBSD: head/lib/libarchive/test/test_write_disk_sparse.c 201247 2009-12-30 05:59:21Z kientzle $");
 
+/*
+ * Non-zero if space can be reserved for a file here the way
+ * ARCHIVE_EXTRACT_PREALLOCATE does it.
+ */
+static int
+can_preallocate(void)
+{
+#if defined(HAVE_FALLOCATE) || defined(HAVE_POSIX_FALLOCATE)
+	struct stat st;
+	int fd, r;
+
+	fd = open("test_preallocate", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return (0);
+#if defined(HAVE_FALLOCATE)
+	r = fallocate(fd, 0, 0, 512 * 1024);
+#else
+	r = posix_fallocate(fd, 0, 512 * 1024);
+#endif
+	r = r == 0 && fstat(fd, &st) == 0 &&
+	    (int64_t)st.st_blocks * 512 >= 512 * 1024;
+	close(fd);
+	unlink("test_preallocate");
+	return (r);
+#else
+	return (0);
+#endif
+}
+
+/*
+ * With ARCHIVE_EXTRACT_PREALLOCATE, the space of a file that is not
+ * extracted sparse is reserved as soon as its header is written.
+ */
+static void
+verify_preallocated(const char *pathname, int64_t size, int prealloc)
+{
+	struct stat st;
+
+	if (!prealloc)
+		return;
+	assert(0 == stat(pathname, &st));
+	failure("%s: %jd blocks reserved", pathname,
+	    (intmax_t)st.st_blocks);
+	assert((int64_t)st.st_blocks * 512 >= size);
+}
+
 /*
  * Write a file using archive_write_data call, read the file
  * back and verify the contents.  The data written includes large
@@ -32,7 +78,7 @@ __FBSDID("$FreeBSD: head/lib/libarchive/test/test_write_disk_sparse.c 201247 200
  * if ARCHIVE_EXTRACT_SPARSE is enabled.
  */
 static void
-verify_write_data(struct archive *a, int sparse)
+verify_write_data(struct archive *a, int sparse, int prealloc)
 {
 	static const char data[]="abcdefghijklmnopqrstuvwxyz";
 	struct stat st;
@@ -53,6 +99,7 @@ verify_write_data(struct archive *a, int sparse)
 	archive_entry_set_pathname(ae, "test_write_data");
 	archive_entry_set_mode(ae, AE_IFREG | 0755);
 	assertEqualIntA(a, 0, archive_write_header(a, ae));
+	verify_preallocated("test_write_data", 8 * buff_size, prealloc);
 
 	/* Use archive_write_data() to write three relatively sparse blocks. */
 
@@ -129,7 +176,7 @@ verify_write_data(struct archive *a, int sparse)
  * As above, but using the archive_write_data_block() call.
  */
 static void
-verify_write_data_block(struct archive *a, int sparse)
+verify_write_data_block(struct archive *a, int sparse, int prealloc)
 {
 	static const char data[]="abcdefghijklmnopqrstuvwxyz";
 	struct stat st;
@@ -150,6 +197,8 @@ verify_write_data_block(struct archive *a, int sparse)
 	archive_entry_set_pathname(ae, "test_write_data_block");
 	archive_entry_set_mode(ae, AE_IFREG | 0755);
 	assertEqualIntA(a, 0, archive_write_header(a, ae));
+	verify_preallocated("test_write_data_block", 8 * buff_size,
+	    prealloc);
 
 	/* Use archive_write_data_block() to write three
 	   relatively sparse blocks. */
@@ -266,6 +315,7 @@ verify_write_data_block(struct archive *a, int sparse)
 DEFINE_TEST(test_write_disk_sparse)
 {
 	struct archive *ad;
+	int prealloc;
 
 
 	/*
@@ -277,14 +327,33 @@ DEFINE_TEST(test_write_disk_sparse)
 	 */
 	assert((ad = archive_write_disk_new()) != NULL);
         archive_write_disk_set_options(ad, 0);
-	verify_write_data(ad, 0);
-	verify_write_data_block(ad, 0);
+	verify_write_data(ad, 0, 0);
+	verify_write_data_block(ad, 0, 0);
 	assertEqualInt(0, archive_write_free(ad));
 
 	assert((ad = archive_write_disk_new()) != NULL);
         archive_write_disk_set_options(ad, ARCHIVE_EXTRACT_SPARSE);
-	verify_write_data(ad, 1);
-	verify_write_data_block(ad, 1);
+	verify_write_data(ad, 1, 0);
+	verify_write_data_block(ad, 1, 0);
+	assertEqualInt(0, archive_write_free(ad));
+
+	/* Nor whether the space is reserved and written with pwrite(). */
+	prealloc = can_preallocate();
+	if (!prealloc) {
+		skipping("Space can't be reserved on this filesystem;"
+		    " not checking ARCHIVE_EXTRACT_PREALLOCATE reserves it");
+	}
+	assert((ad = archive_write_disk_new()) != NULL);
+        archive_write_disk_set_options(ad, ARCHIVE_EXTRACT_PREALLOCATE);
+	verify_write_data(ad, 0, prealloc);
+	verify_write_data_block(ad, 0, prealloc);
+	assertEqualInt(0, archive_write_free(ad));
+
+	assert((ad = archive_write_disk_new()) != NULL);
+        archive_write_disk_set_options(ad,
+	    ARCHIVE_EXTRACT_PREALLOCATE | ARCHIVE_EXTRACT_SPARSE);
+	verify_write_data(ad, 1, 0);
+	verify_write_data_block(ad, 1, 0);
 	assertEqualInt(0, archive_write_free(ad));
 
 }
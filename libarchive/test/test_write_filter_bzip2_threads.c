@@ -0,0 +1,142 @@
+/*-
+ * Copyright (c) 2026 The libarchive developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "test.h"
+
+/*
+ * Compress with several threads and make sure the concatenated
+ * streams decompress to the input, with and without threads on the
+ * reading side.
+ */
+
+static void
+verify(const char *buff, size_t used, const char *data, size_t datasize,
+    const char *threads)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	char *rbuff;
+
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_all(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_filter_all(a));
+	if (threads != NULL)
+		assertEqualIntA(a, ARCHIVE_OK,
+		    archive_read_set_filter_option(a, "bzip2", "threads",
+		    threads));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_open_memory(a, buff, used));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	assertEqualString("file", archive_entry_pathname(ae));
+	assertEqualInt(datasize, archive_entry_size(ae));
+	assert(NULL != (rbuff = (char *)malloc(datasize + 1)));
+	assertEqualInt(datasize, archive_read_data(a, rbuff, datasize));
+	assertEqualMem(data, rbuff, datasize);
+	free(rbuff);
+	assertEqualIntA(a, ARCHIVE_EOF, archive_read_next_header(a, &ae));
+	assertEqualInt(ARCHIVE_FILTER_BZIP2, archive_filter_code(a, 0));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+}
+
+static void
+test_size(size_t datasize, const char *threads)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	char *buff, *data;
+	size_t buffsize, used;
+	int r;
+
+	buffsize = datasize + 100000;
+	assert(NULL != (buff = (char *)malloc(buffsize)));
+	assert(NULL != (data = (char *)malloc(datasize + 1)));
+	fill_with_words_seed(1, data, datasize);
+
+	assert((a = archive_write_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_format_ustar(a));
+	r = archive_write_add_filter_bzip2(a);
+	if (r != ARCHIVE_OK) {
+		skipping("bzip2 writing not supported on this platform");
+		assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+		free(buff);
+		free(data);
+		return;
+	}
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_set_bytes_in_last_block(a, 1));
+	/* Small blocks give us many streams to work with. */
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_set_filter_option(a, "bzip2", "compression-level",
+	    "1"));
+	if (threads != NULL)
+		assertEqualIntA(a, ARCHIVE_OK,
+		    archive_write_set_filter_option(a, "bzip2", "threads",
+		    threads));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_open_memory(a, buff, buffsize, &used));
+	assert((ae = archive_entry_new()) != NULL);
+	archive_entry_copy_pathname(ae, "file");
+	archive_entry_set_filetype(ae, AE_IFREG);
+	archive_entry_set_size(ae, datasize);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_header(a, ae));
+	archive_entry_free(ae);
+	assertEqualInt(datasize, archive_write_data(a, data, datasize));
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+
+	verify(buff, used, data, datasize, NULL);
+	verify(buff, used, data, datasize, "4");
+
+	if (canBzip2()) {
+		char name[64];
+
+		snprintf(name, sizeof(name), "threads%s_%d.tar.bz2",
+		    threads != NULL ? threads : "", (int)datasize);
+		assertMakeBinFile(name, 0644, (int)used, buff);
+		assertEqualInt(0, systemf("bzip2 -t %s", name));
+	}
+
+	free(buff);
+	free(data);
+}
+
+DEFINE_TEST(test_write_filter_bzip2_threads)
+{
+	struct archive *a;
+
+	test_size(0, "4");
+	test_size(1000, "4");
+	test_size(2 * 1024 * 1024 + 12345, "4");
+	test_size(2 * 1024 * 1024 + 12345, "0");
+	/* A single stream with many blocks exercises splitting at
+	 * unaligned block boundaries on the reading side. */
+	test_size(2 * 1024 * 1024 + 12345, NULL);
+
+	/* Invalid values are rejected. */
+	assert((a = archive_write_new()) != NULL);
+	assert(archive_write_add_filter_bzip2(a) >= ARCHIVE_WARN);
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_write_set_filter_option(a, NULL, "threads", "many"));
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+}
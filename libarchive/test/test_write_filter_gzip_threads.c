@@ -0,0 +1,165 @@
+/*-
+ * Copyright (c) 2026 The libarchive developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "test.h"
+
+/*
+ * Compress with several threads and make sure the chunks stitch
+ * together into one gzip stream that decompresses to the input.  With
+ * "bgzf" they are BGZF members instead, which a reader with several
+ * threads decompresses in parallel.
+ */
+
+static void
+test_size(size_t datasize, const char *threads, int bgzf)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	char *buff, *data, *rbuff;
+	size_t buffsize, used, member;
+	int r, pass;
+
+	buffsize = datasize + 100000;
+	assert(NULL != (buff = (char *)malloc(buffsize)));
+	assert(NULL != (data = (char *)malloc(datasize + 1)));
+	fill_with_words_seed(1, data, datasize);
+
+	assert((a = archive_write_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_format_ustar(a));
+	r = archive_write_add_filter_gzip(a);
+	if (r != ARCHIVE_OK) {
+		skipping("gzip writing not supported on this platform");
+		assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+		free(buff);
+		free(data);
+		return;
+	}
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_set_bytes_in_last_block(a, 1));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_set_filter_option(a, "gzip", "threads", threads));
+	if (bgzf)
+		assertEqualIntA(a, ARCHIVE_OK,
+		    archive_write_set_filter_option(a, "gzip", "bgzf", "1"));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_open_memory(a, buff, buffsize, &used));
+	assert((ae = archive_entry_new()) != NULL);
+	archive_entry_copy_pathname(ae, "file");
+	archive_entry_set_filetype(ae, AE_IFREG);
+	archive_entry_set_size(ae, datasize);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_header(a, ae));
+	archive_entry_free(ae);
+	assertEqualInt(datasize, archive_write_data(a, data, datasize));
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+
+	if (!bgzf) {
+		/* A single gzip member. */
+		assertEqualInt(0x1f, (unsigned char)buff[0]);
+		assertEqualInt(0x8b, (unsigned char)buff[1]);
+		assertEqualInt(0x08, (unsigned char)buff[2]);
+	} else {
+		/* Members that each give their size, up to the empty
+		 * one at the end. */
+		for (member = 0; member + 18 <= used; ) {
+			const unsigned char *p =
+			    (const unsigned char *)buff + member;
+
+			assertEqualInt(0x1f, p[0]);
+			assertEqualInt(0x8b, p[1]);
+			assertEqualInt(0x04, p[3]);
+			if (!assertEqualMem(p + 12, "BC", 2))
+				break;
+			member += (p[16] | (p[17] << 8)) + 1;
+		}
+		assertEqualInt(used, member);
+		assert(used >= 28);
+		assertEqualMem(buff + used - 28,
+		    "\x1f\x8b\x08\x04\0\0\0\0\0\xff\x06\0BC\x02\0"
+		    "\x1b\0\x03\0\0\0\0\0\0\0\0\0", 28);
+	}
+
+	/* Read back on one thread and, with the BGZF members, on four. */
+	for (pass = 0; pass < 1 + bgzf; pass++) {
+		assert((a = archive_read_new()) != NULL);
+		assertEqualIntA(a, ARCHIVE_OK,
+		    archive_read_support_format_all(a));
+		assertEqualIntA(a, ARCHIVE_OK,
+		    archive_read_support_filter_all(a));
+		if (pass > 0)
+			assertEqualIntA(a, ARCHIVE_OK,
+			    archive_read_set_filter_option(a, "gzip",
+			    "threads", "4"));
+		assertEqualIntA(a, ARCHIVE_OK,
+		    archive_read_open_memory(a, buff, used));
+		assertEqualIntA(a, ARCHIVE_OK,
+		    archive_read_next_header(a, &ae));
+		assertEqualString("file", archive_entry_pathname(ae));
+		assertEqualInt(datasize, archive_entry_size(ae));
+		assert(NULL != (rbuff = (char *)malloc(datasize + 1)));
+		assertEqualInt(datasize,
+		    archive_read_data(a, rbuff, datasize));
+		assertEqualMem(data, rbuff, datasize);
+		free(rbuff);
+		assertEqualIntA(a, ARCHIVE_EOF,
+		    archive_read_next_header(a, &ae));
+		assertEqualInt(ARCHIVE_FILTER_GZIP,
+		    archive_filter_code(a, 0));
+		assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+	}
+
+	/* Our reader doesn't check the trailer; let gzip do that. */
+	if (canGzip()) {
+		char name[64];
+
+		snprintf(name, sizeof(name), "threads%s_%d%s.tar.gz",
+		    threads, (int)datasize, bgzf ? "_bgzf" : "");
+		assertMakeBinFile(name, 0644, (int)used, buff);
+		assertEqualInt(0, systemf("gzip -t %s", name));
+	}
+
+	free(buff);
+	free(data);
+}
+
+DEFINE_TEST(test_write_filter_gzip_threads)
+{
+	struct archive *a;
+
+	test_size(0, "4", 0);
+	test_size(1000, "4", 0);
+	test_size(3 * 1024 * 1024 + 12345, "4", 0);
+	test_size(3 * 1024 * 1024 + 12345, "0", 0);
+	test_size(0, "4", 1);
+	test_size(1000, "1", 1);
+	test_size(3 * 1024 * 1024 + 12345, "4", 1);
+	test_size(3 * 1024 * 1024 + 12345, "1", 1);
+
+	/* Invalid values are rejected. */
+	assert((a = archive_write_new()) != NULL);
+	assert(archive_write_add_filter_gzip(a) >= ARCHIVE_WARN);
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_write_set_filter_option(a, NULL, "threads", "many"));
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+}
@@ -0,0 +1,211 @@
+/*-
+ * Copyright (c) 2026 The libarchive developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "test.h"
+
+/*
+ * Write a mix of entries with the "threads" and "solid-block-size"
+ * options and read them back.
+ */
+
+#define NFILES	30
+#define BIG	(5 * 1024 * 1024)
+
+static size_t
+file_size(int i)
+{
+	/* One file spans several LZMA2 chunks at level 1. */
+	if (i == NFILES / 2)
+		return (BIG);
+	return ((size_t)(i + 1) * 7919);
+}
+
+static int
+write_archive(const char *compression, const char *threads,
+    const char *solid, char *buff, size_t buffsize, size_t *used,
+    char *data)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	char name[64];
+	size_t size;
+	int i;
+
+	assert((a = archive_write_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_format_7zip(a));
+	if (archive_write_set_format_option(a, "7zip", "compression",
+	    compression) != ARCHIVE_OK) {
+		assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+		return (0);
+	}
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_format_option(
+	    a, "7zip", "compression-level", "1"));
+	if (threads != NULL)
+		assertEqualIntA(a, ARCHIVE_OK, archive_write_set_format_option(
+		    a, "7zip", "threads", threads));
+	if (solid != NULL)
+		assertEqualIntA(a, ARCHIVE_OK, archive_write_set_format_option(
+		    a, "7zip", "solid-block-size", solid));
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_add_filter_none(a));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_open_memory(a, buff, buffsize, used));
+
+	assert((ae = archive_entry_new()) != NULL);
+	archive_entry_copy_pathname(ae, "dir");
+	archive_entry_set_mode(ae, AE_IFDIR | 0755);
+	archive_entry_set_mtime(ae, 1000000000, 0);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_header(a, ae));
+	archive_entry_free(ae);
+
+	assert((ae = archive_entry_new()) != NULL);
+	archive_entry_copy_pathname(ae, "dir/link");
+	archive_entry_set_mode(ae, AE_IFLNK | 0755);
+	archive_entry_copy_symlink(ae, "file0");
+	archive_entry_set_mtime(ae, 1000000000, 0);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_header(a, ae));
+	archive_entry_free(ae);
+
+	assert((ae = archive_entry_new()) != NULL);
+	archive_entry_copy_pathname(ae, "dir/empty");
+	archive_entry_set_mode(ae, AE_IFREG | 0644);
+	archive_entry_set_size(ae, 0);
+	archive_entry_set_mtime(ae, 1000000000, 0);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_header(a, ae));
+	archive_entry_free(ae);
+
+	for (i = 0; i < NFILES; i++) {
+		size = file_size(i);
+		fill_with_words_seed(i, data, size);
+		snprintf(name, sizeof(name), "dir/file%d", i);
+		assert((ae = archive_entry_new()) != NULL);
+		archive_entry_copy_pathname(ae, name);
+		archive_entry_set_mode(ae, AE_IFREG | 0644);
+		archive_entry_set_size(ae, size);
+		archive_entry_set_mtime(ae, 1000000000, 0);
+		assertEqualIntA(a, ARCHIVE_OK, archive_write_header(a, ae));
+		archive_entry_free(ae);
+		assertEqualInt(size, archive_write_data(a, data, size));
+	}
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+	return (1);
+}
+
+static void
+verify(const char *buff, size_t used, char *data, char *rbuff)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	char name[64];
+	size_t size;
+	int i;
+
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_7zip(a));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_open_memory(a, buff, used));
+	/* Files with data come first, then empty files and directories. */
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	assertEqualString("dir/link", archive_entry_pathname(ae));
+	assertEqualString("file0", archive_entry_symlink(ae));
+	for (i = 0; i < NFILES; i++) {
+		size = file_size(i);
+		fill_with_words_seed(i, data, size);
+		snprintf(name, sizeof(name), "dir/file%d", i);
+		assertEqualIntA(a, ARCHIVE_OK,
+		    archive_read_next_header(a, &ae));
+		assertEqualString(name, archive_entry_pathname(ae));
+		assertEqualInt(size, archive_entry_size(ae));
+		assertEqualInt(size, archive_read_data(a, rbuff, size));
+		assertEqualMem(data, rbuff, size);
+	}
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	assertEqualString("dir/empty", archive_entry_pathname(ae));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	assertEqualString("dir/", archive_entry_pathname(ae));
+	assertEqualIntA(a, ARCHIVE_EOF, archive_read_next_header(a, &ae));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+}
+
+DEFINE_TEST(test_write_format_7zip_threads)
+{
+	struct archive *a;
+	char *buff, *data, *rbuff;
+	size_t buffsize, used, used_serial;
+
+	buffsize = 2 * BIG + NFILES * file_size(NFILES);
+	assert(NULL != (buff = (char *)malloc(buffsize)));
+	assert(NULL != (rbuff = (char *)malloc(buffsize)));
+	assert(NULL != (data = (char *)malloc(BIG)));
+
+	/*
+	 * Folders of a deflate archive are compressed whole, so the
+	 * threads do not change the result.
+	 */
+	if (!write_archive("deflate", NULL, "64K", rbuff, buffsize,
+	    &used_serial, data)) {
+		skipping("Deflate compression not supported");
+	} else {
+		assert(write_archive("deflate", "4", "64K", buff, buffsize,
+		    &used, data));
+		assertEqualInt(used_serial, used);
+		assertEqualMem(rbuff, buff, used);
+		verify(buff, used, data, rbuff);
+	}
+
+	/* LZMA2 data is split into chunks even in a single folder. */
+	if (!write_archive("lzma2", "3", NULL, buff, buffsize, &used,
+	    data)) {
+		skipping("LZMA2 compression not supported");
+	} else {
+		verify(buff, used, data, rbuff);
+		assert(write_archive("lzma2", "3", "1M", buff, buffsize,
+		    &used, data));
+		verify(buff, used, data, rbuff);
+	}
+
+	/* PPMd and bzip2 go through the same job code. */
+	if (write_archive("bzip2", "2", "100K", buff, buffsize, &used,
+	    data))
+		verify(buff, used, data, rbuff);
+	assert(write_archive("ppmd", "2", "100K", buff, buffsize, &used,
+	    data));
+	verify(buff, used, data, rbuff);
+
+	/* Invalid values are rejected. */
+	assert((a = archive_write_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_format_7zip(a));
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_write_set_format_option(a, NULL, "threads", "many"));
+	assertEqualIntA(a, ARCHIVE_FAILED, archive_write_set_format_option(
+	    a, NULL, "solid-block-size", "12Q"));
+	/* 2^64 bytes, which does not fit. */
+	assertEqualIntA(a, ARCHIVE_FAILED, archive_write_set_format_option(
+	    a, NULL, "solid-block-size", "17179869184G"));
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+
+	free(data);
+	free(rbuff);
+	free(buff);
+}
@@ -0,0 +1,248 @@
+/*-
+ * Copyright (c) 2026 The libarchive developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "test.h"
+
+/*
+ * Formats that write a header or table of contents in front of the
+ * file data write the data straight to a seekable output and fill in
+ * the header at close.  Write enough data to a file for each of them
+ * to leave its temporary file behind, and read it back.
+ *
+ * Many entries with long names after that make the header outgrow the
+ * room left for it in front of the data, which has to move back, unless
+ * an option leaves enough room.  The same entries written first size
+ * the room themselves.
+ */
+
+#define NFILES	5
+#define BIG	(17 * 1024 * 1024)
+#define NAMELEN	200
+
+static size_t
+file_size(int i)
+{
+	if (i == NFILES / 2)
+		return (BIG);
+	return ((size_t)(i + 1) * 7919);
+}
+
+/* A name no other entry shares, that does not compress well. */
+static void
+long_name(char *path, int i)
+{
+	char prefix[8];
+	int n;
+
+	fill_with_pseudorandom_data_seed(i + 1, path, NAMELEN);
+	for (n = 0; n < NAMELEN; n++)
+		path[n] = 'a' + (unsigned char)path[n] % 26;
+	snprintf(prefix, sizeof(prefix), "m%05d_", i);
+	memcpy(path, prefix, 7);
+	path[NAMELEN] = '\0';
+}
+
+static void
+add_many(struct archive *a, int first, int n)
+{
+	struct archive_entry *ae;
+	char path[NAMELEN + 1];
+	int i;
+
+	for (i = first; i < first + n; i++) {
+		long_name(path, i);
+		assert((ae = archive_entry_new()) != NULL);
+		archive_entry_copy_pathname(ae, path);
+		archive_entry_set_mode(ae, AE_IFREG | 0644);
+		archive_entry_set_size(ae, 0);
+		archive_entry_set_mtime(ae, 1000000000, 0);
+		assertEqualIntA(a, ARCHIVE_OK, archive_write_header(a, ae));
+		archive_entry_free(ae);
+	}
+}
+
+/*
+ * Write nbefore entries with long names, the files, and nafter more
+ * entries with long names.  If data_offset is not 0, the data of the
+ * first file is expected there, in front of where the header ends.
+ */
+static void
+write_read(const char *format, const char *options, const char *name,
+    int nbefore, int nafter, size_t data_offset)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	struct stat st;
+	char *data, *rbuff;
+	char path[NAMELEN + 1];
+	size_t size;
+	int i, n, seen, many;
+
+	assert(NULL != (data = malloc(BIG)));
+	assert(NULL != (rbuff = malloc(BIG)));
+
+	assert((a = archive_write_new()) != NULL);
+	if (archive_write_set_format_by_name(a, format) != ARCHIVE_OK) {
+		skipping("%s writer is not supported on this platform",
+		    format);
+		assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+		free(data);
+		free(rbuff);
+		return;
+	}
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_options(a, options));
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_add_filter_none(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_open_filename(a, name));
+	add_many(a, 0, nbefore);
+	for (i = 0; i < NFILES; i++) {
+		size = file_size(i);
+		fill_with_pseudorandom_data_seed(i, data, size);
+		snprintf(path, sizeof(path), "file%d", i);
+		assert((ae = archive_entry_new()) != NULL);
+		archive_entry_copy_pathname(ae, path);
+		archive_entry_set_mode(ae, AE_IFREG | 0644);
+		archive_entry_set_size(ae, size);
+		archive_entry_set_mtime(ae, 1000000000, 0);
+		assertEqualIntA(a, ARCHIVE_OK, archive_write_header(a, ae));
+		archive_entry_free(ae);
+		assertEqualInt(size, archive_write_data(a, data, size));
+	}
+	add_many(a, nbefore, nafter);
+	/* The data went straight to the output, not to a temporary
+	 * file that is copied there at close. */
+	assertEqualInt(0, stat(name, &st));
+	assert(st.st_size >= BIG);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+
+	if (data_offset != 0) {
+		FILE *f;
+
+		/* The header fit in the room left for it; the data did
+		 * not move. */
+		size = file_size(0);
+		fill_with_pseudorandom_data_seed(0, data, size);
+		assert(NULL != (f = fopen(name, "rb")));
+		if (f != NULL) {
+			assertEqualInt(0, fseek(f, (long)data_offset, SEEK_SET));
+			assertEqualInt(size, fread(rbuff, 1, size, f));
+			assertEqualMem(data, rbuff, size);
+			fclose(f);
+		}
+	}
+
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_all(a));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_open_filename(a, name, 10240));
+	seen = 0;
+	many = 0;
+	while (archive_read_next_header(a, &ae) == ARCHIVE_OK) {
+		if (archive_entry_filetype(ae) != AE_IFREG)
+			continue;
+		if (sscanf(archive_entry_pathname(ae), "m%d", &i) == 1) {
+			long_name(path, i);
+			assertEqualString(path, archive_entry_pathname(ae));
+			assertEqualInt(0, archive_entry_size(ae));
+			many++;
+			continue;
+		}
+		if (sscanf(archive_entry_pathname(ae), "file%d", &i) != 1 ||
+		    i < 0 || i >= NFILES) {
+			failure("Unexpected entry %s",
+			    archive_entry_pathname(ae));
+			assert(0);
+			continue;
+		}
+		seen |= 1 << i;
+		size = file_size(i);
+		fill_with_pseudorandom_data_seed(i, data, size);
+		assertEqualInt(size, archive_entry_size(ae));
+		for (n = 0; (size_t)n < size; ) {
+			ssize_t r = archive_read_data(a, rbuff + n, size - n);
+			if (r <= 0)
+				break;
+			n += (int)r;
+		}
+		assertEqualInt(size, n);
+		assertEqualMem(data, rbuff, size);
+	}
+	assertEqualInt((1 << NFILES) - 1, seen);
+	assertEqualInt(nbefore + nafter, many);
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+	free(data);
+	free(rbuff);
+}
+
+DEFINE_TEST(test_write_format_7zip_in_place)
+{
+	write_read("7zip", "7zip:compression=store", "test.7z", 0, 0, 0);
+}
+
+DEFINE_TEST(test_write_format_iso9660_in_place)
+{
+	write_read("iso9660", "", "test.iso", 0, 0, 0);
+}
+
+DEFINE_TEST(test_write_format_iso9660_in_place_move)
+{
+	/* Directory records past the 2 MiB left for them. */
+	write_read("iso9660", "", "test.iso", 0, 6000, 0);
+}
+
+DEFINE_TEST(test_write_format_iso9660_in_place_reserve)
+{
+	/* The contents start at the room asked for. */
+	write_read("iso9660", "iso9660:metadata-reserve=8388608", "test.iso",
+	    0, 6000, 8388608);
+}
+
+DEFINE_TEST(test_write_format_iso9660_in_place_estimate)
+{
+	write_read("iso9660", "", "test.iso", 6000, 0, 0);
+}
+
+DEFINE_TEST(test_write_format_xar_in_place)
+{
+	write_read("xar", "xar:compression=none", "test.xar", 0, 0, 0);
+}
+
+DEFINE_TEST(test_write_format_xar_in_place_move)
+{
+	/* A TOC that deflates to more than the 256 KiB left for it. */
+	write_read("xar", "xar:compression=none", "test.xar", 0, 3000, 0);
+}
+
+DEFINE_TEST(test_write_format_xar_in_place_reserve)
+{
+	/* The heap starts behind the 28-byte header and the room asked
+	 * for, with the SHA1 checksum of the TOC. */
+	write_read("xar", "xar:compression=none,xar:toc-reserve=1048576",
+	    "test.xar", 0, 3000, 28 + 1048576 + 20);
+}
+
+DEFINE_TEST(test_write_format_xar_in_place_estimate)
+{
+	write_read("xar", "xar:compression=none", "test.xar", 3000, 0, 0);
+}
@@ -0,0 +1,178 @@
+/*-
+ * Copyright (c) 2026 The libarchive developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "test.h"
+
+/*
+ * Compress zisofs blocks on worker threads and check the image is
+ * laid out exactly as one compressed by the calling thread.
+ */
+
+#define NFILES	6
+
+static const unsigned char zisofs_magic[8] = {
+    0x37, 0xE4, 0x53, 0x96, 0xC9, 0xDB, 0xD6, 0x07
+};
+
+static size_t
+file_size(int i)
+{
+	return ((size_t)(i + 1) * 50000 + i * 7);
+}
+
+static void
+fill(char *data, size_t size, int i)
+{
+	/* Half the files are incompressible. */
+	if (i & 1)
+		fill_with_pseudorandom_data_seed(i, data, size);
+	else
+		fill_with_words_seed(i, data, size);
+	/* A full block of zeros, which zisofs does not store. */
+	if (i == 2)
+		memset(data + 32768, 0, 32768);
+	/* A short last block of zeros. */
+	if (i == 4)
+		memset(data + size - 1000, 0, 1000);
+}
+
+static int
+write_image(const char *threads, char *buff, size_t buffsize, size_t *used,
+    char *data)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	char name[16];
+	size_t size, off, n;
+	int i;
+
+	assert((a = archive_write_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_format_iso9660(a));
+	if (archive_write_set_option(a, NULL, "zisofs", "1") != ARCHIVE_OK) {
+		assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+		return (0);
+	}
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_set_option(a, NULL, "zisofs-threads", threads));
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_add_filter_none(a));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_open_memory(a, buff, buffsize, used));
+	for (i = 0; i < NFILES; i++) {
+		size = file_size(i);
+		fill(data, size, i);
+		snprintf(name, sizeof(name), "file%d", i);
+		assert((ae = archive_entry_new()) != NULL);
+		archive_entry_copy_pathname(ae, name);
+		archive_entry_set_mode(ae, AE_IFREG | 0644);
+		archive_entry_set_size(ae, size);
+		archive_entry_set_mtime(ae, 1000000000, 0);
+		assertEqualIntA(a, ARCHIVE_OK, archive_write_header(a, ae));
+		archive_entry_free(ae);
+		/* Feed the data in pieces that do not match the blocks. */
+		for (off = 0; off < size; off += n) {
+			n = size - off;
+			if (n > 10000)
+				n = 10000;
+			assertEqualInt(n, archive_write_data(a, data + off, n));
+		}
+	}
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+	return (1);
+}
+
+static size_t
+first_data(const char *buff, size_t used)
+{
+	size_t off;
+
+	for (off = 0; off + sizeof(zisofs_magic) <= used; off += 2048)
+		if (memcmp(buff + off, zisofs_magic,
+		    sizeof(zisofs_magic)) == 0)
+			return (off);
+	return (used);
+}
+
+DEFINE_TEST(test_write_format_iso9660_zisofs_threads)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	char *buff, *buff2, *data, *rbuff;
+	size_t buffsize, used, used2, size, off;
+	ssize_t r;
+	int i;
+
+	buffsize = 2 * 1024 * 1024;
+	assert(NULL != (buff = malloc(buffsize)));
+	assert(NULL != (buff2 = malloc(buffsize)));
+	assert(NULL != (data = malloc(file_size(NFILES))));
+	assert(NULL != (rbuff = malloc(file_size(NFILES))));
+
+	if (!write_image("1", buff, buffsize, &used, data)) {
+		skipping("zisofs option not supported on this platform");
+		goto done;
+	}
+	assert(write_image("3", buff2, buffsize, &used2, data));
+
+	/*
+	 * The volume descriptors and directories carry the time the
+	 * image was made; everything from the first file on must match.
+	 */
+	assertEqualInt(used, used2);
+	off = first_data(buff, used);
+	assert(off < used);
+	assertEqualInt(off, first_data(buff2, used2));
+	assertEqualMem(buff + off, buff2 + off, used - off);
+
+	/* Read the files back. */
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_all(a));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_open_memory(a, buff2, used2));
+	for (i = 0; i < NFILES; i++) {
+		assertEqualIntA(a, ARCHIVE_OK,
+		    archive_read_next_header(a, &ae));
+		if (archive_entry_filetype(ae) == AE_IFDIR) {
+			i--;
+			continue;
+		}
+		size = file_size(i);
+		fill(data, size, i);
+		assertEqualInt(size, archive_entry_size(ae));
+		for (off = 0; off < size; off += r) {
+			r = archive_read_data(a, rbuff + off, size - off);
+			if (r <= 0)
+				break;
+		}
+		assertEqualInt(size, off);
+		assertEqualMem(data, rbuff, size);
+	}
+	assertEqualIntA(a, ARCHIVE_EOF, archive_read_next_header(a, &ae));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+done:
+	free(buff);
+	free(buff2);
+	free(data);
+	free(rbuff);
+}
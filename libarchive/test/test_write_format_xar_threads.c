@@ -0,0 +1,190 @@
+/*-
+ * Copyright (c) 2026 The libarchive developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "test.h"
+
+/*
+ * Compress and checksum xar entries on worker threads and check the
+ * heap is laid out exactly as one written by the calling thread.
+ */
+
+#define NFILES	8
+
+static size_t
+file_size(int i)
+{
+	/* file3 is empty. */
+	if (i == 3)
+		return (0);
+	return ((size_t)(i + 1) * 30000 + i * 7);
+}
+
+static void
+fill(char *data, size_t size, int i)
+{
+	/* Half the files are incompressible. */
+	if (i & 1)
+		fill_with_pseudorandom_data_seed(i, data, size);
+	else
+		fill_with_words_seed(i, data, size);
+}
+
+static int
+write_xar(const char *compression, const char *threads, char *buff,
+    size_t buffsize, size_t *used, char *data)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	char name[16];
+	size_t size, off, n;
+	int i;
+
+	assert((a = archive_write_new()) != NULL);
+	if (archive_write_set_format_xar(a) != ARCHIVE_OK ||
+	    archive_write_set_option(a, "xar", "compression",
+	    compression) != ARCHIVE_OK) {
+		assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+		return (0);
+	}
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_set_option(a, "xar", "threads", threads));
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_add_filter_none(a));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_open_memory(a, buff, buffsize, used));
+	for (i = 0; i < NFILES; i++) {
+		size = file_size(i);
+		fill(data, size, i);
+		snprintf(name, sizeof(name), "file%d", i);
+		assert((ae = archive_entry_new()) != NULL);
+		archive_entry_copy_pathname(ae, name);
+		archive_entry_set_mode(ae, AE_IFREG | 0644);
+		archive_entry_set_size(ae, size);
+		archive_entry_set_mtime(ae, 1000000000, 0);
+		/* The xattrs of file5 go to the heap between files. */
+		if (i == 5)
+			archive_entry_xattr_add_entry(ae, "user.data",
+			    "ABCDEFG", 7);
+		assertEqualIntA(a, ARCHIVE_OK, archive_write_header(a, ae));
+		archive_entry_free(ae);
+		for (off = 0; off < size; off += n) {
+			n = size - off;
+			if (n > 10000)
+				n = 10000;
+			assertEqualInt(n, archive_write_data(a, data + off, n));
+		}
+	}
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+	return (1);
+}
+
+/*
+ * Return the offset of the file data in the heap, which follows the
+ * header, the TOC and the SHA1 checksum of the TOC.
+ */
+static size_t
+heap_offset(const char *buff, size_t used)
+{
+	const unsigned char *p = (const unsigned char *)buff;
+	size_t off;
+	int i;
+
+	if (used < 28)
+		return (used);
+	off = ((size_t)p[4] << 8) | p[5];
+	for (i = 0; i < 8; i++)
+		off += (size_t)p[8 + i] << (8 * (7 - i));
+	return (off + 20);
+}
+
+static void
+test_xar_threads(const char *compression, int same_heap)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	char *buff, *buff2, *data, *rbuff;
+	size_t buffsize, used, used2, size, off;
+	ssize_t r;
+	int i;
+
+	buffsize = 2 * 1024 * 1024;
+	assert(NULL != (buff = malloc(buffsize)));
+	assert(NULL != (buff2 = malloc(buffsize)));
+	assert(NULL != (data = malloc(file_size(NFILES))));
+	assert(NULL != (rbuff = malloc(file_size(NFILES))));
+
+	if (!write_xar(compression, "1", buff, buffsize, &used, data)) {
+		skipping("xar %s compression is not supported "
+		    "on this platform", compression);
+		goto done;
+	}
+	assert(write_xar(compression, "3", buff2, buffsize, &used2, data));
+
+	/* The TOC carries the time the archive was made; the file data
+	 * must match. */
+	if (same_heap) {
+		off = heap_offset(buff, used);
+		assert(off < used);
+		assertEqualInt(used - off, used2 - heap_offset(buff2, used2));
+		assertEqualMem(buff + off, buff2 + heap_offset(buff2, used2),
+		    used - off);
+	}
+
+	/* Read the files back. */
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_all(a));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_open_memory(a, buff2, used2));
+	for (i = 0; i < NFILES; i++) {
+		assertEqualIntA(a, ARCHIVE_OK,
+		    archive_read_next_header(a, &ae));
+		size = file_size(i);
+		fill(data, size, i);
+		assertEqualInt(size, archive_entry_size(ae));
+		assertEqualInt(i == 5, archive_entry_xattr_count(ae));
+		for (off = 0; off < size; off += r) {
+			r = archive_read_data(a, rbuff + off, size - off);
+			if (r <= 0)
+				break;
+		}
+		assertEqualInt(size, off);
+		assertEqualMem(data, rbuff, size);
+	}
+	assertEqualIntA(a, ARCHIVE_EOF, archive_read_next_header(a, &ae));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+done:
+	free(buff);
+	free(buff2);
+	free(data);
+	free(rbuff);
+}
+
+DEFINE_TEST(test_write_format_xar_threads)
+{
+	test_xar_threads("none", 1);
+	test_xar_threads("gzip", 1);
+	test_xar_threads("bzip2", 1);
+	/* The xattrs are compressed with the multi-threaded encoder. */
+	test_xar_threads("xz", 0);
+}
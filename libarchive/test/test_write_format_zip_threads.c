@@ -0,0 +1,164 @@
+/*-
+ * Copyright (c) 2026 The libarchive developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "test.h"
+
+/*
+ * Write a mix of entries with the "threads" option and make sure the
+ * archive is the same one a single thread produces.
+ */
+
+#define NFILES	40
+
+static size_t
+file_size(int i)
+{
+	/* One file is over the 16 MiB limit and is written directly. */
+	if (i == NFILES / 2)
+		return (17 * 1024 * 1024);
+	return ((size_t)i * 7919);
+}
+
+static size_t
+write_archive(const char *threads, char *buff, size_t buffsize, char *data)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	char name[64];
+	size_t used, size;
+	int i;
+
+	assert((a = archive_write_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_format_zip(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_add_filter_none(a));
+	if (threads != NULL)
+		assertEqualIntA(a, ARCHIVE_OK, archive_write_set_format_option(
+		    a, "zip", "threads", threads));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_open_memory(a, buff, buffsize, &used));
+
+	assert((ae = archive_entry_new()) != NULL);
+	archive_entry_copy_pathname(ae, "dir/");
+	archive_entry_set_mode(ae, AE_IFDIR | 0755);
+	archive_entry_set_mtime(ae, 1000000000, 0);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_header(a, ae));
+	archive_entry_free(ae);
+
+	assert((ae = archive_entry_new()) != NULL);
+	archive_entry_copy_pathname(ae, "dir/link");
+	archive_entry_set_mode(ae, AE_IFLNK | 0755);
+	archive_entry_copy_symlink(ae, "file0");
+	archive_entry_set_mtime(ae, 1000000000, 0);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_header(a, ae));
+	archive_entry_free(ae);
+
+	for (i = 0; i < NFILES; i++) {
+		/* Switch the method every few entries. */
+		if ((i / 3) % 2)
+			assertEqualIntA(a, ARCHIVE_OK,
+			    archive_write_zip_set_compression_store(a));
+		else
+			assertEqualIntA(a, ARCHIVE_OK,
+			    archive_write_zip_set_compression_deflate(a));
+		size = file_size(i);
+		fill_with_words_seed(i, data, size);
+		snprintf(name, sizeof(name), "dir/file%d", i);
+		assert((ae = archive_entry_new()) != NULL);
+		archive_entry_copy_pathname(ae, name);
+		archive_entry_set_mode(ae, AE_IFREG | 0644);
+		archive_entry_set_size(ae, size);
+		archive_entry_set_mtime(ae, 1000000000, 0);
+		assertEqualIntA(a, ARCHIVE_OK, archive_write_header(a, ae));
+		archive_entry_free(ae);
+		assertEqualInt(size, archive_write_data(a, data, size));
+	}
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+	return (used);
+}
+
+DEFINE_TEST(test_write_format_zip_threads)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	char *buff, *data, *rbuff;
+	size_t buffsize, used, used_serial, size;
+	char name[64];
+	int i;
+
+	assert((a = archive_write_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_format_zip(a));
+	if (archive_write_set_format_option(a, "zip", "compression",
+	    "deflate") != ARCHIVE_OK) {
+		skipping("Deflate compression not supported");
+		assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+		return;
+	}
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+
+	buffsize = 2 * file_size(NFILES / 2) + NFILES * file_size(NFILES);
+	assert(NULL != (buff = (char *)malloc(buffsize)));
+	assert(NULL != (rbuff = (char *)malloc(buffsize)));
+	assert(NULL != (data = (char *)malloc(file_size(NFILES / 2))));
+
+	used_serial = write_archive(NULL, rbuff, buffsize, data);
+	used = write_archive("4", buff, buffsize, data);
+	assertEqualInt(used_serial, used);
+	assertEqualMem(rbuff, buff, used);
+
+	/* Read it back. */
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_zip(a));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_open_memory(a, buff, used));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	assertEqualString("dir/", archive_entry_pathname(ae));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	assertEqualString("dir/link", archive_entry_pathname(ae));
+	assertEqualString("file0", archive_entry_symlink(ae));
+	for (i = 0; i < NFILES; i++) {
+		size = file_size(i);
+		fill_with_words_seed(i, data, size);
+		snprintf(name, sizeof(name), "dir/file%d", i);
+		assertEqualIntA(a, ARCHIVE_OK,
+		    archive_read_next_header(a, &ae));
+		assertEqualString(name, archive_entry_pathname(ae));
+		assertEqualInt(size, archive_entry_size(ae));
+		assertEqualInt(size, archive_read_data(a, rbuff, size));
+		assertEqualMem(data, rbuff, size);
+	}
+	assertEqualIntA(a, ARCHIVE_EOF, archive_read_next_header(a, &ae));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+
+	/* Invalid values are rejected. */
+	assert((a = archive_write_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_format_zip(a));
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_write_set_format_option(a, NULL, "threads", "many"));
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+
+	free(data);
+	free(rbuff);
+	free(buff);
+}
@@ -0,0 +1,162 @@
+/*-
+ * Copyright (c) 2026 The libarchive developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "test.h"
+
+/*
+ * Write zstd (method 93) and xz (method 95) entries and read them back
+ * with both the seeking and the streaming zip readers.
+ */
+
+static void
+verify(const char *buff, size_t used, const char *data, size_t datasize,
+    int streaming)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	char *rbuff;
+
+	assert(NULL != (rbuff = (char *)malloc(datasize)));
+	assert((a = archive_read_new()) != NULL);
+	if (streaming)
+		assertEqualIntA(a, ARCHIVE_OK,
+		    archive_read_support_format_zip_streamable(a));
+	else
+		assertEqualIntA(a, ARCHIVE_OK,
+		    archive_read_support_format_zip_seekable(a));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_open_memory(a, buff, used));
+
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	assertEqualString("known", archive_entry_pathname(ae));
+	assertEqualInt(datasize, archive_read_data(a, rbuff, datasize));
+	assertEqualMem(data, rbuff, datasize);
+
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	assertEqualString("unknown", archive_entry_pathname(ae));
+	assertEqualInt(datasize, archive_read_data(a, rbuff, datasize));
+	assertEqualMem(data, rbuff, datasize);
+
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	assertEqualString("empty", archive_entry_pathname(ae));
+	assertEqualInt(0, archive_read_data(a, rbuff, datasize));
+
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	assertEqualString("dir/", archive_entry_pathname(ae));
+
+	assertEqualIntA(a, ARCHIVE_EOF, archive_read_next_header(a, &ae));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+	free(rbuff);
+}
+
+static void
+test_method(const char *method, int code, const char *level,
+    const char *threads)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	size_t buffsize = 1000000, datasize = 300000, used;
+	char *buff, *data;
+
+	assert((a = archive_write_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_format_zip(a));
+	if (archive_write_set_format_option(a, "zip", "compression", method)
+	    != ARCHIVE_OK) {
+		skipping("%s compression not supported", method);
+		assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+		return;
+	}
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_format_option(a,
+	    "zip", "compression-level", level));
+	if (threads != NULL)
+		assertEqualIntA(a, ARCHIVE_OK, archive_write_set_format_option(
+		    a, "zip", "threads", threads));
+	assert(NULL != (buff = (char *)malloc(buffsize)));
+	assert(NULL != (data = (char *)malloc(datasize)));
+	fill_with_words_seed(1, data, datasize);
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_open_memory(a, buff, buffsize, &used));
+
+	assert((ae = archive_entry_new()) != NULL);
+	archive_entry_copy_pathname(ae, "known");
+	archive_entry_set_mode(ae, AE_IFREG | 0644);
+	archive_entry_set_size(ae, datasize);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_header(a, ae));
+	assertEqualInt(datasize, archive_write_data(a, data, datasize));
+
+	archive_entry_copy_pathname(ae, "unknown");
+	archive_entry_unset_size(ae);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_header(a, ae));
+	assertEqualInt(datasize / 2, archive_write_data(a, data, datasize / 2));
+	assertEqualInt(datasize - datasize / 2, archive_write_data(a,
+	    data + datasize / 2, datasize - datasize / 2));
+
+	archive_entry_copy_pathname(ae, "empty");
+	archive_entry_set_size(ae, 0);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_header(a, ae));
+
+	archive_entry_copy_pathname(ae, "dir/");
+	archive_entry_set_mode(ae, AE_IFDIR | 0755);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_header(a, ae));
+	archive_entry_free(ae);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+
+	/* The first local header records the new method and version 6.3. */
+	assertEqualInt(63, buff[4]);
+	assertEqualInt(code, (unsigned char)buff[8]);
+	/* The data actually got compressed. */
+	assert(used < datasize);
+
+	verify(buff, used, data, datasize, 0);
+	verify(buff, used, data, datasize, 1);
+
+	free(data);
+	free(buff);
+}
+
+DEFINE_TEST(test_write_format_zip_zipx)
+{
+	struct archive *a;
+
+	test_method("zstd", 93, "3", NULL);
+	test_method("zstd", 93, "19", "4");
+	test_method("xz", 95, "6", NULL);
+	test_method("xz", 95, "1", "4");
+
+	/* Out-of-range levels are rejected. */
+	assert((a = archive_write_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_format_zip(a));
+	if (archive_write_set_format_option(a, "zip", "compression", "xz")
+	    == ARCHIVE_OK)
+		assertEqualIntA(a, ARCHIVE_FAILED,
+		    archive_write_set_format_option(a, "zip",
+		    "compression-level", "10"));
+	if (archive_write_set_format_option(a, "zip", "compression", "zstd")
+	    == ARCHIVE_OK)
+		assertEqualIntA(a, ARCHIVE_FAILED,
+		    archive_write_set_format_option(a, "zip",
+		    "compression-level", "100"));
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+}
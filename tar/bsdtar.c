@@ -169,6 +169,7 @@ main(int argc, char **argv)
 	bsdtar->gid = -1;
 	bsdtar->uid = -1;
 	bsdtar->flags = 0;
+	bsdtar->extract_threads = 1;
 	compression = compression2 = '\0';
 	compression_name = compression2_name = NULL;
 	compress_program = NULL;
@@ -358,6 +359,17 @@ main(int argc, char **argv)
 					    "exclude %s\n", vcs_files[t]);
 			}
 			break;
+		case OPTION_EXTRACT_THREADS:
+			errno = 0;
+			tptr = NULL;
+			t = (int)strtol(bsdtar->argument, &tptr, 10);
+			if (errno || t < 0 || *(bsdtar->argument) == '\0' ||
+			    tptr == NULL || *tptr != '\0') {
+				lafe_errc(1, 0, "Invalid argument to "
+				    "--extract-threads");
+			}
+			bsdtar->extract_threads = t;
+			break;
 		case OPTION_FFLAGS:
 			bsdtar->extract_flags |= ARCHIVE_EXTRACT_FFLAGS;
 			bsdtar->readdisk_flags &= ~ARCHIVE_READDISK_NO_FFLAGS;
@@ -57,6 +57,7 @@ struct bsdtar {
 	int		  extract_flags; /* Flags for extract operation */
 	int		  readdisk_flags; /* Flags for read disk operation */
 	int		  strip_components; /* Remove this many leading dirs */
+	int		  extract_threads; /* --extract-threads */
 	int		  gid;  /* --gid */
 	const char	 *gname; /* --gname */
 	int		  uid;  /* --uid */
@@ -141,6 +142,7 @@ enum {
 	OPTION_CLEAR_NOCHANGE_FFLAGS,
 	OPTION_EXCLUDE,
 	OPTION_EXCLUDE_VCS,
+	OPTION_EXTRACT_THREADS,
 	OPTION_FFLAGS,
 	OPTION_FORMAT,
 	OPTION_GID,
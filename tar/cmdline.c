@@ -87,6 +87,7 @@ static const struct bsdtar_option {
 	{ "exclude-from",         1, 'X' },
 	{ "exclude-vcs",	  0, OPTION_EXCLUDE_VCS },
 	{ "extract",              0, 'x' },
+	{ "extract-threads",	  1, OPTION_EXTRACT_THREADS },
 	{ "fast-read",            0, 'q' },
 	{ "fflags",               0, OPTION_FFLAGS },
 	{ "file",                 1, 'f' },
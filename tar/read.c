@@ -232,6 +232,9 @@ read_archive(struct bsdtar *bsdtar, char mode, struct archive *writer)
 		progress_data.archive = a;
 		archive_read_extract_set_progress_callback(a, progress_func,
 		    &progress_data);
+		if (bsdtar->extract_threads != 1)
+			archive_read_extract_set_threads(a,
+			    bsdtar->extract_threads);
 	}
 
 	if (mode == 'x' && (bsdtar->flags & OPTFLAG_CHROOT)) {
@@ -82,6 +82,9 @@ __FBSDID("$FreeBSD: src/usr.bin/tar/write.c,v 1.79 2008/11/27 05:49:52 kientzle
 #define	O_BINARY 0
 #endif
 
+/* Bytes of a file handed to archive_write_data_from_fd() at a time. */
+#define	COPY_FD_CHUNK	(8 * 1024 * 1024)
+
 struct archive_dir_entry {
 	struct archive_dir_entry	*next;
 	time_t			 mtime_sec;
@@ -102,6 +105,8 @@ static void		 archive_names_from_file(struct bsdtar *bsdtar,
 static int		 copy_file_data_block(struct bsdtar *,
 			     struct archive *a, struct archive *,
 			     struct archive_entry *);
+static int		 copy_file_data_fd(struct bsdtar *,
+			     struct archive *a, struct archive_entry *);
 static void		 excluded_callback(struct archive *, void *,
 			     struct archive_entry *);
 static void		 report_write(struct bsdtar *, struct archive *,
@@ -808,6 +813,58 @@ copy_file_data_block(struct bsdtar *bsdtar, struct archive *a,
 	return (0);
 }
 
+/*
+ * Hand the data of a regular file without holes to the writer by
+ * descriptor, so that the kernel can copy it when the archive is not
+ * compressed.  Returns 1 if the file has to be read with
+ * copy_file_data_block() instead.
+ */
+static int
+copy_file_data_fd(struct bsdtar *bsdtar, struct archive *a,
+    struct archive_entry *entry)
+{
+#if defined(_WIN32) && !defined(__CYGWIN__)
+	(void)bsdtar; /* UNUSED */
+	(void)a; /* UNUSED */
+	(void)entry; /* UNUSED */
+	return (1);
+#else
+	const char *path = archive_entry_sourcepath(entry);
+	int64_t progress = 0, size = archive_entry_size(entry);
+	ssize_t bytes_written;
+	size_t len;
+	int fd;
+
+	if (path == NULL || archive_entry_filetype(entry) != AE_IFREG ||
+	    archive_entry_sparse_count(entry) > 0)
+		return (1);
+	fd = open(path, O_RDONLY | O_BINARY);
+	if (fd < 0)
+		return (1);
+	while (progress < size) {
+		if (need_report())
+			report_write(bsdtar, a, entry, progress);
+		len = COPY_FD_CHUNK;
+		if ((int64_t)len > size - progress)
+			len = (size_t)(size - progress);
+		bytes_written = archive_write_data_from_fd(a, fd, progress,
+		    len);
+		if (bytes_written < 0) {
+			/* Write failed; this is bad */
+			lafe_warnc(0, "%s", archive_error_string(a));
+			close(fd);
+			return (-1);
+		}
+		progress += bytes_written;
+		/* The file shrank; the writer pads the entry. */
+		if ((size_t)bytes_written < len)
+			break;
+	}
+	close(fd);
+	return (0);
+#endif
+}
+
 static void
 excluded_callback(struct archive *a, void *_data, struct archive_entry *entry)
 {
@@ -997,7 +1054,11 @@ write_entry(struct bsdtar *bsdtar, struct archive *a,
 	 * that case, just skip the write.
 	 */
 	if (e >= ARCHIVE_WARN && archive_entry_size(entry) > 0) {
-		if (copy_file_data_block(bsdtar, a, bsdtar->diskreader, entry))
+		e = copy_file_data_fd(bsdtar, a, entry);
+		if (e > 0)
+			e = copy_file_data_block(bsdtar, a,
+			    bsdtar->diskreader, entry);
+		if (e)
 			exit(1);
 	}
 }
@@ -52,7 +52,7 @@ xorshift64(uint64_t *state)
  * took ~22 seconds, whereas using a xorshift random number generator (that can
  * be inlined) reduces it to ~17 seconds on QEMU RISC-V.
  */
-static void
+void
 fill_with_pseudorandom_data_seed(uint64_t seed, void *buffer, size_t size)
 {
 	uint64_t *aligned_buffer;
@@ -60,6 +60,10 @@ fill_with_pseudorandom_data_seed(uint64_t seed, void *buffer, size_t size)
 	size_t i;
 	size_t unaligned_suffix;
 	size_t unaligned_prefix = 0;
+
+	/* A zero state would make xorshift return nothing but zeros. */
+	if (seed == 0)
+		seed = ~(uint64_t)0;
 	/*
 	 * To avoid unaligned stores we only fill the aligned part of the buffer
 	 * with pseudo-random data and fill the unaligned prefix with 0xab and
@@ -109,3 +113,27 @@ fill_with_pseudorandom_data(void *buffer, size_t size)
 	}
 	fill_with_pseudorandom_data_seed(seed, buffer, size);
 }
+
+/*
+ * Fill a buffer with words picked at random, for tests that need data a
+ * compressor has to work on; the same seed always gives the same text.
+ */
+void
+fill_with_words_seed(uint64_t seed, void *buffer, size_t size)
+{
+	static const char *words[] = { "alpha ", "bravo ", "charlie ",
+	    "delta ", "echo ", "foxtrot ", "golf ", "hotel\n" };
+	char *p = buffer;
+	size_t i, n;
+	const char *w;
+
+	if (seed == 0)
+		seed = ~(uint64_t)0;
+	for (i = 0; i < size; i += n) {
+		w = words[xorshift64(&seed) >> 61];
+		n = strlen(w);
+		if (n > size - i)
+			n = size - i;
+		memcpy(p + i, w, n);
+	}
+}
@@ -32,5 +32,11 @@
 
 /* Fill a buffer with pseudorandom data */
 void fill_with_pseudorandom_data(void* buffer, size_t size);
+/* Fill a buffer with pseudorandom data that depends only on the seed */
+void fill_with_pseudorandom_data_seed(uint64_t seed, void *buffer,
+    size_t size);
+/* Fill a buffer with text of random words that depends only on the seed;
+ * it compresses well, but not trivially */
+void fill_with_words_seed(uint64_t seed, void *buffer, size_t size);
 
 #endif /* TEST_UTILS_H */